@@ -34,12 +34,13 @@
 #include <iopins.h>
 #include <net/net_addr.h>
 #include <net/NetInterface.h>
+#include <net/mac_filter.h>
 #include <mac_descriptors.h>
 #include <ring_buffer.h>
 
 namespace Mcucpp
 {
-	const size_t EthernetHeaderSize = 6 + 6 + 2;
+	using Net::EthernetHeaderSize;
 	
 	enum EthSpeed
 	{
@@ -131,6 +132,7 @@ namespace Mcucpp
 		void SetPhyParameters();
 		void ReadLinkParameters();
 		void SetMacParameters();
+		void ApplyAddressFilter();
 		void SetDmaParameters();
 		void StartAutonegotiation();
 		bool ReadPhyRegister(uint16_t phyReg, uint16_t *regValue);
@@ -139,6 +141,14 @@ namespace Mcucpp
 		void ResetPhy();
 		void Reset();
 		void InterruptHandler();
+		void ProcessTxDescriptors();
+		unsigned ProcessRxDescriptors(unsigned budget);
+		unsigned CompleteFrameDescriptors();
+		void ReceiveFrame(unsigned descriptors);
+		void PollRx();
+		uint8_t RxChecksumFlags(Net::MacDmaRxStatus status);
+		bool ArmRxDescriptor(Net::EthRxPool::RxDescriptorWithBufferPointer &descr);
+		bool ParseFrameHeader(Net::DataBuffer *frame, Net::RxFrame &rxFrame);
 		void InvokeCallbacks();
 		
 		ETH_TypeDef *_eth;
@@ -152,7 +162,15 @@ namespace Mcucpp
 		Net::EthTxPool _txPool;
 		Net::EthRxPool _rxPool;
 		
-		Containers::RingBuffer<Net::EthRxPool::DescriptorCount, Net::DataBuffer *> _rxQueue;
+		struct RxQueueItem
+		{
+			RxQueueItem(Net::DataBuffer *b, uint8_t c):buffer(b), checksumFlags(c){}
+			Net::DataBuffer *buffer;
+			uint8_t checksumFlags;
+		};
+		
+		// received frames waiting for delivery, twice the ring depth to absorb bursts
+		Containers::RingBuffer<Net::EthRxPool::DescriptorCount * 2, RxQueueItem> _rxQueue;
 		
 		struct TxQueueItem
 		{
@@ -164,6 +182,9 @@ namespace Mcucpp
 		Containers::RingBuffer<Net::EthTxPool::DescriptorCount, TxQueueItem> _txQueue;
 		
 		Net::MacAddr _macaddr;
+		// MACA1..MACA3 perfect filters and hash table
+		Net::MacAddressFilter<3> _addressFilter;
+		bool _promiscuous;
 		uint32_t _framesSend;
 		uint32_t _framesRecived;
 		uint32_t _sendErrors;
@@ -173,6 +194,13 @@ namespace Mcucpp
 		uint32_t _status;
 		Net::TransferId _txSequence;
 		
+		// adaptive receive mode, see MaxEthRxPollThreshold
+		unsigned _rxPollThreshold;
+		unsigned _rxBudget;
+		volatile unsigned _rxInterrupts;
+		volatile bool _rxPolling;
+		uint32_t _rxModeSwitches;
+		
 	public:
 		EthernetMac(ETH_TypeDef *eth);
 		void Init();
@@ -186,17 +214,29 @@ namespace Mcucpp
 		void SetMediaInterface(EthMediaInterface mediaInterface);
 		void SetPhyAddress(uint8_t phyAddr);
 		bool Initialized(){return _state != EthNotInitialized;}
+		void SetTxInterruptCoalescing(unsigned frames);
+		// Switches receiving to polling mode after 'interruptThreshold' RX interrupts between two Poll calls,
+		// up to 'budget' frames are received per Poll then. Threshold 0 keeps RX interrupt always enabled.
+		void SetRxPolling(unsigned interruptThreshold, unsigned budget);
+		bool RxPolling(){ return _rxPolling; }
+		// Number of switches between interrupt and polling receive modes in both directions
+		uint32_t RxModeSwitches(){ return _rxModeSwitches; }
 
 	public: // NetInterface members
 		virtual bool SetMacAddress(unsigned addrNumber, const Net::MacAddr &macaddr);
-		virtual unsigned MaxAddresses(){return 4;}
+		// MACA1..MACA3 registers are used by address filter
+		virtual unsigned MaxAddresses(){return 1;}
 		virtual const Net::MacAddr& GetMacAddress(unsigned addrNumber);
 		virtual Net::TransferId Transmit(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer);
+		virtual bool CanTransmit(Net::NetBuffer &buffer);
 		virtual bool IsLinked();
 		virtual void PauseCommand(uint16_t time);
 		virtual void Poll();
 		virtual uint32_t GetParameter(Net::NetInterfaceParameter parameterId);
 		virtual bool TxCompleteFor(Net::TransferId txId);
+		virtual bool AddAddressFilter(const Net::MacAddr &macaddr);
+		virtual bool RemoveAddressFilter(const Net::MacAddr &macaddr);
+		virtual void SetPromiscuous(bool promiscuous);
 	};
 	//==================================================================
 	extern EthernetMac ethernet;
@@ -136,7 +136,7 @@ namespace Mcucpp
 	
 	bool Flash::ErasePage(unsigned page)
 	{
-		if(page > PageCount())
+		if(page >= PageCount())
 			return false;
 		FLASH->KEYR = 0x45670123;
 		FLASH->KEYR = 0xCDEF89AB;
@@ -158,7 +158,7 @@ namespace Mcucpp
 	
 	bool Flash::WritePage(unsigned page, void *data, size_t length, size_t offset)
 	{
-		if(page > PageCount())
+		if(page >= PageCount())
 			return false;
 			
 		if(offset + length > PageSize(page))
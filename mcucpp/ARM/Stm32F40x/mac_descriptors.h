@@ -30,7 +30,9 @@
 #include <enum.h>
 #include <debug.h>
 #include <data_transfer.h>
+#include <atomic.h>
 #include <net/net_buffer.h>
+#include <static_assert.h>
 
 namespace Mcucpp
 {
@@ -42,6 +44,57 @@ namespace Net
 	const size_t MaxEthDescriptors = 8;
 #endif
 
+#if defined(MAX_ETH_RX_DESCRIPTORS) && MAX_ETH_RX_DESCRIPTORS > 0
+	const size_t MaxEthRxDescriptors = MAX_ETH_RX_DESCRIPTORS;
+#else
+	const size_t MaxEthRxDescriptors = 3;
+#endif
+
+// Number of transmitted frames per one TX complete interrupt.
+// Frames sent without interrupt request are reclaimed on next interrupt or in EthernetMac::Poll
+#if defined(MAX_ETH_TX_COALESCE) && MAX_ETH_TX_COALESCE > 0
+	const size_t MaxEthTxCoalesce = MAX_ETH_TX_COALESCE;
+#else
+	const size_t MaxEthTxCoalesce = 4;
+#endif
+
+// Max number of received frames delivered to dispatcher with single RxCompleteBatch call
+#if defined(MAX_ETH_RX_BATCH) && MAX_ETH_RX_BATCH > 0
+	const size_t MaxEthRxBatch = MAX_ETH_RX_BATCH;
+#else
+	const size_t MaxEthRxBatch = 4;
+#endif
+
+// Largest received frame including VLAN tag and FCS
+#if defined(MAX_ETH_FRAME_SIZE) && MAX_ETH_FRAME_SIZE > 0
+	const size_t MaxEthFrameSize = MAX_ETH_FRAME_SIZE;
+#else
+	const size_t MaxEthFrameSize = 1522;
+#endif
+
+	// Each RX descriptor is armed with one medium and one large pool buffer.
+	// Buffer size fields are 13 bit wide, sizes must be word aligned.
+	STATIC_ASSERT(MedPoolBufferSize <= 0x1fff && LargePoolBufferSize <= 0x1fff);
+	STATIC_ASSERT(MedPoolBufferSize % 4 == 0 && LargePoolBufferSize % 4 == 0);
+	// the ring must be able to hold the largest frame
+	STATIC_ASSERT((MedPoolBufferSize + LargePoolBufferSize) * MaxEthRxDescriptors >= MaxEthFrameSize);
+	STATIC_ASSERT(MedPoolBufferCount > MaxEthRxDescriptors && LargePoolBufferCount >= MaxEthRxDescriptors);
+
+// Receive interrupts between two EthernetMac::Poll calls, after which RX interrupt is disabled 
+// and received frames are taken from the ring by Poll only. 0 disables polling mode.
+#if defined(MAX_ETH_RX_POLL_THRESHOLD) && MAX_ETH_RX_POLL_THRESHOLD > 0
+	const size_t MaxEthRxPollThreshold = MAX_ETH_RX_POLL_THRESHOLD;
+#else
+	const size_t MaxEthRxPollThreshold = 8;
+#endif
+
+// Max number of received frames taken from the ring by one Poll call in polling mode
+#if defined(MAX_ETH_RX_BUDGET) && MAX_ETH_RX_BUDGET > 0
+	const size_t MaxEthRxBudget = MAX_ETH_RX_BUDGET;
+#else
+	const size_t MaxEthRxBudget = 8;
+#endif
+
 	enum MacDmaTxStatus
 	{
 		MacDmaTxSuccess            = 0,
@@ -266,14 +319,34 @@ namespace Net
 				MacTxDescriptor::Reset();
 				buffer1 = 0;
 				buffer2 = 0;
+				seqNumber = 0;
 			}
 		};
 		
 		TxDescriptorWithBufferPointer Descriptors[DescriptorCount];
+	private:
+		// next descriptor to be filled, modified by transmitting code only
 		size_t _currentDescriptor;
+		// oldest descriptor not reclaimed yet, modified by completion code only
+		size_t _dirtyDescriptor;
+		// number of descriptors owned by enqueued and not yet reclaimed frames
+		volatile size_t _pending;
+		size_t _framesWithoutInterrupt;
+		size_t _coalesceFrames;
+		
+		static size_t NextIndex(size_t index)
+		{
+			if(++index >= DescriptorCount)
+				index = 0;
+			return index;
+		}
 	public:
 		EthTxPool()
-		:_currentDescriptor(0)
+		:_currentDescriptor(0),
+		_dirtyDescriptor(0),
+		_pending(0),
+		_framesWithoutInterrupt(0),
+		_coalesceFrames(MaxEthTxCoalesce)
 		{
 			Descriptors[DescriptorCount - 1].SetEndOfRing();
 		}
@@ -283,30 +356,50 @@ namespace Net
 		void Reset()
 		{
 			_currentDescriptor = 0;
+			_dirtyDescriptor = 0;
+			_pending = 0;
+			_framesWithoutInterrupt = 0;
 			for(size_t i = 0; i < DescriptorCount; i++)
 				Descriptors[i].Reset();
 			Descriptors[DescriptorCount - 1].SetEndOfRing();
 		}
 		
-		bool EnqueueBuffer(NetBuffer &buffer, uint32_t seqNumber)
+		// Request TX complete interrupt every 'frames' frames
+		void SetInterruptCoalescing(size_t frames)
+		{
+			_coalesceFrames = frames > 0 ? frames : 1;
+		}
+		
+		size_t FreeDescriptors()
+		{
+			return DescriptorCount - Atomic::Fetch(&_pending);
+		}
+		
+		bool HasPending()
+		{
+			return Atomic::Fetch(&_pending) != 0;
+		}
+		
+		// 'checksumOptions' are checksum insertion control bits applied to the frame
+		bool EnqueueBuffer(NetBuffer &buffer, uint32_t seqNumber, MacDmaTxOptions checksumOptions = MacDmaTxNone)
 		{
 			size_t partsCount = buffer.Parts();
 			size_t descriptorsRequired = (partsCount + 1) / 2;
-			size_t descrIndex = _currentDescriptor;
+			size_t freeDescriptors = FreeDescriptors();
 			
-			for(size_t index = 0; index < descriptorsRequired; index++)
+			if(descriptorsRequired == 0 || descriptorsRequired > freeDescriptors)
 			{
-				MacTxDescriptor & descr = Descriptors[descrIndex];
-				if(descr.InUse())
-				{
-					return false; // Not enougth free descriptors
-				}
-				descrIndex++;
-				if(descrIndex >= DescriptorCount)
-					descrIndex=0;
+				return false; // Not enougth free descriptors
 			}
 			
-			descrIndex = _currentDescriptor;
+			// interrupt on every N-th frame or when the ring is running out of descriptors
+			bool requestInterrupt = ++_framesWithoutInterrupt >= _coalesceFrames || 
+				freeDescriptors - descriptorsRequired < DescriptorCount / 2;
+			if(requestInterrupt)
+				_framesWithoutInterrupt = 0;
+			
+			size_t firstIndex = _currentDescriptor;
+			size_t descrIndex = _currentDescriptor;
 			
 			for(size_t i = 0; i < descriptorsRequired; i++)
 			{
@@ -317,7 +410,7 @@ namespace Net
 				descr.buffer1 = part;
 				descr.seqNumber = seqNumber;
 				
-				if(i < partsCount)
+				if(buffer.Parts() > 0)
 				{
 					DataBuffer *part2 = buffer.DetachFront();
 					descr.SetBuffer2(part2->Data(), part2->Size());
@@ -326,21 +419,71 @@ namespace Net
 				
 				MacDmaTxOptions options = MacDmaTxNone;
 				if(i == 0)
-					options |= MacDmaTxFirstSegment | MacDmaTxInterrupt;
+					options |= MacDmaTxFirstSegment | checksumOptions;
 				
 				if(i == descriptorsRequired - 1)
+				{
 					options |= MacDmaTxLastSegment;
+					if(requestInterrupt)
+						options |= MacDmaTxInterrupt;
+				}
 				
-				descrIndex++;
-				if(descrIndex >= DescriptorCount)
-				{
-					descrIndex=0;
+				if(descrIndex == DescriptorCount - 1)
 					options |= MacDmaTxEndOfRing;
-				}
-				descr.SetOptions(options | MacDmaTxReady);
+				
+				// first descriptor is passed to DMA the last, when the whole chain is ready
+				if(i != 0)
+					options |= MacDmaTxReady;
+				
+				descr.SetOptions(options);
+				descrIndex = NextIndex(descrIndex);
 			}
 			_currentDescriptor = descrIndex;
+			Descriptors[firstIndex].SetReady();
+			Atomic::AddAndFetch(&_pending, descriptorsRequired);
+			
+			return true;
+		}
+		
+		// Releases buffers of the oldest transmitted frame and returns its status.
+		// Returns false if there is no frames completed by DMA.
+		bool ReclaimFrame(uint32_t &seqNumber, MacDmaTxStatus &status)
+		{
+			size_t pending = Atomic::Fetch(&_pending);
+			size_t descrIndex = _dirtyDescriptor;
+			size_t descriptorsUsed = 0;
+			
+			// DMA releases descriptors in ring order, so the frame is done when its last segment is
+			while(descriptorsUsed < pending)
+			{
+				TxDescriptorWithBufferPointer & descr = Descriptors[descrIndex];
+				if(descr.InUse())
+					return false;
+				descriptorsUsed++;
+				descrIndex = NextIndex(descrIndex);
+				if(descr.GetOptions() & MacDmaTxLastSegment)
+					break;
+			}
+			
+			if(descriptorsUsed == 0)
+				return false;
+			
+			// status is written back to the last segment descriptor
+			TxDescriptorWithBufferPointer & last = Descriptors[descrIndex == 0 ? DescriptorCount - 1 : descrIndex - 1];
+			seqNumber = last.seqNumber;
+			status = last.GetStatus();
 			
+			for(size_t i = 0; i < descriptorsUsed; i++)
+			{
+				TxDescriptorWithBufferPointer & descr = Descriptors[_dirtyDescriptor];
+				if(descr.buffer1)
+					DataBuffer::Release(descr.buffer1);
+				if(descr.buffer2)
+					DataBuffer::Release(descr.buffer2);
+				descr.Reset();
+				_dirtyDescriptor = NextIndex(_dirtyDescriptor);
+			}
+			Atomic::SubAndFetch(&_pending, descriptorsUsed);
 			return true;
 		}
 	};
@@ -348,7 +491,7 @@ namespace Net
 	class EthRxPool
 	{
 	public:
-		enum {DescriptorCount = 3};
+		enum {DescriptorCount = MaxEthRxDescriptors};
 		
 		struct RxDescriptorWithBufferPointer : public MacRxDescriptor
 		{
@@ -381,23 +524,52 @@ namespace Net
 				{
 					return false;
 				}
-				buffer1 = buffer;
+				buffer2 = buffer;
 				return true;
 			}
 		};
 		
 		RxDescriptorWithBufferPointer Descriptors[DescriptorCount];
+		size_t _currentDescriptor;
 	public:
 		EthRxPool()
+		:_currentDescriptor(0)
 		{
 			Descriptors[DescriptorCount - 1].SetEndOfRing();
 		}
 		
 		void Reset()
 		{
+			_currentDescriptor = 0;
 			for(size_t i = 0; i < DescriptorCount; i++)
 				Descriptors[i].Reset();
 			Descriptors[DescriptorCount - 1].SetEndOfRing();
 		}
+		
+		// Descriptor to be processed next, DMA fills descriptors in ring order
+		RxDescriptorWithBufferPointer &Current()
+		{
+			return Descriptors[_currentDescriptor];
+		}
+		
+		RxDescriptorWithBufferPointer &Next()
+		{
+			return Ahead(1);
+		}
+		
+		// Descriptor 'offset' positions after the current one, offset < DescriptorCount
+		RxDescriptorWithBufferPointer &Ahead(size_t offset)
+		{
+			size_t index = _currentDescriptor + offset;
+			if(index >= DescriptorCount)
+				index -= DescriptorCount;
+			return Descriptors[index];
+		}
+		
+		void Advance()
+		{
+			if(++_currentDescriptor >= DescriptorCount)
+				_currentDescriptor = 0;
+		}
 	};
 }}
\ No newline at end of file
@@ -24,11 +24,17 @@ namespace Mcucpp
 		_speed(EthSpeed100Mbit),
 		_duplexMode(EthFullDuplex),
 		_state(EthNotInitialized),
+		_promiscuous(false),
 		_framesSend(0),
 		_framesRecived(0),
 		_sendErrors(0),
 		_reciveErrors(0),
-		_txSequence(0)
+		_txSequence(0),
+		_rxPollThreshold(MaxEthRxPollThreshold),
+		_rxBudget(MaxEthRxBudget),
+		_rxInterrupts(0),
+		_rxPolling(false),
+		_rxModeSwitches(0)
 	{
 
 	}
@@ -52,7 +58,7 @@ namespace Mcucpp
 			case NetIfLinked:            return _linked;
 			case NetIfLinkSpeedKbps:     return _speed == EthSpeed100Mbit ? 100000 : 10000;
 			case NetIfHwState:           return _state;
-			case NetIfSupportHwCheckSum: return 1;
+			case NetIfSupportHwCheckSum: return ChecksumIpHeader | ChecksumPayload;
 		}
 		return 0;
 	}
@@ -83,15 +89,22 @@ namespace Mcucpp
 		}
 		buffer.Seek(0);
 		
-		buffer.WriteMac(_macaddr);
 		buffer.WriteMac(destAddr);
+		buffer.WriteMac(_macaddr);
 		
 		buffer.WriteU16Be(protocoId);
 	
 		if(++_txSequence == 0)
-			_txSequence = 0;
+			_txSequence = 1;
+		
+		MacDmaTxOptions checksumOptions = MacDmaTxNone;
+		unsigned offload = buffer.ChecksumOffload();
+		if(offload & ChecksumPayload)
+			checksumOptions = MacDmaTxPseudoHeaderCrc; // IP header and payload with pseudo header
+		else if(offload & ChecksumIpHeader)
+			checksumOptions = MacDmaTxIpHeaderCrc;
 		
-		bool res = _txPool.EnqueueBuffer(buffer, _txSequence);
+		bool res = _txPool.EnqueueBuffer(buffer, _txSequence, checksumOptions);
 		_eth->DMATPDR = 1;
 		if(!res)
 		{
@@ -104,6 +117,17 @@ namespace Mcucpp
 		return _txSequence;
 	}
 	
+	bool EthernetMac::CanTransmit(Net::NetBuffer &buffer)
+	{
+		if(!IsLinked())
+			return false;
+		size_t parts = buffer.Parts();
+		// header goes to a new fragment if there is no headroom
+		if(!buffer.BufferList() || buffer.BufferList()->Headroom() < EthernetHeaderSize)
+			parts++;
+		return (parts + 1) / 2 <= _txPool.FreeDescriptors();
+	}
+	
 	bool EthernetMac::SetMacAddress(unsigned addrNumber, const Net::MacAddr &macaddr)
 	{
 		if(addrNumber >= MaxAddresses())
@@ -120,6 +144,59 @@ namespace Mcucpp
 		return true;
 	}
 	
+	bool EthernetMac::AddAddressFilter(const Net::MacAddr &macaddr)
+	{
+		if(!_addressFilter.Add(macaddr))
+			return false;
+		ApplyAddressFilter();
+		return true;
+	}
+	
+	bool EthernetMac::RemoveAddressFilter(const Net::MacAddr &macaddr)
+	{
+		if(!_addressFilter.Remove(macaddr))
+			return false;
+		ApplyAddressFilter();
+		return true;
+	}
+	
+	void EthernetMac::SetPromiscuous(bool promiscuous)
+	{
+		_promiscuous = promiscuous;
+		ApplyAddressFilter();
+	}
+	
+	void EthernetMac::ApplyAddressFilter()
+	{
+		for(unsigned i = 0; i < 3; i++)
+		{
+			Net::MacAddr addr;
+			uint32_t addrHi = 0, addrLo = 0;
+			if(_addressFilter.PerfectSlot(i, addr))
+			{
+				addrHi = ETH_MACA1HR_AE | (addr[5] << 8) | addr[4];
+				addrLo = (addr[3] << 24) | (addr[2] << 16) | (addr[1] << 8) | addr[0];
+			}
+			*(&_eth->MACA1HR + i * 2) = addrHi;
+			*(&_eth->MACA1LR + i * 2) = addrLo;
+		}
+		
+		_eth->MACHTHR = _addressFilter.HashHigh();
+		_eth->MACHTLR = _addressFilter.HashLow();
+		
+		uint32_t ffr = _eth->MACFFR & ~(ETH_MACFFR_HPF | ETH_MACFFR_HM | ETH_MACFFR_HU | ETH_MACFFR_PM);
+		if(_addressFilter.HashMulticast())
+			ffr |= ETH_MACFFR_HM;
+		if(_addressFilter.HashUnicast())
+			ffr |= ETH_MACFFR_HU;
+		// with hash filtering enabled perfect filter matches are accepted only if HPF is set
+		if(ffr & (ETH_MACFFR_HM | ETH_MACFFR_HU))
+			ffr |= ETH_MACFFR_HPF;
+		if(_promiscuous)
+			ffr |= ETH_MACFFR_PM;
+		_eth->MACFFR = ffr;
+	}
+	
 	void EthernetMac::InterruptHandler()
 	{
 		uint32_t dmasr = _eth->DMASR;
@@ -130,134 +207,252 @@ namespace Mcucpp
 		_framesAppMissed += (missedFramesReg >> 17) & 0x07ff;
 		_framesMacMissed += (missedFramesReg >> 0)  & 0x7fff;
 		
-		for(unsigned i = 0; i < Net::EthTxPool::DescriptorCount; i++)
+		ProcessTxDescriptors();
+		if(_rxPolling)
+			return;
+		if((dmasr & ETH_DMASR_RS) && _rxPollThreshold && ++_rxInterrupts >= _rxPollThreshold)
 		{
-			Net::EthTxPool::TxDescriptorWithBufferPointer &descr = _txPool.Descriptors[i];
-			if(!descr.InUse())
+			// receive flood, leave the ring to Poll so that other tasks get their time
+			_eth->DMAIER &= ~ETH_DMAIER_RIE;
+			_rxPolling = true;
+			_rxModeSwitches++;
+			return;
+		}
+		ProcessRxDescriptors(Net::EthRxPool::DescriptorCount);
+	}
+	
+	void EthernetMac::SetRxPolling(unsigned interruptThreshold, unsigned budget)
+	{
+		_rxPollThreshold = interruptThreshold;
+		_rxBudget = budget > 0 ? budget : 1;
+	}
+	
+	void EthernetMac::PollRx()
+	{
+		_rxInterrupts = 0;
+		if(!_rxPolling)
+			return;
+		// RX interrupt is disabled, so the ring is owned by this context
+		unsigned budget = _rxQueue.capacity() - _rxQueue.size();
+		if(budget > _rxBudget)
+			budget = _rxBudget;
+		unsigned frames = ProcessRxDescriptors(budget);
+		if(frames < budget)
+		{
+			// ring is drained. Frames received after the check set DMASR RS, 
+			// that raises the interrupt as soon as it is enabled.
+			_rxPolling = false;
+			_rxModeSwitches++;
+			_eth->DMAIER |= ETH_DMAIER_RIE;
+		}
+	}
+	
+	void EthernetMac::ProcessTxDescriptors()
+	{
+		// reclaim all frames completed since last call, not only the one that requested interrupt.
+		// Frames stay pending in the pool while completion queue is full, they are
+		// reclaimed when InvokeCallbacks drains it.
+		uint32_t seqNumber;
+		MacDmaTxStatus status;
+		while(!_txQueue.full() && _txPool.ReclaimFrame(seqNumber, status))
+		{
+			if(status & MacDmaTxError)
+			{
+				_sendErrors++;
+			}
+			else
+			{
+				_framesSend++;
+			}
+			TxQueueItem transferStatus(seqNumber, (status & MacDmaTxError) == MacDmaTxSuccess);
+			_txQueue.push_back(transferStatus);
+		}
+	}
+	
+	void EthernetMac::SetTxInterruptCoalescing(unsigned frames)
+	{
+		_txPool.SetInterruptCoalescing(frames);
+	}
+	
+	bool EthernetMac::ArmRxDescriptor(Net::EthRxPool::RxDescriptorWithBufferPointer &descr)
+	{
+		descr.Reset();
+		DataBuffer *smallBuffer = DataBuffer::GetNew(MedPoolBufferSize);
+		if(!smallBuffer)
+		{
+			_state = EthOutOfMem;
+			return false;
+		}
+		DataBuffer *largeBuffer = DataBuffer::GetNew(LargePoolBufferSize);
+		if(!largeBuffer)
+		{
+			DataBuffer::Release(smallBuffer);
+			_state = EthOutOfMem;
+			return false;
+		}
+		if(!descr.SetBuffer(smallBuffer) || !descr.SetBuffer2(largeBuffer))
+		{
+			DataBuffer::Release(smallBuffer);
+			DataBuffer::Release(largeBuffer);
+			descr.Reset();
+			_state = EthDriverError;
+			return false;
+		}
+		descr.SetReady();
+		return true;
+	}
+	
+	uint8_t EthernetMac::RxChecksumFlags(MacDmaRxStatus status)
+	{
+		// checksum offload status is valid for IPv4/IPv6 frames only
+		if(!(status & MacDmaRxFrameType))
+			return ChecksumNone;
+		if(status & (MacDmaRxIpHeaderCrcErr | MacDmaRxChecksumErr))
+			return ChecksumError;
+		return ChecksumIpHeader | ChecksumPayload;
+	}
+	
+	// Number of descriptors holding the frame starting at the current one,
+	// zero if DMA has not given all of them back yet
+	unsigned EthernetMac::CompleteFrameDescriptors()
+	{
+		for(unsigned i = 0; i < Net::EthRxPool::DescriptorCount; i++)
+		{
+			Net::EthRxPool::RxDescriptorWithBufferPointer &descr = _rxPool.Ahead(i);
+			if(descr.InUse())
+				return 0;
+			if(!descr.buffer1)
+			{
+				// DMA is suspended on descriptor left unarmed, frame continues there
+				ArmRxDescriptor(descr);
+				return 0;
+			}
+			if(descr.GetStatus() & MacDmaRxLastDescriptor)
+				return i + 1;
+		}
+		return 0;
+	}
+	
+	// Takes buffers of the frame held by 'descriptors' descriptors from the current one
+	void EthernetMac::ReceiveFrame(unsigned descriptors)
+	{
+		bool frameError = false;
+		NetBuffer netBuffer;
+		size_t currentFrameSize = 0;
+		MacDmaRxStatus status = MacDmaRxStatus(0);
+		
+		for(unsigned i = 0; i < descriptors; i++)
+		{
+			Net::EthRxPool::RxDescriptorWithBufferPointer &descr = _rxPool.Ahead(i);
+			status = descr.GetStatus();
+			frameError = frameError || (status & MacDmaRxError);
+			
+			if(frameError)
+			{
+				DataBuffer::Release(descr.buffer1);
+				DataBuffer::Release(descr.buffer2);
+				netBuffer.Clear();
+			}else
 			{
-				if(descr.GetOptions() & MacDmaTxFirstSegment)
+				size_t buf1Size = descr.GetSize();
+				size_t buf2Size = descr.GetSize2();
+				if(status & MacDmaRxLastDescriptor)
 				{
-					MacDmaTxStatus status = descr.GetStatus();
-					if(status & MacDmaTxError)
+					size_t frameSize = descr.GetFrameLength();
+					if(currentFrameSize + buf1Size >= frameSize)
 					{
-						_sendErrors++;
+						buf1Size = frameSize - currentFrameSize;
+						buf2Size = 0;
 					}
 					else
 					{
-						_framesSend++;
+						buf2Size = frameSize - currentFrameSize - buf1Size;
 					}
-					TxQueueItem transferStatus(descr.seqNumber, (status & MacDmaTxError) == MacDmaTxSuccess);
-					(void)_txQueue.push_back(transferStatus);
 				}
 				
-				if(descr.buffer1)
+				currentFrameSize += buf1Size;
+				descr.buffer1->Resize(buf1Size);
+				netBuffer.AttachBack(descr.buffer1);
+				
+				if(buf2Size > 0)
 				{
-					DataBuffer::Release(descr.buffer1);
-				}
-				if(descr.buffer2)
+					currentFrameSize += buf2Size;
+					descr.buffer2->Resize(buf2Size);
+					netBuffer.AttachBack(descr.buffer2);
+				}else
 				{
 					DataBuffer::Release(descr.buffer2);
 				}
-				descr.Reset();
 			}
+			// buffers are owned by the frame now
+			descr.Reset();
 		}
 		
-		bool frameError = false;
-		NetBuffer netBuffer;
-		size_t currentFrameSize = 0;
+		if(frameError)
+		{
+			_reciveErrors++;
+			return;
+		}
+		DataBuffer *bufferList = netBuffer.MoveToBufferList();
+		if(!_rxQueue.push_back(RxQueueItem(bufferList, RxChecksumFlags(status))))
+		{
+			DataBuffer::ReleaseRecursive(bufferList);
+			_framesAppMissed++;
+		}
+		else
+		{
+			_framesRecived++;
+		}
+	}
+	
+	unsigned EthernetMac::ProcessRxDescriptors(unsigned budget)
+	{
+		unsigned frames = 0;
 		
-		for(unsigned i = 0; i < Net::EthRxPool::DescriptorCount; i++)
+		// walk the ring in DMA order starting from the oldest not processed descriptor
+		while(frames < budget)
 		{
-			Net::EthRxPool::RxDescriptorWithBufferPointer &descr = _rxPool.Descriptors[i];
-			if(!descr.InUse())
+			Net::EthRxPool::RxDescriptorWithBufferPointer &descr = _rxPool.Current();
+			if(descr.InUse())
+				break;
+			
+			if(!descr.buffer1)
 			{
-				MacDmaRxStatus status = descr.GetStatus();
-				if(status & MacDmaRxFirstDescriptor)
-				{
-					frameError = false;
-					currentFrameSize = 0;
-				}
-				
-				bool chunkError = status & MacDmaRxError;
-				frameError = frameError || chunkError;
-				
-				if(chunkError || frameError)
-				{
-					_reciveErrors++;
-					DataBuffer::Release(descr.buffer1);
-					DataBuffer::Release(descr.buffer2);
-					netBuffer.Clear();
-				}else
-				{
-					size_t buf1Size = descr.GetSize();
-					size_t buf2Size = descr.GetSize2();
-					bool lastDescriptor = status & MacDmaRxLastDescriptor;
-					if(lastDescriptor)
-					{
-						size_t frameSize = descr.GetFrameLength();
-						if(currentFrameSize + buf1Size >= frameSize)
-						{
-							buf1Size = frameSize - currentFrameSize;
-							buf2Size = 0;
-						}
-						else
-						{
-							buf2Size = frameSize - currentFrameSize - buf1Size;
-						}
-					}
-					
-					currentFrameSize += buf1Size;
-					descr.buffer1->Resize(buf1Size);
-					netBuffer.AttachBack(descr.buffer1);
-					
-					if(buf2Size > 0)
-					{
-						currentFrameSize += buf2Size;
-						descr.buffer2->Resize(buf2Size);
-						netBuffer.AttachBack(descr.buffer2);
-					}else
-					{
-						DataBuffer::Release(descr.buffer2);
-					}
-					
-					if(lastDescriptor)
-					{
-						DataBuffer *bufferList = netBuffer.MoveToBufferList();
-						if(!_rxQueue.push_back(bufferList))
-						{
-							DataBuffer::ReleaseRecursive(bufferList);
-							_framesAppMissed++;
-						}
-						else
-						{
-							_framesRecived++;
-						}
-						currentFrameSize = 0;
-					}
-				}
-				
+				// descriptor was left unarmed due to lack of memory, DMA is suspended on it
+				ArmRxDescriptor(descr);
+				break;
+			}
+			
+			unsigned count = 1;
+			if(descr.GetStatus() & MacDmaRxFirstDescriptor)
+			{
+				// frame is taken at once, when all its descriptors are given back by DMA
+				count = CompleteFrameDescriptors();
+				if(count == 0)
+					break;
+				MCUCPP_PREFETCH(&_rxPool.Ahead(count % Net::EthRxPool::DescriptorCount));
+				ReceiveFrame(count);
+				frames++;
+			}
+			else
+			{
+				// tail of a frame which head was lost
+				_reciveErrors++;
+				DataBuffer::Release(descr.buffer1);
+				DataBuffer::Release(descr.buffer2);
 				descr.Reset();
-				DataBuffer *smallBuffer = DataBuffer::GetNew(MedPoolBufferSize);
-				if(!smallBuffer)
-				{
-					_state = EthOutOfMem; continue;
-				}
-				DataBuffer *largeBuffer = DataBuffer::GetNew(LargePoolBufferSize);
-				if(!largeBuffer)
-				{
-					_state = EthOutOfMem; continue;
-				}
-				if(!descr.SetBuffer(smallBuffer))
-				{
-					_state = EthDriverError; continue;
-				}
-				if(!descr.SetBuffer2(largeBuffer))
-				{
-					_state = EthDriverError; continue;
-				}
-				descr.SetReady();
+			}
+			
+			// consumed descriptors are armed again in ring order,
+			// the ones left unarmed are armed by the next call
+			for(; count > 0; count--)
+			{
+				if(!ArmRxDescriptor(_rxPool.Current()))
+					return frames;
+				_rxPool.Advance();
 			}
 		}
+		return frames;
 	}
 	
 	void EthernetMac::SetSpeed(EthSpeed speed)
@@ -455,8 +650,10 @@ namespace Mcucpp
 							ETH_MACCR_DM | ETH_MACCR_IPCO | ETH_MACCR_RD | ETH_MACCR_APCS |
 							ETH_MACCR_BL | ETH_MACCR_DC | ETH_MACCR_TE | ETH_MACCR_RE;
 							
-		uint32_t crValue = ETH_MACCR_IFG_64Bit | _speed | _duplexMode | ETH_MACCR_TE | ETH_MACCR_RE;
+		// IPCO enables receive checksum offload
+		uint32_t crValue = ETH_MACCR_IFG_64Bit | _speed | _duplexMode | ETH_MACCR_IPCO | ETH_MACCR_TE | ETH_MACCR_RE;
 		_eth->MACCR = (_eth->MACCR & ~clearMask) | crValue;
+		ApplyAddressFilter();
 	}
 
 	void EthernetMac::Init()
@@ -489,41 +686,31 @@ namespace Mcucpp
 					ETH_DMAIER_ROIE | ETH_DMAIER_TUIE | ETH_DMAIER_RIE | ETH_DMAIER_RBUIE |
 					ETH_DMAIER_RPSIE | ETH_DMAIER_RWTIE | ETH_DMAIER_ETIE | ETH_DMAIER_FBEIE |
 					ETH_DMAIER_ERIE  | ETH_DMAIER_NISE | ETH_DMAIER_AISE;
+		_rxPolling = false;
+		_rxInterrupts = 0;
 					
 		for(unsigned i = 0; i < Net::EthTxPool::DescriptorCount; i++)
 		{
 			Net::EthTxPool::TxDescriptorWithBufferPointer &tx = _txPool.Descriptors[i];
 			if(tx.buffer1) DataBuffer::Release(tx.buffer1);
 			if(tx.buffer2) DataBuffer::Release(tx.buffer2);
-			tx.Reset();
 		}
+		_txPool.Reset();
 		
 		for(unsigned i = 0; i < Net::EthRxPool::DescriptorCount; i++)
 		{
 			Net::EthRxPool::RxDescriptorWithBufferPointer &rx = _rxPool.Descriptors[i];
 			if(rx.buffer1) DataBuffer::Release(rx.buffer1);
 			if(rx.buffer2) DataBuffer::Release(rx.buffer2);
-			
-			rx.Reset();
-			DataBuffer *smallBuffer = DataBuffer::GetNew(MedPoolBufferSize);
-			if(!smallBuffer)
-			{
-				_state = EthOutOfMem; return;
-			}
-			DataBuffer *largeBuffer = DataBuffer::GetNew(LargePoolBufferSize);
-			if(!largeBuffer)
-			{
-				_state = EthOutOfMem; return;
-			}
-			if(!rx.SetBuffer(smallBuffer))
-			{
-				_state = EthDriverError; return;
-			}
-			if(!rx.SetBuffer2(largeBuffer))
+		}
+		_rxPool.Reset();
+		
+		for(unsigned i = 0; i < Net::EthRxPool::DescriptorCount; i++)
+		{
+			if(!ArmRxDescriptor(_rxPool.Descriptors[i]))
 			{
-				_state = EthDriverError; return;
+				return;
 			}
-			rx.SetReady();
 		}
 		
 		uint32_t timeout = 10000;
@@ -540,7 +727,8 @@ namespace Mcucpp
 		
 		_eth->DMATDLAR = (uint32_t)&_txPool.Descriptors[0];
 		_eth->DMARDLAR = (uint32_t)&_rxPool.Descriptors[0];
-		_eth->DMAOMR |= ETH_DMAOMR_ST | ETH_DMAOMR_SR;
+		// transmit checksum insertion requires whole frame in TX FIFO
+		_eth->DMAOMR |= ETH_DMAOMR_TSF | ETH_DMAOMR_ST | ETH_DMAOMR_SR;
 		NVIC_EnableIRQ(ETH_IRQn);
 	}
 	
@@ -585,34 +773,76 @@ namespace Mcucpp
 		return true;
 	}
 	
+	bool EthernetMac::ParseFrameHeader(Net::DataBuffer *frame, Net::RxFrame &rxFrame)
+	{
+		// RX descriptor first buffer is always large enough to hold entire header
+		if(frame->Size() < EthernetHeaderSize)
+			return false;
+		const uint8_t *header = frame->Data();
+		rxFrame.destAddr = Net::MacAddr(header);
+		rxFrame.srcAddr = Net::MacAddr(header + 6);
+		rxFrame.protocolId = (uint16_t)((header[12] << 8) | header[13]);
+		rxFrame.headerSize = EthernetHeaderSize;
+		rxFrame.buffer = frame;
+		// 802.1Q tags are stripped by NetDispatch
+		return true;
+	}
+	
 	void EthernetMac::InvokeCallbacks()
 	{
+		Net::RxFrame frames[Net::MaxEthRxBatch];
 		while(!_rxQueue.empty())
 		{
-			Net::NetBuffer buffer(_rxQueue.front()); // move buffer chain from queue
-			_rxQueue.pop_front();
-			buffer.Seek(0);
-			Net::MacAddr src = buffer.ReadMac();
-			Net::MacAddr dest = buffer.ReadMac();
-			uint16_t protocoId = buffer.ReadU16Be();
-			// TODO: VLAN handling
+			unsigned count = 0;
+			while(count < Net::MaxEthRxBatch && !_rxQueue.empty())
+			{
+				DataBuffer *frame = _rxQueue.front().buffer;
+				uint8_t checksumFlags = _rxQueue.front().checksumFlags;
+				_rxQueue.pop_front();
+				if(!_rxQueue.empty())
+				{
+					MCUCPP_PREFETCH(_rxQueue.front().buffer->Data());
+				}
+				if(!ParseFrameHeader(frame, frames[count]))
+				{
+					DataBuffer::ReleaseRecursive(frame);
+					_reciveErrors++;
+					continue;
+				}
+				frames[count].checksumFlags = checksumFlags;
+				count++;
+			}
+			
 			if(_dispatch)
 			{
-				_dispatch->RxComplete(src, dest, protocoId, buffer);
+				_dispatch->RxCompleteBatch(this, frames, count);
 			}
 			else
 			{
-				_framesAppMissed++;
+				for(unsigned i = 0; i < count; i++)
+				{
+					DataBuffer::ReleaseRecursive(frames[i].buffer);
+				}
+				_framesAppMissed += count;
 			}
 		}
 		
-		while(!_txQueue.empty())
+		do
 		{
-			TxQueueItem transferStatus = _txQueue.front();
-			_txQueue.pop_front();
-			if(_dispatch)
-				_dispatch->TxComplete(transferStatus.seqNumber, transferStatus.success);
-		}
+			while(!_txQueue.empty())
+			{
+				TxQueueItem transferStatus = _txQueue.front();
+				_txQueue.pop_front();
+				if(_dispatch)
+					_dispatch->TxComplete(this, transferStatus.seqNumber, transferStatus.success);
+			}
+			if(!_txPool.HasPending())
+				break;
+			// frames left in the pool while the queue was full
+			NVIC_DisableIRQ(ETH_IRQn);
+			ProcessTxDescriptors();
+			NVIC_EnableIRQ(ETH_IRQn);
+		}while(!_txQueue.empty());
 	}
 	
 	void EthernetMac::ReadLinkParameters()
@@ -638,6 +868,14 @@ namespace Mcucpp
 		}
 		if(_linked)
 		{
+			// frames sent without interrupt request are reclaimed here
+			if(_txPool.HasPending())
+			{
+				NVIC_DisableIRQ(ETH_IRQn);
+				ProcessTxDescriptors();
+				NVIC_EnableIRQ(ETH_IRQn);
+			}
+			PollRx();
 			InvokeCallbacks();
 			_eth->DMATPDR = 1;
 			_eth->DMARPDR = 1;
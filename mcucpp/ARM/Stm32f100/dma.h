@@ -68,7 +68,7 @@ namespace Mcucpp
 		
 		static void Disable()
 		{
-			ChannelRegs()->CCR &= DMA_CCR1_EN;
+			ChannelRegs()->CCR &= ~DMA_CCR1_EN;
 		}
 		
 		static uint32_t RemainingTransfers()
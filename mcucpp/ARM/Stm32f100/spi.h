@@ -3,6 +3,8 @@
 #include "ioreg.h"
 #include "stm32f10x.h"
 #include "clock.h"
+#include "dma.h"
+#include <stddef.h>
 
 namespace Mcucpp
 {
@@ -10,6 +12,7 @@ namespace Mcucpp
 	{
 		class SpiBase
 		{
+			protected:
 			static const uint16_t SPI_Mode_Select = 0xF7FF;
 			public:
 			
@@ -52,7 +55,7 @@ namespace Mcucpp
 			return static_cast<SpiBase::ModeFlags>(static_cast<int>(left) | static_cast<int>(right));
 		}
 		
-		template<class Cr1, class Cr2, class Sr, class Dr, class Crcpr, class RxCrcr, class TxCrcr, class I2SCfgr, class I2Spr, class ClkEnReg, unsigned ClkEnMask>
+		template<class Cr1, class Cr2, class Sr, class Dr, class DrAddr, class Crcpr, class RxCrcr, class TxCrcr, class I2SCfgr, class I2Spr, class ClkEnReg, unsigned ClkEnMask>
 		class Spi :public SpiBase
 		{
 			public:
@@ -96,6 +99,24 @@ namespace Mcucpp
 				return Read();
 			}
 			
+			static volatile void *DataRegister()
+			{
+				return DrAddr::Get();
+			}
+			
+			// SPI should be idle, pending received byte is dropped
+			static void EnableDma()
+			{
+				while(Sr::Get() & SPI_SR_BSY);
+				(void)Dr::Get();
+				Cr2::Or(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+			}
+			
+			static void DisableDma()
+			{
+				Cr2::And(~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN));
+			}
+			
 			static void EnableSoftSSControl()
 			{
 				Cr1::Or(SPI_CR1_SSM);
@@ -139,12 +160,54 @@ namespace Mcucpp
 		
 	}
 
+	// SdCard block transfer policy, full duplex DMA transfer on SPI module.
+	// Reads clock out constant 0xff, writes drop received bytes, completion
+	// is tracked by receive channel that finishes last.
+	// SPI1: Dma1Channel2 (rx), Dma1Channel3 (tx); SPI2: Dma1Channel4, Dma1Channel5.
+	template<class SpiModule, class RxChannel, class TxChannel>
+	class SpiDmaTransfer
+	{
+		static uint8_t &Dummy()
+		{
+			static uint8_t dummy;
+			return dummy;
+		}
+	public:
+		static void StartRead(uint8_t *buffer, size_t size)
+		{
+			Dummy() = 0xff;
+			RxChannel::Init(RxChannel::Periph2Mem | RxChannel::MemIncriment, buffer, SpiModule::DataRegister(), size);
+			TxChannel::Init(TxChannel::Mem2Periph, &Dummy(), SpiModule::DataRegister(), size);
+			SpiModule::EnableDma();
+		}
+		
+		static void StartWrite(const uint8_t *buffer, size_t size)
+		{
+			RxChannel::Init(RxChannel::Periph2Mem, &Dummy(), SpiModule::DataRegister(), size);
+			TxChannel::Init(TxChannel::Mem2Periph | TxChannel::MemIncriment, buffer, SpiModule::DataRegister(), size);
+			SpiModule::EnableDma();
+		}
+		
+		static size_t Remaining()
+		{
+			return RxChannel::RemainingTransfers();
+		}
+		
+		static void Finish()
+		{
+			SpiModule::DisableDma();
+			RxChannel::Disable();
+			TxChannel::Disable();
+		}
+	};
+
 #define DECLARE_SPI(CR1, CR2, SR, DR, CRCPR, RXCRCR, TXCRCR, I2SCFGR, I2SPR, CLK_EN_REG, CLK_EN_MASK, className) \
    namespace Private{\
 		IO_REG_WRAPPER(CR1, className ## Cr1, uint32_t);\
 		IO_REG_WRAPPER(CR2, className ## Cr2, uint32_t);\
 		IO_REG_WRAPPER(SR, className ## Sr, uint32_t);\
 		IO_REG_WRAPPER(DR, className ## Dr, uint32_t);\
+		struct className ## DrAddr{ static volatile void *Get(){ return &DR; } };\
 		IO_REG_WRAPPER(CRCPR, className ## Crcpr, uint32_t);\
 		IO_REG_WRAPPER(RXCRCR, className ## RxCrcr, uint32_t);\
 		IO_REG_WRAPPER(TXCRCR, className ## TxCrcr, uint32_t);\
@@ -156,6 +219,7 @@ namespace Mcucpp
 			Private::className ## Cr2, \
 			Private::className ## Sr, \
 			Private::className ## Dr, \
+			Private::className ## DrAddr, \
 			Private::className ## Crcpr, \
 			Private::className ## RxCrcr, \
 			Private::className ## TxCrcr, \
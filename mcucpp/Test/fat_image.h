@@ -0,0 +1,460 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+#include <filesystem/fat.h>
+
+namespace Mcucpp
+{
+namespace Fat
+{
+	// Host tool making FAT volumes in memory for file system tests and benchmarks.
+	// Directories are referred by their first cluster, 0 stands for root directory.
+	class FatImageBuilder
+	{
+		enum{SectorSize = 512, EntrySize = 32};
+		uint8_t *_image;
+		uint32_t _sectors;
+		FatType _type;
+		uint32_t _start;
+		uint32_t _spc;
+		uint32_t _fatStart;
+		uint32_t _fatSize;
+		uint32_t _rootStart;
+		uint32_t _rootSectors;
+		uint32_t _dataStart;
+		uint32_t _clusters;
+		uint32_t _rootCluster;
+		uint32_t _nextFree;
+		unsigned _shortNames;
+		
+		static void Put16(uint8_t *p, uint16_t v){ p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+		static void Put32(uint8_t *p, uint32_t v){ Put16(p, uint16_t(v)); Put16(p + 2, uint16_t(v >> 16)); }
+		
+		uint8_t *Sector(uint32_t sector){ return _image + (size_t)sector * SectorSize; }
+		uint32_t ClusterBytes() const { return _spc * SectorSize; }
+		
+		uint32_t EndOfChain() const
+		{
+			return _type == Fat12 ? 0xfff : _type == Fat16 ? 0xffff : 0x0fffffff;
+		}
+		
+		bool DirectoryEntries(uint32_t dir, std::vector<uint8_t *> &entries);
+		uint8_t *NewEntries(uint32_t dir, unsigned count);
+		uint32_t Allocate(uint32_t count, unsigned gap);
+		void MakeShortName(const char *name, uint8_t *shortName, bool &needLongName);
+		bool AddEntry(uint32_t dir, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size);
+	public:
+		FatImageBuilder(uint8_t *image, uint32_t sectors)
+			:_image(image), _sectors(sectors), _type(None)
+		{}
+		
+		// Fat12 needs less than 4085 clusters, Fat16 less than 65525, Fat32 more.
+		// Volume starts at 'partitionStart' sector, sector 0 has MBR then.
+		bool Format(FatType type, uint8_t sectorsPerCluster, uint32_t partitionStart = 0);
+		
+		uint32_t Root() const { return 0; }
+		FatType Type() const { return _type; }
+		uint32_t Clusters() const { return _clusters; }
+		uint32_t ClusterSector(uint32_t cluster) const { return _dataStart + (cluster - 2) * _spc; }
+		
+		uint32_t FatEntry(uint32_t cluster);
+		void SetFatEntry(uint32_t cluster, uint32_t value);
+		
+		// Returns first cluster of the new directory, 0 on failure
+		uint32_t AddDirectory(uint32_t parent, const char *name);
+		// Every allocated cluster of the file is followed by 'gap' free ones
+		bool AddFile(uint32_t parent, const char *name, const uint8_t *data, uint32_t size, unsigned gap = 0);
+		
+		// File contents following FAT chain, false if file is not found
+		bool ReadFile(uint32_t parent, const char *shortOrLongName, std::vector<uint8_t> &data);
+	};
+	
+	inline bool FatImageBuilder::Format(FatType type, uint8_t sectorsPerCluster, uint32_t partitionStart)
+	{
+		memset(_image, 0, (size_t)_sectors * SectorSize);
+		_type = type;
+		_start = partitionStart;
+		_spc = sectorsPerCluster;
+		uint32_t volumeSectors = _sectors - _start;
+		uint32_t reserved = type == Fat32 ? 32 : 1;
+		uint32_t rootEntries = type == Fat32 ? 0 : 512;
+		_rootSectors = rootEntries * EntrySize / SectorSize;
+		uint32_t entryBits = type == Fat12 ? 12 : type == Fat16 ? 16 : 32;
+		
+		_fatSize = 1;
+		for(int i = 0; i < 3; i++)
+		{
+			uint32_t clusters = (volumeSectors - reserved - _rootSectors - 2 * _fatSize) / _spc;
+			_fatSize = ((clusters + 2) * entryBits / 8 + SectorSize - 1) / SectorSize;
+		}
+		_fatStart = _start + reserved;
+		_rootStart = _fatStart + 2 * _fatSize;
+		_dataStart = _rootStart + _rootSectors;
+		_clusters = (_sectors - _dataStart) / _spc;
+		
+		FatType actual = _clusters < 4085 ? Fat12 : _clusters < 65525 ? Fat16 : Fat32;
+		if(actual != type)
+			return false;
+		
+		if(_start)
+		{
+			uint8_t *mbr = Sector(0);
+			mbr[446] = 0x80;
+			mbr[446 + 4] = type == Fat32 ? 0x0c : 0x06;
+			Put32(mbr + 446 + 8, _start);
+			Put32(mbr + 446 + 12, volumeSectors);
+			Put16(mbr + 510, 0xaa55);
+		}
+		
+		uint8_t *boot = Sector(_start);
+		boot[0] = 0xeb; boot[1] = 0x3c; boot[2] = 0x90;
+		memcpy(boot + 3, "MCUCPP  ", 8);
+		Put16(boot + 11, SectorSize);
+		boot[13] = uint8_t(_spc);
+		Put16(boot + 14, uint16_t(reserved));
+		boot[16] = 2;
+		Put16(boot + 17, uint16_t(rootEntries));
+		if(volumeSectors < 0x10000 && type != Fat32)
+			Put16(boot + 19, uint16_t(volumeSectors));
+		else
+			Put32(boot + 32, volumeSectors);
+		boot[21] = 0xf8;
+		Put16(boot + 24, 63);
+		Put16(boot + 26, 255);
+		Put32(boot + 28, _start);
+		if(type == Fat32)
+		{
+			Put32(boot + 36, _fatSize);
+			Put32(boot + 44, 2);
+			Put16(boot + 48, 1);
+			boot[66] = 0x29;
+			memcpy(boot + 82, "FAT32   ", 8);
+		}
+		else
+		{
+			Put16(boot + 22, uint16_t(_fatSize));
+			boot[38] = 0x29;
+			memcpy(boot + 54, type == Fat12 ? "FAT12   " : "FAT16   ", 8);
+		}
+		Put16(boot + 510, 0xaa55);
+		
+		SetFatEntry(0, (EndOfChain() & ~0xffu) | 0xf8);
+		SetFatEntry(1, EndOfChain());
+		_nextFree = 2;
+		_rootCluster = 0;
+		_shortNames = 0;
+		if(type == Fat32)
+			_rootCluster = Allocate(1, 0);
+		return true;
+	}
+	
+	inline uint32_t FatImageBuilder::FatEntry(uint32_t cluster)
+	{
+		uint8_t *fat = Sector(_fatStart);
+		if(_type == Fat12)
+		{
+			uint32_t offset = cluster + cluster / 2;
+			uint16_t value = uint16_t(fat[offset] | (fat[offset + 1] << 8));
+			return cluster & 1 ? value >> 4 : value & 0xfff;
+		}
+		if(_type == Fat16)
+			return fat[cluster * 2] | (fat[cluster * 2 + 1] << 8);
+		uint8_t *p = fat + cluster * 4;
+		return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) & 0x0fffffff;
+	}
+	
+	inline void FatImageBuilder::SetFatEntry(uint32_t cluster, uint32_t value)
+	{
+		for(unsigned copy = 0; copy < 2; copy++)
+		{
+			uint8_t *fat = Sector(_fatStart + copy * _fatSize);
+			if(_type == Fat12)
+			{
+				uint32_t offset = cluster + cluster / 2;
+				if(cluster & 1)
+				{
+					fat[offset] = uint8_t((fat[offset] & 0x0f) | (value << 4));
+					fat[offset + 1] = uint8_t(value >> 4);
+				}
+				else
+				{
+					fat[offset] = uint8_t(value);
+					fat[offset + 1] = uint8_t((fat[offset + 1] & 0xf0) | ((value >> 8) & 0x0f));
+				}
+			}
+			else if(_type == Fat16)
+				Put16(fat + cluster * 2, uint16_t(value));
+			else
+				Put32(fat + cluster * 4, value & 0x0fffffff);
+		}
+	}
+	
+	inline uint32_t FatImageBuilder::Allocate(uint32_t count, unsigned gap)
+	{
+		uint32_t first = 0, prev = 0;
+		for(uint32_t i = 0; i < count; i++)
+		{
+			while(_nextFree < _clusters + 2 && FatEntry(_nextFree) != 0)
+				_nextFree++;
+			if(_nextFree >= _clusters + 2)
+				return 0;
+			uint32_t cluster = _nextFree;
+			SetFatEntry(cluster, EndOfChain());
+			memset(Sector(ClusterSector(cluster)), 0, ClusterBytes());
+			if(prev)
+				SetFatEntry(prev, cluster);
+			else
+				first = cluster;
+			prev = cluster;
+			_nextFree += 1 + gap;
+		}
+		return first;
+	}
+	
+	inline bool FatImageBuilder::DirectoryEntries(uint32_t dir, std::vector<uint8_t *> &entries)
+	{
+		entries.clear();
+		if(dir == 0 && _type != Fat32)
+		{
+			for(uint32_t i = 0; i < _rootSectors * SectorSize / EntrySize; i++)
+				entries.push_back(Sector(_rootStart) + i * EntrySize);
+			return true;
+		}
+		if(dir == 0)
+			dir = _rootCluster;
+		for(uint32_t cluster = dir; cluster >= 2 && cluster < _clusters + 2; cluster = FatEntry(cluster))
+		{
+			for(uint32_t i = 0; i < ClusterBytes() / EntrySize; i++)
+				entries.push_back(Sector(ClusterSector(cluster)) + i * EntrySize);
+		}
+		return true;
+	}
+	
+	inline uint8_t *FatImageBuilder::NewEntries(uint32_t dir, unsigned count)
+	{
+		std::vector<uint8_t *> entries;
+		DirectoryEntries(dir, entries);
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			if(entries[i][0] != 0)
+				continue;
+			// free entries up to the end of the directory
+			if(entries.size() - i < count + 1)
+				break;
+			return entries[i];
+		}
+		if(dir == 0 && _type != Fat32)
+			return 0;
+		// extend directory, entries of previous end are moved to new cluster
+		uint32_t last = dir == 0 ? _rootCluster : dir;
+		while(FatEntry(last) < EndOfChain() - 7)
+			last = FatEntry(last);
+		uint32_t cluster = Allocate(1, 0);
+		if(!cluster)
+			return 0;
+		SetFatEntry(last, cluster);
+		return NewEntries(dir, count);
+	}
+	
+	inline void FatImageBuilder::MakeShortName(const char *name, uint8_t *shortName, bool &needLongName)
+	{
+		memset(shortName, ' ', 11);
+		needLongName = false;
+		const char *dot = strrchr(name, '.');
+		size_t baseLen = dot ? size_t(dot - name) : strlen(name);
+		size_t extLen = dot ? strlen(dot + 1) : 0;
+		if(baseLen == 0 || baseLen > 8 || extLen > 3)
+			needLongName = true;
+		for(size_t i = 0, j = 0; i < baseLen && j < 8; i++)
+		{
+			char c = name[i];
+			if(islower((unsigned char)c) || c == ' ' || c == '.')
+				needLongName = true;
+			if(c != ' ' && c != '.')
+				shortName[j++] = (uint8_t)toupper((unsigned char)c);
+		}
+		for(size_t i = 0; i < extLen && i < 3; i++)
+		{
+			char c = dot[1 + i];
+			if(islower((unsigned char)c))
+				needLongName = true;
+			shortName[8 + i] = (uint8_t)toupper((unsigned char)c);
+		}
+		if(needLongName)
+		{
+			// unique numeric tail
+			char tail[8];
+			unsigned n = ++_shortNames;
+			int len = 0;
+			do{ tail[len++] = char('0' + n % 10); n /= 10; }while(n);
+			unsigned pos = 8 - len - 1;
+			shortName[pos++] = '~';
+			while(len)
+				shortName[pos++] = (uint8_t)tail[--len];
+		}
+	}
+	
+	inline bool FatImageBuilder::AddEntry(uint32_t dir, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size)
+	{
+		uint8_t shortName[11];
+		bool needLongName;
+		MakeShortName(name, shortName, needLongName);
+		size_t nameLen = strlen(name);
+		unsigned longEntries = needLongName ? unsigned((nameLen + 12) / 13) : 0;
+		uint8_t *entry = NewEntries(dir, longEntries + 1);
+		if(!entry)
+			return false;
+		
+		std::vector<uint8_t *> entries;
+		DirectoryEntries(dir, entries);
+		size_t index = 0;
+		while(entries[index] != entry)
+			index++;
+		
+		uint8_t checksum = 0;
+		for(int i = 0; i < 11; i++)
+			checksum = uint8_t(((checksum & 1) << 7) + (checksum >> 1) + shortName[i]);
+		static const uint8_t charOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+		for(unsigned n = longEntries; n > 0; n--, index++)
+		{
+			uint8_t *lfn = entries[index];
+			memset(lfn, 0, EntrySize);
+			lfn[0] = uint8_t(n | (n == longEntries ? 0x40 : 0));
+			lfn[11] = ATTR_LONG_NAME;
+			lfn[13] = checksum;
+			for(unsigned i = 0; i < 13; i++)
+			{
+				size_t pos = (n - 1) * 13 + i;
+				uint16_t c = pos < nameLen ? (uint8_t)name[pos] : pos == nameLen ? 0 : 0xffff;
+				Put16(lfn + charOffsets[i], c);
+			}
+		}
+		uint8_t *sfn = entries[index];
+		memset(sfn, 0, EntrySize);
+		memcpy(sfn, shortName, 11);
+		sfn[11] = attributes;
+		Put16(sfn + 20, uint16_t(cluster >> 16));
+		Put16(sfn + 26, uint16_t(cluster));
+		Put32(sfn + 28, size);
+		return true;
+	}
+	
+	inline uint32_t FatImageBuilder::AddDirectory(uint32_t parent, const char *name)
+	{
+		uint32_t cluster = Allocate(1, 0);
+		if(!cluster || !AddEntry(parent, name, ATTR_DIRECTORY, cluster, 0))
+			return 0;
+		uint8_t *dot = Sector(ClusterSector(cluster));
+		memset(dot, ' ', 11);
+		dot[0] = '.';
+		dot[11] = ATTR_DIRECTORY;
+		Put16(dot + 20, uint16_t(cluster >> 16));
+		Put16(dot + 26, uint16_t(cluster));
+		uint8_t *dotdot = dot + EntrySize;
+		memset(dotdot, ' ', 11);
+		dotdot[0] = dotdot[1] = '.';
+		dotdot[11] = ATTR_DIRECTORY;
+		Put16(dotdot + 20, uint16_t(parent >> 16));
+		Put16(dotdot + 26, uint16_t(parent));
+		return cluster;
+	}
+	
+	inline bool FatImageBuilder::AddFile(uint32_t parent, const char *name, const uint8_t *data, uint32_t size, unsigned gap)
+	{
+		uint32_t clusters = (size + ClusterBytes() - 1) / ClusterBytes();
+		uint32_t first = clusters ? Allocate(clusters, gap) : 0;
+		if(clusters && !first)
+			return false;
+		uint32_t cluster = first;
+		for(uint32_t offset = 0; offset < size; offset += ClusterBytes())
+		{
+			uint32_t chunk = size - offset < ClusterBytes() ? size - offset : ClusterBytes();
+			memcpy(Sector(ClusterSector(cluster)), data + offset, chunk);
+			cluster = FatEntry(cluster);
+		}
+		return AddEntry(parent, name, ATTR_ARCHIVE, first, size);
+	}
+	
+	inline bool FatImageBuilder::ReadFile(uint32_t parent, const char *name, std::vector<uint8_t> &data)
+	{
+		std::vector<uint8_t *> entries;
+		DirectoryEntries(parent, entries);
+		std::string longName;
+		for(size_t i = 0; i < entries.size() && entries[i][0] != 0; i++)
+		{
+			uint8_t *entry = entries[i];
+			if(entry[0] == 0xe5)
+				continue;
+			if(entry[11] == ATTR_LONG_NAME)
+			{
+				static const uint8_t charOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+				std::string part;
+				for(unsigned c = 0; c < 13; c++)
+				{
+					uint16_t ch = uint16_t(entry[charOffsets[c]] | (entry[charOffsets[c] + 1] << 8));
+					if(ch == 0 || ch == 0xffff)
+						break;
+					part += char(ch);
+				}
+				longName = part + ((entry[0] & 0x40) ? std::string() : longName);
+				continue;
+			}
+			std::string shortName;
+			for(int c = 0; c < 8 && entry[c] != ' '; c++)
+				shortName += char(entry[c]);
+			if(entry[8] != ' ')
+				shortName += '.';
+			for(int c = 8; c < 11 && entry[c] != ' '; c++)
+				shortName += char(entry[c]);
+			bool match = shortName == name || longName == name;
+			longName.clear();
+			if(!match)
+				continue;
+			uint32_t cluster = (entry[26] | (entry[27] << 8)) | ((uint32_t)(entry[20] | (entry[21] << 8)) << 16);
+			uint32_t size = entry[28] | (entry[29] << 8) | (entry[30] << 16) | ((uint32_t)entry[31] << 24);
+			data.clear();
+			while(data.size() < size && cluster >= 2 && cluster < _clusters + 2)
+			{
+				uint8_t *p = Sector(ClusterSector(cluster));
+				uint32_t chunk = size - data.size() < ClusterBytes() ? size - (uint32_t)data.size() : ClusterBytes();
+				data.insert(data.end(), p, p + chunk);
+				cluster = FatEntry(cluster);
+			}
+			return data.size() == size;
+		}
+		return false;
+	}
+}
+}
@@ -0,0 +1,150 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace Mcucpp
+{
+	// Host model of STM32F40x internal flash: 4 x 16K, 64K and 7 x 128K pages.
+	// Erase sets page to 0xff, programming can only clear bits, written byte is
+	// ANDed with current content. Attempts to turn 0 bits back to 1 are counted
+	// in Overwrites.
+	// Power loss is modelled with FailAfter(bytes): programming stops after given
+	// number of bytes, that and all following writes and erases fail until PowerUp.
+	class Flash
+	{
+		enum{Size = 1024*1024, Pages = 12};
+		
+		struct State
+		{
+			uint8_t memory[Size];
+			uint32_t eraseCount[Pages];
+			uint32_t bytesWritten;
+			uint32_t overwrites;
+			uint32_t failAfter;
+			bool failArmed;
+			bool powerLost;
+			
+			State()
+			{
+				Reset();
+			}
+			
+			void Reset()
+			{
+				memset(memory, 0xff, sizeof(memory));
+				memset(eraseCount, 0, sizeof(eraseCount));
+				bytesWritten = 0;
+				overwrites = 0;
+				failAfter = 0;
+				failArmed = false;
+				powerLost = false;
+			}
+		};
+		
+		static State &GetState()
+		{
+			static State state;
+			return state;
+		}
+	public:
+		static uint32_t TotalSize(){ return Size; }
+		static uint32_t PageCount(){ return Pages; }
+		
+		static uintptr_t PageAddress(unsigned page)
+		{
+			uintptr_t base = (uintptr_t)GetState().memory;
+			if(page < 4)
+				return base + page * 0x4000;
+			if(page == 4)
+				return base + 0x10000;
+			return base + 0x20000 + (page-5) * 0x20000;
+		}
+		
+		static uint32_t PageSize(unsigned page)
+		{
+			if(page < 4)
+				return 0x4000;
+			if(page == 4)
+				return 0x10000;
+			return 0x20000;
+		}
+		
+		static bool ErasePage(unsigned page)
+		{
+			State &state = GetState();
+			if(page >= Pages || state.powerLost)
+				return false;
+			memset((uint8_t *)PageAddress(page), 0xff, PageSize(page));
+			state.eraseCount[page]++;
+			return true;
+		}
+		
+		static bool WritePage(unsigned page, void *data, size_t length, size_t offset = 0)
+		{
+			State &state = GetState();
+			if(page >= Pages || offset + length > PageSize(page) || state.powerLost)
+				return false;
+			uint8_t *dest = (uint8_t *)PageAddress(page) + offset;
+			const uint8_t *src = (const uint8_t *)data;
+			for(size_t i = 0; i < length; i++)
+			{
+				if(state.failArmed && state.failAfter-- == 0)
+				{
+					state.powerLost = true;
+					return false;
+				}
+				if(~dest[i] & src[i])
+					state.overwrites++;
+				dest[i] &= src[i];
+				state.bytesWritten++;
+			}
+			return true;
+		}
+		
+		// Test helpers
+		static void Reset(){ GetState().Reset(); }
+		static void FailAfter(uint32_t bytes)
+		{
+			GetState().failAfter = bytes;
+			GetState().failArmed = true;
+		}
+		static void PowerUp()
+		{
+			GetState().failArmed = false;
+			GetState().powerLost = false;
+		}
+		static bool PowerLost(){ return GetState().powerLost; }
+		static uint32_t EraseCount(unsigned page){ return page < Pages ? GetState().eraseCount[page] : 0; }
+		static uint32_t BytesWritten(){ return GetState().bytesWritten; }
+		static uint32_t Overwrites(){ return GetState().overwrites; }
+	};
+}
@@ -0,0 +1,101 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <filesystem/ram_disk.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Mcucpp
+{
+namespace Fs
+{
+	// Disk image file mapped to memory, Linux only.
+	// Read only images are mapped privately, writes do not reach the file then.
+	class ImageDisk :public RamDisk
+	{
+		int _fd;
+		size_t _size;
+		bool _writable;
+	public:
+		ImageDisk()
+			:_fd(-1), _size(0), _writable(false)
+		{}
+		
+		~ImageDisk()
+		{
+			Close();
+		}
+		
+		bool Open(const char *path, bool writable = false)
+		{
+			Close();
+			_fd = open(path, writable ? O_RDWR : O_RDONLY);
+			if(_fd < 0)
+				return false;
+			struct stat st;
+			if(fstat(_fd, &st) != 0 || st.st_size < BlockSizeValue)
+			{
+				Close();
+				return false;
+			}
+			_size = (size_t)st.st_size;
+			_writable = writable;
+			void *memory = mmap(0, _size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, _fd, 0);
+			if(memory == MAP_FAILED)
+			{
+				Close();
+				return false;
+			}
+			Attach(static_cast<uint8_t *>(memory), uint32_t(_size / BlockSizeValue));
+			return true;
+		}
+		
+		bool Sync()
+		{
+			return !Memory() || !_writable || msync(Memory(), _size, MS_SYNC) == 0;
+		}
+		
+		void Close()
+		{
+			if(Memory())
+			{
+				Sync();
+				munmap(Memory(), _size);
+				Attach(0, 0);
+			}
+			if(_fd >= 0)
+				close(_fd);
+			_fd = -1;
+			_size = 0;
+		}
+	};
+}
+}
@@ -0,0 +1,291 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdio.h>
+#include <net/NetInterface.h>
+#include <net/pcap.h>
+#include <dispatcher.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+	// stdio file as byte source/sink for PcapReader/PcapWriter
+	class StdioFile
+	{
+		FILE *_file;
+		StdioFile(const StdioFile &);
+		StdioFile &operator=(const StdioFile &);
+	public:
+		StdioFile() :_file(0) {}
+		~StdioFile() { Close(); }
+		
+		bool Open(const char *fileName, const char *mode)
+		{
+			Close();
+			_file = fopen(fileName, mode);
+			return _file != 0;
+		}
+		
+		void Close()
+		{
+			if(_file)
+				fclose(_file);
+			_file = 0;
+		}
+		
+		bool IsOpen() const { return _file != 0; }
+		
+		bool Eof()
+		{
+			if(!_file)
+				return true;
+			int c = fgetc(_file);
+			if(c == EOF)
+				return true;
+			ungetc(c, _file);
+			return false;
+		}
+		
+		uint8_t Read()
+		{
+			int c = _file ? fgetc(_file) : EOF;
+			return c == EOF ? 0 : (uint8_t)c;
+		}
+		
+		void Write(uint8_t value)
+		{
+			if(_file)
+				fputc(value, _file);
+		}
+		
+		void Flush()
+		{
+			if(_file)
+				fflush(_file);
+		}
+	};
+	
+	// Host network interface recording transmitted frames to pcap file
+	// and replaying received frames from other pcap file.
+	class PcapInterface :public NetInterface
+	{
+		enum{MaxBatch = 8};
+		Dispatcher &_dispatcher;
+		Net::MacAddr _macaddr;
+		StdioFile _output;
+		StdioFile _input;
+		PcapWriter<StdioFile> _writer;
+		PcapReader<StdioFile> _reader;
+		TransferId _txSequence;
+		uint32_t _framesSend;
+		uint32_t _framesRecived;
+		uint32_t _framesAppMissed;
+		uint32_t _reciveErrors;
+		
+		DataBuffer *ReadFrameData(size_t size)
+		{
+			NetBuffer frame;
+			while(size)
+			{
+				// fall back to smaller fragments when large buffers are exhausted
+				size_t chunk = size;
+				DataBuffer *part = 0;
+				while(chunk && !(part = DataBuffer::GetNew(chunk)))
+					chunk /= 2;
+				if(!part)
+				{
+					// skip rest of the record to stay at the next record header
+					while(size--)
+						_input.Read();
+					return 0;
+				}
+				for(size_t i = 0; i < chunk; i++)
+					(*part)[i] = _input.Read();
+				frame.AttachBack(part);
+				size -= chunk;
+			}
+			return frame.MoveToBufferList();
+		}
+	public:
+		PcapInterface(Dispatcher &dispatcher, const Net::MacAddr &macaddr)
+			:_dispatcher(dispatcher),
+			_macaddr(macaddr),
+			_writer(_output),
+			_reader(_input),
+			_txSequence(0),
+			_framesSend(0),
+			_framesRecived(0),
+			_framesAppMissed(0),
+			_reciveErrors(0)
+		{
+		}
+		
+		// Transmitted frames are written to 'fileName'
+		bool OpenRecord(const char *fileName)
+		{
+			if(!_output.Open(fileName, "wb"))
+				return false;
+			_writer.WriteFileHeader(PcapLinkTypeEthernet);
+			return true;
+		}
+		
+		// Frames from 'fileName' are delivered to dispatcher on Poll, as fast as it polls
+		bool OpenReplay(const char *fileName)
+		{
+			if(!_input.Open(fileName, "rb"))
+				return false;
+			if(!_reader.ReadFileHeader() || _reader.LinkType() != PcapLinkTypeEthernet)
+			{
+				_input.Close();
+				return false;
+			}
+			return true;
+		}
+		
+		void Close()
+		{
+			_input.Close();
+			_output.Close();
+		}
+		
+	public: // NetInterface members
+		virtual bool SetMacAddress(unsigned addrNumber, const Net::MacAddr &macaddr)
+		{
+			if(addrNumber != 0)
+				return false;
+			_macaddr = macaddr;
+			return true;
+		}
+		virtual unsigned MaxAddresses(){return 1;}
+		virtual const Net::MacAddr& GetMacAddress(unsigned){ return _macaddr; }
+		virtual bool IsLinked(){ return _input.IsOpen() || _output.IsOpen(); }
+		// captured traffic is neither filtered when recorded nor when replayed
+		virtual bool AddAddressFilter(const Net::MacAddr &){ return true; }
+		virtual bool RemoveAddressFilter(const Net::MacAddr &){ return true; }
+		virtual void SetPromiscuous(bool){}
+		virtual void PauseCommand(uint16_t){}
+		
+		virtual uint32_t GetParameter(NetInterfaceParameter parameterId)
+		{
+			switch(parameterId)
+			{
+				case NetIfFramesSend:        return _framesSend;
+				case NetIfFramesRecived:     return _framesRecived;
+				case NetIfFramesAppMissed:   return _framesAppMissed;
+				case NetIfReciveErrors:      return _reciveErrors;
+				case NetIfLinked:            return IsLinked();
+				default: break;
+			}
+			return 0;
+		}
+		
+		virtual bool CanTransmit(Net::NetBuffer &){ return _output.IsOpen(); }
+		
+		virtual TransferId Transmit(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)
+		{
+			if(!_output.IsOpen())
+				return 0;
+			uint8_t header[EthernetHeaderSize];
+			for(unsigned i = 0; i < 6; i++)
+			{
+				header[i] = destAddr[i];
+				header[i + 6] = _macaddr[i];
+			}
+			header[12] = (uint8_t)(protocoId >> 8);
+			header[13] = (uint8_t)protocoId;
+			
+			// ticks are treated as milliseconds
+			uint32_t ticks = _dispatcher.GetTicks();
+			_writer.WriteFrame(ticks / 1000, (ticks % 1000) * 1000, header, sizeof(header), buffer.BufferList());
+			buffer.Clear();
+			_framesSend++;
+			if(++_txSequence == 0)
+				_txSequence = 1;
+			if(_dispatch)
+				_dispatch->TxComplete(this, _txSequence, true);
+			return _txSequence;
+		}
+		
+		// frames are written synchronously
+		virtual bool TxCompleteFor(TransferId){ return true; }
+		
+		virtual void Poll()
+		{
+			_output.Flush();
+			if(!_input.IsOpen())
+				return;
+			
+			RxFrame frames[MaxBatch];
+			unsigned count = 0;
+			PcapRecordHeader record;
+			while(count < MaxBatch && !_input.Eof())
+			{
+				if(!_reader.ReadRecordHeader(record))
+				{
+					_reciveErrors++;
+					_input.Close();
+					break;
+				}
+				DataBuffer *frame = ReadFrameData(record.capturedLength);
+				if(!frame || record.capturedLength < EthernetHeaderSize)
+				{
+					// frames are skipped if there is no memory to hold them
+					_reciveErrors++;
+					DataBuffer::ReleaseRecursive(frame);
+					continue;
+				}
+				
+				NetBuffer header(frame);
+				header.Seek(0);
+				RxFrame &rxFrame = frames[count++];
+				rxFrame.destAddr = header.ReadMac();
+				rxFrame.srcAddr = header.ReadMac();
+				rxFrame.protocolId = header.ReadU16Be();
+				rxFrame.headerSize = EthernetHeaderSize;
+				rxFrame.buffer = header.MoveToBufferList();
+			}
+			
+			if(!count)
+				return;
+			if(_dispatch)
+			{
+				_framesRecived += count;
+				_dispatch->RxCompleteBatch(this, frames, count);
+			}
+			else
+			{
+				for(unsigned i = 0; i < count; i++)
+					DataBuffer::ReleaseRecursive(frames[i].buffer);
+				_framesAppMissed += count;
+			}
+		}
+	};
+}
+}
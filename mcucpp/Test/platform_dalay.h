@@ -35,19 +35,25 @@ enum
 	PlatformCyslesPerDelayLoop8 = 1
 };
 
+#if defined(_WIN32)
 extern "C" void __stdcall Sleep(unsigned long dwMilliseconds);
+inline void PlatformYield(){ Sleep(0); }
+#else
+#include <sched.h>
+inline void PlatformYield(){ sched_yield(); }
+#endif
 
 inline void PlatformDelayCycle32(uint32_t delayLoops)
 {
-	Sleep(0);
+	PlatformYield();
 }
 
 inline void PlatformDelayCycle16(uint16_t delayLoops)
 {
-	Sleep(0);
+	PlatformYield();
 }
 
 inline void PlatformDelayCycle8(uint8_t delayLoops)
 {
-	Sleep(0);
+	PlatformYield();
 }
@@ -0,0 +1,521 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <crc.h>
+#include <spi.h>
+
+namespace Mcucpp
+{
+	// Host model of SD card in SPI mode. Only one card is attached at a time,
+	// it is reached through static SdCardSimSpi and SdCardSimCs classes that
+	// can be plugged to SdCard driver in place of real SPI module and CS pin.
+	class SdCardSimulator
+	{
+		enum State
+		{
+			StateCommand,
+			StateReadMultiple,
+			StateWaitToken,
+			StateReceiveData
+		};
+		// Card latencies in SPI bytes, roughly proportional to ones of a slow card.
+		// Multiple block transfers pay access and programming latency once per command,
+		// pre-erased blocks are programmed faster.
+		enum
+		{
+			BlockSize = 512,
+			ReadAccessBytes = 64,
+			BlockGapBytes = 2,
+			WriteBusyBytes = 256,
+			StreamBusyBytes = 32,
+			PreErasedBusyBytes = 8,
+			StopBusyBytes = 4,
+			InitPolls = 2
+		};
+		
+		std::vector<uint8_t> _storage;
+		std::deque<uint8_t> _out;
+		bool _sdhc;
+		bool _selected;
+		bool _appCommand;
+		bool _multiWrite;
+		bool _preErased;
+		bool _firstBlock;
+		bool _crc;
+		bool _corruptRead;
+		State _state;
+		unsigned _initPolls;
+		uint8_t _command[6];
+		unsigned _commandPos;
+		uint32_t _block;
+		std::vector<uint8_t> _data;
+		
+		uint32_t _bytes;
+		uint32_t _commands;
+		uint32_t _selects;
+		uint32_t _blocksRead;
+		uint32_t _blocksWritten;
+		uint32_t _preErase;
+		uint32_t _protocolErrors;
+		uint32_t _crcErrors;
+		
+		SdCardSimulator(const SdCardSimulator &);
+		SdCardSimulator &operator=(const SdCardSimulator &);
+	public:
+		static SdCardSimulator *&Current()
+		{
+			static SdCardSimulator *card = 0;
+			return card;
+		}
+		
+		SdCardSimulator(uint32_t blocks, bool sdhc = true)
+			:_storage(blocks * BlockSize),
+			_sdhc(sdhc)
+		{
+			PowerUp();
+			Current() = this;
+		}
+		
+		~SdCardSimulator()
+		{
+			if(Current() == this)
+				Current() = 0;
+		}
+		
+		void PowerUp()
+		{
+			_out.clear();
+			_selected = false;
+			_appCommand = false;
+			_multiWrite = false;
+			_preErased = false;
+			_firstBlock = false;
+			_crc = false;
+			_corruptRead = false;
+			_state = StateCommand;
+			_initPolls = InitPolls;
+			_commandPos = 0;
+			_block = 0;
+			ResetCounters();
+		}
+		
+		void ResetCounters()
+		{
+			_bytes = 0;
+			_commands = 0;
+			_selects = 0;
+			_blocksRead = 0;
+			_blocksWritten = 0;
+			_preErase = 0;
+			_protocolErrors = 0;
+			_crcErrors = 0;
+		}
+		
+		uint32_t Blocks() const { return _storage.size() / BlockSize; }
+		uint8_t *Block(uint32_t block){ return &_storage[block * BlockSize]; }
+		
+		// bytes clocked while card was selected
+		uint32_t Bytes() const { return _bytes; }
+		uint32_t Commands() const { return _commands; }
+		uint32_t Selects() const { return _selects; }
+		uint32_t BlocksRead() const { return _blocksRead; }
+		uint32_t BlocksWritten() const { return _blocksWritten; }
+		// block count from last ACMD23
+		uint32_t PreErase() const { return _preErase; }
+		// tokens or commands sent while card was busy
+		uint32_t ProtocolErrors() const { return _protocolErrors; }
+		// commands and written blocks rejected due to CRC mismatch
+		uint32_t CrcErrors() const { return _crcErrors; }
+		// set by CRC_ON_OFF command
+		bool CrcEnabled() const { return _crc; }
+		// next data block sent to host is damaged after its CRC is computed
+		void CorruptNextRead(){ _corruptRead = true; }
+		
+		void Select(bool select)
+		{
+			if(select && !_selected)
+				_selects++;
+			_selected = select;
+		}
+		
+		uint8_t Transfer(uint8_t mosi)
+		{
+			if(!_selected)
+				return 0xff;
+			_bytes++;
+			if(_out.empty() && _state == StateReadMultiple)
+				QueueBlock();
+			uint8_t miso = 0xff;
+			bool busy = !_out.empty() && _out.back() == 0;
+			if(!_out.empty())
+			{
+				miso = _out.front();
+				_out.pop_front();
+			}
+			
+			switch(_state)
+			{
+			case StateReceiveData:
+				_data.push_back(mosi);
+				if(_data.size() == BlockSize + 2)
+					EndWriteBlock();
+				break;
+			case StateWaitToken:
+				if(mosi == 0xff)
+					break;
+				if(busy)
+					_protocolErrors++;
+				if(mosi == 0xfe || (_multiWrite && mosi == 0xfc))
+				{
+					_data.clear();
+					_state = StateReceiveData;
+				}
+				else if(_multiWrite && mosi == 0xfd)
+				{
+					_out.push_back(0xff);
+					_out.insert(_out.end(), StopBusyBytes, 0);
+					_preErased = false;
+					_state = StateCommand;
+				}
+				break;
+			default:
+				if(_commandPos == 0 && (mosi & 0xc0) != 0x40)
+					break;
+				_command[_commandPos++] = mosi;
+				if(_commandPos == sizeof(_command))
+				{
+					_commandPos = 0;
+					if(busy && _state != StateReadMultiple)
+						_protocolErrors++;
+					Execute();
+				}
+			}
+			return miso;
+		}
+	private:
+		uint32_t Address() const
+		{
+			uint32_t arg = ((uint32_t)_command[1] << 24) | ((uint32_t)_command[2] << 16) |
+				((uint32_t)_command[3] << 8) | _command[4];
+			return arg;
+		}
+		
+		uint8_t R1() const
+		{
+			return _initPolls ? 0x01 : 0x00;
+		}
+		
+		bool SetBlock(uint32_t address)
+		{
+			_block = _sdhc ? address : address / BlockSize;
+			return _block < Blocks();
+		}
+		
+		void QueueData(const uint8_t *data, size_t size, size_t access)
+		{
+			_out.insert(_out.end(), access, 0xff);
+			_out.push_back(0xfe);
+			_out.insert(_out.end(), data, data + size);
+			uint16_t crc = ComputeCrc<XModemCrcTable>(data, size);
+			if(_corruptRead)
+			{
+				_out[_out.size() - size / 2] ^= 0x10;
+				_corruptRead = false;
+			}
+			_out.push_back(uint8_t(crc >> 8));
+			_out.push_back(uint8_t(crc));
+		}
+		
+		void QueueBlock()
+		{
+			if(_block >= Blocks())
+			{
+				_out.push_back(0x08); // out of range data error token
+				_state = StateCommand;
+				return;
+			}
+			QueueData(Block(_block), BlockSize, _firstBlock ? ReadAccessBytes : BlockGapBytes);
+			_firstBlock = false;
+			_block++;
+			_blocksRead++;
+		}
+		
+		void EndWriteBlock()
+		{
+			uint16_t crc = ((uint16_t)_data[BlockSize] << 8) | _data[BlockSize + 1];
+			if(_crc && crc != ComputeCrc<XModemCrcTable>(&_data[0], BlockSize))
+			{
+				_crcErrors++;
+				_out.push_back(0xeb); // CRC error
+			}
+			else if(_block < Blocks())
+			{
+				memcpy(Block(_block), &_data[0], BlockSize);
+				_block++;
+				_blocksWritten++;
+				_out.push_back(0xe5); // data accepted
+				size_t busy = WriteBusyBytes;
+				if(_multiWrite && !_firstBlock)
+					busy = _preErased ? PreErasedBusyBytes : StreamBusyBytes;
+				_out.insert(_out.end(), busy, 0);
+				_firstBlock = false;
+			}
+			else
+				_out.push_back(0xed); // write error
+			_state = _multiWrite ? StateWaitToken : StateCommand;
+		}
+		
+		void Execute()
+		{
+			uint8_t index = _command[0] & 0x3f;
+			uint32_t arg = Address();
+			bool appCommand = _appCommand;
+			_appCommand = false;
+			_commands++;
+			
+			// GO_IDLE_STATE and SEND_IF_COND are always checked
+			if((_crc || index == 0 || index == 8) &&
+				(ComputeCrc<SdCrc7>(_command, 5) | 1) != _command[5])
+			{
+				_crcErrors++;
+				if(_state == StateReadMultiple)
+					return;
+				_out.push_back(0xff);
+				_out.push_back(R1() | 0x08);
+				return;
+			}
+			
+			if(_state == StateReadMultiple)
+			{
+				// block being sent is interrupted
+				if(!_out.empty())
+					_blocksRead--;
+				_out.clear();
+				_state = StateCommand;
+				if(index == 12)
+				{
+					_out.push_back(0xff); // stuff byte
+					_out.push_back(0x00);
+					_out.insert(_out.end(), StopBusyBytes, 0);
+					return;
+				}
+			}
+			_out.push_back(0xff);
+			switch(index)
+			{
+			case 0:
+				_initPolls = InitPolls;
+				_crc = false;
+				_out.push_back(0x01);
+				break;
+			case 1:
+			case 41:
+				if(index == 41 && !appCommand)
+				{
+					_out.push_back(R1() | 0x04);
+					break;
+				}
+				if(_initPolls)
+					_initPolls--;
+				_out.push_back(R1());
+				break;
+			case 8:
+				_out.push_back(R1());
+				_out.push_back(0);
+				_out.push_back(0);
+				_out.push_back(uint8_t(arg >> 8) & 0x0f);
+				_out.push_back(uint8_t(arg));
+				break;
+			case 9:
+				{
+					uint8_t csd[16] = {0};
+					uint32_t cSize = Blocks() / 1024 - 1;
+					csd[0] = 0x40;
+					csd[5] = 0x09;
+					csd[7] = uint8_t(cSize >> 16) & 0x3f;
+					csd[8] = uint8_t(cSize >> 8);
+					csd[9] = uint8_t(cSize);
+					_out.push_back(R1());
+					QueueData(csd, sizeof(csd), BlockGapBytes);
+				}
+				break;
+			case 12:
+				_out.push_back(0xff);
+				_out.push_back(R1());
+				break;
+			case 13:
+				_out.push_back(R1());
+				_out.push_back(0);
+				break;
+			case 16:
+				_out.push_back(R1());
+				break;
+			case 59:
+				_crc = arg & 1;
+				_out.push_back(R1());
+				break;
+			case 17:
+			case 18:
+				if(!SetBlock(arg))
+				{
+					_out.push_back(0x20);
+					break;
+				}
+				_out.push_back(R1());
+				_firstBlock = true;
+				if(index == 17)
+					QueueBlock();
+				else
+					_state = StateReadMultiple;
+				break;
+			case 23:
+				if(appCommand)
+				{
+					_preErase = arg & 0x7fffff;
+					_preErased = _preErase != 0;
+				}
+				_out.push_back(R1() | (appCommand ? 0 : 0x04));
+				break;
+			case 24:
+			case 25:
+				if(!SetBlock(arg))
+				{
+					_out.push_back(0x20);
+					break;
+				}
+				_out.push_back(R1());
+				_multiWrite = index == 25;
+				_firstBlock = true;
+				_state = StateWaitToken;
+				break;
+			case 55:
+				_appCommand = true;
+				_out.push_back(R1());
+				break;
+			case 58:
+				_out.push_back(R1());
+				_out.push_back(_sdhc ? 0xc0 : 0x80);
+				_out.push_back(0xff);
+				_out.push_back(0x80);
+				_out.push_back(0x00);
+				break;
+			default:
+				_out.push_back(R1() | 0x04);
+			}
+		}
+	};
+	
+	// SPI module and CS pin wired to the current SdCardSimulator
+	class SdCardSimSpi :public Private::SpiBase
+	{
+	public:
+		static void Init(ClockDivider = Medium, Mode = Master){}
+		static void Write(uint8_t value)
+		{
+			SdCardSimulator::Current()->Transfer(value);
+		}
+		static uint8_t Read()
+		{
+			return SdCardSimulator::Current()->Transfer(0xff);
+		}
+		static uint8_t ReadWrite(uint8_t value)
+		{
+			return SdCardSimulator::Current()->Transfer(value);
+		}
+	};
+	
+	class SdCardSimCs
+	{
+	public:
+		static void SetDirWrite(){}
+		static void Set(){ SdCardSimulator::Current()->Select(false); }
+		static void Clear(){ SdCardSimulator::Current()->Select(true); }
+	};
+	
+	// SdCard block transfer policy modelling DMA: data is moved in 'Chunk' bytes
+	// portions, one per Remaining call, that counts as one wait loop iteration.
+	template<size_t Chunk = 64>
+	class SdCardSimDma
+	{
+		struct State
+		{
+			uint8_t *rxBuffer;
+			const uint8_t *txBuffer;
+			size_t size;
+			size_t done;
+			uint32_t waits;
+			uint32_t transfers;
+		};
+		static State &Current()
+		{
+			static State state;
+			return state;
+		}
+		static void Start(uint8_t *rxBuffer, const uint8_t *txBuffer, size_t size)
+		{
+			State &state = Current();
+			state.rxBuffer = rxBuffer;
+			state.txBuffer = txBuffer;
+			state.size = size;
+			state.done = 0;
+			state.transfers++;
+		}
+	public:
+		static void StartRead(uint8_t *buffer, size_t size){ Start(buffer, 0, size); }
+		static void StartWrite(const uint8_t *buffer, size_t size){ Start(0, buffer, size); }
+		
+		static size_t Remaining()
+		{
+			State &state = Current();
+			size_t end = state.done + Chunk < state.size ? state.done + Chunk : state.size;
+			if(state.done == end)
+				return 0;
+			for(; state.done < end; state.done++)
+			{
+				if(state.rxBuffer)
+					state.rxBuffer[state.done] = SdCardSimSpi::Read();
+				else
+					SdCardSimSpi::Write(state.txBuffer[state.done]);
+			}
+			state.waits++;
+			return state.size - state.done;
+		}
+		
+		static void Finish(){}
+		
+		// number of started transfers and wait loop iterations
+		static uint32_t Transfers(){ return Current().transfers; }
+		static uint32_t Waits(){ return Current().waits; }
+	};
+}
@@ -29,3 +29,22 @@
 #if defined (__GNUC__) && defined(__arm__)
 	#define MCUCPP_INTERRUPT(ISR_NAME) __attribute__(( __interrupt__)) void ISR_NAME() 
 #endif
+
+#if defined (__GNUC__)
+	#define MCUCPP_PREFETCH(ADDR) __builtin_prefetch(ADDR)
+#else
+	#define MCUCPP_PREFETCH(ADDR)
+#endif
+
+// prevents compiler from reordering memory accesses across it, enough for single core MCUs
+#if defined (__GNUC__)
+	#define MCUCPP_COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+	#define MCUCPP_COMPILER_BARRIER()
+#endif
+
+#if defined (__GNUC__)
+	#define MCUCPP_DEPRECATED __attribute__((deprecated))
+#else
+	#define MCUCPP_DEPRECATED
+#endif
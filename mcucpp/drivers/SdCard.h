@@ -32,6 +32,8 @@
 #include <delay.h>
 //#include <debug.h>
 #include <binary_stream.h>
+#include <crc.h>
+#include <dispatcher.h>
 
 namespace Mcucpp
 {
@@ -60,7 +62,8 @@ namespace Mcucpp
 		GEN_CMD = 56,
 		READ_OCR = 58,
 		CRC_ON_OFF = 59,
-		SD_SEND_OP_COND = 0x40 | 41 // ACDM41
+		SD_SEND_OP_COND = 0x40 | 41, // ACDM41
+		SET_WR_BLK_ERASE_COUNT = 0x40 | 23 // ACMD23
 	};
 	
 	enum SdR1R2ResponseBits
@@ -100,46 +103,194 @@ namespace Mcucpp
 		SdDataOutOfRangeError   = 0x08
 	};
 
+	// Block transfer policy moving data with CPU, one SPI transaction per byte.
+	// Other policies (like DMA driven ones) start transfer in StartRead/StartWrite,
+	// report bytes left to transfer in Remaining and clean up in Finish.
+	template<class SpiModule>
+	class SdSpiTransfer
+	{
+	public:
+		static void StartRead(uint8_t *buffer, size_t size)
+		{
+			for(size_t i = 0; i < size; ++i)
+				buffer[i] = SpiModule::Read();
+		}
+		
+		static void StartWrite(const uint8_t *buffer, size_t size)
+		{
+			for(size_t i = 0; i < size; ++i)
+				SpiModule::Write(buffer[i]);
+		}
+		
+		static size_t Remaining(){ return 0; }
+		static void Finish(){}
+	};
 	
-	template<class SpiModule_, class CsPin>
+	template<class SpiModule_, class CsPin, class BlockTransfer = SdSpiTransfer<SpiModule_> >
 	class SdCard
 	{
 		enum
 		{
-			CommandTimeoutValue = 100
+			CommandTimeoutValue = 100,
+			BusyTimeoutValue = 10000u,
+			BlockSizeValue = 512
+		};
+		enum
+		{
+			StartBlockToken = 0xFE,
+			StartMultipleWriteToken = 0xFC,
+			StopTranToken = 0xFD
 		};
-		static const bool useCrc = false;
-		SdCardType _type;
 		
 		typedef BinaryStream<SpiModule_> Spi;
+		typedef XModemCrcTable DataCrc;
+		SdCardType _type;
+		Spi _spi;
+		Dispatcher *_dispatcher;
+		bool _useCrc;
 	protected:
-		uint16_t SpiCommand(uint8_t index, uint32_t arg, uint8_t crc = 0);
+		uint16_t SpiCommand(uint8_t index, uint32_t arg);
+		uint8_t Command(uint8_t index, uint32_t arg);
 		uint32_t ReadBlocksCount();
 		bool WaitWhileBusy();
-		template<class ReadIterator>
-		bool ReadDataBlock(ReadIterator iter, size_t size)
+		
+		// Asserts CS and waits until card releases busy state
+		bool Select()
 		{
 			CsPin::Clear();
-
-			uint8_t resp;
-			resp = Spi::IgnoreWhile(1000, 0xFF);
-			if(resp != 0xFE)
+			return WaitWhileBusy();
+		}
+		
+		void Release()
+		{
+			CsPin::Set();
+			_spi.Read();
+		}
+		
+		uint32_t BlockAddress(uint32_t logicalBlockAddress)
+		{
+			return _type == SdhcCard ? logicalBlockAddress : logicalBlockAddress << 9;
+		}
+		
+		// Waits for block transfer policy to complete, dispatcher tasks are run meanwhile
+		void WaitTransfer()
+		{
+			while(BlockTransfer::Remaining())
 			{
-				CsPin::Set();
-				return false;
+				if(_dispatcher)
+					_dispatcher->Poll();
 			}
-			Spi::template Read<ReadIterator>(iter, size);
-			uint16_t crc = Spi::ReadU16Le();
-			if(useCrc)
+			BlockTransfer::Finish();
+		}
+		
+		// Returns data CRC if it is enabled
+		template<class ReadIterator>
+		uint16_t ReceiveData(ReadIterator &iter, size_t size)
+		{
+			uint16_t crc = DataCrc::Init;
+			for(size_t i = 0; i < size; ++i, ++iter)
 			{
-				// TBD
-			}else
-				(void)crc;
-			CsPin::Set();
-			Spi::Read();
-			return true;
+				uint8_t value = _spi.Read();
+				if(_useCrc)
+					crc = CrcUpdate<DataCrc>(value, crc);
+				*iter = value;
+			}
+			return crc;
+		}
+		
+		// Contiguous buffers go through block transfer policy,
+		// CRC of already received part is computed while transfer runs.
+		uint16_t ReceiveData(uint8_t *&buffer, size_t size)
+		{
+			uint16_t crc = DataCrc::Init;
+			size_t done = 0, remaining;
+			BlockTransfer::StartRead(buffer, size);
+			while((remaining = BlockTransfer::Remaining()) != 0)
+			{
+				if(_useCrc && size - remaining > done)
+				{
+					crc = ComputeCrc<DataCrc>(buffer + done, size - remaining - done, crc);
+					done = size - remaining;
+				}
+				else if(_dispatcher)
+					_dispatcher->Poll();
+			}
+			BlockTransfer::Finish();
+			if(_useCrc)
+				crc = ComputeCrc<DataCrc>(buffer + done, size - done, crc);
+			buffer += size;
+			return crc;
+		}
+		
+		template<class WriteIterator>
+		uint16_t SendData(WriteIterator &iter, size_t size)
+		{
+			uint16_t crc = DataCrc::Init;
+			for(size_t i = 0; i < size; ++i, ++iter)
+			{
+				uint8_t value = *iter;
+				if(_useCrc)
+					crc = CrcUpdate<DataCrc>(value, crc);
+				_spi.Write(value);
+			}
+			return crc;
+		}
+		
+		uint16_t SendData(const uint8_t *&buffer, size_t size)
+		{
+			uint16_t crc = DataCrc::Init;
+			BlockTransfer::StartWrite(buffer, size);
+			if(_useCrc)
+				crc = ComputeCrc<DataCrc>(buffer, size);
+			WaitTransfer();
+			buffer += size;
+			return crc;
+		}
+		
+		uint16_t SendData(uint8_t *&buffer, size_t size)
+		{
+			const uint8_t *ptr = buffer;
+			buffer += size;
+			return SendData(ptr, size);
+		}
+		
+		// CS is asserted by caller, 'iter' is advanced by 'size'
+		template<class ReadIterator>
+		bool ReceiveDataBlock(ReadIterator &iter, size_t size)
+		{
+			if(_spi.IgnoreWhile(1000, 0xFF) != StartBlockToken)
+				return false;
+			uint16_t crc = ReceiveData(iter, size);
+			return _spi.ReadU16Be() == crc || !_useCrc;
+		}
+		
+		// CS is asserted by caller, 'iter' is advanced by block size
+		template<class WriteIterator>
+		bool SendDataBlock(uint8_t token, WriteIterator &iter)
+		{
+			_spi.Read();
+			_spi.Write(token);
+			uint16_t crc = SendData(iter, BlockSizeValue);
+			_spi.WriteU16Be(_useCrc ? crc : 0xffff);
+			return (_spi.Read() & 0x1F) == 0x05;
 		}
 	public:
+		SdCard()
+			:_type(SdCardNone),
+			_dispatcher(0),
+			_useCrc(false)
+		{}
+		
+		// Detect enables CRC checks, they can be turned off after it
+		bool EnableCrc(bool enable);
+		bool CrcEnabled() const { return _useCrc; }
+		
+		// Tasks of 'dispatcher' are run while block transfer policy moves data
+		// and while the card is busy, they must not access the card.
+		void SetDispatcher(Dispatcher *dispatcher)
+		{
+			_dispatcher = dispatcher;
+		}
 
 		bool CheckStatus();
 
@@ -152,111 +303,164 @@ namespace Mcucpp
 		template<class WriteIterator>
 		bool WriteBlock(WriteIterator iter, uint32_t logicalBlockAddress)
 		{
-			if(_type != SdhcCard)
-				logicalBlockAddress <<= 9;
-			if(SpiCommand(WRITE_BLOCK, logicalBlockAddress) == 0)
-			{
-				CsPin::Clear();
-				if(Spi::Ignore(10000u, 0xff) != 0xff)
-				{
-					return false;
-				}
-
-				Spi::Write(0xFE);
-				Spi::template Write<WriteIterator>(iter, 512);
-				Spi::ReadU16Be();
-				uint8_t resp;
-				if((resp = Spi::Read() & 0x1F) != 0x05)
-				{
-					return false;
-				}
-				CsPin::Set();
-				Spi::Read();
-				return true;
-			}
-			return false;
+			bool result = Select() &&
+				Command(WRITE_BLOCK, BlockAddress(logicalBlockAddress)) == 0 &&
+				SendDataBlock(StartBlockToken, iter);
+			Release();
+			return result;
 		}
 
 		template<class ReadIterator>
 		bool ReadBlock(ReadIterator iter, uint32_t logicalBlockAddress)
 		{
-			if(_type != SdhcCard)
-				logicalBlockAddress <<= 9;
-			if(!WaitWhileBusy())
+			bool result = Select() &&
+				Command(READ_SINGLE_BLOCK, BlockAddress(logicalBlockAddress)) == 0 &&
+				ReceiveDataBlock(iter, BlockSizeValue);
+			Release();
+			return result;
+		}
+		
+		// Multiple block transfers keep the card selected from BeginRead/BeginWrite
+		// till EndRead/EndWrite, no other card access is allowed in between.
+		bool BeginRead(uint32_t logicalBlockAddress);
+		bool EndRead();
+		
+		// reads next block of multiple block transfer
+		template<class ReadIterator>
+		bool ReadNext(ReadIterator iter)
+		{
+			return ReceiveDataBlock(iter, BlockSizeValue);
+		}
+		
+		// 'preErase' is expected number of blocks to be written, zero if unknown
+		bool BeginWrite(uint32_t logicalBlockAddress, uint32_t preErase = 0);
+		bool EndWrite();
+		
+		// writes next block of multiple block transfer
+		template<class WriteIterator>
+		bool WriteNext(WriteIterator iter)
+		{
+			return WaitWhileBusy() && SendDataBlock(StartMultipleWriteToken, iter);
+		}
+		
+		template<class ReadIterator>
+		bool ReadBlocks(ReadIterator iter, uint32_t logicalBlockAddress, uint32_t count)
+		{
+			if(count == 0)
+				return true;
+			if(count == 1)
+				return ReadBlock(iter, logicalBlockAddress);
+			if(!BeginRead(logicalBlockAddress))
 				return false;
-			if(SpiCommand(READ_SINGLE_BLOCK, logicalBlockAddress) == 0)
-			{
-				return ReadDataBlock<ReadIterator>(iter, 512);
-			}
-			return false;
+			bool result = true;
+			for(; count && result; --count)
+				result = ReceiveDataBlock(iter, BlockSizeValue);
+			return EndRead() && result;
+		}
+		
+		template<class WriteIterator>
+		bool WriteBlocks(WriteIterator iter, uint32_t logicalBlockAddress, uint32_t count)
+		{
+			if(count == 0)
+				return true;
+			if(count == 1)
+				return WriteBlock(iter, logicalBlockAddress);
+			if(!BeginWrite(logicalBlockAddress, count))
+				return false;
+			bool result = true;
+			for(; count && result; --count)
+				result = WaitWhileBusy() && SendDataBlock(StartMultipleWriteToken, iter);
+			return EndWrite() && result;
 		}
-			
 	};
 
 
-	template<class SpiModule_, class CsPin> 
-	uint16_t SdCard<SpiModule_, CsPin>::SpiCommand(uint8_t index, uint32_t arg, uint8_t crc)
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	uint8_t SdCard<SpiModule_, CsPin, BlockTransfer>::Command(uint8_t index, uint32_t arg)
+	{
+		uint8_t frame[5] = {uint8_t(index | (1 << 6)), uint8_t(arg >> 24), uint8_t(arg >> 16), uint8_t(arg >> 8), uint8_t(arg)};
+		_spi.Write(frame, sizeof(frame));
+		_spi.Write(ComputeCrc<SdCrc7>(frame, sizeof(frame)) | 1);
+		// skip stuff byte following stop command
+		if(index == STOP_TRANSMISSION)
+			_spi.Read();
+		return _spi.IgnoreWhile(1000, 0xff);
+	}
+
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	uint16_t SdCard<SpiModule_, CsPin, BlockTransfer>::SpiCommand(uint8_t index, uint32_t arg)
 	{
 		CsPin::Clear();
-		Spi::Read();
-		Spi::Write(index | (1 << 6));
-		Spi::WriteU32Be(arg);
-		Spi::Write(crc | 1);
-		uint16_t responce = Spi::IgnoreWhile(1000, 0xff);
+		_spi.Read();
+		uint16_t responce = Command(index, arg);
 		if(index == SEND_STATUS && responce !=0xff)
-			responce |= Spi::Read() << 8;
-		CsPin::Set();
-		Spi::Read();
+			responce |= _spi.Read() << 8;
+		Release();
 		return responce;
 	}
 
 
-	template<class SpiModule_, class CsPin> 
-	bool SdCard<SpiModule_, CsPin>::CheckStatus()
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::EnableCrc(bool enable)
+	{
+		if(SpiCommand(CRC_ON_OFF, enable ? 1 : 0) != 0)
+			return false;
+		_useCrc = enable;
+		return true;
+	}
+
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::CheckStatus()
 	{
 		 return SpiCommand(SEND_STATUS, 0) == 0;
 	}
 
-	template<class SpiModule_, class CsPin> 
-	SdCardType SdCard<SpiModule_, CsPin>::Detect()
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	SdCardType SdCard<SpiModule_, CsPin, BlockTransfer>::Detect()
 	{
 		_type = SdCardNone;
 
 		CsPin::SetDirWrite();
 		CsPin::Set();
-		Spi::Init(Spi::Fastest, Spi::Master | Spi::MsbFirst);
+		_spi.Init(Spi::Fastest);
 
 		for(uint8_t i=0; i<20; i++)
-			Spi::Read();
+			_spi.Read();
 
-		if(SpiCommand(GO_IDLE_STATE, 0, 0x95) > SdR1Idle) 
+		_useCrc = false;
+		if(SpiCommand(GO_IDLE_STATE, 0) > SdR1Idle) 
 			return _type;
 	
 		uint8_t resp;
 		uint16_t timeout = 50;
 
-		// test for SDCv2
-		if(SpiCommand(SEND_IF_COND, 0x1aa, 0x87) <= SdR1Idle)
+		// test for SDCv2, R7 tail is read within the same CS frame
+		CsPin::Clear();
+		_spi.Read();
+		resp = Command(SEND_IF_COND, 0x1aa);
+		uint32_t voltage = _spi.ReadU32Be();
+		Release();
+		if(resp <= SdR1Idle)
 		{
-			CsPin::Clear();
-			uint32_t voltage = Spi::ReadU32Le();
-			CsPin::Set();
-		
 			// voltage check
-			if((voltage & 0x00ffff00) == 0x00aa0100)
+			if((voltage & 0xfff) == 0x1aa)
 			{
 				do
 				{
 					resp = SpiCommand(SEND_OP_COND, 1ul << 30);
-					Util::delay_ms<50, F_CPU>();
+					if(resp != 0)
+						delay_ms<50, F_CPU>();
 				}while(resp != 0 && --timeout);
 
-				if(resp == 0 && !SpiCommand(READ_OCR, 0))
+				if(resp == 0)
 				{
 					CsPin::Clear();
-					uint32_t ocr = Spi::ReadU32Le();
-					CsPin::Set();
- 					_type = ocr & 0x40 ? SdhcCard : SdCardV2;
+					_spi.Read();
+					resp = Command(READ_OCR, 0);
+					uint32_t ocr = _spi.ReadU32Be();
+					Release();
+					if(resp == 0)
+ 						_type = ocr & (1ul << 30) ? SdhcCard : SdCardV2;
 				}
 			}
 		}
@@ -268,7 +472,7 @@ namespace Mcucpp
 				while(resp != 0 && --timeout)
 				{
 					resp = SpiCommand(SEND_OP_COND, 0);
-					Util::delay_ms<50, F_CPU>();
+					delay_ms<50, F_CPU>();
 				}
 
 				if(resp == 0)
@@ -279,21 +483,26 @@ namespace Mcucpp
 				do
 				{
 					resp = SpiCommand(SEND_OP_COND, 0);
-					Util::delay_ms<50, F_CPU>();
+					delay_ms<50, F_CPU>();
 				}while(resp != 0 && --timeout);
 
 				if(resp == SdR1Idle)
 					_type = SdCardMmc;
 			}
 		}
+		if(_type != SdCardNone)
+			EnableCrc(true);
 		return _type;
 	}
 
-	template<class SpiModule_, class CsPin> 
-	uint32_t SdCard<SpiModule_, CsPin>::ReadBlocksCount()
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	uint32_t SdCard<SpiModule_, CsPin, BlockTransfer>::ReadBlocksCount()
 	{
 		uint8_t csd[16];
-		if(!SpiCommand(SEND_CSD, 0) && ReadDataBlock(csd, 16))
+		uint8_t *ptr = csd;
+		bool result = Select() && Command(SEND_CSD, 0) == 0 && ReceiveDataBlock(ptr, 16);
+		Release();
+		if(result)
 		{
 			if(csd[0] & 0xC0) // SD v2
 			{
@@ -311,24 +520,80 @@ namespace Mcucpp
 		return 0;
 	}
 
-	template<class SpiModule_, class CsPin> 
-	uint32_t SdCard<SpiModule_, CsPin>::BlocksCount()
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	uint32_t SdCard<SpiModule_, CsPin, BlockTransfer>::BlocksCount()
 	{
 		// TODO: cache this value
 		return ReadBlocksCount();
 	}
 
-	template<class SpiModule_, class CsPin> 
-	size_t SdCard<SpiModule_, CsPin>::BlockSize()
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	size_t SdCard<SpiModule_, CsPin, BlockTransfer>::BlockSize()
 	{
-		return 512;
+		return BlockSizeValue;
 	}
 
-	template<class SpiModule_, class CsPin> 
-	bool SdCard<SpiModule_, CsPin>::WaitWhileBusy()
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::WaitWhileBusy()
 	{
-		CsPin::Clear();
-		return Spi::Ignore(10000u, 0xff) == 0xff;
+		for(unsigned i = 0; i < BusyTimeoutValue; i++)
+		{
+			if(_spi.Read() == 0xff)
+				return true;
+			// card may be busy for tens of milliseconds programming flash
+			if(_dispatcher && (i & 0x0f) == 0x0f)
+				_dispatcher->Poll();
+		}
+		return false;
+	}
+
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::BeginRead(uint32_t logicalBlockAddress)
+	{
+		if(Select() && Command(READ_MULTIPLE_BLOCK, BlockAddress(logicalBlockAddress)) == 0)
+			return true;
+		Release();
+		return false;
+	}
+
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::EndRead()
+	{
+		bool result = Command(STOP_TRANSMISSION, 0) == 0 && WaitWhileBusy();
+		Release();
+		return result;
+	}
+
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::BeginWrite(uint32_t logicalBlockAddress, uint32_t preErase)
+	{
+		if(!Select())
+		{
+			Release();
+			return false;
+		}
+		// ACMD23 is only a hint, card may ignore it.
+		// Sent after Select, card may still be programming previous write.
+		if(preErase > 1 && _type != SdCardMmc && Command(APP_CMD, 0) == 0)
+			Command(SET_WR_BLK_ERASE_COUNT, preErase & 0x7fffff);
+		if(Command(WRITE_MULTIPLE_BLOCK, BlockAddress(logicalBlockAddress)) == 0)
+			return true;
+		Release();
+		return false;
+	}
+
+	template<class SpiModule_, class CsPin, class BlockTransfer> 
+	bool SdCard<SpiModule_, CsPin, BlockTransfer>::EndWrite()
+	{
+		bool result = WaitWhileBusy();
+		if(result)
+		{
+			_spi.Write(StopTranToken);
+			_spi.Read();
+			result = WaitWhileBusy();
+		}
+		Release();
+		return result;
 	}
 
 } // namespace Mcucpp
@@ -1,39 +1,75 @@
-#include <static_assert.h>#include <binary_stream.h>
-#include <iostream>
-#include <iomanip>
-namespace Mcucpp{	namespace Fat	{
-        static const uint16_t BootSignatureOff = 510;
-        static const uint16_t BootSignatureVal = 0xaa55;
-
-        enum FileAttributes
-        {
-            ATTR_READ_ONLY    = 0x01,
-            ATTR_HIDDEN       = 0x02,
-            ATTR_SYSTEM       = 0x04,
-            ATTR_VOLUME_ID    = 0x08,
-            ATTR_DIRECTORY    = 0x10,
-            ATTR_ARCHIVE      = 0x20,
-            ATTR_LONG_NAME    = 0x0f
-        };        enum
-        {
-            DIR_ENTRY_SIZE    = 0x32,            EMPTY             = 0x00,            DELETED           = 0xe5
-        };
-        enum FatType
-        {
-            None = 0,
-            Fat12,
-            Fat16,
-            Fat32
-        };
+#pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <utf8.h>
+#include <filesystem/filesystem.h>
+#include <filesystem/sector_cache.h>
+
+namespace Mcucpp
+{
+	namespace Fat
+	{
+		static const uint16_t BootSignatureOff = 510;
+		static const uint16_t BootSignatureVal = 0xaa55;
+
+		enum FileAttributes
+		{
+			ATTR_READ_ONLY    = 0x01,
+			ATTR_HIDDEN       = 0x02,
+			ATTR_SYSTEM       = 0x04,
+			ATTR_VOLUME_ID    = 0x08,
+			ATTR_DIRECTORY    = 0x10,
+			ATTR_ARCHIVE      = 0x20,
+			ATTR_LONG_NAME    = 0x0f
+		};
+
+		enum
+		{
+			DIR_ENTRY_SIZE    = 32,
+			EMPTY             = 0x00,
+			DELETED           = 0xe5
+		};
+
+		enum FatType
+		{
+			None = 0,
+			Fat12,
+			Fat16,
+			Fat32
+		};
+
+		// FAT entries are normalized to FAT32 values
+		enum ClusterValues
+		{
+			FreeCluster = 0,
+			BadCluster = 0x0ffffff7,
+			EndOfChain = 0x0fffffff
+		};
+
+		// Position of 32 byte entry in directory
+		struct DirEntryLocation
+		{
+			uint32_t sector;
+			uint16_t index;
+		};
+
+		// Sector numbers are absolute device sectors
 		struct FatInfo
 		{
 			uint8_t  sectorPerCluster;
 			uint8_t  numberofFATs;
-			uint16_t bytesPerSector;			uint16_t reservedSectorCount;			uint16_t rootEntCnt;
+			uint16_t bytesPerSector;
+			uint16_t reservedSectorCount;
+			uint16_t rootEntCnt;
 			uint16_t rootDirSectors;
-			uint32_t totalSectors;			uint32_t hiddenSectors;			uint32_t FATsize;
+			uint32_t totalSectors;
+			uint32_t hiddenSectors;
+			uint32_t FATsize;
 			uint32_t firstSector;
+			uint32_t firstFatSector;
+			uint32_t rootDirSector;
 			uint32_t rootCluster;
 			uint32_t countofClusters;
 			uint32_t firstDataSector;
@@ -41,137 +77,1480 @@
 			FatType type;
 		};
 
+		inline uint16_t ReadU16Le(const uint8_t *p)
+		{
+			return uint16_t(p[0] | (p[1] << 8));
+		}
+
+		inline uint32_t ReadU32Le(const uint8_t *p)
+		{
+			return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+
+		// FAT12/16/32 volume on top of sector cache.
+		// Nodes are absolute sector numbers: directory nodes and file nodes refer
+		// to the first sector of the first cluster, FAT12/16 root directory to its fixed region.
+		// FAT sectors are pinned in cache so chain walking seldom touches the device.
 		template<class Dev>
-		class FatFs
+		class FatFs :public Fs::IFsDriver
 		{
-			static FatInfo _fat;
-			static uint32_t ClasterToSector(uint32_t cluster)
+		public:
+			typedef Fs::SectorCache<Dev> Cache;
+			enum{MaxLongName = 255};
+		private:
+			Cache &_cache;
+			FatInfo _fat;
+			uint8_t *_bitmap;
+			uint32_t _bitmapClusters;
+			bool _bitmapValid;
+			uint32_t _nextFree;
+			// FAT sectors modified since the last Sync, FAT copies are refreshed from them
+			enum{MaxDirtyFatSectors = 8};
+			uint32_t _fatDirty[MaxDirtyFatSectors];
+			unsigned _fatDirtyCount;
+
+			bool ParseBootSector(const uint8_t *boot, uint32_t firstSector);
+			bool ReadShortName(const uint8_t *entry, uint8_t *name);
+
+			bool IsFree(uint32_t cluster);
+			void BuildBitmap();
+			bool FatSectorModified(uint32_t sector);
+			bool MirrorFat();
+			uint32_t FindFreeRun(uint32_t start, uint32_t count, uint32_t &length);
+			bool NextEntry(DirEntryLocation &location);
+			bool FindFreeEntries(Fs::FsNode dir, unsigned count, DirEntryLocation &location);
+			bool ShortNameExists(Fs::FsNode dir, const uint8_t *shortName);
+			bool NameExists(Fs::FsNode dir, const uint8_t *name);
+			bool MakeShortName(const uint8_t *name, uint8_t *shortName);
+			bool ZeroCluster(uint32_t cluster);
+		public:
+			FatFs(Cache &cache)
+				:_cache(cache),
+				_bitmap(0),
+				_bitmapClusters(0),
+				_bitmapValid(false),
+				_nextFree(2),
+				_fatDirtyCount(0)
+			{
+				memset(&_fat, 0, sizeof(_fat));
+			}
+
+			// Free cluster bitmap, one bit per cluster. It is built from FAT on first allocation.
+			// Clusters not covered by the bitmap are looked up in FAT.
+			void SetFreeBitmap(uint8_t *bitmap, uint32_t bytes)
+			{
+				_bitmap = bitmap;
+				_bitmapClusters = bytes * 8;
+				_bitmapValid = false;
+			}
+
+			bool Mount();
+
+			const FatInfo &Info() const { return _fat; }
+			Cache &GetCache(){ return _cache; }
+			uint32_t ClusterSize() const { return (uint32_t)_fat.sectorPerCluster * _fat.bytesPerSector; }
+
+			bool IsValidCluster(uint32_t cluster) const
+			{
+				return cluster >= 2 && cluster < _fat.countofClusters + 2;
+			}
+
+			uint32_t ClusterToSector(uint32_t cluster) const
 			{
 				return (((cluster - 2) * _fat.sectorPerCluster) + _fat.firstDataSector);
 			}
 
-			static uint32_t FatSector(uint32_t cluster, unsigned fatNumber)
+			// 0 for sectors out of data region
+			uint32_t SectorToCluster(uint32_t sector) const
+			{
+				if(sector < _fat.firstDataSector)
+					return 0;
+				return (sector - _fat.firstDataSector) / _fat.sectorPerCluster + 2;
+			}
+
+			// Sector of given FAT copy holding entry of the cluster and entry offset within it
+			uint32_t FatSector(uint32_t cluster, unsigned fatNumber, unsigned &offset) const
+			{
+				uint32_t byteOffset;
+				if(_fat.type == Fat12)
+					byteOffset = cluster + cluster / 2;
+				else if(_fat.type == Fat16)
+					byteOffset = cluster * 2;
+				else
+					byteOffset = cluster * 4;
+				offset = byteOffset % _fat.bytesPerSector;
+				return _fat.firstFatSector + fatNumber * _fat.FATsize + byteOffset / _fat.bytesPerSector;
+			}
+
+			// Next cluster in chain, EndOfChain, FreeCluster or BadCluster
+			uint32_t FatEntry(uint32_t cluster);
+			// Number of consecutive clusters in chain starting from given one, up to maxLength
+			uint32_t ContiguousRun(uint32_t cluster, uint32_t maxLength);
+
+			// FAT updates stay in cache until Sync, FAT copies are updated on Sync too,
+			// or earlier when many FAT sectors are modified
+			bool SetFatEntry(uint32_t cluster, uint32_t value);
+			// Allocates up to 'count' clusters preferring contiguous free space.
+			// New clusters are linked after 'last' if it is valid cluster. On return 'first'
+			// and 'last' hold the first and the last new clusters. Returns number of allocated clusters.
+			uint32_t AllocateClusters(uint32_t count, uint32_t &first, uint32_t &last);
+			bool FreeChain(uint32_t cluster);
+			uint32_t FreeClusters();
+
+			// Creates directory entry with long name if needed, name is UTF-8
+			bool CreateEntry(Fs::FsNode parentDir, const uint8_t *name, uint8_t attributes, uint32_t firstCluster, DirEntryLocation &location);
+			bool UpdateEntry(const DirEntryLocation &location, uint32_t firstCluster, uint32_t size);
+			// Writes modified metadata and data sectors to device
+			virtual bool Sync();
+
+			virtual Fs::FsNode RootDirectory();
+			virtual bool ListDirectory(Fs::FsNode dir, Fs::DirectoryLister &directoryLister);
+			virtual uint32_t GetParameter(Fs::FsParams param);
+			virtual Fs::FsNode NextBlock(Fs::FsNode node);
+			virtual Fs::FsNode AllocBlock(Fs::FsNode parentNode);
+			virtual Fs::FsNode CreateNode(Fs::FsNode parentDir, Fs::DirectoryEntryType type, uint8_t *nodeName);
+			virtual bool ReadBlock(Fs::FsNode node, uint8_t *buffer);
+			virtual bool WriteBlock(Fs::FsNode node, const uint8_t *buffer);
+			virtual bool ReadBlocks(Fs::FsNode &node, uint8_t *const *buffers, unsigned count);
+			virtual bool WriteBlocks(Fs::FsNode &node, const uint8_t *const *buffers, unsigned count);
+		};
+
+		template<class Dev>
+		bool FatFs<Dev>::Mount()
+		{
+			_cache.Clear();
+			memset(&_fat, 0, sizeof(_fat));
+			_bitmapValid = false;
+			_nextFree = 2;
+			_fatDirtyCount = 0;
+			const uint8_t *sector = _cache.Read(0);
+			if(!sector || ReadU16Le(sector + BootSignatureOff) != BootSignatureVal)
+				return false;
+
+			uint32_t firstSector = 0;
+			if(sector[0] != 0xE9 && sector[0] != 0xEB) // MBR?
+			{
+				firstSector = ReadU32Le(sector + 446 + 8);
+				sector = _cache.Read(firstSector);
+				if(!sector || ReadU16Le(sector + BootSignatureOff) != BootSignatureVal)
+					return false;
+				if(sector[0] != 0xE9 && sector[0] != 0xEB)
+					return false;
+			}
+			if(!ParseBootSector(sector, firstSector))
+				return false;
+			_cache.SetPinnedRange(_fat.firstFatSector, _fat.FATsize);
+			return true;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::ParseBootSector(const uint8_t *boot, uint32_t firstSector)
+		{
+			_fat.firstSector = firstSector;
+			_fat.bytesPerSector = ReadU16Le(boot + 11);
+			_fat.sectorPerCluster = boot[13];
+			_fat.reservedSectorCount = ReadU16Le(boot + 14);
+			_fat.numberofFATs = boot[16];
+			_fat.rootEntCnt = ReadU16Le(boot + 17);
+			_fat.totalSectors = ReadU16Le(boot + 19);
+			_fat.FATsize = ReadU16Le(boot + 22);
+			_fat.hiddenSectors = ReadU32Le(boot + 28);
+
+			if(_fat.totalSectors == 0)
+				_fat.totalSectors = ReadU32Le(boot + 32);
+
+			if(_fat.FATsize == 0)
+			{
+				_fat.FATsize = ReadU32Le(boot + 36);
+				_fat.rootCluster = ReadU32Le(boot + 44);
+			}
+
+			// only sectors matching the cache are supported
+			if(_fat.bytesPerSector != Fs::SectorSize || _fat.sectorPerCluster == 0 || _fat.numberofFATs == 0)
+				return false;
+
+			_fat.rootDirSectors = (_fat.rootEntCnt * DIR_ENTRY_SIZE + _fat.bytesPerSector - 1) / _fat.bytesPerSector;
+			_fat.firstFatSector = firstSector + _fat.reservedSectorCount;
+			_fat.rootDirSector = _fat.firstFatSector + _fat.FATsize * _fat.numberofFATs;
+			_fat.firstDataSector = _fat.rootDirSector + _fat.rootDirSectors;
+
+			uint32_t metadataSectors = _fat.reservedSectorCount + _fat.FATsize * _fat.numberofFATs + _fat.rootDirSectors;
+			if(_fat.totalSectors <= metadataSectors)
+				return false;
+			_fat.dataSectors = _fat.totalSectors - metadataSectors;
+			_fat.countofClusters = _fat.dataSectors / _fat.sectorPerCluster;
+
+			if(_fat.countofClusters < 4085)
+			{
+				_fat.type = Fat12;
+			} else if(_fat.countofClusters < 65525)
+			{
+				_fat.type = Fat16;
+			} else
+			{
+				_fat.type = Fat32;
+			}
+
+			if(_fat.type == Fat32 ? !IsValidCluster(_fat.rootCluster) : _fat.rootDirSectors == 0)
+			{
+				_fat.type = None;
+				return false;
+			}
+			return true;
+		}
+
+		template<class Dev>
+		uint32_t FatFs<Dev>::FatEntry(uint32_t cluster)
+		{
+			if(!IsValidCluster(cluster))
+				return BadCluster;
+			unsigned offset;
+			uint32_t sectorNum = FatSector(cluster, 0, offset);
+			const uint8_t *sector = _cache.Read(sectorNum);
+			if(!sector)
+				return BadCluster;
+
+			uint32_t value;
+			if(_fat.type == Fat12)
+			{
+				value = sector[offset];
+				// entry may straddle sector boundary
+				if(offset + 1 == _fat.bytesPerSector)
+				{
+					sector = _cache.Read(sectorNum + 1);
+					if(!sector)
+						return BadCluster;
+					value |= sector[0] << 8;
+				}
+				else
+					value |= sector[offset + 1] << 8;
+				value = cluster & 1 ? value >> 4 : value & 0xfff;
+				if(value >= 0xff7)
+					value |= 0x0ffff000;
+			}
+			else if(_fat.type == Fat16)
+			{
+				value = ReadU16Le(sector + offset);
+				if(value >= 0xfff7)
+					value |= 0x0fff0000;
+			}
+			else
+			{
+				value = ReadU32Le(sector + offset) & 0x0fffffff;
+			}
+
+			if(value >= 0x0ffffff8)
+				return EndOfChain;
+			return value;
+		}
+
+		template<class Dev>
+		uint32_t FatFs<Dev>::ContiguousRun(uint32_t cluster, uint32_t maxLength)
+		{
+			uint32_t length = 1;
+			while(length < maxLength && FatEntry(cluster) == cluster + 1)
+			{
+				cluster++;
+				length++;
+			}
+			return length;
+		}
+
+		template<class Dev>
+		Fs::FsNode FatFs<Dev>::RootDirectory()
+		{
+			if(_fat.type == Fat32)
+				return ClusterToSector(_fat.rootCluster);
+			return _fat.rootDirSector;
+		}
+
+		template<class Dev>
+		Fs::FsNode FatFs<Dev>::NextBlock(Fs::FsNode node)
+		{
+			uint32_t sector = (uint32_t)node;
+			if(_fat.type == None || node == Fs::EndOfFileNode)
+				return Fs::EndOfFileNode;
+			if(sector < _fat.firstDataSector)
+			{
+				if(sector >= _fat.rootDirSector && sector + 1 < _fat.firstDataSector)
+					return sector + 1;
+				return Fs::EndOfFileNode;
+			}
+			if((sector + 1 - _fat.firstDataSector) % _fat.sectorPerCluster != 0)
+				return sector + 1;
+			uint32_t next = FatEntry(SectorToCluster(sector));
+			if(!IsValidCluster(next))
+				return Fs::EndOfFileNode;
+			return ClusterToSector(next);
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::ReadShortName(const uint8_t *entry, uint8_t *name)
+		{
+			// NT lower case flags
+			uint8_t baseCase = entry[12] & 0x08 ? 'a' - 'A' : 0;
+			uint8_t extCase = entry[12] & 0x10 ? 'a' - 'A' : 0;
+			unsigned len = 0;
+			for(unsigned i = 0; i < 8 && entry[i] != ' '; i++)
+			{
+				uint8_t c = i == 0 && entry[i] == 0x05 ? uint8_t(DELETED) : entry[i];
+				name[len++] = c >= 'A' && c <= 'Z' ? uint8_t(c + baseCase) : c;
+			}
+			if(entry[8] != ' ')
+			{
+				name[len++] = '.';
+				for(unsigned i = 8; i < 11 && entry[i] != ' '; i++)
+				{
+					uint8_t c = entry[i];
+					name[len++] = c >= 'A' && c <= 'Z' ? uint8_t(c + extCase) : c;
+				}
+			}
+			name[len] = 0;
+			return len > 0;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::ListDirectory(Fs::FsNode dir, Fs::DirectoryLister &directoryLister)
+		{
+			static const uint8_t longNameChars[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+			if(_fat.type == None)
+				return false;
+
+			uint16_t longName[MaxLongName + 1];
+			uint8_t name[Fs::MaxPath + 1];
+			unsigned longNameSequence = 0;
+			uint8_t longNameChecksum = 0;
+
+			for(Fs::FsNode node = dir; node != Fs::EndOfFileNode; node = NextBlock(node))
+			{
+				for(unsigned i = 0; i < _fat.bytesPerSector / DIR_ENTRY_SIZE; i++)
+				{
+					// lister may use the cache, so sector is looked up for each entry
+					const uint8_t *sector = _cache.Read((uint32_t)node);
+					if(!sector)
+						return false;
+					const uint8_t *entry = sector + i * DIR_ENTRY_SIZE;
+
+					if(entry[0] == EMPTY)
+						return true;
+					if(entry[0] == DELETED)
+					{
+						longNameSequence = 0;
+						continue;
+					}
+
+					uint8_t attributes = entry[11];
+					if((attributes & 0x3f) == ATTR_LONG_NAME)
+					{
+						unsigned sequence = entry[0] & 0x1f;
+						if(entry[0] & 0x40)
+						{
+							longName[sequence * 13 > MaxLongName ? unsigned(MaxLongName) : sequence * 13] = 0;
+							longNameChecksum = entry[13];
+						}
+						else if(sequence + 1 != longNameSequence || entry[13] != longNameChecksum)
+						{
+							longNameSequence = 0;
+							continue;
+						}
+						if(sequence == 0)
+						{
+							longNameSequence = 0;
+							continue;
+						}
+						for(unsigned c = 0; c < 13; c++)
+						{
+							unsigned pos = (sequence - 1) * 13 + c;
+							if(pos < MaxLongName)
+								longName[pos] = ReadU16Le(entry + longNameChars[c]);
+						}
+						longNameSequence = sequence;
+						continue;
+					}
+
+					if(attributes & ATTR_VOLUME_ID)
+					{
+						longNameSequence = 0;
+						continue;
+					}
+
+					uint8_t checksum = 0;
+					for(unsigned c = 0; c < 11; c++)
+						checksum = uint8_t(((checksum & 1) << 7) + (checksum >> 1) + entry[c]);
+
+					if(longNameSequence == 1 && checksum == longNameChecksum)
+					{
+						uint8_t *out = name;
+						for(unsigned c = 0; c < MaxLongName && longName[c] != 0 && longName[c] != 0xffff; c++)
+						{
+							// keep room for the longest UTF-8 sequence
+							if(out + 3 > name + Fs::MaxPath)
+								break;
+							Utf8Encoding<uint16_t>::Encode(out, longName[c]);
+						}
+						*out = 0;
+					}
+					else
+						ReadShortName(entry, name);
+					longNameSequence = 0;
+
+					uint32_t cluster = ReadU16Le(entry + 26) | ((uint32_t)ReadU16Le(entry + 20) << 16);
+					if(_fat.type != Fat32)
+						cluster &= 0xffff;
+					uint32_t size = ReadU32Le(entry + 28);
+					Fs::DirectoryEntryType type = (attributes & ATTR_DIRECTORY) ? Fs::DirectoryEntry : Fs::FileEntry;
+					Fs::FsNode entryNode;
+					if(IsValidCluster(cluster))
+						entryNode = ClusterToSector(cluster);
+					else if(type == Fs::DirectoryEntry && cluster == 0)
+						entryNode = RootDirectory(); // '..' of first level directory
+					else
+						entryNode = Fs::EndOfFileNode;
+
+					if(!directoryLister.DirectoryEntry(name, type, Fs::FileAttributes(attributes), entryNode, size))
+						return true;
+				}
+			}
+			return true;
+		}
+
+		template<class Dev>
+		uint32_t FatFs<Dev>::GetParameter(Fs::FsParams param)
+		{
+			switch(param)
+			{
+			case Fs::BlockSize:
+				return _fat.bytesPerSector;
+			case Fs::TotalBlocks:
+				return _fat.countofClusters * _fat.sectorPerCluster;
+			case Fs::UsedBlocks:
+				return (_fat.countofClusters - FreeClusters()) * _fat.sectorPerCluster;
+			}
+			return 0;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::ReadBlock(Fs::FsNode node, uint8_t *buffer)
+		{
+			if(node == Fs::EndOfFileNode)
+				return false;
+			const uint8_t *sector = _cache.Read((uint32_t)node);
+			if(!sector)
+				return false;
+			memcpy(buffer, sector, _fat.bytesPerSector);
+			return true;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::SetFatEntry(uint32_t cluster, uint32_t value)
+		{
+			if(!IsValidCluster(cluster))
+				return false;
+			unsigned offset;
+			uint32_t sectorNum = FatSector(cluster, 0, offset);
+			// cache pointers are not valid after FatSectorModified
+			if(!FatSectorModified(sectorNum))
+				return false;
+			uint8_t *sector = _cache.Modify(sectorNum);
+			if(!sector)
+				return false;
+
+			if(_fat.type == Fat12)
+			{
+				value &= 0xfff;
+				uint8_t low = sector[offset];
+				low = cluster & 1 ? uint8_t((low & 0x0f) | (value << 4)) : uint8_t(value);
+				sector[offset] = low;
+				uint8_t *high;
+				if(offset + 1 == _fat.bytesPerSector)
+				{
+					if(!FatSectorModified(sectorNum + 1))
+						return false;
+					high = _cache.Modify(sectorNum + 1);
+					if(!high)
+						return false;
+				}
+				else
+					high = sector + offset + 1;
+				*high = cluster & 1 ? uint8_t(value >> 4) : uint8_t((*high & 0xf0) | (value >> 8));
+			}
+			else if(_fat.type == Fat16)
+			{
+				sector[offset] = uint8_t(value);
+				sector[offset + 1] = uint8_t(value >> 8);
+			}
+			else
+			{
+				// upper 4 bits are reserved
+				value = (value & 0x0fffffff) | (ReadU32Le(sector + offset) & 0xf0000000);
+				sector[offset] = uint8_t(value);
+				sector[offset + 1] = uint8_t(value >> 8);
+				sector[offset + 2] = uint8_t(value >> 16);
+				sector[offset + 3] = uint8_t(value >> 24);
+			}
+
+			if(_bitmapValid && cluster - 2 < _bitmapClusters)
 			{
-                if(_fat.type == Fat12)
-                {
+				uint32_t bit = cluster - 2;
+				if(value == FreeCluster)
+					_bitmap[bit / 8] &= ~(1 << bit % 8);
+				else
+					_bitmap[bit / 8] |= 1 << bit % 8;
+			}
+			return true;
+		}
 
-                } else if(_fat.type == Fat16)
-                {
-                    cluster *= 2;
-                }else
-                {
-                    cluster *= 4;
-                }
-                return 0;
+		template<class Dev>
+		bool FatFs<Dev>::FatSectorModified(uint32_t sector)
+		{
+			if(_fat.numberofFATs < 2)
+				return true;
+			for(unsigned i = 0; i < _fatDirtyCount; i++)
+			{
+				if(_fatDirty[i] == sector)
+					return true;
 			}
+			// copies are refreshed ahead of Sync when too many sectors are modified
+			if(_fatDirtyCount == MaxDirtyFatSectors && !MirrorFat())
+				return false;
+			_fatDirty[_fatDirtyCount++] = sector;
+			return true;
+		}
+
+		// Copies modified sectors of the first FAT to other ones,
+		// sectors failed to copy are kept for the next try.
+		template<class Dev>
+		bool FatFs<Dev>::MirrorFat()
+		{
+			uint8_t buffer[Fs::SectorSize];
+			while(_fatDirtyCount > 0)
+			{
+				uint32_t sector = _fatDirty[_fatDirtyCount - 1];
+				const uint8_t *src = _cache.Read(sector);
+				if(!src)
+					return false;
+				memcpy(buffer, src, Fs::SectorSize);
+				for(unsigned copy = 1; copy < _fat.numberofFATs; copy++)
+				{
+					uint8_t *dst = _cache.Overwrite(sector + copy * _fat.FATsize);
+					if(!dst)
+						return false;
+					memcpy(dst, buffer, Fs::SectorSize);
+				}
+				_fatDirtyCount--;
+			}
+			return true;
+		}
+
+		template<class Dev>
+		void FatFs<Dev>::BuildBitmap()
+		{
+			if(!_bitmap)
+				return;
+			uint32_t clusters = _fat.countofClusters < _bitmapClusters ? _fat.countofClusters : _bitmapClusters;
+			memset(_bitmap, 0, (_bitmapClusters + 7) / 8);
+			for(uint32_t bit = 0; bit < clusters; bit++)
+			{
+				if(FatEntry(bit + 2) != FreeCluster)
+					_bitmap[bit / 8] |= 1 << bit % 8;
+			}
+			_bitmapValid = true;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::IsFree(uint32_t cluster)
+		{
+			uint32_t bit = cluster - 2;
+			if(_bitmapValid && bit < _bitmapClusters)
+				return (_bitmap[bit / 8] & (1 << bit % 8)) == 0;
+			return FatEntry(cluster) == FreeCluster;
+		}
+
+		template<class Dev>
+		uint32_t FatFs<Dev>::FreeClusters()
+		{
+			if(!_bitmapValid)
+				BuildBitmap();
+			uint32_t freeClusters = 0;
+			for(uint32_t cluster = 2; cluster < _fat.countofClusters + 2; cluster++)
+			{
+				if(IsFree(cluster))
+					freeClusters++;
+			}
+			return freeClusters;
+		}
+
+		// Returns start of the first free run of 'count' clusters found from 'start',
+		// or of the longest one if there is no such run.
+		template<class Dev>
+		uint32_t FatFs<Dev>::FindFreeRun(uint32_t start, uint32_t count, uint32_t &length)
+		{
+			uint32_t bestStart = 0, runStart = 0, runLength = 0;
+			length = 0;
+			for(uint32_t i = 0; i < _fat.countofClusters; i++)
+			{
+				uint32_t cluster = start + i;
+				if(cluster >= _fat.countofClusters + 2)
+					cluster -= _fat.countofClusters;
+				// runs do not wrap around the end of volume
+				if(cluster == 2)
+					runLength = 0;
+				if(!IsFree(cluster))
+				{
+					runLength = 0;
+					continue;
+				}
+				if(runLength++ == 0)
+					runStart = cluster;
+				if(runLength > length)
+				{
+					bestStart = runStart;
+					length = runLength;
+					if(length == count)
+						break;
+				}
+			}
+			return bestStart;
+		}
+
+		template<class Dev>
+		uint32_t FatFs<Dev>::AllocateClusters(uint32_t count, uint32_t &first, uint32_t &last)
+		{
+			if(_fat.type == None)
+				return 0;
+			if(!_bitmapValid)
+				BuildBitmap();
+			uint32_t prev = IsValidCluster(last) ? last : 0;
+			uint32_t allocated = 0;
+			first = 0;
+			while(allocated < count)
+			{
+				uint32_t length;
+				uint32_t run = FindFreeRun(prev ? prev + 1 : _nextFree, count - allocated, length);
+				if(length == 0)
+					break;
+				if(length > count - allocated)
+					length = count - allocated;
+				for(uint32_t cluster = run; cluster < run + length; cluster++)
+				{
+					if(!SetFatEntry(cluster, EndOfChain) || (prev && !SetFatEntry(prev, cluster)))
+						return allocated;
+					if(!first)
+						first = cluster;
+					last = prev = cluster;
+					allocated++;
+				}
+				_nextFree = run + length;
+				if(_nextFree >= _fat.countofClusters + 2)
+					_nextFree = 2;
+			}
+			return allocated;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::FreeChain(uint32_t cluster)
+		{
+			while(IsValidCluster(cluster))
+			{
+				uint32_t next = FatEntry(cluster);
+				if(!SetFatEntry(cluster, FreeCluster))
+					return false;
+				if(cluster < _nextFree)
+					_nextFree = cluster;
+				cluster = next;
+			}
+			return true;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::Sync()
+		{
+			bool result = MirrorFat();
+			return _cache.Flush() && result;
+		}
 
+		template<class Dev>
+		bool FatFs<Dev>::NextEntry(DirEntryLocation &location)
+		{
+			if(++location.index < _fat.bytesPerSector / DIR_ENTRY_SIZE)
+				return true;
+			Fs::FsNode next = NextBlock(location.sector);
+			if(next == Fs::EndOfFileNode)
+				return false;
+			location.sector = (uint32_t)next;
+			location.index = 0;
+			return true;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::ZeroCluster(uint32_t cluster)
+		{
+			uint32_t sector = ClusterToSector(cluster);
+			for(unsigned i = 0; i < _fat.sectorPerCluster; i++)
+			{
+				uint8_t *data = _cache.Overwrite(sector + i);
+				if(!data)
+					return false;
+				memset(data, 0, _fat.bytesPerSector);
+			}
+			return true;
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::FindFreeEntries(Fs::FsNode dir, unsigned count, DirEntryLocation &location)
+		{
+			DirEntryLocation current = {(uint32_t)dir, 0};
+			unsigned found = 0;
+			for(;;)
+			{
+				const uint8_t *sector = _cache.Read(current.sector);
+				if(!sector)
+					return false;
+				uint8_t mark = sector[current.index * DIR_ENTRY_SIZE];
+				if(mark == EMPTY || mark == DELETED)
+				{
+					if(found++ == 0)
+						location = current;
+					if(found == count)
+						return true;
+				}
+				else
+					found = 0;
+
+				uint32_t lastSector = current.sector;
+				if(NextEntry(current))
+					continue;
+				// FAT12/16 root directory can not grow
+				uint32_t last = SectorToCluster(lastSector);
+				if(!last)
+					return false;
+				uint32_t first;
+				if(AllocateClusters(1, first, last) != 1 || !ZeroCluster(first))
+					return false;
+				current.sector = ClusterToSector(first);
+				current.index = 0;
+			}
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::ShortNameExists(Fs::FsNode dir, const uint8_t *shortName)
+		{
+			DirEntryLocation current = {(uint32_t)dir, 0};
+			do
+			{
+				const uint8_t *sector = _cache.Read(current.sector);
+				if(!sector)
+					return true;
+				const uint8_t *entry = sector + current.index * DIR_ENTRY_SIZE;
+				if(entry[0] == EMPTY)
+					return false;
+				if(entry[0] != DELETED && (entry[11] & 0x3f) != ATTR_LONG_NAME && memcmp(entry, shortName, 11) == 0)
+					return true;
+			}while(NextEntry(current));
+			return false;
+		}
+
+		// Case insensitive for ASCII letters like FAT itself
+		class NameMatchLister :public Fs::DirectoryLister
+		{
+			const uint8_t *_name;
+			bool _found;
 		public:
-		typedef BinaryStream<Dev> Stream;
-			static bool Mount();
-			static void StartReadingDir();
-			static bool NextDirEntry();
+			NameMatchLister(const uint8_t *name)
+				:_name(name), _found(false)
+			{}
+
+			static uint8_t ToUpper(uint8_t c)
+			{
+				return c >= 'a' && c <= 'z' ? uint8_t(c - 'a' + 'A') : c;
+			}
+
+			virtual bool DirectoryEntry(const uint8_t *name, Fs::DirectoryEntryType, Fs::FileAttributes, Fs::FsNode, uint32_t)
+			{
+				const uint8_t *ptr = _name;
+				while(*ptr && ToUpper(*ptr) == ToUpper(*name))
+				{
+					ptr++;
+					name++;
+				}
+				_found = *ptr == 0 && *name == 0;
+				return !_found;
+			}
+
+			bool Found() const { return _found; }
 		};
 
 		template<class Dev>
-		FatInfo FatFs<Dev>::_fat;
+		bool FatFs<Dev>::NameExists(Fs::FsNode dir, const uint8_t *name)
+		{
+			NameMatchLister lister(name);
+			return !ListDirectory(dir, lister) || lister.Found();
+		}
 
+		// Returns true if the name can not be stored as short name and long name entries are needed
 		template<class Dev>
-		void FatFs<Dev>::StartReadingDir()
+		bool FatFs<Dev>::MakeShortName(const uint8_t *name, uint8_t *shortName)
 		{
-            if(_fat.type != Fat32)
-            {
-                for(int c = 0; c < 1 /*_fat.rootDirSectors*/; c++)
-                {
-                    Stream::StartRead(_fat.rootCluster + c);
-                    for(int i = 0 ; i < 512 / DIR_ENTRY_SIZE; i++)
-                    {
-                        char name[12];
-                        Stream::Read(name, 11);
-                        name[11] = 0;
-                        uint8_t attr = Stream::Read();
-                        Stream::Ignore(16);
-                        uint32_t size = Stream::ReadU32Le();
-                        std::cout << std::left << std::setw(16) << name << "\t" << std::hex << (unsigned)attr << "\t" << std::dec << size << std::endl;
-                    }
-                    Stream::EndRead();
-                }
-            }
+			static const char invalidChars[] = "\"*+,/:;<=>?[\\]|";
+			memset(shortName, ' ', 11);
+			const uint8_t *ext = 0;
+			for(const uint8_t *ptr = name; *ptr; ptr++)
+			{
+				if(*ptr == '.')
+					ext = ptr;
+			}
+			bool lossy = ext == name;
+			unsigned len = 0;
+			const uint8_t *ptr = name;
+			for(unsigned part = 0; part < 2; part++)
+			{
+				unsigned maxLen = part == 0 ? 8 : 3;
+				uint8_t *out = shortName + (part == 0 ? 0 : 8);
+				const uint8_t *end = part == 0 && ext ? ext : 0;
+				for(len = 0; *ptr && ptr != end; ptr++)
+				{
+					uint8_t c = *ptr;
+					if(c == ' ' || (c == '.' && part == 0))
+					{
+						lossy = true;
+						continue;
+					}
+					if(c >= 'a' && c <= 'z')
+					{
+						c = uint8_t(c - 'a' + 'A');
+						lossy = true;
+					}
+					else if(c >= 0x80 || c < 0x20 || strchr(invalidChars, c))
+					{
+						c = '_';
+						lossy = true;
+					}
+					if(len < maxLen)
+						out[len++] = c;
+					else
+						lossy = true;
+				}
+				if(!ext)
+					break;
+				ptr = ext + 1;
+			}
+			if(shortName[0] == DELETED)
+				shortName[0] = 0x05;
+			return lossy || shortName[0] == ' ';
 		}
 
-		template<class Dev>		bool FatFs<Dev>::Mount()
+		template<class Dev>
+		bool FatFs<Dev>::CreateEntry(Fs::FsNode parentDir, const uint8_t *name, uint8_t attributes, uint32_t firstCluster, DirEntryLocation &location)
 		{
-			if(!Dev::Activate())
+			static const uint8_t longNameChars[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+			if(_fat.type == None || !name || !*name || NameExists(parentDir, name))
 				return false;
 
-			Stream::StartRead(0);
-			uint8_t c = Stream::Read();
-			if(c != 0xE9 && c != 0xEB) // MBR?
+			uint16_t longName[MaxLongName + 1];
+			unsigned longNameLength = 0;
+			for(const uint8_t *ptr = name; *ptr; longNameLength++)
 			{
-				Stream::ReadTo(446 + 8);
-				_fat.firstSector = Stream::ReadU32Le();
-				Stream::ReadTo(510);
-				uint16_t sig = Stream::ReadU16Le();
-				Stream::EndRead();
-				if(sig != BootSignatureVal)
+				if(longNameLength == MaxLongName || *ptr == Fs::PathDelim)
+					return false;
+				longName[longNameLength] = Utf8Encoding<uint16_t>::Decode(ptr);
+			}
+
+			uint8_t shortName[11];
+			unsigned longEntries = 0;
+			if(MakeShortName(name, shortName))
+			{
+				longEntries = (longNameLength + 12) / 13;
+				// numeric tail ~N
+				unsigned baseLen = 0;
+				while(baseLen < 8 && shortName[baseLen] != ' ')
+					baseLen++;
+				bool unique = false;
+				for(uint32_t n = 1; n < 1000000 && !unique; n++)
 				{
+					uint8_t tail[8];
+					unsigned tailLen = 0;
+					for(uint32_t value = n; value; value /= 10)
+						tail[tailLen++] = uint8_t('0' + value % 10);
+					unsigned pos = baseLen + tailLen + 1 > 8 ? 8 - tailLen - 1 : baseLen;
+					memset(shortName + pos, ' ', 8 - pos);
+					shortName[pos++] = '~';
+					while(tailLen)
+						shortName[pos++] = tail[--tailLen];
+					unique = !ShortNameExists(parentDir, shortName);
+				}
+				if(!unique)
 					return false;
+			}
+
+			if(!FindFreeEntries(parentDir, longEntries + 1, location))
+				return false;
+
+			uint8_t checksum = 0;
+			for(unsigned c = 0; c < 11; c++)
+				checksum = uint8_t(((checksum & 1) << 7) + (checksum >> 1) + shortName[c]);
+
+			DirEntryLocation current = location;
+			for(unsigned sequence = longEntries; sequence > 0; sequence--)
+			{
+				uint8_t *sector = _cache.Modify(current.sector);
+				if(!sector)
+					return false;
+				uint8_t *entry = sector + current.index * DIR_ENTRY_SIZE;
+				memset(entry, 0, DIR_ENTRY_SIZE);
+				entry[0] = uint8_t(sequence | (sequence == longEntries ? 0x40 : 0));
+				entry[11] = ATTR_LONG_NAME;
+				entry[13] = checksum;
+				for(unsigned c = 0; c < 13; c++)
+				{
+					unsigned pos = (sequence - 1) * 13 + c;
+					uint16_t value = pos < longNameLength ? longName[pos] : pos == longNameLength ? 0 : 0xffff;
+					entry[longNameChars[c]] = uint8_t(value);
+					entry[longNameChars[c] + 1] = uint8_t(value >> 8);
 				}
-				Stream::StartRead(_fat.firstSector);
-				uint8_t c = Stream::Read();
-				if(c != 0xE9 && c != 0xEB)
+				if(!NextEntry(current))
 					return false;
 			}
-			Stream::ReadTo(11);
-			_fat.bytesPerSector = Stream::ReadU16Le();			_fat.sectorPerCluster = Stream::Read();			_fat.reservedSectorCount = Stream::ReadU16Le();			_fat.numberofFATs = Stream::Read();			_fat.rootEntCnt = Stream::ReadU16Le();			_fat.totalSectors = Stream::ReadU16Le();
-			/*uint8_t  mediaType = */Stream::Read();			_fat.FATsize = Stream::ReadU16Le();			/*uint16_t sectorsPerTrack = */Stream::ReadU16Le();			/*uint16_t numberofHeads = */Stream::ReadU16Le();			_fat.hiddenSectors = Stream::ReadU32Le();			uint32_t totalSectors_F32 = Stream::ReadU32Le();
+			location = current;
 
-			if(_fat.totalSectors == 0)
-				_fat.totalSectors = totalSectors_F32;
+			uint8_t *sector = _cache.Modify(location.sector);
+			if(!sector)
+				return false;
+			uint8_t *entry = sector + location.index * DIR_ENTRY_SIZE;
+			memset(entry, 0, DIR_ENTRY_SIZE);
+			memcpy(entry, shortName, 11);
+			entry[11] = attributes;
+			// 1980-01-01
+			entry[16] = entry[18] = entry[24] = 0x21;
+			return UpdateEntry(location, firstCluster, 0);
+		}
 
-			if(_fat.FATsize == 0)
+		template<class Dev>
+		bool FatFs<Dev>::UpdateEntry(const DirEntryLocation &location, uint32_t firstCluster, uint32_t size)
+		{
+			uint8_t *sector = _cache.Modify(location.sector);
+			if(!sector)
+				return false;
+			uint8_t *entry = sector + location.index * DIR_ENTRY_SIZE;
+			entry[20] = uint8_t(firstCluster >> 16);
+			entry[21] = uint8_t(firstCluster >> 24);
+			entry[26] = uint8_t(firstCluster);
+			entry[27] = uint8_t(firstCluster >> 8);
+			entry[28] = uint8_t(size);
+			entry[29] = uint8_t(size >> 8);
+			entry[30] = uint8_t(size >> 16);
+			entry[31] = uint8_t(size >> 24);
+			return true;
+		}
+
+		template<class Dev>
+		Fs::FsNode FatFs<Dev>::AllocBlock(Fs::FsNode node)
+		{
+			uint32_t sector = (uint32_t)node;
+			uint32_t cluster = SectorToCluster(sector);
+			if(!IsValidCluster(cluster))
+				return Fs::EndOfFileNode;
+			Fs::FsNode next = NextBlock(node);
+			if(next != Fs::EndOfFileNode)
+				return next;
+			uint32_t first;
+			if(AllocateClusters(1, first, cluster) != 1)
+				return Fs::EndOfFileNode;
+			return ClusterToSector(first);
+		}
+
+		template<class Dev>
+		Fs::FsNode FatFs<Dev>::CreateNode(Fs::FsNode parentDir, Fs::DirectoryEntryType type, uint8_t *nodeName)
+		{
+			uint32_t first, last = 0;
+			if(AllocateClusters(1, first, last) != 1)
+				return Fs::EndOfFileNode;
+			bool ok = true;
+			if(type == Fs::DirectoryEntry)
 			{
-				_fat.FATsize = Stream::ReadU32Le();
-				/*uint16_t extFlags = */Stream::ReadU16Le();				/*uint16_t FSversion = */Stream::ReadU16Le();				_fat.rootCluster = Stream::ReadU32Le();
-			}			Stream::ReadTo(510);
-			uint16_t sig = Stream::ReadU16Le();
-			Stream::EndRead();
-			if(sig != 0xaa55)
-			{
-				return false;
-			}
-
-            _fat.rootDirSectors = (_fat.rootEntCnt * 32 + _fat.bytesPerSector - 1) / _fat.bytesPerSector;
-
-			_fat.firstDataSector = _fat.rootDirSectors + _fat.reservedSectorCount + _fat.FATsize * _fat.numberofFATs;
-
-			uint32_t dataSec = _fat.totalSectors - (_fat.reservedSectorCount + _fat.FATsize * _fat.numberofFATs + _fat.rootDirSectors);
-			_fat.countofClusters = dataSec / _fat.sectorPerCluster;
-            if(_fat.rootCluster == 0)
-                _fat.rootCluster = (_fat.reservedSectorCount + _fat.FATsize * _fat.numberofFATs);
-
-            if(_fat.countofClusters < 4085)
-            {
-                _fat.type = Fat12;
-            } else if(_fat.countofClusters < 65525)
-            {
-                _fat.type = Fat16;
-            } else
-            {
-                _fat.type = Fat32;
-            }
-#define Prn(x) std::cout << std::left << std::setw(24) << #x " = " << (uint32_t)x << "\n"
-
-Prn(_fat.bytesPerSector);
-Prn(_fat.sectorPerCluster);
-Prn(_fat.reservedSectorCount);
-Prn(_fat.numberofFATs);
-Prn(_fat.rootEntCnt);
-Prn(_fat.totalSectors);
-Prn(_fat.FATsize);
-Prn(_fat.hiddenSectors);
-Prn(_fat.rootCluster);
-Prn(_fat.countofClusters);
-Prn(_fat.firstDataSector);
-Prn(_fat.rootDirSectors);
-			return true;
-		}	}}
+				ok = ZeroCluster(first);
+				uint8_t *sector = ok ? _cache.Modify(ClusterToSector(first)) : 0;
+				if(sector)
+				{
+					uint32_t parentCluster = SectorToCluster((uint32_t)parentDir);
+					if(_fat.type == Fat32 && parentCluster == _fat.rootCluster)
+						parentCluster = 0;
+					for(unsigned i = 0; i < 2; i++)
+					{
+						uint8_t *entry = sector + i * DIR_ENTRY_SIZE;
+						uint32_t cluster = i == 0 ? first : parentCluster;
+						memset(entry, ' ', 11);
+						memset(entry + 11, 0, DIR_ENTRY_SIZE - 11);
+						entry[0] = '.';
+						entry[1] = i == 0 ? ' ' : '.';
+						entry[11] = ATTR_DIRECTORY;
+						entry[16] = entry[18] = entry[24] = 0x21;
+						entry[20] = uint8_t(cluster >> 16);
+						entry[21] = uint8_t(cluster >> 24);
+						entry[26] = uint8_t(cluster);
+						entry[27] = uint8_t(cluster >> 8);
+					}
+				}
+				else
+					ok = false;
+			}
+			DirEntryLocation location;
+			if(!ok || !CreateEntry(parentDir, nodeName, type == Fs::DirectoryEntry ? ATTR_DIRECTORY : ATTR_ARCHIVE, first, location))
+			{
+				FreeChain(first);
+				return Fs::EndOfFileNode;
+			}
+			return ClusterToSector(first);
+		}
+
+		template<class Dev>
+		bool FatFs<Dev>::WriteBlock(Fs::FsNode node, const uint8_t *buffer)
+		{
+			if(node == Fs::EndOfFileNode || (uint32_t)node < _fat.rootDirSector)
+				return false;
+			uint8_t *sector = _cache.Overwrite((uint32_t)node);
+			if(!sector)
+				return false;
+			memcpy(sector, buffer, _fat.bytesPerSector);
+			return true;
+		}
+
+		// Consecutive sectors are read with one multiple block command bypassing the cache
+		template<class Dev>
+		bool FatFs<Dev>::ReadBlocks(Fs::FsNode &node, uint8_t *const *buffers, unsigned count)
+		{
+			if(node == Fs::EndOfFileNode || count == 0)
+				return false;
+			// device must see modified sectors before they are read around the cache
+			if(_cache.DirtyCount() && !_cache.Flush())
+				return false;
+			Dev &device = _cache.Device();
+			unsigned done = 0;
+			while(done < count)
+			{
+				uint32_t first = (uint32_t)node;
+				unsigned length = 1;
+				Fs::FsNode next = Fs::EndOfFileNode;
+				while(done + length < count)
+				{
+					next = NextBlock(node);
+					if(next != node + 1)
+						break;
+					node = next;
+					length++;
+				}
+				if(length == 1)
+				{
+					if(!device.ReadBlocks(buffers[done], first, 1))
+						return false;
+				}
+				else
+				{
+					if(!device.BeginRead(first))
+						return false;
+					bool ok = true;
+					for(unsigned i = 0; i < length && ok; i++)
+						ok = device.ReadNext(buffers[done + i]);
+					if(!device.EndRead() || !ok)
+						return false;
+				}
+				done += length;
+				if(done < count)
+				{
+					if(next == Fs::EndOfFileNode)
+						return false;
+					node = next;
+				}
+			}
+			return true;
+		}
+
+		// Blocks are allocated as needed, consecutive sectors are written with
+		// one multiple block command. Cached copies of written sectors are dropped.
+		template<class Dev>
+		bool FatFs<Dev>::WriteBlocks(Fs::FsNode &node, const uint8_t *const *buffers, unsigned count)
+		{
+			if(node == Fs::EndOfFileNode || (uint32_t)node < _fat.firstDataSector || count == 0)
+				return false;
+			Dev &device = _cache.Device();
+			unsigned done = 0;
+			while(done < count)
+			{
+				uint32_t first = (uint32_t)node;
+				unsigned length = 1;
+				Fs::FsNode next = Fs::EndOfFileNode;
+				while(done + length < count)
+				{
+					next = AllocBlock(node);
+					if(next != node + 1)
+						break;
+					node = next;
+					length++;
+				}
+				_cache.Invalidate(first, length);
+				if(length == 1)
+				{
+					if(!device.WriteBlocks(buffers[done], first, 1))
+						return false;
+				}
+				else
+				{
+					if(!device.BeginWrite(first, length))
+						return false;
+					bool ok = true;
+					for(unsigned i = 0; i < length && ok; i++)
+						ok = device.WriteNext(buffers[done + i]);
+					if(!device.EndWrite() || !ok)
+						return false;
+				}
+				done += length;
+				if(done < count)
+				{
+					if(next == Fs::EndOfFileNode)
+						return false;
+					node = next;
+				}
+			}
+			return true;
+		}
+
+		// Fragment of cluster chain: 'length' consecutive clusters starting
+		// from 'cluster' hold file clusters starting from 'fileCluster'
+		struct ClusterRun
+		{
+			uint32_t fileCluster;
+			uint32_t cluster;
+			uint32_t length;
+		};
+
+		// Sequential file reader. Consecutive clusters are read with one multiple block
+		// command directly to user buffer bypassing the cache. Runs met while reading are
+		// remembered in the link map, so seeking back does not walk the chain from the beginning.
+		template<class Dev>
+		class FatFileReader
+		{
+			enum{MaxRunLength = 128};
+			FatFs<Dev> &_fs;
+			ClusterRun *_map;
+			unsigned _mapSize;
+			unsigned _mapUsed;
+			ClusterRun _run;
+			uint32_t _size;
+			uint32_t _position;
+
+			bool FindRun(uint32_t fileCluster);
+			void Remember(const ClusterRun &run);
+		public:
+			FatFileReader(FatFs<Dev> &fs, ClusterRun *map, unsigned mapSize)
+				:_fs(fs), _map(map), _mapSize(mapSize), _mapUsed(0), _size(0), _position(0)
+			{
+				_run.length = 0;
+			}
+
+			// Opens file by node returned by directory listing
+			bool Open(Fs::FsNode node, uint32_t size)
+			{
+				return OpenCluster(node == Fs::EndOfFileNode ? 0 : _fs.SectorToCluster((uint32_t)node), size);
+			}
+
+			bool OpenCluster(uint32_t firstCluster, uint32_t size);
+
+			// Returns number of bytes read, less than requested at the end of file or on error
+			uint32_t Read(uint8_t *buffer, uint32_t count);
+			bool Seek(uint32_t position);
+			uint32_t Tell() const { return _position; }
+			uint32_t Size() const { return _size; }
+			bool Eof() const { return _position >= _size; }
+		};
+
+		template<class Dev>
+		bool FatFileReader<Dev>::OpenCluster(uint32_t firstCluster, uint32_t size)
+		{
+			_mapUsed = 0;
+			_run.length = 0;
+			_position = 0;
+			_size = 0;
+			if(size == 0)
+				return true;
+			if(!_fs.IsValidCluster(firstCluster))
+				return false;
+			_size = size;
+			_run.fileCluster = 0;
+			_run.cluster = firstCluster;
+			_run.length = _fs.ContiguousRun(firstCluster, MaxRunLength);
+			Remember(_run);
+			return true;
+		}
+
+		template<class Dev>
+		void FatFileReader<Dev>::Remember(const ClusterRun &run)
+		{
+			if(_mapUsed > 0 && _map[_mapUsed - 1].fileCluster >= run.fileCluster)
+				return;
+			if(_mapUsed < _mapSize)
+				_map[_mapUsed++] = run;
+		}
+
+		template<class Dev>
+		bool FatFileReader<Dev>::FindRun(uint32_t fileCluster)
+		{
+			if(_run.length == 0)
+				return false;
+			if(fileCluster - _run.fileCluster < _run.length)
+				return true;
+			if(fileCluster < _run.fileCluster)
+			{
+				// closest known run before the position
+				unsigned i = _mapUsed;
+				while(i > 0 && _map[i - 1].fileCluster > fileCluster)
+					i--;
+				if(i == 0)
+					return false;
+				_run = _map[i - 1];
+			}
+			else if(_mapUsed > 0 && _map[_mapUsed - 1].fileCluster > _run.fileCluster &&
+				_map[_mapUsed - 1].fileCluster <= fileCluster)
+			{
+				_run = _map[_mapUsed - 1];
+			}
+
+			while(fileCluster - _run.fileCluster >= _run.length)
+			{
+				uint32_t next = _fs.FatEntry(_run.cluster + _run.length - 1);
+				if(!_fs.IsValidCluster(next))
+					return false;
+				_run.fileCluster += _run.length;
+				_run.cluster = next;
+				_run.length = _fs.ContiguousRun(next, MaxRunLength);
+				Remember(_run);
+			}
+			return true;
+		}
+
+		template<class Dev>
+		bool FatFileReader<Dev>::Seek(uint32_t position)
+		{
+			if(position > _size)
+				return false;
+			_position = position;
+			return true;
+		}
+
+		template<class Dev>
+		uint32_t FatFileReader<Dev>::Read(uint8_t *buffer, uint32_t count)
+		{
+			const uint32_t sectorSize = _fs.Info().bytesPerSector;
+			const uint32_t clusterSize = _fs.ClusterSize();
+			uint32_t done = 0;
+			if(count > _size - _position)
+				count = _size - _position;
+
+			while(done < count)
+			{
+				uint32_t fileCluster = _position / clusterSize;
+				if(!FindRun(fileCluster))
+					break;
+				uint32_t runOffset = _position - _run.fileCluster * clusterSize;
+				uint32_t sector = _fs.ClusterToSector(_run.cluster) + runOffset / sectorSize;
+				uint32_t sectorOffset = _position % sectorSize;
+				uint32_t chunk;
+
+				if(sectorOffset == 0 && count - done >= sectorSize)
+				{
+					uint32_t sectors = (count - done) / sectorSize;
+					uint32_t runSectors = (_run.length * clusterSize - runOffset) / sectorSize;
+					if(sectors > runSectors)
+						sectors = runSectors;
+					typename FatFs<Dev>::Cache &cache = _fs.GetCache();
+					// device must see modified sectors before they are read around the cache
+					if(cache.DirtyCount() && !cache.Flush())
+						break;
+					uint8_t *ptr = buffer + done;
+					if(!cache.Device().ReadBlocks(ptr, sector, sectors))
+						break;
+					chunk = sectors * sectorSize;
+				}
+				else
+				{
+					const uint8_t *data = _fs.GetCache().Read(sector);
+					if(!data)
+						break;
+					chunk = sectorSize - sectorOffset;
+					if(chunk > count - done)
+						chunk = count - done;
+					memcpy(buffer + done, data + sectorOffset, chunk);
+				}
+				done += chunk;
+				_position += chunk;
+			}
+			return done;
+		}
+
+		// Appending file writer. Clusters for whole write request are allocated at once,
+		// preferably contiguous, and sector aligned data is written with multiple block
+		// commands directly to device. FAT and directory entry changes are written on Sync.
+		template<class Dev>
+		class FatFileWriter
+		{
+			enum{MaxRunLength = 128};
+			FatFs<Dev> &_fs;
+			DirEntryLocation _entry;
+			uint32_t _firstCluster;
+			uint32_t _lastCluster;
+			uint32_t _allocated;
+			uint32_t _cluster;
+			uint32_t _clusterIndex;
+			uint32_t _size;
+			bool _open;
+
+			uint32_t Reserve(uint32_t count);
+		public:
+			FatFileWriter(FatFs<Dev> &fs)
+				:_fs(fs), _open(false)
+			{}
+
+			// Creates new file, 'preallocate' bytes are allocated contiguously if possible
+			bool Create(Fs::FsNode parentDir, const uint8_t *name, uint32_t preallocate = 0);
+			// Returns number of bytes written, less than requested if volume is full or on error
+			uint32_t Write(const uint8_t *buffer, uint32_t count);
+			bool Sync();
+			// Unused preallocated clusters are freed
+			bool Close();
+			uint32_t Size() const { return _size; }
+			uint32_t FirstCluster() const { return _firstCluster; }
+		};
+
+		template<class Dev>
+		bool FatFileWriter<Dev>::Create(Fs::FsNode parentDir, const uint8_t *name, uint32_t preallocate)
+		{
+			_open = false;
+			_firstCluster = _lastCluster = 0;
+			_allocated = _clusterIndex = _size = 0;
+			if(!_fs.CreateEntry(parentDir, name, ATTR_ARCHIVE, 0, _entry))
+				return false;
+			_open = true;
+			if(preallocate && Reserve(preallocate) == 0)
+				return false;
+			return true;
+		}
+
+		// Allocates clusters to hold file of 'size' bytes, returns size of allocated space
+		template<class Dev>
+		uint32_t FatFileWriter<Dev>::Reserve(uint32_t size)
+		{
+			const uint32_t clusterSize = _fs.ClusterSize();
+			uint32_t needed = size / clusterSize + (size % clusterSize ? 1 : 0);
+			if(needed > _allocated)
+			{
+				uint32_t first;
+				uint32_t allocated = _fs.AllocateClusters(needed - _allocated, first, _lastCluster);
+				if(allocated && !_firstCluster)
+				{
+					_firstCluster = _cluster = first;
+					_clusterIndex = 0;
+				}
+				_allocated += allocated;
+			}
+			return _allocated * clusterSize;
+		}
+
+		template<class Dev>
+		uint32_t FatFileWriter<Dev>::Write(const uint8_t *buffer, uint32_t count)
+		{
+			if(!_open)
+				return 0;
+			const uint32_t sectorSize = _fs.Info().bytesPerSector;
+			const uint32_t clusterSize = _fs.ClusterSize();
+			if(count > 0xffffffff - _size)
+				count = 0xffffffff - _size;
+			uint32_t space = Reserve(_size + count) - _size;
+			if(count > space)
+				count = space;
+			typename FatFs<Dev>::Cache &cache = _fs.GetCache();
+			uint32_t done = 0;
+
+			while(done < count)
+			{
+				if(_size / clusterSize > _clusterIndex)
+				{
+					uint32_t next = _fs.FatEntry(_cluster);
+					if(!_fs.IsValidCluster(next))
+						break;
+					_cluster = next;
+					_clusterIndex++;
+				}
+				uint32_t clusterOffset = _size % clusterSize;
+				uint32_t sector = _fs.ClusterToSector(_cluster) + clusterOffset / sectorSize;
+				uint32_t sectorOffset = _size % sectorSize;
+				uint32_t chunk;
+
+				if(sectorOffset == 0 && count - done >= sectorSize)
+				{
+					uint32_t sectors = (count - done) / sectorSize;
+					uint32_t runSectors = (_fs.ContiguousRun(_cluster, MaxRunLength) * clusterSize - clusterOffset) / sectorSize;
+					if(sectors > runSectors)
+						sectors = runSectors;
+					// cached copies would be stale
+					cache.Invalidate(sector, sectors);
+					const uint8_t *ptr = buffer + done;
+					if(!cache.Device().WriteBlocks(ptr, sector, sectors))
+						break;
+					chunk = sectors * sectorSize;
+				}
+				else
+				{
+					uint8_t *data = sectorOffset == 0 ? cache.Overwrite(sector) : cache.Modify(sector);
+					if(!data)
+						break;
+					chunk = sectorSize - sectorOffset;
+					if(chunk > count - done)
+						chunk = count - done;
+					memcpy(data + sectorOffset, buffer + done, chunk);
+					if(sectorOffset == 0)
+						memset(data + chunk, 0, sectorSize - chunk);
+				}
+				done += chunk;
+				_size += chunk;
+				// contiguous run or single sector was written
+				uint32_t lastIndex = (_size - 1) / clusterSize;
+				_cluster += lastIndex - _clusterIndex;
+				_clusterIndex = lastIndex;
+			}
+			return done;
+		}
+
+		template<class Dev>
+		bool FatFileWriter<Dev>::Sync()
+		{
+			if(!_open)
+				return false;
+			return _fs.UpdateEntry(_entry, _firstCluster, _size) && _fs.Sync();
+		}
+
+		template<class Dev>
+		bool FatFileWriter<Dev>::Close()
+		{
+			if(!_open)
+				return false;
+			const uint32_t clusterSize = _fs.ClusterSize();
+			uint32_t used = _size / clusterSize + (_size % clusterSize ? 1 : 0);
+			bool result = true;
+			if(used < _allocated)
+			{
+				if(used == 0)
+				{
+					result = _fs.FreeChain(_firstCluster);
+					_firstCluster = 0;
+				}
+				else
+				{
+					uint32_t next = _fs.FatEntry(_cluster);
+					result = _fs.SetFatEntry(_cluster, EndOfChain) && _fs.FreeChain(next);
+				}
+				_allocated = used;
+			}
+			result = Sync() && result;
+			_open = false;
+			return result;
+		}
+	}
+}
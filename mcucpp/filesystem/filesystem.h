@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <dispatcher.h>
 
 namespace Mcucpp
 {
@@ -41,7 +44,7 @@ namespace Fs
 	class DirectoryLister
 	{
 	public:
-		virtual bool DirectoryEntry(const uint8_t *name, DirectoryEntryType directoryEntryType, FileAttributes attributes, FsNode node)=0;
+		virtual bool DirectoryEntry(const uint8_t *name, DirectoryEntryType directoryEntryType, FileAttributes attributes, FsNode node, uint32_t size)=0;
 	};
 
 	
@@ -57,21 +60,235 @@ namespace Fs
 		virtual FsNode CreateNode(FsNode parentDir, DirectoryEntryType type, uint8_t *nodeName)=0;
 		virtual bool ReadBlock(FsNode node, uint8_t *buffer)=0;
 		virtual bool WriteBlock(FsNode node, const uint8_t *buffer)=0;
+		
+		// Reads 'count' blocks following 'node' in NextBlock order, 'node' is set to the last one.
+		// Drivers override it to transfer consecutive blocks at once.
+		virtual bool ReadBlocks(FsNode &node, uint8_t *const *buffers, unsigned count)
+		{
+			for(unsigned i = 0; i < count; i++)
+			{
+				if(i > 0)
+					node = NextBlock(node);
+				if(node == EndOfFileNode || !ReadBlock(node, buffers[i]))
+					return false;
+			}
+			return true;
+		}
+		
+		// Writes 'count' blocks starting from 'node', blocks are allocated when chain ends.
+		// 'node' is set to the last written block.
+		virtual bool WriteBlocks(FsNode &node, const uint8_t *const *buffers, unsigned count)
+		{
+			for(unsigned i = 0; i < count; i++)
+			{
+				if(i > 0)
+					node = AllocBlock(node);
+				if(node == EndOfFileNode || !WriteBlock(node, buffers[i]))
+					return false;
+			}
+			return true;
+		}
+		
+		// Writes buffered metadata and data to the device
+		virtual bool Sync()
+		{
+			return true;
+		}
 	};
 	
 	
+#if defined(MCUCPP_FS_LOOKUP_NAME_SIZE) && MCUCPP_FS_LOOKUP_NAME_SIZE > 0
+	const size_t LookupNameSize = MCUCPP_FS_LOOKUP_NAME_SIZE;
+#else
+	const size_t LookupNameSize = 32;
+#endif
+
+	inline uint8_t FoldCase(uint8_t c)
+	{
+		return c >= 'A' && c <= 'Z' ? uint8_t(c - 'A' + 'a') : c;
+	}
+
+	struct NodeLookupEntry
+	{
+		FsNode parent;
+		FsNode node;
+		uint32_t hash;
+		uint16_t lastUse;
+		uint8_t length;
+		uint8_t name[LookupNameSize];
+	};
+
+	template<unsigned Entries>
+	struct NodeLookupStorage
+	{
+		NodeLookupEntry entries[Entries];
+		static const unsigned EntryCount = Entries;
+	};
+
+	// Hash table of path elements: (parent directory node, name) -> child node.
+	// Names are case folded once at insert when FileSystem using the cache ignores
+	// case, names longer than LookupNameSize are not cached. Entry is looked up in MaxProbe slots
+	// following its hash, least recently used one of them is replaced.
+	class NodeLookupCache
+	{
+		enum{MaxProbe = 4};
+		NodeLookupEntry *_entries;
+		unsigned _count;
+		bool _ignoreCase;
+		uint16_t _useCounter;
+		uint32_t _hits;
+		uint32_t _misses;
+
+		uint32_t Hash(FsNode parent, const uint8_t *name, size_t length) const
+		{
+			// FNV-1a
+			uint32_t hash = 2166136261u ^ (uint32_t)parent;
+			for(size_t i = 0; i < length; i++)
+			{
+				hash ^= _ignoreCase ? FoldCase(name[i]) : name[i];
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+
+		bool Match(const NodeLookupEntry &entry, FsNode parent, const uint8_t *name, size_t length, uint32_t hash) const
+		{
+			if(entry.length != length || entry.hash != hash || entry.parent != parent)
+				return false;
+			for(size_t i = 0; i < length; i++)
+			{
+				uint8_t c = _ignoreCase ? FoldCase(name[i]) : name[i];
+				if(entry.name[i] != c)
+					return false;
+			}
+			return true;
+		}
+
+		NodeLookupEntry *Find(FsNode parent, const uint8_t *name, size_t length, uint32_t hash)
+		{
+			for(unsigned i = 0; i < MaxProbe && i < _count; i++)
+			{
+				NodeLookupEntry &entry = _entries[(hash + i) % _count];
+				if(Match(entry, parent, name, length, hash))
+					return &entry;
+			}
+			return 0;
+		}
+	public:
+		NodeLookupCache(NodeLookupEntry *entries, unsigned count)
+			:_entries(entries), _count(count), _ignoreCase(false)
+		{
+			Clear();
+		}
+
+		template<unsigned Entries>
+		NodeLookupCache(NodeLookupStorage<Entries> &storage)
+			:_entries(storage.entries), _count(Entries), _ignoreCase(false)
+		{
+			Clear();
+		}
+
+		bool IgnoreCase() const { return _ignoreCase; }
+
+		// Set by FileSystem::SetLookupCache, entries stored in other mode are dropped
+		void SetIgnoreCase(bool ignoreCase)
+		{
+			if(_ignoreCase != ignoreCase)
+			{
+				_ignoreCase = ignoreCase;
+				Clear();
+			}
+		}
+
+		void Clear()
+		{
+			for(unsigned i = 0; i < _count; i++)
+				_entries[i].length = 0;
+			_useCounter = 0;
+			_hits = _misses = 0;
+		}
+
+		bool Lookup(FsNode parent, const uint8_t *name, size_t length, FsNode &node)
+		{
+			NodeLookupEntry *entry = length <= LookupNameSize ? Find(parent, name, length, Hash(parent, name, length)) : 0;
+			if(!entry)
+			{
+				_misses++;
+				return false;
+			}
+			_hits++;
+			entry->lastUse = ++_useCounter;
+			node = entry->node;
+			return true;
+		}
+
+		void Insert(FsNode parent, const uint8_t *name, size_t length, FsNode node)
+		{
+			if(_count == 0 || length == 0 || length > LookupNameSize)
+				return;
+			uint32_t hash = Hash(parent, name, length);
+			NodeLookupEntry *entry = Find(parent, name, length, hash);
+			if(!entry)
+			{
+				// free slot or least recently used one
+				for(unsigned i = 0; i < MaxProbe && i < _count; i++)
+				{
+					NodeLookupEntry &candidate = _entries[(hash + i) % _count];
+					if(candidate.length == 0)
+					{
+						entry = &candidate;
+						break;
+					}
+					if(!entry || uint16_t(_useCounter - candidate.lastUse) > uint16_t(_useCounter - entry->lastUse))
+						entry = &candidate;
+				}
+			}
+			entry->parent = parent;
+			entry->node = node;
+			entry->hash = hash;
+			entry->length = (uint8_t)length;
+			for(size_t i = 0; i < length; i++)
+				entry->name[i] = _ignoreCase ? FoldCase(name[i]) : name[i];
+			entry->lastUse = ++_useCounter;
+		}
+
+		void Invalidate(FsNode parent, const uint8_t *name, size_t length)
+		{
+			NodeLookupEntry *entry = length <= LookupNameSize ? Find(parent, name, length, Hash(parent, name, length)) : 0;
+			if(entry)
+				entry->length = 0;
+		}
+
+		// Drops entries of the directory and entries referring to the node
+		void InvalidateNode(FsNode node)
+		{
+			for(unsigned i = 0; i < _count; i++)
+			{
+				if(_entries[i].parent == node || _entries[i].node == node)
+					_entries[i].length = 0;
+			}
+		}
+
+		uint32_t Hits() const { return _hits; }
+		uint32_t Misses() const { return _misses; }
+	};
+
 	class FindNodeLister :public DirectoryLister
 	{
 		const uint8_t *_filePath;
 		IFsDriver &_driver;
+		NodeLookupCache *_cache;
+		bool _ignoreCase;
 		bool _found;
 		bool _pathMatched;
 		FsNode _currentNode;
 		
 	public:
-		FindNodeLister(const uint8_t *filePath, IFsDriver &driver)
+		FindNodeLister(const uint8_t *filePath, IFsDriver &driver, NodeLookupCache *cache = 0, bool ignoreCase = false)
 			:_filePath(filePath),
 			_driver(driver),
+			_cache(cache),
+			_ignoreCase(ignoreCase),
 			_found(false),
 			_pathMatched(false)
 		{
@@ -82,15 +299,40 @@ namespace Fs
 		{
 			do
 			{
+				FsNode parent = _currentNode;
+				const uint8_t *element = _filePath;
+				while(*element == PathDelim)
+				{
+					element++;
+				}
+				size_t length = 0;
+				while(element[length] != 0 && element[length] != PathDelim)
+				{
+					length++;
+				}
+				if(length == 0)
+					return _currentNode;
+				
+				if(_cache && _cache->Lookup(parent, element, length, _currentNode))
+				{
+					_filePath = element + length;
+					_found = *_filePath == 0;
+					continue;
+				}
+				
+				// empty directory does not call DirectoryEntry
+				_pathMatched = false;
 				if(!_driver.ListDirectory(_currentNode, *this))
 					return EndOfFileNode;
 				if(!_pathMatched)
 					return EndOfFileNode;
+				if(_cache)
+					_cache->Insert(parent, element, length, _currentNode);
 			}while(!_found);
 			return _currentNode;
 		}
 		
-		virtual bool DirectoryEntry(const uint8_t *name, DirectoryEntryType directoryEntryType, FileAttributes attributes, FsNode node)
+		virtual bool DirectoryEntry(const uint8_t *name, DirectoryEntryType directoryEntryType, FileAttributes attributes, FsNode node, uint32_t size)
 		{
 			if(PathElementMatch(name))
 			{
@@ -113,52 +355,324 @@ namespace Fs
 				pathPtr++;
 			}
 
-			do
+			for(;; pathPtr++, name++)
 			{
-				if(*pathPtr == PathDelim)
+				if(*pathPtr == PathDelim || *pathPtr == 0)
 				{
+					if(*name != 0)
+						return false;
+					if(*pathPtr == 0)
+						_found = true;
 					_filePath = pathPtr;
 					return true;
 				}
-				if(*pathPtr == 0)
-				{
-					_found = true;
-					return true;
-				}
-			}while(*pathPtr++ == *name++);
-			return false;
+				uint8_t c1 = _ignoreCase ? FoldCase(*pathPtr) : *pathPtr;
+				uint8_t c2 = _ignoreCase ? FoldCase(*name) : *name;
+				if(c1 != c2)
+					return false;
+			}
 		}
 	};
 
-	template<class FsDriverType>
+	typedef void (*IoCallback)(void *tag, bool success);
+	
+	// Block oriented file with asynchronous reads and writes.
+	// Requests are queued and served by 'Process' task of the dispatcher one transfer at a time,
+	// so other tasks run between transfers. Adjacent queued requests of the same direction are
+	// merged in one driver call of up to MaxMergeBlocks blocks. Callbacks are called from
+	// the dispatcher in request order. If the block device polls the same dispatcher while
+	// it waits for DMA or busy card, queued tasks run during the transfer too; they may queue
+	// new requests, but must not access the driver directly.
+	template<class FsDriverType, unsigned QueueSize = 4>
 	class File
 	{
+		enum{MaxMergeBlocks = 16};
+		enum RequestState
+		{
+			Free,
+			Queued,
+			Done,
+			Failed
+		};
+		
+		struct Request
+		{
+			uint8_t *buffer;
+			uint32_t block;
+			uint16_t count;
+			uint16_t done;
+			uint8_t state;
+			bool write;
+			IoCallback callback;
+			void *tag;
+		};
+		
 		FsDriverType &_driver;
+		Dispatcher &_dispatcher;
+		Request _requests[QueueSize];
+		unsigned _head;
+		unsigned _count;
+		FsNode _first;
+		FsNode _cursor;
+		uint32_t _cursorBlock;
+		uint32_t _position;
+		bool _busy;
+		bool _split;
+		bool _processPending;
+		bool _completePending;
+		
+		File(const File &);
+		File &operator=(const File &);
+		
+		Request &At(unsigned i){ return _requests[(_head + i) % QueueSize]; }
+		bool Enqueue(uint8_t *buffer, unsigned blocks, bool write, IoCallback callback, void *tag);
+		FsNode Locate(uint32_t block, bool write);
+		void Schedule();
+		void Complete();
 	public:
-		File(FsDriverType &driver)
-			:_driver(driver)
+		File(FsDriverType &driver, Dispatcher &dispatcher)
+			:_driver(driver),
+			_dispatcher(dispatcher),
+			_head(0),
+			_count(0),
+			_first(EndOfFileNode),
+			_cursor(EndOfFileNode),
+			_cursorBlock(0),
+			_position(0),
+			_busy(false),
+			_split(false),
+			_processPending(false),
+			_completePending(false)
 		{
+		}
 		
+		// 'node' is the first block of the file, fails while requests are pending
+		bool Open(FsNode node)
+		{
+			if(_count || node == EndOfFileNode)
+				return false;
+			_first = _cursor = node;
+			_cursorBlock = 0;
+			_position = 0;
+			return true;
+		}
+		
+		// Block position of the next request
+		void Seek(uint32_t block){ _position = block; }
+		uint32_t Tell() const { return _position; }
+		unsigned Pending() const { return _count; }
+		bool Idle() const { return _count == 0; }
+		
+		// Return false if request queue is full, buffers must stay valid till completion
+		bool ReadAsync(uint8_t *buffer, unsigned blocks, IoCallback callback, void *tag = 0)
+		{
+			return Enqueue(buffer, blocks, false, callback, tag);
 		}
+		
+		bool WriteAsync(const uint8_t *buffer, unsigned blocks, IoCallback callback, void *tag = 0)
+		{
+			return Enqueue(const_cast<uint8_t *>(buffer), blocks, true, callback, tag);
+		}
+		
+		// Synchronous, call it when the file is idle
+		bool Sync(){ return _driver.Sync(); }
+		
+		void Process();
 	};
 	
+	template<class FsDriverType, unsigned QueueSize>
+	bool File<FsDriverType, QueueSize>::Enqueue(uint8_t *buffer, unsigned blocks, bool write, IoCallback callback, void *tag)
+	{
+		if(_count >= QueueSize || _first == EndOfFileNode || blocks == 0 || blocks > 0xffff)
+			return false;
+		Request &request = _requests[(_head + _count) % QueueSize];
+		request.buffer = buffer;
+		request.block = _position;
+		request.count = (uint16_t)blocks;
+		request.done = 0;
+		request.state = Queued;
+		request.write = write;
+		request.callback = callback;
+		request.tag = tag;
+		_count++;
+		_position += blocks;
+		Schedule();
+		return true;
+	}
+	
+	template<class FsDriverType, unsigned QueueSize>
+	void File<FsDriverType, QueueSize>::Schedule()
+	{
+		if(!_processPending)
+			_processPending = _dispatcher.SetTask<File, &File::Process>(this);
+	}
+	
+	template<class FsDriverType, unsigned QueueSize>
+	FsNode File<FsDriverType, QueueSize>::Locate(uint32_t block, bool write)
+	{
+		if(_cursor == EndOfFileNode || block < _cursorBlock)
+		{
+			_cursor = _first;
+			_cursorBlock = 0;
+		}
+		while(_cursorBlock < block && _cursor != EndOfFileNode)
+		{
+			_cursor = write ? _driver.AllocBlock(_cursor) : _driver.NextBlock(_cursor);
+			_cursorBlock++;
+		}
+		return _cursor;
+	}
+	
+	template<class FsDriverType, unsigned QueueSize>
+	void File<FsDriverType, QueueSize>::Process()
+	{
+		_processPending = false;
+		// re-entered from the dispatcher polled by the device driver,
+		// the outer call schedules remaining requests
+		if(_busy)
+			return;
+		_busy = true;
+		
+		unsigned index = 0;
+		while(index < _count && At(index).state != Queued)
+			index++;
+		if(index < _count)
+		{
+			const uint32_t blockSize = _driver.GetParameter(BlockSize);
+			Request *merged[MaxMergeBlocks];
+			uint16_t parts[MaxMergeBlocks];
+			unsigned requests = 0;
+			uint8_t *buffers[MaxMergeBlocks];
+			unsigned total = 0;
+			bool write = At(index).write;
+			uint32_t block = At(index).block + At(index).done;
+			
+			// failed merged transfer is retried request by request
+			unsigned maxRequests = _split ? 1 : QueueSize;
+			for(; index < _count && total < MaxMergeBlocks && requests < maxRequests; index++)
+			{
+				Request &request = At(index);
+				if(request.state != Queued || request.write != write || request.block + request.done != block + total)
+					break;
+				unsigned blocks = request.count - request.done;
+				if(blocks > MaxMergeBlocks - total)
+					blocks = MaxMergeBlocks - total;
+				for(unsigned i = 0; i < blocks; i++)
+					buffers[total + i] = request.buffer + (request.done + i) * blockSize;
+				merged[requests] = &request;
+				parts[requests++] = (uint16_t)blocks;
+				total += blocks;
+			}
+			
+			FsNode node = Locate(block, write);
+			bool ok = node != EndOfFileNode && (write ?
+				_driver.WriteBlocks(node, buffers, total) :
+				_driver.ReadBlocks(node, buffers, total));
+			if(ok)
+			{
+				_cursor = node;
+				_cursorBlock = block + total - 1;
+			}
+			else
+				_cursor = EndOfFileNode;
+			
+			_split = !ok && requests > 1;
+			for(unsigned i = 0; i < requests && !_split; i++)
+			{
+				Request &request = *merged[i];
+				request.done += parts[i];
+				if(!ok)
+					request.state = Failed;
+				else if(request.done == request.count)
+					request.state = Done;
+			}
+			if(!_completePending)
+				_completePending = _dispatcher.SetTask<File, &File::Complete>(this);
+		}
+		_busy = false;
+		
+		for(index = 0; index < _count; index++)
+		{
+			if(At(index).state == Queued)
+			{
+				Schedule();
+				break;
+			}
+		}
+	}
+	
+	template<class FsDriverType, unsigned QueueSize>
+	void File<FsDriverType, QueueSize>::Complete()
+	{
+		_completePending = false;
+		while(_count && At(0).state != Queued)
+		{
+			Request &request = At(0);
+			bool success = request.state == Done;
+			IoCallback callback = request.callback;
+			void *tag = request.tag;
+			request.state = Free;
+			_head = (_head + 1) % QueueSize;
+			_count--;
+			// callback may queue new requests
+			if(callback)
+				callback(tag, success);
+		}
+	}
+	
 	template<class FsDriverType>
 	class FileSystem
 	{
-		FsDriverType _driver;
+		FsDriverType &_driver;
+		NodeLookupCache *_lookupCache;
+		bool _ignoreCase;
 	public:
+		FileSystem(FsDriverType &driver, bool ignoreCase = false)
+			:_driver(driver),
+			_lookupCache(0),
+			_ignoreCase(ignoreCase)
+		{
+		}
+		
+		// Path elements found by FindNode are remembered in the cache,
+		// cache is switched to the file system case mode
+		void SetLookupCache(NodeLookupCache *cache)
+		{
+			_lookupCache = cache;
+			if(_lookupCache)
+				_lookupCache->SetIgnoreCase(_ignoreCase);
+		}
+		
+		FsDriverType &Driver(){ return _driver; }
 		FsNode FindNode(const uint8_t *nodePath);
 		bool ListDirectory(FsNode dir, DirectoryLister &directoryLister);
-		
+		FsNode CreateNode(FsNode parentDir, DirectoryEntryType type, uint8_t *nodeName);
 	};
 
 	
 	template<class FsDriverType>
 	FsNode FileSystem<FsDriverType>::FindNode(const uint8_t *nodePath)
 	{
-		FindNodeLister lister(nodePath, _driver);
+		FindNodeLister lister(nodePath, _driver, _lookupCache, _ignoreCase);
 		FsNode node = lister.Find();
 		return node;
 	}
+	
+	template<class FsDriverType>
+	bool FileSystem<FsDriverType>::ListDirectory(FsNode dir, DirectoryLister &directoryLister)
+	{
+		return _driver.ListDirectory(dir, directoryLister);
+	}
+	
+	template<class FsDriverType>
+	FsNode FileSystem<FsDriverType>::CreateNode(FsNode parentDir, DirectoryEntryType type, uint8_t *nodeName)
+	{
+		FsNode node = _driver.CreateNode(parentDir, type, nodeName);
+		// missing names are never cached, but entry of a node removed behind
+		// the cache may still hold this name
+		if(_lookupCache)
+			_lookupCache->Invalidate(parentDir, nodeName, strlen((const char *)nodeName));
+		return node;
+	}
 }
 }
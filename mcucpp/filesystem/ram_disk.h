@@ -0,0 +1,263 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace Mcucpp
+{
+namespace Fs
+{
+	// Modelled device time in microseconds
+	struct BlockDeviceLatency
+	{
+		uint32_t command;     // command issued, including stop of multiple block transfer
+		uint32_t readBlock;   // per block read
+		uint32_t writeBlock;  // per block written
+		uint32_t writeBusy;   // programming after single block write or multiple block write end
+	};
+	
+	// Block device over RAM with the same interface as SdCard:
+	// ReadBlocks/WriteBlocks, BeginRead/ReadNext/EndRead and BeginWrite/WriteNext/EndWrite.
+	// Latencies are not waited for, they are summed in BusyTime to model real card throughput.
+	class RamDisk
+	{
+	public:
+		enum{BlockSizeValue = 512};
+	private:
+		uint8_t *_memory;
+		uint32_t _blocks;
+		uint32_t _current;
+		bool _reading;
+		bool _writing;
+		BlockDeviceLatency _latency;
+		
+		uint32_t _commands;
+		uint32_t _blocksRead;
+		uint32_t _blocksWritten;
+		uint32_t _busyTime;
+		
+		RamDisk(const RamDisk &);
+		RamDisk &operator=(const RamDisk &);
+		
+		uint8_t *Block(uint32_t block){ return _memory + (size_t)block * BlockSizeValue; }
+		
+		void Command()
+		{
+			_commands++;
+			_busyTime += _latency.command;
+		}
+		
+		template<class ReadIterator>
+		static void CopyOut(ReadIterator &iter, const uint8_t *src)
+		{
+			for(size_t i = 0; i < BlockSizeValue; ++i, ++iter)
+				*iter = src[i];
+		}
+		
+		static void CopyOut(uint8_t *&ptr, const uint8_t *src)
+		{
+			memcpy(ptr, src, BlockSizeValue);
+			ptr += BlockSizeValue;
+		}
+		
+		template<class WriteIterator>
+		static void CopyIn(WriteIterator &iter, uint8_t *dst)
+		{
+			for(size_t i = 0; i < BlockSizeValue; ++i, ++iter)
+				dst[i] = *iter;
+		}
+		
+		static void CopyIn(const uint8_t *&ptr, uint8_t *dst)
+		{
+			memcpy(dst, ptr, BlockSizeValue);
+			ptr += BlockSizeValue;
+		}
+		
+		static void CopyIn(uint8_t *&ptr, uint8_t *dst)
+		{
+			memcpy(dst, ptr, BlockSizeValue);
+			ptr += BlockSizeValue;
+		}
+		
+		// next block of multiple block transfer, 'iter' is advanced
+		template<class ReadIterator>
+		bool ReceiveBlock(ReadIterator &iter)
+		{
+			if(!_reading || _current >= _blocks)
+				return false;
+			CopyOut(iter, Block(_current++));
+			_blocksRead++;
+			_busyTime += _latency.readBlock;
+			return true;
+		}
+		
+		template<class WriteIterator>
+		bool SendBlock(WriteIterator &iter)
+		{
+			if(!_writing || _current >= _blocks)
+				return false;
+			CopyIn(iter, Block(_current++));
+			_blocksWritten++;
+			_busyTime += _latency.writeBlock;
+			return true;
+		}
+	public:
+		RamDisk(uint8_t *memory = 0, uint32_t blocks = 0)
+			:_reading(false),
+			_writing(false)
+		{
+			Attach(memory, blocks);
+			memset(&_latency, 0, sizeof(_latency));
+			ResetCounters();
+		}
+		
+		void Attach(uint8_t *memory, uint32_t blocks)
+		{
+			_memory = memory;
+			_blocks = memory ? blocks : 0;
+		}
+		
+		uint8_t *Memory(){ return _memory; }
+		uint32_t BlocksCount(){ return _blocks; }
+		size_t BlockSize(){ return BlockSizeValue; }
+		
+		void SetLatency(const BlockDeviceLatency &latency){ _latency = latency; }
+		
+		template<class ReadIterator>
+		bool ReadBlock(ReadIterator iter, uint32_t logicalBlockAddress)
+		{
+			Command();
+			if(logicalBlockAddress >= _blocks || _reading || _writing)
+				return false;
+			CopyOut(iter, Block(logicalBlockAddress));
+			_blocksRead++;
+			_busyTime += _latency.readBlock;
+			return true;
+		}
+		
+		template<class WriteIterator>
+		bool WriteBlock(WriteIterator iter, uint32_t logicalBlockAddress)
+		{
+			Command();
+			if(logicalBlockAddress >= _blocks || _reading || _writing)
+				return false;
+			CopyIn(iter, Block(logicalBlockAddress));
+			_blocksWritten++;
+			_busyTime += _latency.writeBlock + _latency.writeBusy;
+			return true;
+		}
+		
+		bool BeginRead(uint32_t logicalBlockAddress)
+		{
+			Command();
+			if(logicalBlockAddress >= _blocks || _reading || _writing)
+				return false;
+			_current = logicalBlockAddress;
+			_reading = true;
+			return true;
+		}
+		
+		template<class ReadIterator>
+		bool ReadNext(ReadIterator iter)
+		{
+			return ReceiveBlock(iter);
+		}
+		
+		bool EndRead()
+		{
+			Command();
+			bool result = _reading;
+			_reading = false;
+			return result;
+		}
+		
+		// 'preErase' is accepted for compatibility with SdCard
+		bool BeginWrite(uint32_t logicalBlockAddress, uint32_t preErase = 0)
+		{
+			(void)preErase;
+			Command();
+			if(logicalBlockAddress >= _blocks || _reading || _writing)
+				return false;
+			_current = logicalBlockAddress;
+			_writing = true;
+			return true;
+		}
+		
+		template<class WriteIterator>
+		bool WriteNext(WriteIterator iter)
+		{
+			return SendBlock(iter);
+		}
+		
+		bool EndWrite()
+		{
+			Command();
+			bool result = _writing;
+			_writing = false;
+			_busyTime += _latency.writeBusy;
+			return result;
+		}
+		
+		template<class ReadIterator>
+		bool ReadBlocks(ReadIterator iter, uint32_t logicalBlockAddress, uint32_t count)
+		{
+			if(count == 1)
+				return ReadBlock(iter, logicalBlockAddress);
+			if(!BeginRead(logicalBlockAddress))
+				return false;
+			bool result = true;
+			for(; count && result; --count)
+				result = ReceiveBlock(iter);
+			return EndRead() && result;
+		}
+		
+		template<class WriteIterator>
+		bool WriteBlocks(WriteIterator iter, uint32_t logicalBlockAddress, uint32_t count)
+		{
+			if(count == 1)
+				return WriteBlock(iter, logicalBlockAddress);
+			if(!BeginWrite(logicalBlockAddress, count))
+				return false;
+			bool result = true;
+			for(; count && result; --count)
+				result = SendBlock(iter);
+			return EndWrite() && result;
+		}
+		
+		uint32_t Commands() const { return _commands; }
+		uint32_t BlocksRead() const { return _blocksRead; }
+		uint32_t BlocksWritten() const { return _blocksWritten; }
+		// Modelled device time in microseconds
+		uint32_t BusyTime() const { return _busyTime; }
+		void ResetCounters(){ _commands = _blocksRead = _blocksWritten = _busyTime = 0; }
+	};
+}
+}
@@ -0,0 +1,456 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace Mcucpp
+{
+namespace Fs
+{
+	const size_t SectorSize = 512;
+	
+	struct SectorCacheLine
+	{
+		enum
+		{
+			Valid = 1,
+			Dirty = 2,
+			Pinned = 4
+		};
+		uint32_t sector;
+		uint32_t lastUse;
+		uint8_t flags;
+	};
+	
+	// RAM for cache with 'Lines' sectors
+	template<unsigned Lines>
+	struct SectorCacheStorage
+	{
+		uint8_t buffer[Lines * SectorSize];
+		SectorCacheLine lines[Lines];
+		static const unsigned LineCount = Lines;
+	};
+	
+	// Set associative sector cache between file system and block device.
+	// 'Dev' is block device like SdCard: ReadBlocks/WriteBlocks, BeginRead/ReadNext/EndRead
+	// and BeginWrite/WriteNext/EndWrite for consecutive blocks.
+	// Sector N is cached in set N % sets, sets = lineCount / ways, least recently used
+	// line of the set is replaced. Modified sectors are written back on eviction or Flush,
+	// consecutive dirty sectors are written with one multiple block command.
+	// Sectors in pinned range are replaced by other sectors only when all lines of the set are pinned.
+	// Pointers returned by Read/Modify/Overwrite are valid until the next cache call.
+	template<class Dev>
+	class SectorCache
+	{
+		enum{MaxReadAhead = 32};
+		Dev &_device;
+		uint8_t *_buffer;
+		SectorCacheLine *_lines;
+		unsigned _sets;
+		unsigned _ways;
+		uint32_t _useCounter;
+		uint32_t _pinnedFirst;
+		uint32_t _pinnedCount;
+		unsigned _readAhead;
+		uint32_t _nextSequential;
+		unsigned _dirtyCount;
+		
+		uint32_t _hits;
+		uint32_t _misses;
+		uint32_t _deviceReads;
+		uint32_t _deviceWrites;
+		uint32_t _errors;
+		
+		SectorCache(const SectorCache &);
+		SectorCache &operator=(const SectorCache &);
+		
+		uint8_t *Data(unsigned line){ return _buffer + line * SectorSize; }
+		bool IsPinned(uint32_t sector) const { return sector - _pinnedFirst < _pinnedCount; }
+		
+		int Find(uint32_t sector) const;
+		unsigned Victim(uint32_t sector);
+		bool WriteBack(unsigned line);
+		void Touch(unsigned line);
+		void Assign(unsigned line, uint32_t sector);
+		int Load(uint32_t sector);
+		void SetDirty(unsigned line);
+	public:
+		SectorCache(Dev &device, uint8_t *buffer, SectorCacheLine *lines, unsigned lineCount, unsigned ways = 4);
+		
+		template<unsigned Lines>
+		SectorCache(Dev &device, SectorCacheStorage<Lines> &storage, unsigned ways = 4)
+			:_device(device)
+		{
+			Init(storage.buffer, storage.lines, Lines, ways);
+		}
+		
+		void Init(uint8_t *buffer, SectorCacheLine *lines, unsigned lineCount, unsigned ways);
+		
+		Dev &Device(){ return _device; }
+		
+		// Sector contents or null on device error
+		const uint8_t *Read(uint32_t sector);
+		// Sector contents to be changed, sector is marked dirty
+		uint8_t *Modify(uint32_t sector);
+		// Dirty sector without reading it from device, caller fills it entirely
+		uint8_t *Overwrite(uint32_t sector);
+		
+		// Writes all dirty sectors to device
+		bool Flush();
+		// Drops cached copies of sectors, dirty ones are discarded too
+		void Invalidate(uint32_t first, uint32_t count);
+		void Clear();
+		
+		// Sectors in given range (like FAT) stay in cache in favour of other sectors
+		void SetPinnedRange(uint32_t first, uint32_t count);
+		// Number of sectors read at once when sequential access is detected, 0 or 1 to disable.
+		// It is limited by number of sets and 32 sectors.
+		void SetReadAhead(unsigned sectors);
+		
+		bool IsCached(uint32_t sector) const { return Find(sector) >= 0; }
+		unsigned DirtyCount() const { return _dirtyCount; }
+		
+		uint32_t Hits() const { return _hits; }
+		uint32_t Misses() const { return _misses; }
+		// block device commands issued
+		uint32_t DeviceReads() const { return _deviceReads; }
+		uint32_t DeviceWrites() const { return _deviceWrites; }
+		uint32_t Errors() const { return _errors; }
+		void ResetCounters(){ _hits = _misses = _deviceReads = _deviceWrites = _errors = 0; }
+	};
+	
+	template<class Dev>
+	SectorCache<Dev>::SectorCache(Dev &device, uint8_t *buffer, SectorCacheLine *lines, unsigned lineCount, unsigned ways)
+		:_device(device)
+	{
+		Init(buffer, lines, lineCount, ways);
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::Init(uint8_t *buffer, SectorCacheLine *lines, unsigned lineCount, unsigned ways)
+	{
+		_buffer = buffer;
+		_lines = lines;
+		// fall back to fully associative cache if lines can not be split to sets evenly
+		if(ways == 0 || ways > lineCount || lineCount % ways != 0)
+			ways = lineCount;
+		_ways = ways;
+		_sets = ways ? lineCount / ways : 0;
+		_useCounter = 0;
+		_pinnedFirst = 0;
+		_pinnedCount = 0;
+		_readAhead = 0;
+		_nextSequential = 0;
+		Clear();
+		ResetCounters();
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::Clear()
+	{
+		for(unsigned i = 0; i < _sets * _ways; i++)
+		{
+			_lines[i].flags = 0;
+			_lines[i].lastUse = 0;
+		}
+		_dirtyCount = 0;
+	}
+	
+	template<class Dev>
+	int SectorCache<Dev>::Find(uint32_t sector) const
+	{
+		if(_sets == 0)
+			return -1;
+		unsigned first = (sector % _sets) * _ways;
+		for(unsigned i = first; i < first + _ways; i++)
+		{
+			if((_lines[i].flags & SectorCacheLine::Valid) && _lines[i].sector == sector)
+				return (int)i;
+		}
+		return -1;
+	}
+	
+	template<class Dev>
+	unsigned SectorCache<Dev>::Victim(uint32_t sector)
+	{
+		unsigned first = (sector % _sets) * _ways;
+		unsigned victim = first;
+		bool victimPinned = true;
+		for(unsigned i = first; i < first + _ways; i++)
+		{
+			const SectorCacheLine &line = _lines[i];
+			if(!(line.flags & SectorCacheLine::Valid))
+				return i;
+			bool linePinned = (line.flags & SectorCacheLine::Pinned) != 0;
+			// unpinned lines are preferred, then least recently used
+			if((victimPinned && !linePinned) ||
+				(victimPinned == linePinned && line.lastUse - _lines[victim].lastUse > 0x80000000u))
+			{
+				victim = i;
+				victimPinned = linePinned;
+			}
+		}
+		return victim;
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::Touch(unsigned line)
+	{
+		_lines[line].lastUse = ++_useCounter;
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::SetDirty(unsigned line)
+	{
+		if(!(_lines[line].flags & SectorCacheLine::Dirty))
+		{
+			_lines[line].flags |= SectorCacheLine::Dirty;
+			_dirtyCount++;
+		}
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::Assign(unsigned line, uint32_t sector)
+	{
+		_lines[line].sector = sector;
+		_lines[line].flags = SectorCacheLine::Valid | (IsPinned(sector) ? SectorCacheLine::Pinned : 0);
+		Touch(line);
+	}
+	
+	template<class Dev>
+	bool SectorCache<Dev>::WriteBack(unsigned line)
+	{
+		if(!(_lines[line].flags & SectorCacheLine::Dirty))
+			return true;
+		_deviceWrites++;
+		if(!_device.WriteBlocks(const_cast<const uint8_t *>(Data(line)), _lines[line].sector, 1))
+		{
+			_errors++;
+			return false;
+		}
+		_lines[line].flags &= ~SectorCacheLine::Dirty;
+		_dirtyCount--;
+		return true;
+	}
+	
+	template<class Dev>
+	int SectorCache<Dev>::Load(uint32_t sector)
+	{
+		if(_sets == 0)
+			return -1;
+		int found = Find(sector);
+		if(found >= 0)
+		{
+			_hits++;
+			Touch(found);
+			return found;
+		}
+		_misses++;
+		
+		unsigned count = 1;
+		if(_readAhead > 1 && sector == _nextSequential)
+		{
+			// read following sectors until one of them is already cached,
+			// they all are placed to different sets
+			unsigned limit = _readAhead < _sets ? _readAhead : _sets;
+			if(limit > MaxReadAhead)
+				limit = MaxReadAhead;
+			while(count < limit && Find(sector + count) < 0)
+				count++;
+		}
+		_nextSequential = sector + count;
+		
+		// victims are written back before read command is started
+		unsigned first = Victim(sector);
+		if(!WriteBack(first))
+			return -1;
+		_lines[first].flags = 0;
+		unsigned lines[MaxReadAhead];
+		lines[0] = first;
+		for(unsigned i = 1; i < count; i++)
+		{
+			lines[i] = Victim(sector + i);
+			if(!WriteBack(lines[i]))
+				return -1;
+			_lines[lines[i]].flags = 0;
+		}
+		_deviceReads++;
+		bool result;
+		if(count == 1)
+		{
+			result = _device.ReadBlocks(Data(first), sector, 1);
+			if(result)
+				Assign(first, sector);
+		}
+		else
+		{
+			result = _device.BeginRead(sector);
+			if(result)
+			{
+				for(unsigned i = 0; i < count && result; i++)
+				{
+					if((result = _device.ReadNext(Data(lines[i]))))
+						Assign(lines[i], sector + i);
+				}
+				result = _device.EndRead() && result;
+				// sector asked for is the most recently used one
+				Touch(first);
+			}
+		}
+		if(!result)
+			_errors++;
+		return (_lines[first].flags & SectorCacheLine::Valid) ? (int)first : -1;
+	}
+	
+	template<class Dev>
+	const uint8_t *SectorCache<Dev>::Read(uint32_t sector)
+	{
+		int line = Load(sector);
+		return line >= 0 ? Data(line) : 0;
+	}
+	
+	template<class Dev>
+	uint8_t *SectorCache<Dev>::Modify(uint32_t sector)
+	{
+		int line = Load(sector);
+		if(line < 0)
+			return 0;
+		SetDirty(line);
+		return Data(line);
+	}
+	
+	template<class Dev>
+	uint8_t *SectorCache<Dev>::Overwrite(uint32_t sector)
+	{
+		if(_sets == 0)
+			return 0;
+		int line = Find(sector);
+		if(line < 0)
+		{
+			line = Victim(sector);
+			if(!WriteBack(line))
+				return 0;
+			Assign(line, sector);
+		}
+		else
+			Touch(line);
+		SetDirty(line);
+		return Data(line);
+	}
+	
+	template<class Dev>
+	bool SectorCache<Dev>::Flush()
+	{
+		bool result = true;
+		uint32_t from = 0;
+		while(_dirtyCount)
+		{
+			// lowest dirty sector not below 'from'
+			int start = -1;
+			for(unsigned i = 0; i < _sets * _ways; i++)
+			{
+				const SectorCacheLine &line = _lines[i];
+				if((line.flags & SectorCacheLine::Dirty) && line.sector >= from &&
+					(start < 0 || line.sector < _lines[start].sector))
+					start = i;
+			}
+			if(start < 0)
+				break;
+			uint32_t sector = _lines[start].sector;
+			unsigned count = 1;
+			int next;
+			while((next = Find(sector + count)) >= 0 && (_lines[next].flags & SectorCacheLine::Dirty))
+				count++;
+			from = sector + count;
+			
+			if(count == 1)
+			{
+				result = WriteBack(start) && result;
+				continue;
+			}
+			_deviceWrites++;
+			bool ok = _device.BeginWrite(sector, count);
+			for(unsigned i = 0; i < count && ok; i++)
+			{
+				unsigned line = Find(sector + i);
+				ok = _device.WriteNext(const_cast<const uint8_t *>(Data(line)));
+				if(ok)
+				{
+					_lines[line].flags &= ~SectorCacheLine::Dirty;
+					_dirtyCount--;
+				}
+			}
+			if(!_device.EndWrite() || !ok)
+			{
+				_errors++;
+				result = false;
+			}
+		}
+		return result;
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::Invalidate(uint32_t first, uint32_t count)
+	{
+		for(unsigned i = 0; i < _sets * _ways; i++)
+		{
+			SectorCacheLine &line = _lines[i];
+			if((line.flags & SectorCacheLine::Valid) && line.sector - first < count)
+			{
+				if(line.flags & SectorCacheLine::Dirty)
+					_dirtyCount--;
+				line.flags = 0;
+			}
+		}
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::SetPinnedRange(uint32_t first, uint32_t count)
+	{
+		_pinnedFirst = first;
+		_pinnedCount = count;
+		for(unsigned i = 0; i < _sets * _ways; i++)
+		{
+			SectorCacheLine &line = _lines[i];
+			if(IsPinned(line.sector))
+				line.flags |= SectorCacheLine::Pinned;
+			else
+				line.flags &= ~SectorCacheLine::Pinned;
+		}
+	}
+	
+	template<class Dev>
+	void SectorCache<Dev>::SetReadAhead(unsigned sectors)
+	{
+		_readAhead = sectors;
+	}
+}
+}
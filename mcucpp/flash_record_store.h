@@ -0,0 +1,537 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <crc.h>
+
+namespace Mcucpp
+{
+	struct FlashRecordIndexEntry
+	{
+		uint16_t key;
+		uint16_t page;     // page number in the store, not in flash
+		uint32_t offset;   // record header offset in page
+	};
+
+	template<unsigned Entries>
+	struct FlashRecordIndexStorage
+	{
+		FlashRecordIndexEntry entries[Entries];
+		static const unsigned EntryCount = Entries;
+	};
+
+	// Append only record store in a ring of internal flash pages.
+	// FlashT is static flash driver like Stm32F40x Flash: PageAddress, PageSize,
+	// ErasePage and WritePage. Pages must be memory mapped, erased to 0xff and
+	// of equal size, store occupies 'pages' of them starting from 'firstPage'.
+	//
+	// Page:   PageHeader, records, erased space.
+	// Record: RecordHeader, data, padding to RecordAlign.
+	//
+	// Records are never rewritten in place, new value of a key is appended and
+	// the RAM index built by Mount with one pass over the pages points to the last
+	// one. When active page is full, the next one in the ring becomes active and the
+	// oldest page is recycled: its live values are copied to the active page, then
+	// it is erased and kept as the spare page. So every page is erased in turn.
+	// Log records are not indexed and are dropped when their page is recycled.
+	// Live data should stay well below (pages - 1) page sizes, otherwise Write fails.
+	//
+	// Interrupted write leaves torn record which fails CRC check, rest of that
+	// page is not used any more. Interrupted recycling is completed by next Mount.
+	template<class FlashT>
+	class FlashRecordStore
+	{
+	public:
+		enum RecordType
+		{
+			ValueRecord = 0x0001,
+			RemovedRecord = 0x0002,
+			LogRecord = 0x0004
+		};
+
+		enum
+		{
+			RecordAlign = 4,
+			MaxKey = 0xfffe
+		};
+
+		struct Record
+		{
+			uint16_t key;
+			uint16_t length;
+			RecordType type;
+			const uint8_t *data;
+			unsigned position;  // pages passed from the oldest one
+			uint32_t offset;
+		};
+	private:
+		// Magic is written last, so torn header is not valid.
+		struct PageHeader
+		{
+			uint32_t sequence;
+			uint32_t magic;
+		};
+
+		struct RecordHeader
+		{
+			uint16_t key;
+			uint16_t length;
+			uint16_t type;
+			uint16_t crc;
+		};
+
+		static const uint32_t Magic = 0x5346434d; // 'MCFS'
+		static const uint32_t Erased = 0xffffffff;
+
+		FlashRecordIndexEntry *_index;
+		unsigned _indexSize;
+		unsigned _count;
+		unsigned _firstPage;
+		unsigned _pages;
+		unsigned _active;
+		uint32_t _offset;
+		uint32_t _sequence;
+		bool _mounted;
+
+		static uint32_t RecordSize(uint16_t length)
+		{
+			return (sizeof(RecordHeader) + length + RecordAlign - 1) & ~(uint32_t)(RecordAlign - 1);
+		}
+
+		uint32_t PageSize(unsigned page) const
+		{
+			return FlashT::PageSize(_firstPage + page);
+		}
+
+		const uint8_t *Address(unsigned page, uint32_t offset) const
+		{
+			return (const uint8_t *)(uintptr_t)(FlashT::PageAddress(_firstPage + page) + offset);
+		}
+
+		unsigned NextPage(unsigned page) const
+		{
+			return page + 1 < _pages ? page + 1 : 0;
+		}
+
+		bool ReadPageHeader(unsigned page, PageHeader &header) const
+		{
+			memcpy(&header, Address(page, 0), sizeof(header));
+			return header.magic == Magic && header.sequence != Erased;
+		}
+
+		bool PageValid(unsigned page) const
+		{
+			PageHeader header;
+			return ReadPageHeader(page, header);
+		}
+
+		bool PageErased(unsigned page) const
+		{
+			const uint32_t *ptr = (const uint32_t *)Address(page, 0);
+			for(uint32_t i = 0; i < PageSize(page) / 4; i++)
+			{
+				if(ptr[i] != Erased)
+					return false;
+			}
+			return true;
+		}
+
+		static uint16_t RecordCrc(const RecordHeader &header, const void *data)
+		{
+			uint16_t crc = ComputeCrc<XModemCrcTable>((const uint8_t *)&header, offsetof(RecordHeader, crc));
+			return ComputeCrc<XModemCrcTable>((const uint8_t *)data, header.length, crc);
+		}
+
+		static bool HeaderErased(const RecordHeader &header)
+		{
+			return header.key == 0xffff && header.length == 0xffff && header.type == 0xffff && header.crc == 0xffff;
+		}
+
+		// Reads and checks record at offset, returns false at the end of records in page
+		bool ReadRecord(unsigned page, uint32_t offset, uint32_t end, RecordHeader &header) const
+		{
+			if(offset + sizeof(RecordHeader) > end)
+				return false;
+			memcpy(&header, Address(page, offset), sizeof(header));
+			if(HeaderErased(header))
+				return false;
+			return offset + RecordSize(header.length) <= end &&
+				header.key <= MaxKey &&
+				(header.type == ValueRecord || header.type == RemovedRecord || header.type == LogRecord) &&
+				RecordCrc(header, Address(page, offset + sizeof(RecordHeader))) == header.crc;
+		}
+
+		// Returns offset after the last record, page size if the page ends with a damaged one
+		uint32_t ScanPage(unsigned page, bool &ok)
+		{
+			uint32_t offset = sizeof(PageHeader);
+			uint32_t size = PageSize(page);
+			RecordHeader header;
+			while(ReadRecord(page, offset, size, header))
+			{
+				if(header.type == ValueRecord)
+					ok &= IndexInsert(header.key, page, offset);
+				else if(header.type == RemovedRecord)
+					IndexRemove(header.key);
+				offset += RecordSize(header.length);
+			}
+			if(offset + sizeof(RecordHeader) <= size && !HeaderErased(header))
+				return size;
+			return offset;
+		}
+
+		// Index is sorted by key
+		unsigned LowerBound(uint16_t key) const
+		{
+			unsigned first = 0, count = _count;
+			while(count > 0)
+			{
+				unsigned step = count / 2;
+				if(_index[first + step].key < key)
+				{
+					first += step + 1;
+					count -= step + 1;
+				}
+				else
+					count = step;
+			}
+			return first;
+		}
+
+		const FlashRecordIndexEntry *FindEntry(uint16_t key) const
+		{
+			unsigned pos = LowerBound(key);
+			return pos < _count && _index[pos].key == key ? &_index[pos] : 0;
+		}
+
+		bool IndexInsert(uint16_t key, unsigned page, uint32_t offset)
+		{
+			unsigned pos = LowerBound(key);
+			if(pos >= _count || _index[pos].key != key)
+			{
+				if(_count >= _indexSize)
+					return false;
+				memmove(&_index[pos + 1], &_index[pos], (_count - pos) * sizeof(FlashRecordIndexEntry));
+				_count++;
+				_index[pos].key = key;
+			}
+			_index[pos].page = (uint16_t)page;
+			_index[pos].offset = offset;
+			return true;
+		}
+
+		void IndexRemove(uint16_t key)
+		{
+			unsigned pos = LowerBound(key);
+			if(pos < _count && _index[pos].key == key)
+			{
+				_count--;
+				memmove(&_index[pos], &_index[pos + 1], (_count - pos) * sizeof(FlashRecordIndexEntry));
+			}
+		}
+
+		bool HasValues(unsigned page) const
+		{
+			for(unsigned i = 0; i < _count; i++)
+			{
+				if(_index[i].page == page)
+					return true;
+			}
+			return false;
+		}
+
+		bool Program(uint32_t offset, const void *data, size_t length)
+		{
+			return length == 0 || FlashT::WritePage(_firstPage + _active, (void *)data, length, offset);
+		}
+
+		bool Append(const RecordHeader &header, const void *data)
+		{
+			uint32_t offset = _offset;
+			// Record is already damaged if either write fails, do not use rest of the page
+			_offset = PageSize(_active);
+			if(!Program(offset, &header, sizeof(header)) ||
+				!Program(offset + sizeof(header), data, header.length))
+				return false;
+			_offset = offset + RecordSize(header.length);
+			return true;
+		}
+
+		bool StartPage(unsigned page)
+		{
+			if(!PageErased(page) && !FlashT::ErasePage(_firstPage + page))
+				return false;
+			PageHeader header;
+			header.sequence = _sequence + 1;
+			header.magic = Magic;
+			if(!FlashT::WritePage(_firstPage + page, &header, sizeof(header), 0))
+				return false;
+			_sequence++;
+			_active = page;
+			_offset = sizeof(PageHeader);
+			return true;
+		}
+
+		// Moves live values of the page to the active one and erases it
+		bool Recycle(unsigned page)
+		{
+			for(unsigned i = 0; i < _count; i++)
+			{
+				FlashRecordIndexEntry &entry = _index[i];
+				if(entry.page != page)
+					continue;
+				RecordHeader header;
+				memcpy(&header, Address(page, entry.offset), sizeof(header));
+				uint32_t size = RecordSize(header.length);
+				if(_offset + size > PageSize(_active))
+					return false;
+				if(!Append(header, Address(page, entry.offset + sizeof(RecordHeader))))
+					return false;
+				entry.page = (uint16_t)_active;
+				entry.offset = _offset - size;
+			}
+			return FlashT::ErasePage(_firstPage + page);
+		}
+
+		bool Rotate()
+		{
+			unsigned page = NextPage(_active);
+			// ring is full of live data, erasing would lose it
+			if(HasValues(page))
+				return false;
+			// page ring and index are inconsistent after failure here, Mount has to recover them
+			if(!StartPage(page))
+			{
+				_mounted = false;
+				return false;
+			}
+			unsigned oldest = NextPage(_active);
+			if(PageValid(oldest))
+			{
+				if(!Recycle(oldest))
+					_mounted = false;
+				return _mounted;
+			}
+			return PageErased(oldest) || FlashT::ErasePage(_firstPage + oldest);
+		}
+
+		bool AppendRecord(uint16_t key, const void *data, uint16_t length, RecordType type)
+		{
+			if(!_mounted || key > MaxKey)
+				return false;
+			uint32_t size = RecordSize(length);
+			if(size > PageSize(_active) - sizeof(PageHeader))
+				return false;
+			if(type == ValueRecord && !FindEntry(key) && _count >= _indexSize)
+				return false;
+			for(unsigned i = 0; _offset + size > PageSize(_active); i++)
+			{
+				if(i >= _pages || !Rotate())
+					return false;
+			}
+			RecordHeader header;
+			header.key = key;
+			header.length = length;
+			header.type = (uint16_t)type;
+			header.crc = RecordCrc(header, data);
+			if(!Append(header, data))
+				return false;
+			if(type == ValueRecord)
+				IndexInsert(key, _active, _offset - size);
+			else if(type == RemovedRecord)
+				IndexRemove(key);
+			return true;
+		}
+
+		bool Fetch(Record &record) const
+		{
+			for(; record.position < _pages; record.position++, record.offset = sizeof(PageHeader))
+			{
+				unsigned page = (_active + 1 + record.position) % _pages;
+				if(!PageValid(page))
+					continue;
+				RecordHeader header;
+				if(ReadRecord(page, record.offset, page == _active ? _offset : PageSize(page), header))
+				{
+					record.key = header.key;
+					record.length = header.length;
+					record.type = (RecordType)header.type;
+					record.data = Address(page, record.offset + sizeof(RecordHeader));
+					return true;
+				}
+			}
+			return false;
+		}
+	public:
+		FlashRecordStore(unsigned firstPage, unsigned pages, FlashRecordIndexEntry *index, unsigned indexSize)
+			:_index(index), _indexSize(indexSize), _count(0),
+			_firstPage(firstPage), _pages(pages),
+			_active(0), _offset(0), _sequence(0), _mounted(false)
+		{}
+
+		template<unsigned Entries>
+		FlashRecordStore(unsigned firstPage, unsigned pages, FlashRecordIndexStorage<Entries> &storage)
+			:_index(storage.entries), _indexSize(Entries), _count(0),
+			_firstPage(firstPage), _pages(pages),
+			_active(0), _offset(0), _sequence(0), _mounted(false)
+		{}
+
+		// Erases all pages and starts empty store
+		bool Format()
+		{
+			_mounted = false;
+			_count = 0;
+			_sequence = 0;
+			if(_pages < 2)
+				return false;
+			for(unsigned page = 0; page < _pages; page++)
+			{
+				if(!PageErased(page) && !FlashT::ErasePage(_firstPage + page))
+					return false;
+			}
+			if(!StartPage(0))
+				return false;
+			_mounted = true;
+			return true;
+		}
+
+		// Builds index with one pass over pages from the oldest one, formats flash holding no store
+		bool Mount()
+		{
+			_mounted = false;
+			_count = 0;
+			if(_pages < 2)
+				return false;
+			bool found = false;
+			for(unsigned page = 0; page < _pages; page++)
+			{
+				PageHeader header;
+				if(ReadPageHeader(page, header) && (!found || header.sequence > _sequence))
+				{
+					found = true;
+					_active = page;
+					_sequence = header.sequence;
+				}
+			}
+			if(!found)
+				return Format();
+
+			bool ok = true;
+			for(unsigned i = 1; i <= _pages; i++)
+			{
+				unsigned page = (_active + i) % _pages;
+				if(!PageValid(page))
+					continue;
+				uint32_t end = ScanPage(page, ok);
+				if(page == _active)
+					_offset = end;
+			}
+			if(!ok)
+				return false;
+
+			// complete interrupted recycling or page start, so the next page is spare again
+			unsigned spare = NextPage(_active);
+			if(PageValid(spare) && !Recycle(spare))
+			{
+				// While the oldest page is not erased, the active one holds only copies
+				// of its values. Copy was damaged or did not fit, drop the copies.
+				if(!FlashT::ErasePage(_firstPage + _active))
+					return false;
+				return Mount();
+			}
+			if(!PageErased(spare) && !FlashT::ErasePage(_firstPage + spare))
+				return false;
+			_mounted = true;
+			return true;
+		}
+
+		bool Mounted() const { return _mounted; }
+
+		bool Write(uint16_t key, const void *data, uint16_t length)
+		{
+			return AppendRecord(key, data, length, ValueRecord);
+		}
+
+		bool Remove(uint16_t key)
+		{
+			if(!FindEntry(key))
+				return false;
+			return AppendRecord(key, 0, 0, RemovedRecord);
+		}
+
+		// Appends not indexed record, it is only reached with First/Next
+		bool Log(uint16_t key, const void *data, uint16_t length)
+		{
+			return AppendRecord(key, data, length, LogRecord);
+		}
+
+		// Returns pointer to value data in flash or null if key is not found
+		const uint8_t *Find(uint16_t key, uint16_t &length) const
+		{
+			const FlashRecordIndexEntry *entry = FindEntry(key);
+			if(!entry)
+				return 0;
+			RecordHeader header;
+			memcpy(&header, Address(entry->page, entry->offset), sizeof(header));
+			length = header.length;
+			return Address(entry->page, entry->offset + sizeof(RecordHeader));
+		}
+
+		bool Read(uint16_t key, void *buffer, uint16_t size) const
+		{
+			uint16_t length;
+			const uint8_t *data = Find(key, length);
+			if(!data)
+				return false;
+			memcpy(buffer, data, length < size ? length : size);
+			return true;
+		}
+
+		// Iterates over all records from the oldest to the newest one,
+		// overwritten values and removals are included
+		bool First(Record &record) const
+		{
+			record.position = 0;
+			record.offset = sizeof(PageHeader);
+			return _mounted && Fetch(record);
+		}
+
+		bool Next(Record &record) const
+		{
+			record.offset += RecordSize(record.length);
+			return Fetch(record);
+		}
+
+		unsigned Count() const { return _count; }
+		uint32_t FreeSpace() const { return _mounted ? PageSize(_active) - _offset : 0; }
+		uint32_t Sequence() const { return _sequence; }
+	};
+}
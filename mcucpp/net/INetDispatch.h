@@ -38,11 +38,41 @@ namespace Net
 	
 	typedef uint32_t TransferId;
 	
+	const size_t EthernetHeaderSize = 6 + 6 + 2;
+	// IEEE 802.1Q tag: tag control information and encapsulated EtherType
+	const size_t VlanTagSize = 4;
+	
+	inline uint16_t VlanId(uint16_t vlanTag) { return vlanTag & 0x0fff; }
+	inline uint8_t VlanPriority(uint16_t vlanTag) { return (uint8_t)(vlanTag >> 13); }
+	inline uint16_t MakeVlanTag(uint16_t vlanId, uint8_t priority) { return (uint16_t)((priority << 13) | (vlanId & 0x0fff)); }
+	
+	class NetInterface;
+	
+	// Received frame descriptor used for batched delivery.
+	// 'buffer' holds the whole frame including link layer header of 'headerSize' bytes.
+	// Interfaces stripping 802.1Q tags in hardware report them in 'vlanTag'.
+	struct RxFrame
+	{
+		RxFrame()
+			:protocolId(0), headerSize(0), vlanTag(0), checksumFlags(ChecksumNone), buffer(0)
+		{}
+		Net::MacAddr srcAddr;
+		Net::MacAddr destAddr;
+		uint16_t protocolId;
+		uint16_t headerSize;
+		uint16_t vlanTag;
+		uint8_t checksumFlags; // checksums verified by hardware, ChecksumFlags
+		Net::DataBuffer *buffer;
+	};
+	
 	class INetDispatch
 	{
 	public:
-		virtual void TxComplete(TransferId txId, bool success)=0;
-		virtual void RxComplete(const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)=0;
+		virtual void TxComplete(NetInterface *interface, TransferId txId, bool success)=0;
+		virtual void RxComplete(NetInterface *interface, const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)=0;
+		// Takes ownership of all frames buffers
+		virtual void RxCompleteBatch(NetInterface *interface, RxFrame *frames, unsigned count)=0;
+		// Returns false if frame is not accepted for transmission, 'buffer' is left to caller then
 		virtual bool SendMesage(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)=0;
 	};
 	
@@ -31,14 +31,23 @@
 #include <net/NetInterface.h>
 #include <net/INetDispatch.h>
 #include <net/INetProtocol.h>
-#include <Dispatcher.h>
+#include <net/net_stats.h>
+#include <net/tx_scheduler.h>
+#include <dispatcher.h>
 #include <array.h>
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+#include <net/net_capture.h>
+#endif
 
 namespace Mcucpp
 {
 namespace Net
 {
 
+	// Number of receive priority lanes. Frames of a receive batch are delivered 
+	// starting from the highest lane, so control traffic preempts bulk transfers.
+	const unsigned NetRxLanes = 2;
+	
 	class NetDispatch: public INetDispatch
 	{
 		enum{MaxInterfaces = 4};
@@ -47,23 +56,53 @@ namespace Net
 		
 		struct ProtocolIdPair
 		{
-			ProtocolIdPair(INetProtocol *p, uint16_t i) :protocol(p), id(i) {}
+			ProtocolIdPair(INetProtocol *p, uint16_t i, uint16_t v) :protocol(p), id(i), vlanId(v) {}
 			INetProtocol *protocol;
 			uint16_t id;
+			uint16_t vlanId;
 		};
 		
 		Containers::FixedArray<MaxInterfaces, NetInterface *> _interfaces;
+		Containers::FixedArray<MaxInterfaces, NetTxScheduler *> _schedulers;
 		Containers::FixedArray<MaxProtocols, ProtocolIdPair> _protocols;
 		
+		NetStats *_stats;
+		
+		uint8_t _priorityLanes[8];
+		
+		INetProtocol *FindProtocol(uint16_t protocoId, uint16_t vlanId);
+		unsigned InterfaceIndex(NetInterface *interface);
+		unsigned SelectInterface();
+		// delivers frames of 'lane', all frames if lane is NetRxLanes
+		void DeliverFrames(unsigned interfaceIndex, RxFrame *frames, unsigned count, unsigned lane);
+		static bool ParseVlanTag(RxFrame &frame);
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+		NetCapture *_capture;
+		void Capture(CaptureDirection direction, const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, const DataBuffer *chain);
+#endif
 	public: // INetDispatch
 		virtual void TxComplete(NetInterface *interface, TransferId txId, bool success);
 		virtual void RxComplete(NetInterface *interface, const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer);
+		virtual void RxCompleteBatch(NetInterface *interface, RxFrame *frames, unsigned count);
 		virtual bool SendMesage(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer);
 	public:
 		NetDispatch(Dispatcher &dispatcher);
-		void AddInterface(NetInterface *interface);
-		void AddProtocol(uint16_t protocoId, INetProtocol *protocol);
+		// Frames to the interface are queued in 'scheduler' if it is given,
+		// otherwise they are passed to interface Transmit directly.
+		void AddInterface(NetInterface *interface, NetTxScheduler *scheduler = 0);
+		// Registers 'protocol' for untagged frames or for frames of VLAN 'vlanId'.
+		// Frames of VLANs without registered protocols are dropped.
+		void AddProtocol(uint16_t protocoId, INetProtocol *protocol, uint16_t vlanId = 0);
+		// Maps 802.1Q priority code point to receive lane, untagged frames have priority 0.
+		// By default priorities 0-3 go to lane 0 and 4-7 to lane 1.
+		void SetPriorityLane(uint8_t priority, uint8_t lane);
 		void Poll();
+		// Per interface and per EtherType traffic is counted in 'stats', may be null
+		void SetStats(NetStats *stats) { _stats = stats; }
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+		// Received and sent frames are recorded to 'capture' while it is enabled
+		void SetCapture(NetCapture *capture) { _capture = capture; }
+#endif
 	};
 	
 }}
\ No newline at end of file
@@ -45,7 +45,7 @@ namespace Net
 		NetIfLinked,
 		NetIfLinkSpeedKbps,
 		NetIfHwState,
-		NetIfSupportHwCheckSum
+		NetIfSupportHwCheckSum // ChecksumFlags mask of checksums computed by hardware
 	};
 	
 
@@ -65,8 +65,16 @@ namespace Net
 		virtual void PauseCommand(uint16_t time)=0;
 		virtual void Poll()=0;
 		virtual uint32_t GetParameter(NetInterfaceParameter parameterId)=0;
+		
+		// Receive filter for additional destination addresses, i.e. multicast groups.
+		// Perfect filter slots are used first, then the hash table, it passes frames with the same address hash too.
+		virtual bool AddAddressFilter(const Net::MacAddr &macaddr)=0;
+		virtual bool RemoveAddressFilter(const Net::MacAddr &macaddr)=0;
+		virtual void SetPromiscuous(bool promiscuous)=0;
 
 		virtual TransferId Transmit(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)=0;
+		// Returns true if frame in 'buffer' fits to transmit queue now
+		virtual bool CanTransmit(Net::NetBuffer &buffer)=0;
 		virtual bool TxCompleteFor(TransferId txId)=0;
 		
 	public:
@@ -0,0 +1,155 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/INetProtocol.h>
+#include <net/INetDispatch.h>
+#include <net/net_addr.h>
+#include <dispatcher.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MAX_ARP_PENDING) && MAX_ARP_PENDING > 0
+	const size_t MaxArpPending = MAX_ARP_PENDING;
+#else
+	const size_t MaxArpPending = 4;
+#endif
+	
+	enum ArpEntryState
+	{
+		ArpFree = 0,
+		ArpIncomplete,  // request sent, waiting for reply
+		ArpReachable,
+		ArpStatic       // added by user, never aged or evicted
+	};
+	
+	struct ArpEntry
+	{
+		ArpEntry()
+			:age(0), state(ArpFree), referenced(0)
+		{}
+		Net::IpAddr ip;
+		Net::MacAddr mac;
+		uint16_t age;       // aging periods since last update, or requests sent for incomplete entry
+		uint8_t state;
+		uint8_t referenced; // used since last eviction clock pass
+	};
+	
+	// ARP protocol with neighbor cache.
+	// Cache is an open-addressed hash table with linear probing over caller-provided storage,
+	// it is filled up to 3/4 of capacity, then least recently used entries are evicted with clock algorithm.
+	class Arp :public INetProtocol
+	{
+		struct PendingFrame
+		{
+			PendingFrame()
+				:buffer(0), protocolId(0), checksumFlags(0)
+			{}
+			Net::IpAddr ip;
+			DataBuffer *buffer;
+			uint16_t protocolId;
+			uint8_t checksumFlags;
+		};
+		
+		Dispatcher &_dispatcher;
+		INetDispatch &_netDispatch;
+		ArpEntry *_entries;
+		size_t _mask;
+		size_t _count;
+		size_t _hand;
+		PendingFrame _pending[MaxArpPending];
+		
+		Net::IpAddr _ipAddr;
+		Net::MacAddr _macAddr;
+		uint32_t _agingPeriod;
+		uint16_t _maxAge;
+		uint16_t _maxRetries;
+		bool _agingArmed;
+		
+		uint32_t _hits;
+		uint32_t _misses;
+		uint32_t _evictions;
+		uint32_t _pendingDropped;
+		
+		size_t Home(const Net::IpAddr &ip) const;
+		ArpEntry *Find(const Net::IpAddr &ip);
+		ArpEntry *Insert(const Net::IpAddr &ip, ArpEntryState state);
+		void RemoveAt(size_t index);
+		bool Evict();
+		void Update(const Net::IpAddr &ip, const Net::MacAddr &mac, bool create);
+		void SendArp(uint16_t operation, const Net::MacAddr &destMac, const Net::MacAddr &targetMac, const Net::IpAddr &targetIp);
+		void FlushPending(const Net::IpAddr &ip, const Net::MacAddr &mac);
+		void DropPending(const Net::IpAddr &ip);
+		void StartAging();
+		void AgingTimer();
+	public:
+		enum Operation
+		{
+			ArpRequest = 1,
+			ArpReply = 2
+		};
+		
+		enum Statistic
+		{
+			ArpHits,
+			ArpMisses,
+			ArpEvictions,
+			ArpPendingDropped,
+			ArpEntries
+		};
+		
+		// 'capacity' is rounded down to power of 2
+		Arp(Dispatcher &dispatcher, INetDispatch &netDispatch, ArpEntry *storage, size_t capacity);
+		
+		void SetAddress(const Net::IpAddr &ipAddr, const Net::MacAddr &macAddr);
+		
+		// Aging timer period in dispatcher ticks, resolved entries lifetime and request retries in periods
+		void SetAging(uint32_t agingPeriod, uint16_t maxAge, uint16_t maxRetries);
+		
+		// Looks up MAC address for 'ip' in the cache only
+		bool Lookup(const Net::IpAddr &ip, Net::MacAddr &mac);
+		
+		// Looks up MAC address for 'ip'. On miss sends request and returns false.
+		bool Resolve(const Net::IpAddr &ip, Net::MacAddr &mac);
+		
+		// Sends 'buffer' to 'ip' host. If address is not resolved yet, buffer is moved to pending queue
+		// and sent when reply arrives. Returns false if pending queue is full, buffer is left untouched.
+		bool Send(const Net::IpAddr &ip, uint16_t protocolId, Net::NetBuffer &buffer);
+		
+		bool AddStatic(const Net::IpAddr &ip, const Net::MacAddr &mac);
+		bool Remove(const Net::IpAddr &ip);
+		void Clear();
+		
+		uint32_t GetStatistic(Statistic statistic) const;
+		
+	public: // INetProtocol
+		virtual void ProcessMessage(const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, Net::NetBuffer &buffer);
+	};
+}
+}
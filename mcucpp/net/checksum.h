@@ -0,0 +1,81 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <net/net_buffer.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+	// Adds 'length' bytes of buffer chain starting from 'offset' to one's complement sum 'sum'.
+	// Returns not folded 32 bit sum, it can be passed as initial value to the next call.
+	// Fragments of odd size are handled, the data is summed as if it was contiguous.
+	uint32_t ChecksumAdd(const DataBuffer *chain, size_t offset, size_t length, uint32_t sum = 0);
+	
+	// Adds contiguous memory block to one's complement sum 'sum'.
+	// Block is treated as started at even offset of checksummed data.
+	uint32_t ChecksumAdd(const void *data, size_t length, uint32_t sum = 0);
+	
+	// Folds 32 bit one's complement sum to 16 bits
+	inline uint16_t ChecksumFold(uint32_t sum)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+		sum = (sum & 0xffff) + (sum >> 16);
+		return (uint16_t)sum;
+	}
+	
+	// Internet checksum of 'length' bytes of buffer chain starting from 'offset'
+	inline uint16_t Checksum(const DataBuffer *chain, size_t offset, size_t length, uint32_t initial = 0)
+	{
+		return (uint16_t)~ChecksumFold(ChecksumAdd(chain, offset, length, initial));
+	}
+	
+	// Incremental checksum update when 16 bit field changes from 'oldValue' to 'newValue'.
+	// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m')
+	inline uint16_t ChecksumUpdate(uint16_t checksum, uint16_t oldValue, uint16_t newValue)
+	{
+		uint32_t sum = (uint32_t)(uint16_t)~checksum + (uint16_t)~oldValue + newValue;
+		return (uint16_t)~ChecksumFold(sum);
+	}
+	
+	// Incremental checksum update for 32 bit field, i.e. IPv4 address
+	inline uint16_t ChecksumUpdate32(uint16_t checksum, uint32_t oldValue, uint32_t newValue)
+	{
+		uint32_t sum = (uint32_t)(uint16_t)~checksum + 
+			(uint16_t)~(oldValue >> 16) + (uint16_t)~oldValue + 
+			(newValue >> 16) + (newValue & 0xffff);
+		return (uint16_t)~ChecksumFold(sum);
+	}
+	
+	// Software checksum insertion for IPv4 packet placed at the beginning of the buffer.
+	// 'flags' is a ChecksumFlags mask. Fragmented packets payload checksum is not touched.
+	bool ComputeIpv4Checksums(NetBuffer &buffer, unsigned flags);
+}
+}
@@ -0,0 +1,142 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/INetProtocol.h>
+#include <net/INetDispatch.h>
+#include <net/ip_protocol.h>
+#include <net/arp.h>
+#include <array.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MAX_IP_PROTOCOLS) && MAX_IP_PROTOCOLS > 0
+	const size_t MaxIpProtocols = MAX_IP_PROTOCOLS;
+#else
+	const size_t MaxIpProtocols = 4;
+#endif
+	
+	const size_t Ipv4HeaderSize = 20;
+	const uint8_t Ipv4DefaultTtl = 64;
+	
+	// Parsed IPv4 header. Offsets are absolute positions in received frame buffer,
+	// headers are not stripped, so upper layers may access the payload in place.
+	struct Ipv4Header
+	{
+		Net::IpAddr srcAddr;
+		Net::IpAddr destAddr;
+		size_t offset;          // IP header position in buffer
+		size_t payloadOffset;
+		uint16_t payloadLength;
+		uint16_t id;
+		uint16_t fragment;      // flags and fragment offset
+		uint8_t headerLength;
+		uint8_t tos;
+		uint8_t ttl;
+		uint8_t protocol;
+		uint8_t checksumFlags;  // checksums verified by hardware, ChecksumFlags
+	};
+	
+	class Ipv4Reassembly;
+	
+	class IIpProtocol
+	{
+	public:
+		virtual void ProcessMessage(const Ipv4Header &header, Net::NetBuffer &buffer)=0;
+	};
+	
+	// Minimal IPv4 layer: header validation, demultiplexing to upper protocols
+	// and sending via ARP resolved next hop. Fragmented packets are dropped unless reassembly is set.
+	class Ipv4 :public INetProtocol
+	{
+		struct ProtocolIdPair
+		{
+			ProtocolIdPair(IIpProtocol *p, uint8_t i) :protocol(p), id(i) {}
+			IIpProtocol *protocol;
+			uint8_t id;
+		};
+		
+		INetDispatch &_netDispatch;
+		Arp &_arp;
+		Ipv4Reassembly *_reassembly;
+		Net::IpAddr _address;
+		Net::IpAddr _netmask;
+		Net::IpAddr _gateway;
+		uint16_t _id;
+		uint8_t _ttl;
+		Containers::FixedArray<MaxIpProtocols, ProtocolIdPair> _protocols;
+		
+		uint32_t _received;
+		uint32_t _delivered;
+		uint32_t _headerErrors;
+		uint32_t _checksumErrors;
+		uint32_t _notForUs;
+		uint32_t _fragmentsDropped;
+		uint32_t _unknownProtocol;
+		uint32_t _sent;
+		uint32_t _sendErrors;
+		
+		IIpProtocol *FindProtocol(uint8_t protocol);
+		bool IsLocal(const Net::IpAddr &addr) const;
+		bool IsBroadcast(const Net::IpAddr &addr) const;
+	public:
+		enum Statistic
+		{
+			IpReceived,
+			IpDelivered,
+			IpHeaderErrors,
+			IpChecksumErrors,
+			IpNotForUs,
+			IpFragmentsDropped,
+			IpUnknownProtocol,
+			IpSent,
+			IpSendErrors
+		};
+		
+		Ipv4(INetDispatch &netDispatch, Arp &arp);
+		
+		void SetAddress(const Net::IpAddr &address, const Net::IpAddr &netmask, const Net::IpAddr &gateway);
+		const Net::IpAddr &Address() const { return _address; }
+		void SetTtl(uint8_t ttl) { _ttl = ttl; }
+		
+		bool AddProtocol(uint8_t protocol, IIpProtocol *handler);
+		void SetReassembly(Ipv4Reassembly *reassembly) { _reassembly = reassembly; }
+		
+		// Prepends IPv4 header to 'buffer' payload and sends it to 'destAddr'.
+		// Header is placed into first buffer headroom when there is enough of it.
+		// Header checksum is inserted by interface hardware or by NetDispatch.
+		bool Send(const Net::IpAddr &destAddr, uint8_t protocol, Net::NetBuffer &buffer);
+		
+		uint32_t GetStatistic(Statistic statistic) const;
+		
+	public: // INetProtocol
+		virtual void ProcessMessage(const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, Net::NetBuffer &buffer);
+	};
+}
+}
@@ -0,0 +1,133 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/ipv4.h>
+#include <dispatcher.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MAX_IP_REASSEMBLY_SLOTS) && MAX_IP_REASSEMBLY_SLOTS > 0
+	const size_t MaxIpReassemblySlots = MAX_IP_REASSEMBLY_SLOTS;
+#else
+	const size_t MaxIpReassemblySlots = 2;
+#endif
+
+#if defined(MAX_IP_FRAGMENTS) && MAX_IP_FRAGMENTS > 0
+	const size_t MaxIpFragments = MAX_IP_FRAGMENTS;
+#else
+	const size_t MaxIpFragments = 8;
+#endif
+	
+	// IPv4 fragments reassembly with bounded memory.
+	// Each datagram under reassembly occupies one of fixed slots, holding up to MaxIpFragments fragments.
+	// Received fragment buffers are trimmed to payload and kept sorted by offset, on completion they
+	// are linked into single buffer chain without copying. Missing ranges are tracked with
+	// hole descriptors (RFC 815), overlapping fragments are discarded.
+	// Incomplete datagrams are dropped on timeout. When all slots are busy, or free pool buffers
+	// are running out, the least recently updated datagram is evicted.
+	class Ipv4Reassembly
+	{
+		struct Hole
+		{
+			uint16_t first;
+			uint16_t last;
+		};
+		
+		struct Fragment
+		{
+			DataBuffer *buffer;
+			uint16_t offset;
+		};
+		
+		struct Slot
+		{
+			Net::IpAddr srcAddr;
+			Net::IpAddr destAddr;
+			uint16_t id;
+			uint8_t protocol;
+			uint8_t headerLength;      // IP header length of the first fragment, 0 until it arrives
+			uint16_t totalLength;      // payload length, 0 until the last fragment arrives
+			uint32_t started;
+			uint32_t updated;
+			uint8_t fragmentCount;
+			uint8_t holeCount;
+			Fragment fragments[MaxIpFragments];
+			Hole holes[MaxIpFragments + 1];
+		};
+		
+		Dispatcher &_dispatcher;
+		Slot _slots[MaxIpReassemblySlots];
+		uint32_t _timeout;
+		size_t _minFreeBuffers;
+		
+		uint32_t _fragments;
+		uint32_t _reassembled;
+		uint32_t _timedOut;
+		uint32_t _evicted;
+		uint32_t _dropped;
+		
+		Slot *Find(const Ipv4Header &header);
+		Slot *Allocate(const Ipv4Header &header);
+		Slot *LeastRecentlyUpdated(const Slot *except);
+		void Free(Slot &slot);
+		bool AddHoles(Slot &slot, uint16_t first, uint16_t last, bool moreFragments);
+		void Complete(Slot &slot, Ipv4Header &header, Net::NetBuffer &buffer);
+		void TimeoutTimer();
+	public:
+		enum Statistic
+		{
+			ReassemblyFragments,
+			ReassemblyCompleted,
+			ReassemblyTimedOut,
+			ReassemblyEvicted,
+			ReassemblyDropped,
+			ReassemblyActive
+		};
+		
+		Ipv4Reassembly(Dispatcher &dispatcher);
+		~Ipv4Reassembly();
+		
+		// Reassembly timeout in dispatcher ticks, timer runs twice per timeout period
+		void SetTimeout(uint32_t timeout);
+		
+		// Incomplete datagrams are evicted while fewer full size frame buffers are free
+		void SetMinFreeBuffers(size_t count) { _minFreeBuffers = count; }
+		
+		// Takes fragment from 'buffer', positioned as described by 'header'.
+		// Returns true when datagram is complete, then 'buffer' holds the whole datagram
+		// starting with the first fragment IP header and 'header' is updated to describe it.
+		bool Process(Ipv4Header &header, Net::NetBuffer &buffer);
+		
+		void Clear();
+		
+		uint32_t GetStatistic(Statistic statistic) const;
+	};
+}
+}
@@ -0,0 +1,119 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/NetInterface.h>
+#include <net/mac_filter.h>
+#include <dispatcher.h>
+#include <ring_buffer.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MAX_LOOPBACK_FRAMES) && MAX_LOOPBACK_FRAMES > 0
+	const size_t MaxLoopbackFrames = MAX_LOOPBACK_FRAMES;
+#else
+	const size_t MaxLoopbackFrames = 16;
+#endif
+	
+	// Max number of frames delivered with single RxCompleteBatch call
+	const size_t MaxLoopbackBatch = 8;
+	
+	// Perfect address filter slots, the rest of addresses go to the hash table like in hardware MAC
+	const unsigned MaxLoopbackFilters = 2;
+	
+	// In-process network interface for simulation and testing.
+	// Transmitted frames are delivered to the connected peer interface (itself by default)
+	// on Poll, after modelled link serialization time and latency in Dispatcher ticks.
+	class LoopbackInterface :public NetInterface
+	{
+		struct Frame
+		{
+			Frame(DataBuffer *b = 0, TransferId i = 0, uint32_t t = 0, bool l = false)
+				:buffer(b), id(i), deliveryTime(t), lost(l)
+			{}
+			DataBuffer *buffer;
+			TransferId id;
+			uint32_t deliveryTime;
+			bool lost;
+		};
+		
+		Dispatcher &_dispatcher;
+		LoopbackInterface *_peer;
+		Containers::RingBuffer<MaxLoopbackFrames, Frame> _queue;
+		Net::MacAddr _macaddr;
+		Net::MacAddressFilter<MaxLoopbackFilters> _addressFilter;
+		bool _promiscuous;
+		bool _linked;
+		uint32_t _latency;
+		uint32_t _bandwidth;
+		uint16_t _lossRate;
+		uint32_t _random;
+		uint32_t _linkFreeTime;
+		TransferId _txSequence;
+		
+		uint32_t _framesSend;
+		uint32_t _framesRecived;
+		uint32_t _framesAppMissed;
+		uint32_t _framesLost;
+		uint32_t _sendErrors;
+		
+		uint16_t NextRandom();
+		void Deliver(RxFrame *frames, unsigned count);
+		bool Accepts(const Net::MacAddr &destAddr) const;
+	public:
+		LoopbackInterface(Dispatcher &dispatcher, const Net::MacAddr &macaddr);
+		
+		// Frames are delivered to 'peer' interface, 0 to loop them back to this one
+		void Connect(LoopbackInterface *peer);
+		// Delivery delay in dispatcher ticks
+		void SetLatency(uint32_t ticks);
+		// Link bandwidth in bytes per tick, 0 for unlimited
+		void SetBandwidth(uint32_t bytesPerTick);
+		// Frame loss probability in 1/65536 units
+		void SetLossRate(uint16_t lossRate);
+		void SetRandomSeed(uint32_t seed);
+		void SetLinked(bool linked);
+		
+	public: // NetInterface members
+		virtual bool SetMacAddress(unsigned addrNumber, const Net::MacAddr &macaddr);
+		virtual unsigned MaxAddresses(){return 1;}
+		virtual const Net::MacAddr& GetMacAddress(unsigned addrNumber);
+		virtual bool IsLinked();
+		virtual void PauseCommand(uint16_t time);
+		virtual void Poll();
+		virtual uint32_t GetParameter(NetInterfaceParameter parameterId);
+		virtual TransferId Transmit(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer);
+		virtual bool CanTransmit(Net::NetBuffer &buffer);
+		virtual bool TxCompleteFor(TransferId txId);
+		virtual bool AddAddressFilter(const Net::MacAddr &macaddr);
+		virtual bool RemoveAddressFilter(const Net::MacAddr &macaddr);
+		virtual void SetPromiscuous(bool promiscuous);
+	};
+}
+}
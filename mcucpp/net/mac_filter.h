@@ -0,0 +1,181 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/net_addr.h>
+#include <crc.h>
+#include <static_assert.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+	// Bit index in 64 bit destination address hash table of Synopsys based Ethernet MACs (STM32 ETH):
+	// upper 6 bits of bit reversed IEEE 802.3 CRC-32 of the address.
+	// ComputeCrc<Crc32> gives the reflected CRC, so the index is its low 6 bits in reverse order.
+	inline unsigned MacHashIndex(const Net::MacAddr &addr)
+	{
+		uint32_t crc = ComputeCrc<Crc32>(addr, addr.Length());
+		unsigned index = 0;
+		for(unsigned i = 0; i < 6; i++)
+		{
+			index = (index << 1) | (crc & 1);
+			crc >>= 1;
+		}
+		return index;
+	}
+	
+	enum MacFilterMatch
+	{
+		MacFilterNone,
+		MacFilterHash,    // imperfect match, other addresses with the same hash pass as well
+		MacFilterPerfect
+	};
+	
+	// Receive destination address filter state.
+	// Addresses occupy perfect filter slots first, the rest are spilled to 64 bit hash table.
+	// Add and Remove calls must be balanced, both slots and hash bits are reference counted.
+	template<unsigned PerfectSlots>
+	class MacAddressFilter
+	{
+		STATIC_ASSERT(PerfectSlots <= 8);
+		
+		Net::MacAddr _perfect[PerfectSlots];
+		uint8_t _perfectRefs[PerfectSlots];
+		uint8_t _hashRefs[64];
+		uint32_t _hashTable[2];
+		uint16_t _hashedUnicast;
+		uint16_t _hashedMulticast;
+		
+		static bool IsMulticast(const Net::MacAddr &addr) { return (addr[0] & 1) != 0; }
+		
+		int FindPerfect(const Net::MacAddr &addr) const
+		{
+			for(unsigned i = 0; i < PerfectSlots; i++)
+			{
+				if(_perfectRefs[i] && _perfect[i] == addr)
+					return i;
+			}
+			return -1;
+		}
+	public:
+		MacAddressFilter()
+		{
+			Clear();
+		}
+		
+		void Clear()
+		{
+			for(unsigned i = 0; i < PerfectSlots; i++)
+				_perfectRefs[i] = 0;
+			for(unsigned i = 0; i < 64; i++)
+				_hashRefs[i] = 0;
+			_hashTable[0] = _hashTable[1] = 0;
+			_hashedUnicast = _hashedMulticast = 0;
+		}
+		
+		bool Add(const Net::MacAddr &addr)
+		{
+			int slot = FindPerfect(addr);
+			if(slot < 0)
+			{
+				for(unsigned i = 0; i < PerfectSlots && slot < 0; i++)
+				{
+					if(!_perfectRefs[i])
+						slot = i;
+				}
+			}
+			if(slot >= 0)
+			{
+				if(_perfectRefs[slot] == 0xff)
+					return false;
+				_perfect[slot] = addr;
+				_perfectRefs[slot]++;
+				return true;
+			}
+			
+			unsigned index = MacHashIndex(addr);
+			if(_hashRefs[index] == 0xff)
+				return false;
+			_hashRefs[index]++;
+			_hashTable[index >> 5] |= 1ul << (index & 31);
+			if(IsMulticast(addr))
+				_hashedMulticast++;
+			else
+				_hashedUnicast++;
+			return true;
+		}
+		
+		bool Remove(const Net::MacAddr &addr)
+		{
+			int slot = FindPerfect(addr);
+			if(slot >= 0)
+			{
+				_perfectRefs[slot]--;
+				return true;
+			}
+			
+			unsigned index = MacHashIndex(addr);
+			if(!_hashRefs[index])
+				return false;
+			if(--_hashRefs[index] == 0)
+				_hashTable[index >> 5] &= ~(1ul << (index & 31));
+			if(IsMulticast(addr))
+				_hashedMulticast--;
+			else
+				_hashedUnicast--;
+			return true;
+		}
+		
+		MacFilterMatch Match(const Net::MacAddr &addr) const
+		{
+			if(FindPerfect(addr) >= 0)
+				return MacFilterPerfect;
+			unsigned index = MacHashIndex(addr);
+			if(_hashTable[index >> 5] & (1ul << (index & 31)))
+				return MacFilterHash;
+			return MacFilterNone;
+		}
+		
+		// Returns false if slot is not used
+		bool PerfectSlot(unsigned slot, Net::MacAddr &addr) const
+		{
+			if(slot >= PerfectSlots || !_perfectRefs[slot])
+				return false;
+			addr = _perfect[slot];
+			return true;
+		}
+		
+		// Hash table bits 0..31 and 32..63
+		uint32_t HashLow() const { return _hashTable[0]; }
+		uint32_t HashHigh() const { return _hashTable[1]; }
+		
+		bool HashUnicast() const { return _hashedUnicast != 0; }
+		bool HashMulticast() const { return _hashedMulticast != 0; }
+	};
+}
+}
@@ -30,15 +30,63 @@
 #include <stddef.h>
 #include <array.h>
 #include <binary_stream.h>
+#include <static_assert.h>
 #include <net/net_addr.h>
 
 namespace Mcucpp
 {
 namespace Net
 {
+// Buffer pools geometry: data size and number of buffers in each of three pools.
+// Buffers are allocated from the smallest pool fitting requested size. Large buffers may be
+// made jumbo frame sized, if the interface supports it.
+#if defined(MCUCPP_NET_SMALL_BUFFER_SIZE) && MCUCPP_NET_SMALL_BUFFER_SIZE > 0
+	const size_t SmallPoolBufferSize = MCUCPP_NET_SMALL_BUFFER_SIZE;
+#else
 	const size_t SmallPoolBufferSize = 32;
+#endif
+
+#if defined(MCUCPP_NET_SMALL_BUFFERS) && MCUCPP_NET_SMALL_BUFFERS > 0
+	const size_t SmallPoolBufferCount = MCUCPP_NET_SMALL_BUFFERS;
+#else
+	const size_t SmallPoolBufferCount = 20;
+#endif
+
+#if defined(MCUCPP_NET_MED_BUFFER_SIZE) && MCUCPP_NET_MED_BUFFER_SIZE > 0
+	const size_t MedPoolBufferSize = MCUCPP_NET_MED_BUFFER_SIZE;
+#else
 	const size_t MedPoolBufferSize = 128;
+#endif
+
+#if defined(MCUCPP_NET_MED_BUFFERS) && MCUCPP_NET_MED_BUFFERS > 0
+	const size_t MedPoolBufferCount = MCUCPP_NET_MED_BUFFERS;
+#else
+	const size_t MedPoolBufferCount = 16;
+#endif
+
+#if defined(MCUCPP_NET_LARGE_BUFFER_SIZE) && MCUCPP_NET_LARGE_BUFFER_SIZE > 0
+	const size_t LargePoolBufferSize = MCUCPP_NET_LARGE_BUFFER_SIZE;
+#else
 	const size_t LargePoolBufferSize = 1396;
+#endif
+
+#if defined(MCUCPP_NET_LARGE_BUFFERS) && MCUCPP_NET_LARGE_BUFFERS > 0
+	const size_t LargePoolBufferCount = MCUCPP_NET_LARGE_BUFFERS;
+#else
+	const size_t LargePoolBufferCount = 4;
+#endif
+
+	STATIC_ASSERT(SmallPoolBufferSize <= MedPoolBufferSize && MedPoolBufferSize <= LargePoolBufferSize);
+	
+	// Checksum offload flags attached to a buffer.
+	// On transmit they request checksum insertion, on receive they report checks done by hardware.
+	enum ChecksumFlags
+	{
+		ChecksumNone     = 0,
+		ChecksumIpHeader = 1 << 0, // IPv4 header checksum
+		ChecksumPayload  = 1 << 1, // TCP/UDP/ICMP checksum including pseudo header
+		ChecksumError    = 1 << 2  // receive only, hardware found invalid checksum
+	};
 	
 	class DataBuffer
 	{
@@ -46,6 +94,7 @@ namespace Net
 		DataBuffer * _next;
 		uint16_t _size;
 		uint16_t _storage;
+		uint16_t _headroom;
 		friend class NetBufferBase;
 		friend class BufferChain;
 	public:
@@ -56,13 +105,13 @@ namespace Net
 		}
 	
 		DataBuffer(uint8_t *data, size_t size)
-			:_data(data), _next(0), _size(size), _storage(0)
+			:_data(data), _next(0), _size(size), _storage(0), _headroom(0)
 		{
 			
 		}
 		
-		DataBuffer(uint8_t *data, size_t size, size_t storageSize)
-			:_data(data), _next(0), _size(size), _storage(storageSize)
+		DataBuffer(uint8_t *data, size_t size, size_t storageSize, size_t headroom = 0)
+			:_data(data), _next(0), _size(size), _storage(storageSize), _headroom(headroom)
 		{
 			
 		}
@@ -91,20 +140,67 @@ namespace Net
 		size_t Capacity() const {return _storage ? _storage : _size; }
 		DataBuffer* Next() const {return _next; }
 		
+		// Free space in front of data, headers may be prepended there without copying
+		size_t Headroom() const {return _headroom; }
+		
+		// Moves data start 'size' bytes back into headroom
+		bool PushFront(size_t size)
+		{
+			if(size > _headroom)
+				return false;
+			_data -= size;
+			_size += size;
+			if(_storage)
+				_storage += size;
+			_headroom -= size;
+			return true;
+		}
+		
+		// Moves data start 'size' bytes forward, removed bytes become headroom
+		bool PullFront(size_t size)
+		{
+			if(size > _size)
+				return false;
+			_data += size;
+			_size -= size;
+			if(_storage)
+				_storage -= size;
+			_headroom += size;
+			return true;
+		}
+		
 		static DataBuffer* GetNew(size_t size);
+		// Allocates buffer with 'headroom' bytes reserved in front of data
+		static DataBuffer* GetNewWithHeadroom(size_t size, size_t headroom);
 		static DataBuffer* GetNew(const void *data, size_t size);
 		
 		static void Release(DataBuffer * data);
+		// Number of free pool blocks able to hold 'size' bytes
+		static size_t FreeBuffers(size_t size);
 		static void ReleaseRecursive(DataBuffer * data);
 		static DataBuffer *FindLast(DataBuffer *first);
+		// Number of failed allocations since startup
+		static uint32_t AllocFailures();
 	};
 	
 
+	// Total RAM taken by buffer pools, the build fails if it exceeds MCUCPP_NET_POOLS_RAM_LIMIT
+	const size_t NetBufferPoolsRam = 
+		(sizeof(DataBuffer) + SmallPoolBufferSize) * SmallPoolBufferCount +
+		(sizeof(DataBuffer) + MedPoolBufferSize) * MedPoolBufferCount +
+		(sizeof(DataBuffer) + LargePoolBufferSize) * LargePoolBufferCount;
+	
+#if defined(MCUCPP_NET_POOLS_RAM_LIMIT) && MCUCPP_NET_POOLS_RAM_LIMIT > 0
+	STATIC_ASSERT(NetBufferPoolsRam <= MCUCPP_NET_POOLS_RAM_LIMIT);
+#endif
+	
 	class NetBufferBase
 	{
 		DataBuffer *_first;
 		DataBuffer *_current;
 		size_t _pos;
+		uint8_t _checksumFlags;
+		uint16_t _vlanTag;
 	public:
 		NetBufferBase();
 		~NetBufferBase();
@@ -115,7 +211,7 @@ namespace Net
 		NetBufferBase & operator=(NetBufferBase &);
 		
 		NetBufferBase(DataBuffer* chain)
-		:_first(chain), _current(0), _pos(0)
+		:_first(chain), _current(0), _pos(0), _checksumFlags(ChecksumNone), _vlanTag(0)
 		{
 		
 		}
@@ -126,11 +222,21 @@ namespace Net
 			_first = 0;
 			_current = 0;
 			_pos = 0;
+			_checksumFlags = ChecksumNone;
+			_vlanTag = 0;
 			return result;
 		}
 		
 		DataBuffer* BufferList(){ return _first;}
 		
+		unsigned ChecksumOffload() const { return _checksumFlags; }
+		void SetChecksumOffload(unsigned flags) { _checksumFlags = (uint8_t)flags; }
+		
+		// IEEE 802.1Q tag control information (priority and VLAN id) of the frame, 0 for untagged frames.
+		// On transmit non zero tag is inserted in front of the buffer by NetDispatch.
+		uint16_t VlanTag() const { return _vlanTag; }
+		void SetVlanTag(uint16_t tag) { _vlanTag = tag; }
+		
 		uint8_t Read()
 		{
 			if(!_current)
@@ -193,18 +299,62 @@ namespace Net
 		}
 		
 		void Clear();
+		// Prepends 'size' bytes, using first buffer headroom if it is large enough
 		bool InsertFront(size_t size);
 		bool InsertBack(size_t size);
+		// Appends 'size' bytes, newly allocated buffer gets 'headroom' bytes for headers to be prepended later
+		bool InsertBack(size_t size, size_t headroom);
 		bool Insert(size_t pos, size_t size);
 		void AttachBack(DataBuffer* buffer);
 		void AttachFront(DataBuffer* buffer);
 		DataBuffer* DetachFront();
+		// Removes 'size' bytes from the buffer start, emptied fragments are released
+		bool TrimFront(size_t size);
+		// Cuts the buffer to 'size' bytes, not used fragments are released
+		bool Truncate(size_t size);
 		
 		bool Seek(size_t pos);
+		// Current read/write position from the buffer start
+		size_t Position();
 		size_t Size();
 		unsigned Parts();
 	};
 	
 	typedef Mcucpp::BinaryStream<NetBufferBase> NetBuffer;
+	
+	// Iterates contiguous spans of buffer chain region without copying data
+	class BufferSpans
+	{
+		const DataBuffer *_buffer;
+		size_t _offset;
+		size_t _remaining;
+	public:
+		BufferSpans(const DataBuffer *chain, size_t offset, size_t length)
+			:_buffer(chain), _offset(offset), _remaining(length)
+		{
+			while(_buffer && _offset >= _buffer->Size())
+			{
+				_offset -= _buffer->Size();
+				_buffer = _buffer->Next();
+			}
+		}
+		
+		// bytes left to iterate
+		size_t Length() const { return _remaining; }
+		
+		bool Next(const uint8_t *&data, size_t &size)
+		{
+			if(!_buffer || !_remaining)
+				return false;
+			data = _buffer->Data() + _offset;
+			size = _buffer->Size() - _offset;
+			if(size > _remaining)
+				size = _remaining;
+			_remaining -= size;
+			_offset = 0;
+			_buffer = _buffer->Next();
+			return true;
+		}
+	};
 }
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/net_buffer.h>
+#include <net/pcap.h>
+#include <static_assert.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MCUCPP_NET_CAPTURE_SNAPLEN) && MCUCPP_NET_CAPTURE_SNAPLEN > 0
+	const size_t NetCaptureSnapLength = MCUCPP_NET_CAPTURE_SNAPLEN;
+#else
+	const size_t NetCaptureSnapLength = 64;
+#endif
+
+#if defined(MCUCPP_NET_CAPTURE_RECORDS) && MCUCPP_NET_CAPTURE_RECORDS > 0
+	const size_t NetCaptureRecords = MCUCPP_NET_CAPTURE_RECORDS;
+#else
+	const size_t NetCaptureRecords = 16;
+#endif
+	
+	enum CaptureDirection
+	{
+		CaptureRx,
+		CaptureTx
+	};
+	
+	struct CaptureRecord
+	{
+		uint32_t timestamp;       // dispatcher ticks
+		uint16_t originalLength;
+		uint16_t capturedLength;
+		uint8_t direction;
+		uint8_t data[NetCaptureSnapLength];
+	};
+	
+	// Frames capture ring. Records are copied in place at their slots, the writer never waits
+	// for the reader, oldest records are overwritten. Every slot carries sequence number,
+	// it is invalidated before and published after the record is written,
+	// so the reader detects records overwritten while being copied.
+	// Capture hooks in NetDispatch are compiled only if MCUCPP_NET_CAPTURE is defined non-zero.
+	class NetCapture
+	{
+		STATIC_ASSERT((NetCaptureRecords & (NetCaptureRecords - 1)) == 0);
+		
+		struct Slot
+		{
+			volatile uint32_t sequence;
+			CaptureRecord record;
+		};
+		
+		Slot _slots[NetCaptureRecords];
+		uint32_t _writeSequence;
+		uint32_t _readSequence;
+		uint32_t _overwritten;
+		uint32_t _ticksPerSecond;
+		volatile bool _enabled;
+	public:
+		NetCapture();
+		
+		void Enable(bool enable) { _enabled = enable; }
+		bool Enabled() const { return _enabled; }
+		// Dispatcher ticks rate for pcap timestamps
+		void SetTickRate(uint32_t ticksPerSecond) { _ticksPerSecond = ticksPerSecond; }
+		
+		// Records 'headerSize' bytes of 'header' (may be null) followed by buffer chain data,
+		// truncated to NetCaptureSnapLength
+		void Record(uint32_t timestamp, CaptureDirection direction, const uint8_t *header, size_t headerSize, const DataBuffer *chain);
+		
+		// Takes the oldest not read record, returns false if there is none
+		bool Read(CaptureRecord &record);
+		
+		// Records lost because reader did not keep up
+		uint32_t Overwritten() const { return _overwritten; }
+		
+		void Clear();
+		
+		// Writes up to 'maxRecords' captured records to pcap stream, file header should be already written.
+		// Returns number of records written.
+		template<class Sink>
+		unsigned ExportPcap(PcapWriter<Sink> &writer, unsigned maxRecords)
+		{
+			CaptureRecord record;
+			unsigned count = 0;
+			while(count < maxRecords && Read(record))
+			{
+				uint32_t ticks = record.timestamp % _ticksPerSecond;
+				writer.WriteRecord(record.timestamp / _ticksPerSecond, 
+					(uint32_t)((uint64_t)ticks * 1000000u / _ticksPerSecond),
+					record.data, record.capturedLength, record.originalLength);
+				count++;
+			}
+			return count;
+		}
+	};
+}
+}
@@ -0,0 +1,220 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <binary_stream.h>
+#include <tiny_ios.h>
+#include <net/net_buffer.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MAX_STATS_PROTOCOLS) && MAX_STATS_PROTOCOLS > 0
+	const size_t MaxStatsProtocols = MAX_STATS_PROTOCOLS;
+#else
+	const size_t MaxStatsProtocols = 8;
+#endif
+
+#if defined(MAX_STATS_UDP_PORTS) && MAX_STATS_UDP_PORTS > 0
+	const size_t MaxStatsUdpPorts = MAX_STATS_UDP_PORTS;
+#else
+	const size_t MaxStatsUdpPorts = 8;
+#endif
+	
+	const size_t MaxStatsInterfaces = 4;
+	
+	// Frame size histogram buckets upper bounds (including link layer header), the last one is for larger frames
+	const size_t NetStatsSizeBuckets = 6;
+	
+	inline unsigned NetStatsSizeBucket(size_t size)
+	{
+		if(size <= 64)   return 0;
+		if(size <= 128)  return 1;
+		if(size <= 256)  return 2;
+		if(size <= 512)  return 3;
+		if(size <= 1024) return 4;
+		return 5;
+	}
+	
+	struct NetTrafficCounters
+	{
+		uint32_t frames;
+		uint32_t bytes;
+		
+		void Add(size_t size)
+		{
+			frames++;
+			bytes += size;
+		}
+	};
+	
+	struct NetInterfaceStats
+	{
+		NetTrafficCounters rx;
+		NetTrafficCounters tx;
+		uint32_t txRejected;   // frames not accepted by interface: queue full, no link or no memory
+		uint32_t rxSizes[NetStatsSizeBuckets];
+		uint32_t txSizes[NetStatsSizeBuckets];
+	};
+	
+	// Traffic of one EtherType or one local UDP port
+	struct NetFlowStats
+	{
+		uint16_t id;
+		NetTrafficCounters rx;
+		NetTrafficCounters tx;
+	};
+	
+	// Network statistics registry. Counters are plain arrays updated without locks,
+	// each of them is aligned 32 bit word, so reading them from other context gives consistent values.
+	// EtherTypes and UDP ports get their entries on first use, while there is room in the tables.
+	class NetStats
+	{
+		NetInterfaceStats _interfaces[MaxStatsInterfaces];
+		NetFlowStats _protocols[MaxStatsProtocols];
+		NetFlowStats _ports[MaxStatsUdpPorts];
+		uint8_t _protocolCount;
+		uint8_t _portCount;
+		uint8_t _lastProtocol;
+		uint32_t _noProtocol;
+		uint32_t _untracked;
+		uint32_t _allocFailuresBase;
+		
+		NetFlowStats *FindFlow(NetFlowStats *table, uint8_t &count, size_t capacity, uint16_t id);
+		NetFlowStats *FindProtocol(uint16_t protocolId);
+	public:
+		enum{BinaryVersion = 1};
+		
+		NetStats();
+		void Reset();
+		
+		void RxFrame(unsigned interfaceIndex, uint16_t protocolId, size_t size);
+		void TxFrame(unsigned interfaceIndex, uint16_t protocolId, size_t size, bool accepted);
+		// received frame for which there is no protocol handler
+		void NoProtocol() { _noProtocol++; }
+		void UdpRx(uint16_t localPort, size_t size);
+		void UdpTx(uint16_t localPort, size_t size);
+		
+		const NetInterfaceStats &Interface(unsigned interfaceIndex) const { return _interfaces[interfaceIndex]; }
+		// Returns 0 if 'protocolId' is not tracked
+		const NetFlowStats *Protocol(uint16_t protocolId) const;
+		const NetFlowStats *UdpPort(uint16_t localPort) const;
+		uint32_t NoProtocolFrames() const { return _noProtocol; }
+		// frames of protocols and ports, that did not fit to the tables
+		uint32_t Untracked() const { return _untracked; }
+		// net buffer allocation failures since last reset
+		uint32_t PoolExhausted() const { return DataBuffer::AllocFailures() - _allocFailuresBase; }
+		
+		// Prints statistics as text to tiny_ostream compatible stream
+		template<class Stream>
+		void Print(Stream &out) const;
+		
+		// Writes compact little endian binary form to byte sink with 'void Write(uint8_t)' method:
+		//   u8 version, u8 interfaces, u8 buckets, u8 protocols, u8 ports, u32 no protocol, u32 untracked, u32 pool exhausted,
+		//   interfaces: u32 rx frames, rx bytes, tx frames, tx bytes, tx rejected, rx sizes[buckets], tx sizes[buckets],
+		//   protocols and ports: u16 id, u32 rx frames, rx bytes, tx frames, tx bytes
+		template<class Sink>
+		void WriteBinary(Sink &sink) const;
+	};
+	
+	template<class Stream>
+	void NetStats::Print(Stream &out) const
+	{
+		for(unsigned i = 0; i < MaxStatsInterfaces; i++)
+		{
+			const NetInterfaceStats &stats = _interfaces[i];
+			if(!stats.rx.frames && !stats.tx.frames && !stats.txRejected)
+				continue;
+			out << "if" << i << " rx " << stats.rx.frames << '/' << stats.rx.bytes 
+				<< " tx " << stats.tx.frames << '/' << stats.tx.bytes << " rejected " << stats.txRejected << "\r\n";
+			out << "  sizes rx";
+			for(unsigned b = 0; b < NetStatsSizeBuckets; b++)
+				out << ' ' << stats.rxSizes[b];
+			out << " tx";
+			for(unsigned b = 0; b < NetStatsSizeBuckets; b++)
+				out << ' ' << stats.txSizes[b];
+			out << "\r\n";
+		}
+		for(unsigned i = 0; i < _protocolCount; i++)
+		{
+			const NetFlowStats &stats = _protocols[i];
+			out << "eth 0x" << hex << stats.id << dec << " rx " << stats.rx.frames << '/' << stats.rx.bytes 
+				<< " tx " << stats.tx.frames << '/' << stats.tx.bytes << "\r\n";
+		}
+		for(unsigned i = 0; i < _portCount; i++)
+		{
+			const NetFlowStats &stats = _ports[i];
+			out << "udp " << stats.id << " rx " << stats.rx.frames << '/' << stats.rx.bytes 
+				<< " tx " << stats.tx.frames << '/' << stats.tx.bytes << "\r\n";
+		}
+		out << "no protocol " << _noProtocol << " untracked " << _untracked << " pool exhausted " << PoolExhausted() << "\r\n";
+	}
+	
+	template<class Sink>
+	void NetStats::WriteBinary(Sink &sink) const
+	{
+		BinaryStreamAdapter<Sink> stream(sink);
+		stream.WriteU8(BinaryVersion);
+		stream.WriteU8(MaxStatsInterfaces);
+		stream.WriteU8(NetStatsSizeBuckets);
+		stream.WriteU8(_protocolCount);
+		stream.WriteU8(_portCount);
+		stream.WriteU32Le(_noProtocol);
+		stream.WriteU32Le(_untracked);
+		stream.WriteU32Le(PoolExhausted());
+		for(unsigned i = 0; i < MaxStatsInterfaces; i++)
+		{
+			const NetInterfaceStats &stats = _interfaces[i];
+			stream.WriteU32Le(stats.rx.frames);
+			stream.WriteU32Le(stats.rx.bytes);
+			stream.WriteU32Le(stats.tx.frames);
+			stream.WriteU32Le(stats.tx.bytes);
+			stream.WriteU32Le(stats.txRejected);
+			for(unsigned b = 0; b < NetStatsSizeBuckets; b++)
+				stream.WriteU32Le(stats.rxSizes[b]);
+			for(unsigned b = 0; b < NetStatsSizeBuckets; b++)
+				stream.WriteU32Le(stats.txSizes[b]);
+		}
+		for(unsigned table = 0; table < 2; table++)
+		{
+			const NetFlowStats *flows = table == 0 ? _protocols : _ports;
+			unsigned count = table == 0 ? _protocolCount : _portCount;
+			for(unsigned i = 0; i < count; i++)
+			{
+				stream.WriteU16Le(flows[i].id);
+				stream.WriteU32Le(flows[i].rx.frames);
+				stream.WriteU32Le(flows[i].rx.bytes);
+				stream.WriteU32Le(flows[i].tx.frames);
+				stream.WriteU32Le(flows[i].tx.bytes);
+			}
+		}
+	}
+}
+}
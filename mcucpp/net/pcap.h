@@ -0,0 +1,162 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <binary_stream.h>
+#include <net/net_buffer.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+	enum PcapLinkType
+	{
+		PcapLinkTypeEthernet = 1
+	};
+	
+	const uint32_t PcapMagic = 0xa1b2c3d4;
+	const uint32_t PcapMagicSwapped = 0xd4c3b2a1;
+	
+	struct PcapRecordHeader
+	{
+		PcapRecordHeader()
+			:seconds(0), microseconds(0), capturedLength(0), originalLength(0)
+		{}
+		uint32_t seconds;
+		uint32_t microseconds;
+		uint32_t capturedLength;
+		uint32_t originalLength;
+	};
+	
+	// Writes libpcap capture file format to any byte sink with 'void Write(uint8_t)' method
+	template<class Sink>
+	class PcapWriter
+	{
+		BinaryStreamAdapter<Sink> _stream;
+		uint32_t _snapLength;
+	public:
+		PcapWriter(Sink &sink, uint32_t snapLength = 65535)
+			:_stream(sink), _snapLength(snapLength)
+		{}
+		
+		void WriteFileHeader(uint32_t linkType = PcapLinkTypeEthernet)
+		{
+			_stream.WriteU32Le(PcapMagic);
+			_stream.WriteU16Le(2); // version 2.4
+			_stream.WriteU16Le(4);
+			_stream.WriteU32Le(0); // UTC
+			_stream.WriteU32Le(0); // timestamps accuracy
+			_stream.WriteU32Le(_snapLength);
+			_stream.WriteU32Le(linkType);
+		}
+		
+		// Writes frame record: 'headerSize' bytes of 'header' (may be null) followed by buffer chain data.
+		// Data exceeding snap length is truncated.
+		void WriteFrame(uint32_t seconds, uint32_t microseconds, const uint8_t *header, size_t headerSize, const DataBuffer *chain)
+		{
+			size_t originalLength = headerSize;
+			for(const DataBuffer *part = chain; part; part = part->Next())
+				originalLength += part->Size();
+			size_t capturedLength = originalLength < _snapLength ? originalLength : _snapLength;
+			
+			_stream.WriteU32Le(seconds);
+			_stream.WriteU32Le(microseconds);
+			_stream.WriteU32Le(capturedLength);
+			_stream.WriteU32Le(originalLength);
+			
+			size_t toWrite = capturedLength;
+			for(size_t i = 0; i < headerSize && toWrite; i++, toWrite--)
+				_stream.Write(header[i]);
+			for(const DataBuffer *part = chain; part && toWrite; part = part->Next())
+			{
+				for(size_t i = 0; i < part->Size() && toWrite; i++, toWrite--)
+					_stream.Write(part->Data()[i]);
+			}
+		}
+		
+		// Writes record of already truncated frame data
+		void WriteRecord(uint32_t seconds, uint32_t microseconds, const uint8_t *data, size_t capturedLength, size_t originalLength)
+		{
+			if(capturedLength > _snapLength)
+				capturedLength = _snapLength;
+			_stream.WriteU32Le(seconds);
+			_stream.WriteU32Le(microseconds);
+			_stream.WriteU32Le(capturedLength);
+			_stream.WriteU32Le(originalLength);
+			for(size_t i = 0; i < capturedLength; i++)
+				_stream.Write(data[i]);
+		}
+	};
+	
+	// Reads libpcap capture file format from byte source with 'uint8_t Read()' method.
+	// End of data is not detected, caller should check it before reading next record.
+	template<class Source>
+	class PcapReader
+	{
+		BinaryStreamAdapter<Source> _stream;
+		uint32_t _snapLength;
+		uint32_t _linkType;
+		bool _swapped;
+		
+		uint32_t ReadU32()
+		{
+			return _swapped ? _stream.ReadU32Be() : _stream.ReadU32Le();
+		}
+	public:
+		PcapReader(Source &source)
+			:_stream(source), _snapLength(0), _linkType(0), _swapped(false)
+		{}
+		
+		bool ReadFileHeader()
+		{
+			uint32_t magic = _stream.ReadU32Le();
+			if(magic != PcapMagic && magic != PcapMagicSwapped)
+				return false;
+			_swapped = magic == PcapMagicSwapped;
+			_stream.Ignore(12); // version, time zone and accuracy
+			_snapLength = ReadU32();
+			_linkType = ReadU32();
+			return true;
+		}
+		
+		uint32_t SnapLength() const { return _snapLength; }
+		uint32_t LinkType() const { return _linkType; }
+		
+		// Reads record header, record data of 'capturedLength' bytes follows it in the source
+		bool ReadRecordHeader(PcapRecordHeader &record)
+		{
+			record.seconds = ReadU32();
+			record.microseconds = ReadU32();
+			record.capturedLength = ReadU32();
+			record.originalLength = ReadU32();
+			return record.capturedLength <= _snapLength && record.capturedLength <= record.originalLength;
+		}
+	};
+}
+}
@@ -1,50 +1,279 @@
 
 #include <net/NetDispatch.h>
+#include <net/checksum.h>
+#include <net/ether_type.h>
+#include <compiler.h>
+#include <string.h>
 
 using namespace Mcucpp;
 using namespace Mcucpp::Net;
 
 void NetDispatch::TxComplete(NetInterface *interface, TransferId txId, bool success)
 {
-	
+	(void)txId;
+	(void)success;
+	// descriptors are freed, queued frames can be passed to interface
+	unsigned index = InterfaceIndex(interface);
+	if(index < _schedulers.size() && _schedulers[index])
+		_schedulers[index]->Service(*interface);
 }
 
-void NetDispatch::RxComplete(NetInterface *interface, const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)
+INetProtocol *NetDispatch::FindProtocol(uint16_t protocoId, uint16_t vlanId)
 {
-	for(unsigned i = 0; i < _interfaces.size(); i++)
+	for(unsigned i = 0; i < _protocols.size(); i++)
 	{
-		if(_protocols[i].id == protocoId)
+		if(_protocols[i].id == protocoId && _protocols[i].vlanId == vlanId)
 		{
-			_protocols[i].protocol->ProcessMessage(srcAddr, destAddr, buffer);
-			break;
+			return _protocols[i].protocol;
 		}
 	}
+	return 0;
 }
 
-bool NetDispatch::SendMesage(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)
+unsigned NetDispatch::InterfaceIndex(NetInterface *interface)
+{
+	for(unsigned i = 0; i < _interfaces.size(); i++)
+	{
+		if(_interfaces[i] == interface)
+			return i;
+	}
+	return MaxInterfaces;
+}
+
+unsigned NetDispatch::SelectInterface()
 {
 	for(unsigned i = 0; i < _interfaces.size(); i++)
 	{
-		_interfaces[i]->Transmit(destAddr, protocoId, buffer);
+		if(_interfaces[i]->IsLinked())
+			return i;
+	}
+	return 0;
+}
+
+void NetDispatch::RxComplete(NetInterface *interface, const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)
+{
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+	Capture(CaptureRx, srcAddr, destAddr, protocoId, buffer.BufferList());
+#endif
+	size_t frameSize = buffer.Size() + EthernetHeaderSize;
+	if(protocoId == VLAN_Tagged)
+	{
+		buffer.SetVlanTag(buffer.ReadU16Be());
+		protocoId = buffer.ReadU16Be();
+	}
+	INetProtocol *protocol = FindProtocol(protocoId, VlanId(buffer.VlanTag()));
+	if(_stats)
+	{
+		_stats->RxFrame(InterfaceIndex(interface), protocoId, frameSize);
+		if(!protocol)
+			_stats->NoProtocol();
+	}
+	if(protocol)
+	{
+		protocol->ProcessMessage(srcAddr, destAddr, buffer);
 	}
-	// TODO: handle
+}
+
+bool NetDispatch::ParseVlanTag(RxFrame &frame)
+{
+	// tag is stripped by moving header boundary, frame data stays in place
+	uint8_t tag[VlanTagSize];
+	size_t offset = frame.headerSize;
+	const DataBuffer *buffer = frame.buffer;
+	for(unsigned i = 0; i < VlanTagSize; )
+	{
+		if(!buffer)
+			return false;
+		if(offset >= buffer->Size())
+		{
+			offset -= buffer->Size();
+			buffer = buffer->Next();
+			continue;
+		}
+		tag[i++] = (*buffer)[offset++];
+	}
+	frame.vlanTag = (uint16_t)((tag[0] << 8) | tag[1]);
+	frame.protocolId = (uint16_t)((tag[2] << 8) | tag[3]);
+	frame.headerSize += VlanTagSize;
 	return true;
 }
 
-NetDispatch::NetDispatch(Dispatcher &dispatcher)
-	:_dispatcher(dispatcher)
+void NetDispatch::DeliverFrames(unsigned interfaceIndex, RxFrame *frames, unsigned count, unsigned lane)
 {
+	// frames of a burst are usually of the same protocol, so protocol lookup result is reused
+	INetProtocol *protocol = 0;
+	uint16_t lastProtocolId = 0;
+	uint16_t lastVlanId = 0;
+	bool lookedUp = false;
+	for(unsigned i = 0; i < count; i++)
+	{
+		RxFrame &frame = frames[i];
+		if(!frame.buffer || (lane < NetRxLanes && _priorityLanes[VlanPriority(frame.vlanTag)] != lane))
+			continue;
+		if(i + 1 < count && frames[i + 1].buffer)
+		{
+			MCUCPP_PREFETCH(frames[i + 1].buffer->Data());
+		}
+		uint16_t vlanId = VlanId(frame.vlanTag);
+		if(!lookedUp || frame.protocolId != lastProtocolId || vlanId != lastVlanId)
+		{
+			protocol = FindProtocol(frame.protocolId, vlanId);
+			lastProtocolId = frame.protocolId;
+			lastVlanId = vlanId;
+			lookedUp = true;
+		}
+		Net::NetBuffer buffer(frame.buffer); // takes buffer chain ownership
+		frame.buffer = 0;
+		buffer.SetChecksumOffload(frame.checksumFlags);
+		buffer.SetVlanTag(frame.vlanTag);
+		if(_stats)
+		{
+			_stats->RxFrame(interfaceIndex, frame.protocolId, buffer.Size());
+			if(!protocol)
+				_stats->NoProtocol();
+		}
+		if(protocol)
+		{
+			buffer.Seek(frame.headerSize);
+			protocol->ProcessMessage(frame.srcAddr, frame.destAddr, buffer);
+		}
+	}
+}
+
+void NetDispatch::RxCompleteBatch(NetInterface *interface, RxFrame *frames, unsigned count)
+{
+	unsigned interfaceIndex = _stats ? InterfaceIndex(interface) : unsigned(MaxInterfaces);
+	unsigned lanes = 0;
+	for(unsigned i = 0; i < count; i++)
+	{
+		RxFrame &frame = frames[i];
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+		if(_capture && _capture->Enabled())
+			_capture->Record(_dispatcher.GetTicks(), CaptureRx, 0, 0, frame.buffer);
+#endif
+		if(frame.protocolId == VLAN_Tagged && !ParseVlanTag(frame))
+		{
+			DataBuffer::ReleaseRecursive(frame.buffer);
+			frame.buffer = 0;
+			continue;
+		}
+		lanes |= 1u << _priorityLanes[VlanPriority(frame.vlanTag)];
+	}
+	
+	if((lanes & (lanes - 1)) == 0)
+	{
+		// all frames are in the same lane, deliver in arrival order
+		DeliverFrames(interfaceIndex, frames, count, NetRxLanes);
+		return;
+	}
+	for(unsigned lane = NetRxLanes; lane-- > 0; )
+	{
+		if(lanes & (1u << lane))
+			DeliverFrames(interfaceIndex, frames, count, lane);
+	}
+}
+
+bool NetDispatch::SendMesage(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)
+{
+	unsigned offload = buffer.ChecksumOffload();
+	if(offload != ChecksumNone)
+	{
+		// software fallback if any of interfaces can not insert requested checksums
+		for(unsigned i = 0; i < _interfaces.size(); i++)
+		{
+			if((_interfaces[i]->GetParameter(NetIfSupportHwCheckSum) & offload) != offload)
+			{
+				if(protocoId == IPv4)
+					ComputeIpv4Checksums(buffer, offload);
+				buffer.SetChecksumOffload(ChecksumNone);
+				break;
+			}
+		}
+	}
 	
+	if(_interfaces.empty())
+		return false;
+	uint16_t payloadProtocolId = protocoId;
+	if(buffer.VlanTag())
+	{
+		// uses buffer headroom when available
+		if(!buffer.InsertFront(VlanTagSize))
+			return false;
+		buffer.Seek(0);
+		buffer.WriteU16Be(buffer.VlanTag());
+		buffer.WriteU16Be(protocoId);
+		protocoId = VLAN_Tagged;
+	}
+	
+	unsigned index = SelectInterface();
+	NetInterface *interface = _interfaces[index];
+	NetTxScheduler *scheduler = _schedulers[index];
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+	Capture(CaptureTx, interface->GetMacAddress(0), destAddr, protocoId, buffer.BufferList());
+#endif
+	size_t frameSize = _stats ? buffer.Size() + EthernetHeaderSize : 0;
+	bool accepted;
+	if(scheduler)
+	{
+		accepted = scheduler->Enqueue(destAddr, protocoId, buffer);
+		scheduler->Service(*interface);
+	}
+	else
+	{
+		accepted = interface->CanTransmit(buffer) && interface->Transmit(destAddr, protocoId, buffer) != 0;
+	}
+	if(_stats)
+		_stats->TxFrame(index, payloadProtocolId, frameSize, accepted);
+	if(!accepted && protocoId == VLAN_Tagged)
+	{
+		// sender may retry with the same buffer
+		buffer.TrimFront(VlanTagSize);
+	}
+	return accepted;
 }
 
-void NetDispatch::AddInterface(NetInterface *interface)
+NetDispatch::NetDispatch(Dispatcher &dispatcher)
+	:_dispatcher(dispatcher),
+	_stats(0)
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+	,_capture(0)
+#endif
 {
+	for(unsigned i = 0; i < 8; i++)
+		_priorityLanes[i] = i < 4 ? 0 : NetRxLanes - 1;
+}
+
+#if defined(MCUCPP_NET_CAPTURE) && MCUCPP_NET_CAPTURE
+void NetDispatch::Capture(CaptureDirection direction, const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, uint16_t protocoId, const DataBuffer *chain)
+{
+	if(!_capture || !_capture->Enabled())
+		return;
+	// link layer header is not in the buffer yet, it is rebuilt for the record
+	uint8_t header[EthernetHeaderSize];
+	memcpy(header, (const uint8_t *)destAddr, 6);
+	memcpy(header + 6, (const uint8_t *)srcAddr, 6);
+	header[12] = (uint8_t)(protocoId >> 8);
+	header[13] = (uint8_t)protocoId;
+	_capture->Record(_dispatcher.GetTicks(), direction, header, sizeof(header), chain);
+}
+#endif
+
+void NetDispatch::AddInterface(NetInterface *interface, NetTxScheduler *scheduler)
+{
+	interface->SetDispatch(this);
 	_interfaces.push_back(interface);
+	_schedulers.push_back(scheduler);
+}
+
+void NetDispatch::AddProtocol(uint16_t protocoId, INetProtocol *protocol, uint16_t vlanId)
+{
+	_protocols.push_back(ProtocolIdPair(protocol, protocoId, VlanId(vlanId)));
 }
 
-void NetDispatch::AddProtocol(uint16_t protocoId, INetProtocol *protocol)
+void NetDispatch::SetPriorityLane(uint8_t priority, uint8_t lane)
 {
-	_protocols.push_back(ProtocolIdPair(protocol, protocoId));
+	if(priority < 8 && lane < NetRxLanes)
+		_priorityLanes[priority] = lane;
 }
 
 void NetDispatch::Poll()
@@ -52,5 +281,7 @@ void NetDispatch::Poll()
 	for(unsigned i = 0; i < _interfaces.size(); i++)
 	{
 		_interfaces[i]->Poll();
+		if(_schedulers[i])
+			_schedulers[i]->Service(*_interfaces[i]);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,412 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/arp.h>
+#include <net/ether_type.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	const size_t ArpPacketSize = 28;
+	const uint16_t ArpHwTypeEthernet = 1;
+	
+	inline uint32_t IpToU32(const Net::IpAddr &ip)
+	{
+		return ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+	}
+}
+
+Arp::Arp(Dispatcher &dispatcher, INetDispatch &netDispatch, ArpEntry *storage, size_t capacity)
+	:_dispatcher(dispatcher),
+	_netDispatch(netDispatch),
+	_entries(storage),
+	_mask(0),
+	_count(0),
+	_hand(0),
+	_agingPeriod(1000),
+	_maxAge(300),
+	_maxRetries(3),
+	_agingArmed(false),
+	_hits(0),
+	_misses(0),
+	_evictions(0),
+	_pendingDropped(0)
+{
+	size_t size = 1;
+	while(size * 2 <= capacity)
+		size *= 2;
+	_mask = size - 1;
+	for(size_t i = 0; i < size; i++)
+		_entries[i] = ArpEntry();
+}
+
+void Arp::SetAddress(const Net::IpAddr &ipAddr, const Net::MacAddr &macAddr)
+{
+	_ipAddr = ipAddr;
+	_macAddr = macAddr;
+	StartAging();
+}
+
+void Arp::SetAging(uint32_t agingPeriod, uint16_t maxAge, uint16_t maxRetries)
+{
+	_agingPeriod = agingPeriod;
+	_maxAge = maxAge;
+	_maxRetries = maxRetries;
+	_agingArmed = _dispatcher.SetTimer<Arp, &Arp::AgingTimer>(_agingPeriod, this) != 0;
+}
+
+// Dispatcher refuses timers until its tick source is set, so arming is retried when entries are created
+void Arp::StartAging()
+{
+	if(!_agingArmed)
+		_agingArmed = _dispatcher.SetTimer<Arp, &Arp::AgingTimer>(_agingPeriod, this) != 0;
+}
+
+size_t Arp::Home(const Net::IpAddr &ip) const
+{
+	// Fibonacci hashing, high bits of product are the best mixed ones
+	return (size_t)((IpToU32(ip) * 2654435769u) >> 16) & _mask;
+}
+
+ArpEntry *Arp::Find(const Net::IpAddr &ip)
+{
+	for(size_t i = Home(ip); ; i = (i + 1) & _mask)
+	{
+		ArpEntry &entry = _entries[i];
+		if(entry.state == ArpFree)
+			return 0;
+		if(entry.ip == ip)
+			return &entry;
+	}
+}
+
+ArpEntry *Arp::Insert(const Net::IpAddr &ip, ArpEntryState state)
+{
+	StartAging();
+	// keep load factor under 3/4, so probe sequences stay short and always end with free slot
+	size_t size = _mask + 1;
+	size_t maxCount = size - (size >= 4 ? size / 4 : 1);
+	if(_count >= maxCount && !Evict())
+		return 0;
+	size_t i = Home(ip);
+	while(_entries[i].state != ArpFree)
+		i = (i + 1) & _mask;
+	ArpEntry &entry = _entries[i];
+	entry.ip = ip;
+	entry.state = state;
+	entry.age = 0;
+	entry.referenced = 1;
+	_count++;
+	return &entry;
+}
+
+void Arp::RemoveAt(size_t index)
+{
+	// backward shift deletion, no tombstones are left in the table
+	size_t hole = index;
+	for(size_t i = (index + 1) & _mask; _entries[i].state != ArpFree; i = (i + 1) & _mask)
+	{
+		size_t home = Home(_entries[i].ip);
+		// entry may be moved to the hole only if its home slot is not in (hole, i] cyclic range
+		bool inRange = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+		if(!inRange)
+		{
+			_entries[hole] = _entries[i];
+			hole = i;
+		}
+	}
+	_entries[hole] = ArpEntry();
+	_count--;
+}
+
+bool Arp::Evict()
+{
+	// clock algorithm: recently referenced entries get second chance
+	for(size_t steps = 0; steps < 2 * (_mask + 1); steps++)
+	{
+		ArpEntry &entry = _entries[_hand];
+		if(entry.state == ArpReachable)
+		{
+			if(!entry.referenced)
+			{
+				RemoveAt(_hand);
+				_evictions++;
+				return true;
+			}
+			entry.referenced = 0;
+		}
+		_hand = (_hand + 1) & _mask;
+	}
+	return false;
+}
+
+void Arp::Update(const Net::IpAddr &ip, const Net::MacAddr &mac, bool create)
+{
+	ArpEntry *entry = Find(ip);
+	if(!entry)
+	{
+		if(!create)
+			return;
+		entry = Insert(ip, ArpReachable);
+		if(!entry)
+			return;
+	}
+	if(entry->state == ArpStatic)
+		return;
+	entry->mac = mac;
+	entry->state = ArpReachable;
+	entry->age = 0;
+	entry->referenced = 1;
+	FlushPending(ip, mac);
+}
+
+bool Arp::Lookup(const Net::IpAddr &ip, Net::MacAddr &mac)
+{
+	ArpEntry *entry = Find(ip);
+	if(entry && entry->state >= ArpReachable)
+	{
+		entry->referenced = 1;
+		mac = entry->mac;
+		return true;
+	}
+	return false;
+}
+
+bool Arp::Resolve(const Net::IpAddr &ip, Net::MacAddr &mac)
+{
+	if(Lookup(ip, mac))
+	{
+		_hits++;
+		return true;
+	}
+	_misses++;
+	ArpEntry *entry = Find(ip);
+	if(!entry)
+	{
+		entry = Insert(ip, ArpIncomplete);
+		if(!entry)
+			return false;
+		SendArp(ArpRequest, Net::MacAddr::Broadcast(), Net::MacAddr(), ip);
+	}
+	// incomplete entry requests are repeated by aging timer
+	return false;
+}
+
+bool Arp::Send(const Net::IpAddr &ip, uint16_t protocolId, Net::NetBuffer &buffer)
+{
+	Net::MacAddr mac;
+	if(Resolve(ip, mac))
+	{
+		return _netDispatch.SendMesage(mac, protocolId, buffer);
+	}
+	
+	// no room for incomplete entry in the cache, reply would not be accepted
+	if(!Find(ip))
+	{
+		_pendingDropped++;
+		return false;
+	}
+	
+	for(size_t i = 0; i < MaxArpPending; i++)
+	{
+		PendingFrame &pending = _pending[i];
+		if(!pending.buffer)
+		{
+			pending.ip = ip;
+			pending.protocolId = protocolId;
+			pending.checksumFlags = (uint8_t)buffer.ChecksumOffload();
+			pending.buffer = buffer.MoveToBufferList();
+			return true;
+		}
+	}
+	_pendingDropped++;
+	return false;
+}
+
+void Arp::FlushPending(const Net::IpAddr &ip, const Net::MacAddr &mac)
+{
+	for(size_t i = 0; i < MaxArpPending; i++)
+	{
+		PendingFrame &pending = _pending[i];
+		if(pending.buffer && pending.ip == ip)
+		{
+			Net::NetBuffer buffer(pending.buffer);
+			pending.buffer = 0;
+			buffer.SetChecksumOffload(pending.checksumFlags);
+			_netDispatch.SendMesage(mac, pending.protocolId, buffer);
+		}
+	}
+}
+
+void Arp::DropPending(const Net::IpAddr &ip)
+{
+	for(size_t i = 0; i < MaxArpPending; i++)
+	{
+		PendingFrame &pending = _pending[i];
+		if(pending.buffer && pending.ip == ip)
+		{
+			DataBuffer::ReleaseRecursive(pending.buffer);
+			pending.buffer = 0;
+			_pendingDropped++;
+		}
+	}
+}
+
+bool Arp::AddStatic(const Net::IpAddr &ip, const Net::MacAddr &mac)
+{
+	ArpEntry *entry = Find(ip);
+	if(!entry)
+		entry = Insert(ip, ArpStatic);
+	if(!entry)
+		return false;
+	entry->mac = mac;
+	entry->state = ArpStatic;
+	FlushPending(ip, mac);
+	return true;
+}
+
+bool Arp::Remove(const Net::IpAddr &ip)
+{
+	ArpEntry *entry = Find(ip);
+	if(!entry)
+		return false;
+	RemoveAt(entry - _entries);
+	DropPending(ip);
+	return true;
+}
+
+void Arp::Clear()
+{
+	for(size_t i = 0; i <= _mask; i++)
+		_entries[i] = ArpEntry();
+	_count = 0;
+	for(size_t i = 0; i < MaxArpPending; i++)
+	{
+		DataBuffer::ReleaseRecursive(_pending[i].buffer);
+		_pending[i].buffer = 0;
+	}
+}
+
+void Arp::AgingTimer()
+{
+	// start right after free slot, so backward shifts never move not yet visited entries to visited slots
+	size_t start = 0;
+	while(_entries[start].state != ArpFree)
+		start++;
+	
+	size_t index = (start + 1) & _mask;
+	for(size_t visited = 0; visited < _mask; )
+	{
+		ArpEntry &entry = _entries[index];
+		bool removed = false;
+		if(entry.state == ArpReachable && ++entry.age >= _maxAge)
+		{
+			RemoveAt(index);
+			removed = true;
+		}
+		else if(entry.state == ArpIncomplete)
+		{
+			if(++entry.age > _maxRetries)
+			{
+				Net::IpAddr ip = entry.ip;
+				RemoveAt(index);
+				DropPending(ip);
+				removed = true;
+			}
+			else
+			{
+				SendArp(ArpRequest, Net::MacAddr::Broadcast(), Net::MacAddr(), entry.ip);
+			}
+		}
+		// shifted entry now occupies current slot, it is visited on next step
+		if(!removed)
+		{
+			index = (index + 1) & _mask;
+			visited++;
+		}
+	}
+	_agingArmed = _dispatcher.SetTimer<Arp, &Arp::AgingTimer>(_agingPeriod, this) != 0;
+}
+
+void Arp::SendArp(uint16_t operation, const Net::MacAddr &destMac, const Net::MacAddr &targetMac, const Net::IpAddr &targetIp)
+{
+	Net::NetBuffer buffer;
+	if(!buffer.InsertBack(ArpPacketSize))
+		return;
+	buffer.Seek(0);
+	buffer.WriteU16Be(ArpHwTypeEthernet);
+	buffer.WriteU16Be(IPv4);
+	buffer.Write(6);
+	buffer.Write(4);
+	buffer.WriteU16Be(operation);
+	buffer.WriteMac(_macAddr);
+	buffer.WriteIp(_ipAddr);
+	buffer.WriteMac(targetMac);
+	buffer.WriteIp(targetIp);
+	_netDispatch.SendMesage(destMac, ARP, buffer);
+}
+
+void Arp::ProcessMessage(const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, Net::NetBuffer &buffer)
+{
+	(void)srcAddr;
+	(void)destAddr;
+	uint16_t hwType = buffer.ReadU16Be();
+	uint16_t protocolType = buffer.ReadU16Be();
+	uint8_t hwLength = buffer.Read();
+	uint8_t protocolLength = buffer.Read();
+	if(hwType != ArpHwTypeEthernet || protocolType != IPv4 || hwLength != 6 || protocolLength != 4)
+		return;
+	uint16_t operation = buffer.ReadU16Be();
+	Net::MacAddr senderMac = buffer.ReadMac();
+	Net::IpAddr senderIp = buffer.ReadIp();
+	buffer.ReadMac();
+	Net::IpAddr targetIp = buffer.ReadIp();
+	
+	// RFC 826: update existing entry, create new one only if the packet is addressed to us
+	bool forUs = targetIp == _ipAddr;
+	Update(senderIp, senderMac, forUs);
+	
+	if(forUs && operation == ArpRequest)
+	{
+		SendArp(ArpReply, senderMac, senderMac, senderIp);
+	}
+}
+
+uint32_t Arp::GetStatistic(Statistic statistic) const
+{
+	switch(statistic)
+	{
+		case ArpHits:           return _hits;
+		case ArpMisses:         return _misses;
+		case ArpEvictions:      return _evictions;
+		case ArpPendingDropped: return _pendingDropped;
+		case ArpEntries:        return _count;
+	}
+	return 0;
+}
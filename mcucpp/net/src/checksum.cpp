@@ -0,0 +1,240 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/checksum.h>
+#include <net/ip_protocol.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	inline void AddWithCarry(uint64_t &sum, uint64_t value)
+	{
+		sum += value;
+		sum += (sum < value);
+	}
+	
+	inline uint16_t Fold64(uint64_t sum)
+	{
+		uint32_t low = (uint32_t)sum;
+		uint32_t res = low + (uint32_t)(sum >> 32);
+		res += (res < low);
+		return ChecksumFold(res);
+	}
+	
+	inline uint16_t Swap16(uint16_t value)
+	{
+		return (uint16_t)((value << 8) | (value >> 8));
+	}
+	
+	// One's complement sum of memory block in native byte order.
+	// Words are loaded with memcpy, so the block may have any alignment.
+	uint16_t SumBlock(const uint8_t *data, size_t length)
+	{
+		uint64_t sum = 0;
+#if defined(__SSE2__)
+		// four 32 bit words per step, widened to two 64 bit lanes; no carries until 2^32 steps
+		if(length >= 32)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i acc0 = zero, acc1 = zero;
+			do
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+				acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+				acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+				data += 16;
+				length -= 16;
+			}while(length >= 16);
+			uint64_t lanes[2];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_add_epi64(acc0, acc1));
+			AddWithCarry(sum, lanes[0]);
+			AddWithCarry(sum, lanes[1]);
+		}
+#elif defined(__LP64__) || defined(_WIN64)
+		// 64 bit words with end-around carry
+		while(length >= 8)
+		{
+			uint64_t w;
+			memcpy(&w, data, 8);
+			AddWithCarry(sum, w);
+			data += 8;
+			length -= 8;
+		}
+#endif
+		// 32 bit words accumulated into 64 bit, no carries until 2^32 words
+		uint64_t acc = 0;
+		while(length >= 16)
+		{
+			uint32_t w[4];
+			memcpy(w, data, 16);
+			acc += (uint64_t)w[0] + w[1];
+			acc += (uint64_t)w[2] + w[3];
+			data += 16;
+			length -= 16;
+		}
+		while(length >= 4)
+		{
+			uint32_t w;
+			memcpy(&w, data, 4);
+			acc += w;
+			data += 4;
+			length -= 4;
+		}
+		if(length >= 2)
+		{
+			uint16_t w;
+			memcpy(&w, data, 2);
+			acc += w;
+			data += 2;
+			length -= 2;
+		}
+		if(length)
+		{
+			// odd tail byte padded with zero
+			uint8_t tail[2] = {data[0], 0};
+			uint16_t w;
+			memcpy(&w, tail, 2);
+			acc += w;
+		}
+		AddWithCarry(sum, acc);
+		return Fold64(sum);
+	}
+	
+	// converts native byte order sum to network byte order value
+	inline uint16_t NativeToBe(uint16_t value)
+	{
+		uint8_t bytes[2];
+		memcpy(bytes, &value, 2);
+		return (uint16_t)((bytes[0] << 8) | bytes[1]);
+	}
+	
+	inline uint32_t AddPart(uint32_t sum, uint16_t part)
+	{
+		sum += part;
+		sum += (sum < part);
+		return sum;
+	}
+}
+
+uint32_t Mcucpp::Net::ChecksumAdd(const void *data, size_t length, uint32_t sum)
+{
+	return AddPart(sum, NativeToBe(SumBlock(static_cast<const uint8_t *>(data), length)));
+}
+
+uint32_t Mcucpp::Net::ChecksumAdd(const DataBuffer *chain, size_t offset, size_t length, uint32_t sum)
+{
+	while(chain && offset >= chain->Size())
+	{
+		offset -= chain->Size();
+		chain = chain->Next();
+	}
+	
+	// fragment started at odd position contributes byte swapped sum
+	bool odd = false;
+	while(chain && length)
+	{
+		size_t chunk = chain->Size() - offset;
+		if(chunk > length)
+			chunk = length;
+		uint16_t part = NativeToBe(SumBlock(chain->Data() + offset, chunk));
+		if(odd)
+			part = Swap16(part);
+		sum = AddPart(sum, part);
+		if(chunk & 1)
+			odd = !odd;
+		length -= chunk;
+		offset = 0;
+		chain = chain->Next();
+	}
+	return sum;
+}
+
+bool Mcucpp::Net::ComputeIpv4Checksums(NetBuffer &buffer, unsigned flags)
+{
+	const DataBuffer *chain = buffer.BufferList();
+	if(!buffer.Seek(0))
+		return false;
+	uint8_t versionAndLength = buffer.Read();
+	if((versionAndLength >> 4) != 4)
+		return false;
+	size_t headerLength = (versionAndLength & 0x0f) * 4;
+	buffer.Seek(2);
+	size_t totalLength = buffer.ReadU16Be();
+	if(headerLength < 20 || totalLength < headerLength || buffer.Size() < totalLength)
+		return false;
+	buffer.Seek(6);
+	uint16_t fragment = buffer.ReadU16Be();
+	buffer.Seek(9);
+	uint8_t protocol = buffer.Read();
+	
+	if(flags & ChecksumIpHeader)
+	{
+		buffer.Seek(10);
+		buffer.WriteU16Be(0);
+		uint16_t checksum = Checksum(chain, 0, headerLength);
+		buffer.Seek(10);
+		buffer.WriteU16Be(checksum);
+	}
+	
+	// more fragments flag or fragment offset set
+	if(!(flags & ChecksumPayload) || (fragment & 0x3fff))
+		return true;
+	
+	size_t checksumOffset;
+	uint32_t sum = 0;
+	size_t payloadLength = totalLength - headerLength;
+	switch(protocol)
+	{
+		case IpProtocolIcmp: checksumOffset = 2; break;
+		case IpProtocolTcp:  checksumOffset = 16; break;
+		case IpProtocolUdp:  checksumOffset = 6; break;
+		default: return true;
+	}
+	if(payloadLength < checksumOffset + 2)
+		return false;
+	
+	if(protocol != IpProtocolIcmp)
+	{
+		// pseudo header: addresses, protocol and payload length
+		sum = ChecksumAdd(chain, 12, 8, protocol + payloadLength);
+	}
+	
+	buffer.Seek(headerLength + checksumOffset);
+	buffer.WriteU16Be(0);
+	uint16_t checksum = Checksum(chain, headerLength, payloadLength, sum);
+	if(checksum == 0 && protocol == IpProtocolUdp)
+		checksum = 0xffff;
+	buffer.Seek(headerLength + checksumOffset);
+	buffer.WriteU16Be(checksum);
+	return true;
+}
@@ -0,0 +1,235 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/ipv4.h>
+#include <net/ipv4_reassembly.h>
+#include <net/checksum.h>
+#include <net/ether_type.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	const uint16_t Ipv4FragmentMask = 0x3fff; // more fragments flag and fragment offset
+	
+	inline uint32_t IpToU32(const Net::IpAddr &ip)
+	{
+		return ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+	}
+}
+
+Ipv4::Ipv4(INetDispatch &netDispatch, Arp &arp)
+	:_netDispatch(netDispatch),
+	_arp(arp),
+	_reassembly(0),
+	_id(0),
+	_ttl(Ipv4DefaultTtl),
+	_received(0),
+	_delivered(0),
+	_headerErrors(0),
+	_checksumErrors(0),
+	_notForUs(0),
+	_fragmentsDropped(0),
+	_unknownProtocol(0),
+	_sent(0),
+	_sendErrors(0)
+{
+	
+}
+
+void Ipv4::SetAddress(const Net::IpAddr &address, const Net::IpAddr &netmask, const Net::IpAddr &gateway)
+{
+	_address = address;
+	_netmask = netmask;
+	_gateway = gateway;
+}
+
+bool Ipv4::AddProtocol(uint8_t protocol, IIpProtocol *handler)
+{
+	if(_protocols.full())
+		return false;
+	_protocols.push_back(ProtocolIdPair(handler, protocol));
+	return true;
+}
+
+IIpProtocol *Ipv4::FindProtocol(uint8_t protocol)
+{
+	for(unsigned i = 0; i < _protocols.size(); i++)
+	{
+		if(_protocols[i].id == protocol)
+			return _protocols[i].protocol;
+	}
+	return 0;
+}
+
+bool Ipv4::IsLocal(const Net::IpAddr &addr) const
+{
+	return addr == _address;
+}
+
+bool Ipv4::IsBroadcast(const Net::IpAddr &addr) const
+{
+	uint32_t value = IpToU32(addr);
+	if(value == 0xffffffffu)
+		return true;
+	// subnet directed broadcast
+	uint32_t mask = IpToU32(_netmask);
+	return mask != 0xffffffffu && (value & mask) == (IpToU32(_address) & mask) && (value | mask) == 0xffffffffu;
+}
+
+bool Ipv4::Send(const Net::IpAddr &destAddr, uint8_t protocol, Net::NetBuffer &buffer)
+{
+	size_t totalLength = buffer.Size() + Ipv4HeaderSize;
+	if(totalLength > 0xffff || !buffer.InsertFront(Ipv4HeaderSize))
+	{
+		_sendErrors++;
+		return false;
+	}
+	buffer.Seek(0);
+	buffer.Write(0x40 | (Ipv4HeaderSize / 4));
+	buffer.Write(0);
+	buffer.WriteU16Be((uint16_t)totalLength);
+	buffer.WriteU16Be(_id++);
+	buffer.WriteU16Be(0);
+	buffer.Write(_ttl);
+	buffer.Write(protocol);
+	buffer.WriteU16Be(0);
+	buffer.WriteIp(_address);
+	buffer.WriteIp(destAddr);
+	unsigned offload = buffer.ChecksumOffload();
+	buffer.SetChecksumOffload(offload | ChecksumIpHeader);
+	
+	bool result;
+	if(IsBroadcast(destAddr))
+	{
+		result = _netDispatch.SendMesage(Net::MacAddr::Broadcast(), IPv4, buffer);
+	}
+	else
+	{
+		uint32_t mask = IpToU32(_netmask);
+		bool onLink = (IpToU32(destAddr) & mask) == (IpToU32(_address) & mask) || _gateway == Net::IpAddr();
+		result = _arp.Send(onLink ? destAddr : _gateway, IPv4, buffer);
+	}
+	if(result)
+	{
+		_sent++;
+	}
+	else
+	{
+		// caller may retry with the same buffer
+		buffer.TrimFront(Ipv4HeaderSize);
+		buffer.SetChecksumOffload(offload);
+		_sendErrors++;
+	}
+	return result;
+}
+
+void Ipv4::ProcessMessage(const Net::MacAddr &srcAddr, const Net::MacAddr &destAddr, Net::NetBuffer &buffer)
+{
+	(void)srcAddr;
+	(void)destAddr;
+	_received++;
+	
+	Ipv4Header header;
+	header.offset = buffer.Position();
+	uint8_t versionAndLength = buffer.Read();
+	header.headerLength = (versionAndLength & 0x0f) * 4;
+	header.tos = buffer.Read();
+	uint16_t totalLength = buffer.ReadU16Be();
+	header.id = buffer.ReadU16Be();
+	header.fragment = buffer.ReadU16Be();
+	header.ttl = buffer.Read();
+	header.protocol = buffer.Read();
+	buffer.ReadU16Be();
+	header.srcAddr = buffer.ReadIp();
+	header.destAddr = buffer.ReadIp();
+	header.checksumFlags = (uint8_t)buffer.ChecksumOffload();
+	
+	// frame may be longer than packet due to link layer padding
+	if((versionAndLength >> 4) != 4 || header.headerLength < Ipv4HeaderSize || 
+		totalLength < header.headerLength || buffer.Size() < header.offset + totalLength)
+	{
+		_headerErrors++;
+		return;
+	}
+	
+	if((header.checksumFlags & ChecksumError) || 
+		(!(header.checksumFlags & ChecksumIpHeader) && Checksum(buffer.BufferList(), header.offset, header.headerLength) != 0))
+	{
+		_checksumErrors++;
+		return;
+	}
+	
+	if(!IsLocal(header.destAddr) && !IsBroadcast(header.destAddr))
+	{
+		_notForUs++;
+		return;
+	}
+	
+	IIpProtocol *protocol = FindProtocol(header.protocol);
+	if(!protocol)
+	{
+		_unknownProtocol++;
+		return;
+	}
+	
+	header.payloadOffset = header.offset + header.headerLength;
+	header.payloadLength = totalLength - header.headerLength;
+	
+	if(header.fragment & Ipv4FragmentMask)
+	{
+		if(!_reassembly)
+		{
+			_fragmentsDropped++;
+			return;
+		}
+		// buffer is taken by reassembly until the datagram is complete
+		if(!_reassembly->Process(header, buffer))
+			return;
+	}
+	buffer.Seek(header.payloadOffset);
+	_delivered++;
+	protocol->ProcessMessage(header, buffer);
+}
+
+uint32_t Ipv4::GetStatistic(Statistic statistic) const
+{
+	switch(statistic)
+	{
+		case IpReceived:         return _received;
+		case IpDelivered:        return _delivered;
+		case IpHeaderErrors:     return _headerErrors;
+		case IpChecksumErrors:   return _checksumErrors;
+		case IpNotForUs:         return _notForUs;
+		case IpFragmentsDropped: return _fragmentsDropped;
+		case IpUnknownProtocol:  return _unknownProtocol;
+		case IpSent:             return _sent;
+		case IpSendErrors:       return _sendErrors;
+	}
+	return 0;
+}
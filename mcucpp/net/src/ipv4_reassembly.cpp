@@ -0,0 +1,294 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/ipv4_reassembly.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	const uint16_t Ipv4MoreFragments = 0x2000;
+	const uint16_t Ipv4FragmentOffsetMask = 0x1fff;
+	const uint16_t HoleOpenEnd = 0xffff; // last hole end while datagram length is unknown
+}
+
+Ipv4Reassembly::Ipv4Reassembly(Dispatcher &dispatcher)
+	:_dispatcher(dispatcher),
+	_timeout(15000),
+	_minFreeBuffers(1),
+	_fragments(0),
+	_reassembled(0),
+	_timedOut(0),
+	_evicted(0),
+	_dropped(0)
+{
+	for(size_t i = 0; i < MaxIpReassemblySlots; i++)
+		_slots[i].fragmentCount = 0;
+	_dispatcher.SetTimer<Ipv4Reassembly, &Ipv4Reassembly::TimeoutTimer>(_timeout / 2, this);
+}
+
+Ipv4Reassembly::~Ipv4Reassembly()
+{
+	Clear();
+}
+
+void Ipv4Reassembly::SetTimeout(uint32_t timeout)
+{
+	_timeout = timeout;
+	_dispatcher.SetTimer<Ipv4Reassembly, &Ipv4Reassembly::TimeoutTimer>(_timeout / 2 ? _timeout / 2 : 1, this);
+}
+
+Ipv4Reassembly::Slot *Ipv4Reassembly::Find(const Ipv4Header &header)
+{
+	for(size_t i = 0; i < MaxIpReassemblySlots; i++)
+	{
+		Slot &slot = _slots[i];
+		if(slot.fragmentCount && slot.id == header.id && slot.protocol == header.protocol && 
+			slot.srcAddr == header.srcAddr && slot.destAddr == header.destAddr)
+			return &slot;
+	}
+	return 0;
+}
+
+Ipv4Reassembly::Slot *Ipv4Reassembly::LeastRecentlyUpdated(const Slot *except)
+{
+	Slot *oldest = 0;
+	uint32_t now = _dispatcher.GetTicks();
+	for(size_t i = 0; i < MaxIpReassemblySlots; i++)
+	{
+		Slot &slot = _slots[i];
+		if(!slot.fragmentCount || &slot == except)
+			continue;
+		if(!oldest || now - slot.updated > now - oldest->updated)
+			oldest = &slot;
+	}
+	return oldest;
+}
+
+Ipv4Reassembly::Slot *Ipv4Reassembly::Allocate(const Ipv4Header &header)
+{
+	Slot *slot = 0;
+	for(size_t i = 0; i < MaxIpReassemblySlots && !slot; i++)
+	{
+		if(!_slots[i].fragmentCount)
+			slot = &_slots[i];
+	}
+	if(!slot)
+	{
+		slot = LeastRecentlyUpdated(0);
+		Free(*slot);
+		_evicted++;
+	}
+	slot->srcAddr = header.srcAddr;
+	slot->destAddr = header.destAddr;
+	slot->id = header.id;
+	slot->protocol = header.protocol;
+	slot->headerLength = 0;
+	slot->totalLength = 0;
+	slot->started = slot->updated = _dispatcher.GetTicks();
+	slot->holes[0].first = 0;
+	slot->holes[0].last = HoleOpenEnd;
+	slot->holeCount = 1;
+	return slot;
+}
+
+void Ipv4Reassembly::Free(Slot &slot)
+{
+	for(size_t i = 0; i < slot.fragmentCount; i++)
+		DataBuffer::ReleaseRecursive(slot.fragments[i].buffer);
+	slot.fragmentCount = 0;
+	slot.holeCount = 0;
+}
+
+bool Ipv4Reassembly::AddHoles(Slot &slot, uint16_t first, uint16_t last, bool moreFragments)
+{
+	// RFC 815: fragment must fit in one of holes, the hole is replaced with remaining parts of it
+	for(size_t i = 0; i < slot.holeCount; i++)
+	{
+		Hole hole = slot.holes[i];
+		if(first < hole.first || last > hole.last)
+			continue;
+		// the last fragment may only fill the open ended hole
+		if(!moreFragments && hole.last != HoleOpenEnd)
+			return false;
+		slot.holes[i] = slot.holes[--slot.holeCount];
+		if(first > hole.first)
+		{
+			slot.holes[slot.holeCount].first = hole.first;
+			slot.holes[slot.holeCount].last = first - 1;
+			slot.holeCount++;
+		}
+		if(moreFragments && last < hole.last)
+		{
+			slot.holes[slot.holeCount].first = last + 1;
+			slot.holes[slot.holeCount].last = hole.last;
+			slot.holeCount++;
+		}
+		if(!moreFragments)
+			slot.totalLength = last + 1;
+		return true;
+	}
+	return false;
+}
+
+bool Ipv4Reassembly::Process(Ipv4Header &header, Net::NetBuffer &buffer)
+{
+	_fragments++;
+	uint16_t offset = (header.fragment & Ipv4FragmentOffsetMask) * 8;
+	bool moreFragments = (header.fragment & Ipv4MoreFragments) != 0;
+	size_t length = header.payloadLength;
+	// all fragments but the last one carry multiple of 8 bytes
+	if(length == 0 || (moreFragments && (length & 7)) || offset + length + header.headerLength > 0xffff)
+	{
+		_dropped++;
+		return false;
+	}
+	
+	Slot *slot = Find(header);
+	if(!slot)
+		slot = Allocate(header);
+	
+	if(slot->fragmentCount >= MaxIpFragments)
+	{
+		Free(*slot);
+		_dropped++;
+		return false;
+	}
+	
+	// overlapping or duplicate fragment is discarded, datagram is kept
+	if(!AddHoles(*slot, offset, (uint16_t)(offset + length - 1), moreFragments))
+	{
+		_dropped++;
+		return false;
+	}
+	
+	// fragment buffer is trimmed to payload in place, the first one keeps IP header
+	buffer.Truncate(header.payloadOffset + length);
+	if(offset == 0)
+	{
+		buffer.TrimFront(header.offset);
+		slot->headerLength = header.headerLength;
+	}
+	else
+	{
+		buffer.TrimFront(header.payloadOffset);
+	}
+	
+	size_t pos = slot->fragmentCount;
+	while(pos > 0 && slot->fragments[pos - 1].offset > offset)
+	{
+		slot->fragments[pos] = slot->fragments[pos - 1];
+		pos--;
+	}
+	slot->fragments[pos].offset = offset;
+	slot->fragments[pos].buffer = buffer.MoveToBufferList();
+	slot->fragmentCount++;
+	slot->updated = _dispatcher.GetTicks();
+	
+	if(slot->holeCount == 0)
+	{
+		Complete(*slot, header, buffer);
+		return true;
+	}
+	
+	// incomplete datagrams must not starve receive path of buffers
+	while(DataBuffer::FreeBuffers(LargePoolBufferSize) < _minFreeBuffers)
+	{
+		Slot *victim = LeastRecentlyUpdated(slot);
+		if(!victim)
+			break;
+		Free(*victim);
+		_evicted++;
+	}
+	return false;
+}
+
+void Ipv4Reassembly::Complete(Slot &slot, Ipv4Header &header, Net::NetBuffer &buffer)
+{
+	Net::NetBuffer datagram(slot.fragments[0].buffer);
+	for(size_t i = 1; i < slot.fragmentCount; i++)
+		datagram.AttachBack(slot.fragments[i].buffer);
+	slot.fragmentCount = 0;
+	slot.holeCount = 0;
+	
+	buffer = datagram;
+	header.offset = 0;
+	header.headerLength = slot.headerLength;
+	header.payloadOffset = slot.headerLength;
+	header.payloadLength = slot.totalLength;
+	header.fragment = 0;
+	// hardware does not verify payload checksum of fragments
+	header.checksumFlags &= ~ChecksumPayload;
+	buffer.SetChecksumOffload(header.checksumFlags);
+	buffer.Seek(header.payloadOffset);
+	_reassembled++;
+}
+
+void Ipv4Reassembly::Clear()
+{
+	for(size_t i = 0; i < MaxIpReassemblySlots; i++)
+	{
+		if(_slots[i].fragmentCount)
+			Free(_slots[i]);
+	}
+}
+
+void Ipv4Reassembly::TimeoutTimer()
+{
+	uint32_t now = _dispatcher.GetTicks();
+	for(size_t i = 0; i < MaxIpReassemblySlots; i++)
+	{
+		Slot &slot = _slots[i];
+		if(slot.fragmentCount && now - slot.started >= _timeout)
+		{
+			Free(slot);
+			_timedOut++;
+		}
+	}
+	_dispatcher.SetTimer<Ipv4Reassembly, &Ipv4Reassembly::TimeoutTimer>(_timeout / 2 ? _timeout / 2 : 1, this);
+}
+
+uint32_t Ipv4Reassembly::GetStatistic(Statistic statistic) const
+{
+	switch(statistic)
+	{
+		case ReassemblyFragments: return _fragments;
+		case ReassemblyCompleted: return _reassembled;
+		case ReassemblyTimedOut:  return _timedOut;
+		case ReassemblyEvicted:   return _evicted;
+		case ReassemblyDropped:   return _dropped;
+		case ReassemblyActive:
+		{
+			uint32_t active = 0;
+			for(size_t i = 0; i < MaxIpReassemblySlots; i++)
+				active += _slots[i].fragmentCount != 0;
+			return active;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,264 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/loopback_interface.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+LoopbackInterface::LoopbackInterface(Dispatcher &dispatcher, const Net::MacAddr &macaddr)
+	:_dispatcher(dispatcher),
+	_peer(this),
+	_macaddr(macaddr),
+	_promiscuous(false),
+	_linked(true),
+	_latency(0),
+	_bandwidth(0),
+	_lossRate(0),
+	_random(1),
+	_linkFreeTime(0),
+	_txSequence(0),
+	_framesSend(0),
+	_framesRecived(0),
+	_framesAppMissed(0),
+	_framesLost(0),
+	_sendErrors(0)
+{
+	
+}
+
+void LoopbackInterface::Connect(LoopbackInterface *peer)
+{
+	_peer = peer ? peer : this;
+}
+
+void LoopbackInterface::SetLatency(uint32_t ticks)
+{
+	_latency = ticks;
+}
+
+void LoopbackInterface::SetBandwidth(uint32_t bytesPerTick)
+{
+	_bandwidth = bytesPerTick;
+}
+
+void LoopbackInterface::SetLossRate(uint16_t lossRate)
+{
+	_lossRate = lossRate;
+}
+
+void LoopbackInterface::SetRandomSeed(uint32_t seed)
+{
+	_random = seed;
+}
+
+void LoopbackInterface::SetLinked(bool linked)
+{
+	_linked = linked;
+}
+
+uint16_t LoopbackInterface::NextRandom()
+{
+	_random = _random * 1664525u + 1013904223u;
+	return (uint16_t)(_random >> 16);
+}
+
+bool LoopbackInterface::SetMacAddress(unsigned addrNumber, const Net::MacAddr &macaddr)
+{
+	if(addrNumber >= MaxAddresses())
+		return false;
+	_macaddr = macaddr;
+	return true;
+}
+
+bool LoopbackInterface::AddAddressFilter(const Net::MacAddr &macaddr)
+{
+	return _addressFilter.Add(macaddr);
+}
+
+bool LoopbackInterface::RemoveAddressFilter(const Net::MacAddr &macaddr)
+{
+	return _addressFilter.Remove(macaddr);
+}
+
+void LoopbackInterface::SetPromiscuous(bool promiscuous)
+{
+	_promiscuous = promiscuous;
+}
+
+bool LoopbackInterface::Accepts(const Net::MacAddr &destAddr) const
+{
+	return _promiscuous || destAddr == _macaddr || destAddr == Net::MacAddr::Broadcast() ||
+		_addressFilter.Match(destAddr) != MacFilterNone;
+}
+
+const Net::MacAddr& LoopbackInterface::GetMacAddress(unsigned addrNumber)
+{
+	(void)addrNumber;
+	return _macaddr;
+}
+
+bool LoopbackInterface::IsLinked()
+{
+	return _linked;
+}
+
+void LoopbackInterface::PauseCommand(uint16_t time)
+{
+	(void)time;
+}
+
+uint32_t LoopbackInterface::GetParameter(NetInterfaceParameter parameterId)
+{
+	switch(parameterId)
+	{
+		case NetIfFramesSend:        return _framesSend;
+		case NetIfFramesRecived:     return _framesRecived;
+		case NetIfFramesAppMissed:   return _framesAppMissed;
+		case NetIfFramesMacMissed:   return _framesLost;
+		case NetIfSendErrors:        return _sendErrors;
+		case NetIfReciveErrors:      return 0;
+		case NetIfLinked:            return _linked;
+		case NetIfLinkSpeedKbps:     return _bandwidth * 8; // assuming 1 ms ticks
+		case NetIfHwState:           return 0;
+		case NetIfSupportHwCheckSum: return ChecksumNone;
+	}
+	return 0;
+}
+
+TransferId LoopbackInterface::Transmit(const Net::MacAddr &destAddr, uint16_t protocoId, Net::NetBuffer &buffer)
+{
+	if(!_linked || _queue.full())
+	{
+		_sendErrors++;
+		return 0;
+	}
+	
+	if(!buffer.InsertFront(EthernetHeaderSize))
+	{
+		_sendErrors++;
+		return 0;
+	}
+	buffer.Seek(0);
+	buffer.WriteMac(destAddr);
+	buffer.WriteMac(_macaddr);
+	buffer.WriteU16Be(protocoId);
+	
+	// frame occupies the link after previous one is serialized
+	uint32_t now = _dispatcher.GetTicks();
+	uint32_t startTime = _queue.empty() || (int32_t)(now - _linkFreeTime) > 0 ? now : _linkFreeTime;
+	uint32_t serializationTime = _bandwidth ? (buffer.Size() + _bandwidth - 1) / _bandwidth : 0;
+	_linkFreeTime = startTime + serializationTime;
+	
+	if(++_txSequence == 0)
+		_txSequence = 1;
+	
+	bool lost = _lossRate && NextRandom() < _lossRate;
+	_queue.push_back(Frame(buffer.MoveToBufferList(), _txSequence, _linkFreeTime + _latency, lost));
+	return _txSequence;
+}
+
+bool LoopbackInterface::CanTransmit(Net::NetBuffer &)
+{
+	return _linked && !_queue.full();
+}
+
+bool LoopbackInterface::TxCompleteFor(TransferId txId)
+{
+	for(unsigned i = 0; i < _queue.size(); i++)
+	{
+		if(_queue[i].id == txId)
+			return false;
+	}
+	return true;
+}
+
+void LoopbackInterface::Deliver(RxFrame *frames, unsigned count)
+{
+	if(_dispatch)
+	{
+		_framesRecived += count;
+		_dispatch->RxCompleteBatch(this, frames, count);
+	}
+	else
+	{
+		for(unsigned i = 0; i < count; i++)
+		{
+			DataBuffer::ReleaseRecursive(frames[i].buffer);
+		}
+		_framesAppMissed += count;
+	}
+}
+
+void LoopbackInterface::Poll()
+{
+	uint32_t now = _dispatcher.GetTicks();
+	RxFrame frames[MaxLoopbackBatch];
+	unsigned count = 0;
+	
+	while(!_queue.empty())
+	{
+		Frame frame = _queue.front();
+		if((int32_t)(now - frame.deliveryTime) < 0)
+			break;
+		_queue.pop_front();
+		_framesSend++;
+		
+		// header is written by Transmit into the first fragment
+		DataBuffer *header = frame.buffer;
+		if(frame.lost || !_peer->_linked || header->Size() < EthernetHeaderSize)
+		{
+			_framesLost++;
+			DataBuffer::ReleaseRecursive(frame.buffer);
+		}
+		else if(!_peer->Accepts(Net::MacAddr(header->Data())))
+		{
+			// dropped by receiver address filter
+			DataBuffer::ReleaseRecursive(frame.buffer);
+		}
+		else
+		{
+			RxFrame &rxFrame = frames[count++];
+			rxFrame.destAddr = Net::MacAddr(header->Data());
+			rxFrame.srcAddr = Net::MacAddr(header->Data() + 6);
+			rxFrame.protocolId = (uint16_t)((header->Data()[12] << 8) | header->Data()[13]);
+			rxFrame.headerSize = EthernetHeaderSize;
+			rxFrame.checksumFlags = ChecksumNone;
+			rxFrame.buffer = frame.buffer;
+			if(count == MaxLoopbackBatch)
+			{
+				_peer->Deliver(frames, count);
+				count = 0;
+			}
+		}
+		
+		if(_dispatch)
+			_dispatch->TxComplete(this, frame.id, true);
+	}
+	if(count)
+		_peer->Deliver(frames, count);
+}
@@ -1,19 +1,50 @@
 
 #include <net/net_buffer.h>
-#include <MemPool.h>
+#include <mempool.h>
 #include <new.h>
+#include <atomic.h>
+#include <compiler.h>
 
 using namespace Mcucpp;
 using namespace Mcucpp::Net;
 
 
-MemPool<sizeof(DataBuffer) + SmallPoolBufferSize, 20, unsigned, VoidAtomic> SmallPool;
-MemPool<sizeof(DataBuffer) + MedPoolBufferSize,   16, unsigned, VoidAtomic> MedPool;
-MemPool<sizeof(DataBuffer) + LargePoolBufferSize, 4, unsigned, VoidAtomic> LargePool;
+MemPool<sizeof(DataBuffer) + SmallPoolBufferSize, SmallPoolBufferCount, unsigned, VoidAtomic> SmallPool;
+MemPool<sizeof(DataBuffer) + MedPoolBufferSize,   MedPoolBufferCount,   unsigned, VoidAtomic> MedPool;
+MemPool<sizeof(DataBuffer) + LargePoolBufferSize, LargePoolBufferCount, unsigned, VoidAtomic> LargePool;
+static uint32_t allocFailures = 0;
+
+#if defined(MCUCPP_NET_POOLS_REPORT) && MCUCPP_NET_POOLS_REPORT
+namespace
+{
+	// Pools RAM usage is printed by compiler as template arguments in deprecation warning
+	template<size_t TotalBytes, size_t SmallPoolBytes, size_t MedPoolBytes, size_t LargePoolBytes>
+	struct NetBufferPoolsReport
+	{
+		MCUCPP_DEPRECATED static void Show(){}
+	};
+	
+	inline void ShowPoolsReport()
+	{
+		NetBufferPoolsReport<sizeof(SmallPool) + sizeof(MedPool) + sizeof(LargePool), 
+			sizeof(SmallPool), sizeof(MedPool), sizeof(LargePool)>::Show();
+	}
+}
+#endif
 
 DataBuffer* DataBuffer::GetNew(size_t size)
 {
-	size_t sizeReuired = size + sizeof(DataBuffer);
+	return GetNewWithHeadroom(size, 0);
+}
+
+uint32_t DataBuffer::AllocFailures()
+{
+	return Atomic::Fetch(&allocFailures);
+}
+
+DataBuffer* DataBuffer::GetNewWithHeadroom(size_t size, size_t headroom)
+{
+	size_t sizeReuired = size + headroom + sizeof(DataBuffer);
 	void * ptr = 0;
 	size_t storage;
 	if(SmallPool.GetBlockSize() >= sizeReuired)
@@ -34,11 +65,14 @@ DataBuffer* DataBuffer::GetNew(size_t size)
 		storage = LargePool.GetBlockSize();
 	}
 	if(!ptr)
+	{
+		Atomic::FetchAndAdd(&allocFailures, 1);
 		return 0;
-	uint8_t *data = (uint8_t *)ptr + sizeof(DataBuffer);
-	storage -= sizeof(DataBuffer);
+	}
+	uint8_t *data = (uint8_t *)ptr + sizeof(DataBuffer) + headroom;
+	storage -= sizeof(DataBuffer) + headroom;
 	
-	DataBuffer * dataBuffer = new (ptr)DataBuffer(data, size, storage);
+	DataBuffer * dataBuffer = new (ptr)DataBuffer(data, size, storage, headroom);
 	return dataBuffer;
 }
 
@@ -58,6 +92,19 @@ void DataBuffer::Release(DataBuffer * data)
 	LargePool.Free(data);
 }
 
+size_t DataBuffer::FreeBuffers(size_t size)
+{
+	size_t sizeReuired = size + sizeof(DataBuffer);
+	size_t count = 0;
+	if(SmallPool.GetBlockSize() >= sizeReuired)
+		count += SmallPool.BlockCount() - SmallPool.UsedBlocks();
+	if(MedPool.GetBlockSize() >= sizeReuired)
+		count += MedPool.BlockCount() - MedPool.UsedBlocks();
+	if(LargePool.GetBlockSize() >= sizeReuired)
+		count += LargePool.BlockCount() - LargePool.UsedBlocks();
+	return count;
+}
+
 void DataBuffer::ReleaseRecursive(DataBuffer * buffer)
 {
 	DataBuffer *next;
@@ -74,7 +121,9 @@ void DataBuffer::ReleaseRecursive(DataBuffer * buffer)
 NetBufferBase::NetBufferBase()
 	:_first(0),
 	_current(0),
-	_pos(0)
+	_pos(0),
+	_checksumFlags(ChecksumNone),
+	_vlanTag(0)
 {
 	
 }
@@ -84,9 +133,13 @@ NetBufferBase::NetBufferBase(NetBufferBase &rhs)
 	_first = rhs._first;
 	_current = rhs._current;
 	_pos = rhs._pos;
+	_checksumFlags = rhs._checksumFlags;
+	_vlanTag = rhs._vlanTag;
 	rhs._first = 0;
 	rhs._current = 0;
 	rhs._pos = 0;
+	rhs._checksumFlags = ChecksumNone;
+	rhs._vlanTag = 0;
 	
 }
 
@@ -96,9 +149,13 @@ NetBufferBase & NetBufferBase::operator=(NetBufferBase &rhs)
 	_first = rhs._first;
 	_current = rhs._current;
 	_pos = rhs._pos;
+	_checksumFlags = rhs._checksumFlags;
+	_vlanTag = rhs._vlanTag;
 	rhs._first = 0;
 	rhs._current = 0;
 	rhs._pos = 0;
+	rhs._checksumFlags = ChecksumNone;
+	rhs._vlanTag = 0;
 	return *this;
 }
 
@@ -111,11 +168,19 @@ void NetBufferBase::Clear()
 {
 	DataBuffer *buffer = _first;
 	_current = _first = 0;
+	_checksumFlags = ChecksumNone;
+	_vlanTag = 0;
 	DataBuffer::ReleaseRecursive(buffer);
 }
 
 bool NetBufferBase::InsertFront(size_t size)
 {
+	if(_first && _first->PushFront(size))
+	{
+		if(_current == _first)
+			_pos += size;
+		return true;
+	}
 	DataBuffer* buffer = 0;
 	DataBuffer* next;
 	do
@@ -144,6 +209,11 @@ DataBuffer *DataBuffer::FindLast(DataBuffer *first)
 }
 
 bool NetBufferBase::InsertBack(size_t size)
+{
+	return InsertBack(size, 0);
+}
+
+bool NetBufferBase::InsertBack(size_t size, size_t headroom)
 {
 	DataBuffer *last, *buffer = 0;
 	DataBuffer** pnext;
@@ -164,7 +234,7 @@ bool NetBufferBase::InsertBack(size_t size)
 			}
 		}
 		if(!buffer)
-			buffer = DataBuffer::GetNew(size);
+			buffer = DataBuffer::GetNewWithHeadroom(size, headroom);
 		if(!buffer)
 			return false;
 	}while(!Atomic::CompareExchange(pnext, (DataBuffer *)0, buffer));
@@ -204,11 +274,49 @@ DataBuffer* NetBufferBase::DetachFront()
 	return first;
 }
 
+bool NetBufferBase::TrimFront(size_t size)
+{
+	while(_first && size)
+	{
+		if(_first->Size() > size)
+		{
+			_first->PullFront(size);
+			size = 0;
+			break;
+		}
+		size -= _first->Size();
+		DataBuffer *first = _first;
+		_first = first->_next;
+		DataBuffer::Release(first);
+	}
+	_current = _first;
+	_pos = 0;
+	return size == 0;
+}
+
+bool NetBufferBase::Truncate(size_t size)
+{
+	DataBuffer *current = _first;
+	while(current && current->Size() < size)
+	{
+		size -= current->Size();
+		current = current->Next();
+	}
+	if(!current)
+		return size == 0;
+	current->_size = size;
+	DataBuffer::ReleaseRecursive(current->_next);
+	current->_next = 0;
+	_current = _first;
+	_pos = 0;
+	return true;
+}
 
 bool NetBufferBase::Seek(size_t pos)
 {
 	DataBuffer *current = _first;
-	while(current && current->Size() < pos)
+	// position at the end of fragment is the beginning of the next one
+	while(current && (current->Size() < pos || (current->Size() == pos && current->Next())))
 	{
 		pos -= current->Size();
 		current = current->Next();
@@ -222,6 +330,18 @@ bool NetBufferBase::Seek(size_t pos)
 	return true;
 }
 
+size_t NetBufferBase::Position()
+{
+	size_t position = 0;
+	for(DataBuffer *current = _first; current; current = current->Next())
+	{
+		if(current == _current)
+			return position + _pos;
+		position += current->Size();
+	}
+	return position;
+}
+
 size_t NetBufferBase::Size()
 {
 	DataBuffer *current = _first;
@@ -0,0 +1,117 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/net_capture.h>
+#include <atomic.h>
+#include <compiler.h>
+#include <string.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+NetCapture::NetCapture()
+	:_writeSequence(0),
+	_readSequence(0),
+	_overwritten(0),
+	_ticksPerSecond(1000),
+	_enabled(false)
+{
+	for(size_t i = 0; i < NetCaptureRecords; i++)
+		_slots[i].sequence = ~(uint32_t)i;
+}
+
+void NetCapture::Record(uint32_t timestamp, CaptureDirection direction, const uint8_t *header, size_t headerSize, const DataBuffer *chain)
+{
+	if(!_enabled)
+		return;
+	uint32_t sequence = Atomic::FetchAndAdd(&_writeSequence, 1);
+	Slot &slot = _slots[sequence & (NetCaptureRecords - 1)];
+	// inverted sequence marks slot being written
+	slot.sequence = ~sequence;
+	MCUCPP_COMPILER_BARRIER();
+	
+	CaptureRecord &record = slot.record;
+	record.timestamp = timestamp;
+	record.direction = (uint8_t)direction;
+	size_t length = headerSize < NetCaptureSnapLength ? headerSize : NetCaptureSnapLength;
+	if(length)
+		memcpy(record.data, header, length);
+	size_t originalLength = headerSize;
+	for(const DataBuffer *part = chain; part; part = part->Next())
+	{
+		size_t size = part->Size();
+		originalLength += size;
+		if(length < NetCaptureSnapLength)
+		{
+			size_t toCopy = NetCaptureSnapLength - length < size ? NetCaptureSnapLength - length : size;
+			memcpy(record.data + length, part->Data(), toCopy);
+			length += toCopy;
+		}
+	}
+	record.capturedLength = (uint16_t)length;
+	record.originalLength = (uint16_t)originalLength;
+	
+	MCUCPP_COMPILER_BARRIER();
+	slot.sequence = sequence;
+}
+
+bool NetCapture::Read(CaptureRecord &record)
+{
+	uint32_t written = Atomic::Fetch(&_writeSequence);
+	if(written - _readSequence > NetCaptureRecords)
+	{
+		_overwritten += written - _readSequence - NetCaptureRecords;
+		_readSequence = written - NetCaptureRecords;
+	}
+	while(_readSequence != written)
+	{
+		Slot &slot = _slots[_readSequence & (NetCaptureRecords - 1)];
+		uint32_t sequence = slot.sequence;
+		if(sequence == ~_readSequence)
+			return false; // still being written
+		if(sequence == _readSequence)
+		{
+			MCUCPP_COMPILER_BARRIER();
+			record = slot.record;
+			MCUCPP_COMPILER_BARRIER();
+			if(slot.sequence == sequence)
+			{
+				_readSequence++;
+				return true;
+			}
+		}
+		// overwritten by newer record
+		_readSequence++;
+		_overwritten++;
+	}
+	return false;
+}
+
+void NetCapture::Clear()
+{
+	_readSequence = Atomic::Fetch(&_writeSequence);
+}
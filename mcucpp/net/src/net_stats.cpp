@@ -0,0 +1,144 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/net_stats.h>
+#include <string.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+NetStats::NetStats()
+{
+	Reset();
+}
+
+void NetStats::Reset()
+{
+	memset(_interfaces, 0, sizeof(_interfaces));
+	memset(_protocols, 0, sizeof(_protocols));
+	memset(_ports, 0, sizeof(_ports));
+	_protocolCount = 0;
+	_portCount = 0;
+	_lastProtocol = 0;
+	_noProtocol = 0;
+	_untracked = 0;
+	_allocFailuresBase = DataBuffer::AllocFailures();
+}
+
+NetFlowStats *NetStats::FindFlow(NetFlowStats *table, uint8_t &count, size_t capacity, uint16_t id)
+{
+	for(unsigned i = 0; i < count; i++)
+	{
+		if(table[i].id == id)
+			return &table[i];
+	}
+	if(count >= capacity)
+	{
+		_untracked++;
+		return 0;
+	}
+	NetFlowStats &flow = table[count++];
+	flow.id = id;
+	return &flow;
+}
+
+NetFlowStats *NetStats::FindProtocol(uint16_t protocolId)
+{
+	// frames of the same protocol usually come in bursts
+	if(_lastProtocol < _protocolCount && _protocols[_lastProtocol].id == protocolId)
+		return &_protocols[_lastProtocol];
+	NetFlowStats *flow = FindFlow(_protocols, _protocolCount, MaxStatsProtocols, protocolId);
+	if(flow)
+		_lastProtocol = (uint8_t)(flow - _protocols);
+	return flow;
+}
+
+void NetStats::RxFrame(unsigned interfaceIndex, uint16_t protocolId, size_t size)
+{
+	if(interfaceIndex < MaxStatsInterfaces)
+	{
+		NetInterfaceStats &stats = _interfaces[interfaceIndex];
+		stats.rx.Add(size);
+		stats.rxSizes[NetStatsSizeBucket(size)]++;
+	}
+	NetFlowStats *flow = FindProtocol(protocolId);
+	if(flow)
+		flow->rx.Add(size);
+}
+
+void NetStats::TxFrame(unsigned interfaceIndex, uint16_t protocolId, size_t size, bool accepted)
+{
+	if(!accepted)
+	{
+		if(interfaceIndex < MaxStatsInterfaces)
+			_interfaces[interfaceIndex].txRejected++;
+		return;
+	}
+	if(interfaceIndex < MaxStatsInterfaces)
+	{
+		NetInterfaceStats &stats = _interfaces[interfaceIndex];
+		stats.tx.Add(size);
+		stats.txSizes[NetStatsSizeBucket(size)]++;
+	}
+	NetFlowStats *flow = FindProtocol(protocolId);
+	if(flow)
+		flow->tx.Add(size);
+}
+
+void NetStats::UdpRx(uint16_t localPort, size_t size)
+{
+	NetFlowStats *flow = FindFlow(_ports, _portCount, MaxStatsUdpPorts, localPort);
+	if(flow)
+		flow->rx.Add(size);
+}
+
+void NetStats::UdpTx(uint16_t localPort, size_t size)
+{
+	NetFlowStats *flow = FindFlow(_ports, _portCount, MaxStatsUdpPorts, localPort);
+	if(flow)
+		flow->tx.Add(size);
+}
+
+const NetFlowStats *NetStats::Protocol(uint16_t protocolId) const
+{
+	for(unsigned i = 0; i < _protocolCount; i++)
+	{
+		if(_protocols[i].id == protocolId)
+			return &_protocols[i];
+	}
+	return 0;
+}
+
+const NetFlowStats *NetStats::UdpPort(uint16_t localPort) const
+{
+	for(unsigned i = 0; i < _portCount; i++)
+	{
+		if(_ports[i].id == localPort)
+			return &_ports[i];
+	}
+	return 0;
+}
@@ -0,0 +1,247 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/tx_scheduler.h>
+#include <net/NetInterface.h>
+#include <net/ether_type.h>
+#include <atomic.h>
+#include <compiler.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+NetTxQueue::NetTxQueue()
+	:_head(0),
+	_tail(0)
+{
+	for(unsigned i = 0; i < NetTxQueueSize; i++)
+		_slots[i].sequence = i;
+}
+
+bool NetTxQueue::Push(const NetTxFrame &frame)
+{
+	unsigned pos = Atomic::Fetch(&_head);
+	Slot *slot;
+	for(;;)
+	{
+		slot = &_slots[pos & (NetTxQueueSize - 1)];
+		int diff = (int)(slot->sequence - pos);
+		if(diff == 0)
+		{
+			if(Atomic::CompareExchange(&_head, pos, pos + 1))
+				break;
+		}
+		else if(diff < 0)
+		{
+			return false; // slot is not consumed yet, queue is full
+		}
+		pos = Atomic::Fetch(&_head);
+	}
+	slot->frame = frame;
+	MCUCPP_COMPILER_BARRIER();
+	slot->sequence = pos + 1;
+	return true;
+}
+
+NetTxFrame *NetTxQueue::Front()
+{
+	Slot &slot = _slots[_tail & (NetTxQueueSize - 1)];
+	if(slot.sequence != _tail + 1)
+		return 0;
+	MCUCPP_COMPILER_BARRIER();
+	return &slot.frame;
+}
+
+void NetTxQueue::Pop()
+{
+	Slot &slot = _slots[_tail & (NetTxQueueSize - 1)];
+	MCUCPP_COMPILER_BARRIER();
+	slot.sequence = _tail + NetTxQueueSize;
+	_tail++;
+}
+
+NetTxScheduler::NetTxScheduler()
+	:_drrClass(1),
+	_drrCredited(false),
+	_busy(0),
+	_rerun(0),
+	_transmitErrors(0)
+{
+	for(unsigned i = 0; i < NetTxClasses; i++)
+	{
+		_quantum[i] = NetTxDefaultQuantum;
+		_deficit[i] = 0;
+		_queued[i] = 0;
+		_rejected[i] = 0;
+	}
+	for(unsigned i = 0; i < 8; i++)
+		_priorityClasses[i] = i >= 6 ? 0 : i >= 4 ? 1 : 2;
+}
+
+void NetTxScheduler::SetPriorityClass(uint8_t priority, uint8_t txClass)
+{
+	if(priority < 8 && txClass < NetTxClasses)
+		_priorityClasses[priority] = txClass;
+}
+
+void NetTxScheduler::SetQuantum(uint8_t txClass, uint16_t bytes)
+{
+	if(txClass < NetTxClasses && bytes > 0)
+		_quantum[txClass] = bytes;
+}
+
+unsigned NetTxScheduler::ClassOf(uint16_t protocolId, uint16_t vlanTag) const
+{
+	if(vlanTag == 0 && protocolId == ARP)
+		return 0;
+	return _priorityClasses[vlanTag >> 13];
+}
+
+bool NetTxScheduler::Enqueue(const Net::MacAddr &destAddr, uint16_t protocolId, Net::NetBuffer &buffer)
+{
+	unsigned txClass = ClassOf(protocolId, buffer.VlanTag());
+	NetTxFrame frame;
+	frame.destAddr = destAddr;
+	frame.protocolId = protocolId;
+	frame.size = (uint16_t)buffer.Size();
+	frame.checksumFlags = (uint8_t)buffer.ChecksumOffload();
+	frame.buffer = buffer.BufferList();
+	if(!_queues[txClass].Push(frame))
+	{
+		_rejected[txClass]++;
+		return false;
+	}
+	buffer.MoveToBufferList();
+	_queued[txClass]++;
+	return true;
+}
+
+NetTxFrame *NetTxScheduler::NextDrrFrame(unsigned &txClass)
+{
+	for(;;)
+	{
+		bool backlog = false;
+		for(unsigned i = 1; i < NetTxClasses; i++)
+		{
+			NetTxFrame *frame = _queues[_drrClass].Front();
+			if(frame)
+			{
+				backlog = true;
+				if(!_drrCredited)
+				{
+					_deficit[_drrClass] += _quantum[_drrClass];
+					_drrCredited = true;
+				}
+				if(frame->size <= _deficit[_drrClass])
+				{
+					txClass = _drrClass;
+					return frame;
+				}
+			}
+			else
+			{
+				_deficit[_drrClass] = 0;
+			}
+			_drrClass = (unsigned)_drrClass + 1 < NetTxClasses ? _drrClass + 1 : 1;
+			_drrCredited = false;
+		}
+		if(!backlog)
+			return 0;
+	}
+}
+
+unsigned NetTxScheduler::ServiceQueues(NetInterface &interface)
+{
+	unsigned sent = 0;
+	for(;;)
+	{
+		unsigned txClass = 0;
+		NetTxFrame *frame = _queues[0].Front();
+		if(!frame)
+			frame = NextDrrFrame(txClass);
+		if(!frame)
+			break;
+		
+		NetBuffer buffer(frame->buffer);
+		buffer.SetChecksumOffload(frame->checksumFlags);
+		if(!interface.CanTransmit(buffer))
+		{
+			// frame stays in queue until interface frees its descriptors
+			buffer.MoveToBufferList();
+			break;
+		}
+		if(!interface.Transmit(frame->destAddr, frame->protocolId, buffer))
+			_transmitErrors++;
+		if(txClass != 0)
+			_deficit[txClass] -= frame->size;
+		_queues[txClass].Pop();
+		sent++;
+	}
+	return sent;
+}
+
+unsigned NetTxScheduler::Service(NetInterface &interface)
+{
+	if(!Atomic::CompareExchange(&_busy, (uint8_t)0, (uint8_t)1))
+	{
+		// queues are being serviced in other context, it will run once more
+		_rerun = 1;
+		return 0;
+	}
+	unsigned sent = 0;
+	do
+	{
+		_rerun = 0;
+		sent += ServiceQueues(interface);
+		_busy = 0;
+	}while(_rerun && Atomic::CompareExchange(&_busy, (uint8_t)0, (uint8_t)1));
+	return sent;
+}
+
+bool NetTxScheduler::Empty()
+{
+	for(unsigned i = 0; i < NetTxClasses; i++)
+	{
+		if(_queues[i].Front())
+			return false;
+	}
+	return true;
+}
+
+void NetTxScheduler::Clear()
+{
+	for(unsigned i = 0; i < NetTxClasses; i++)
+	{
+		NetTxFrame *frame;
+		while((frame = _queues[i].Front()) != 0)
+		{
+			DataBuffer::ReleaseRecursive(frame->buffer);
+			_queues[i].Pop();
+		}
+		_deficit[i] = 0;
+	}
+}
@@ -0,0 +1,211 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#include <net/udp.h>
+#include <net/checksum.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	const uint16_t FirstEphemeralPort = 49152;
+}
+
+Udp::Udp(Ipv4 &ipv4)
+	:_ipv4(ipv4),
+	_count(0),
+	_nextEphemeral(FirstEphemeralPort),
+	_stats(0),
+	_received(0),
+	_sent(0),
+	_noPort(0),
+	_errors(0)
+{
+	_ipv4.AddProtocol(IpProtocolUdp, this);
+}
+
+size_t Udp::Home(uint16_t port)
+{
+	return (size_t)(((uint32_t)port * 2654435769u) >> 16) & (TableSize - 1);
+}
+
+Udp::PortEntry *Udp::Find(uint16_t port)
+{
+	// table is at most half full, so there is always free slot ending probe sequence
+	for(size_t i = Home(port); ; i = (i + 1) & (TableSize - 1))
+	{
+		PortEntry &entry = _ports[i];
+		if(!entry.handler)
+			return 0;
+		if(entry.port == port)
+			return &entry;
+	}
+}
+
+bool Udp::Bind(uint16_t port, IUdpHandler *handler)
+{
+	if(port == 0 || !handler || _count >= MaxUdpPorts || Find(port))
+		return false;
+	size_t i = Home(port);
+	while(_ports[i].handler)
+		i = (i + 1) & (TableSize - 1);
+	_ports[i].port = port;
+	_ports[i].handler = handler;
+	_count++;
+	return true;
+}
+
+uint16_t Udp::BindEphemeral(IUdpHandler *handler)
+{
+	if(_count >= MaxUdpPorts)
+		return 0;
+	for(unsigned tries = 0; tries < MaxUdpPorts + 1; tries++)
+	{
+		uint16_t port = _nextEphemeral;
+		_nextEphemeral = _nextEphemeral == 0xffff ? FirstEphemeralPort : _nextEphemeral + 1;
+		if(Bind(port, handler))
+			return port;
+	}
+	return 0;
+}
+
+bool Udp::Unbind(uint16_t port)
+{
+	PortEntry *entry = Find(port);
+	if(!entry)
+		return false;
+	// backward shift deletion, same as in ARP cache
+	size_t hole = entry - _ports;
+	for(size_t i = (hole + 1) & (TableSize - 1); _ports[i].handler; i = (i + 1) & (TableSize - 1))
+	{
+		size_t home = Home(_ports[i].port);
+		bool inRange = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+		if(!inRange)
+		{
+			_ports[hole] = _ports[i];
+			hole = i;
+		}
+	}
+	_ports[hole] = PortEntry();
+	_count--;
+	return true;
+}
+
+bool Udp::Send(uint16_t localPort, const Net::IpAddr &destAddr, uint16_t destPort, Net::NetBuffer &buffer)
+{
+	size_t payloadSize = buffer.Size();
+	size_t length = payloadSize + UdpHeaderSize;
+	if(length + Ipv4HeaderSize > 0xffff || !buffer.InsertFront(UdpHeaderSize))
+	{
+		_errors++;
+		return false;
+	}
+	buffer.Seek(0);
+	buffer.WriteU16Be(localPort);
+	buffer.WriteU16Be(destPort);
+	buffer.WriteU16Be((uint16_t)length);
+	buffer.WriteU16Be(0);
+	unsigned offload = buffer.ChecksumOffload();
+	buffer.SetChecksumOffload(offload | ChecksumPayload);
+	if(!_ipv4.Send(destAddr, IpProtocolUdp, buffer))
+	{
+		// caller may retry with the same buffer
+		buffer.TrimFront(UdpHeaderSize);
+		buffer.SetChecksumOffload(offload);
+		_errors++;
+		return false;
+	}
+	_sent++;
+	if(_stats)
+		_stats->UdpTx(localPort, payloadSize);
+	return true;
+}
+
+void Udp::ProcessMessage(const Ipv4Header &header, Net::NetBuffer &buffer)
+{
+	_received++;
+	if(header.payloadLength < UdpHeaderSize)
+	{
+		_errors++;
+		return;
+	}
+	uint16_t srcPort = buffer.ReadU16Be();
+	uint16_t destPort = buffer.ReadU16Be();
+	uint16_t length = buffer.ReadU16Be();
+	uint16_t checksum = buffer.ReadU16Be();
+	if(length < UdpHeaderSize || length > header.payloadLength)
+	{
+		_errors++;
+		return;
+	}
+	
+	// zero checksum means that sender did not compute it
+	if(checksum != 0 && !(header.checksumFlags & ChecksumPayload))
+	{
+		const DataBuffer *chain = buffer.BufferList();
+		uint32_t sum = ChecksumAdd(chain, header.offset + 12, 8, IpProtocolUdp + length);
+		if(Checksum(chain, header.payloadOffset, length, sum) != 0)
+		{
+			_errors++;
+			return;
+		}
+	}
+	
+	PortEntry *entry = Find(destPort);
+	if(!entry)
+	{
+		_noPort++;
+		return;
+	}
+	
+	if(_stats)
+		_stats->UdpRx(destPort, length - UdpHeaderSize);
+	
+	UdpDatagram datagram;
+	datagram.remoteAddr = header.srcAddr;
+	datagram.localAddr = header.destAddr;
+	datagram.remotePort = srcPort;
+	datagram.localPort = destPort;
+	datagram.payloadOffset = header.payloadOffset + UdpHeaderSize;
+	datagram.payloadLength = length - UdpHeaderSize;
+	
+	BufferSpans payload(buffer.BufferList(), datagram.payloadOffset, datagram.payloadLength);
+	entry->handler->ProcessDatagram(datagram, payload, buffer);
+}
+
+uint32_t Udp::GetStatistic(Statistic statistic) const
+{
+	switch(statistic)
+	{
+		case UdpReceived: return _received;
+		case UdpSent:     return _sent;
+		case UdpNoPort:   return _noPort;
+		case UdpErrors:   return _errors;
+	}
+	return 0;
+}
@@ -0,0 +1,125 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/net_buffer.h>
+#include <net/net_addr.h>
+#include <static_assert.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+	class NetInterface;
+	
+#if defined(MCUCPP_NET_TX_QUEUE) && MCUCPP_NET_TX_QUEUE > 0
+	const size_t NetTxQueueSize = MCUCPP_NET_TX_QUEUE;
+#else
+	const size_t NetTxQueueSize = 8;
+#endif
+	STATIC_ASSERT((NetTxQueueSize & (NetTxQueueSize - 1)) == 0); // must be a power of 2
+	
+	// Class 0 is served with strict priority, others share remaining bandwidth by deficit round robin
+	const unsigned NetTxClasses = 3;
+	const uint16_t NetTxDefaultQuantum = 1518;
+	
+	struct NetTxFrame
+	{
+		Net::MacAddr destAddr;
+		uint16_t protocolId;
+		uint16_t size;
+		uint8_t checksumFlags;
+		DataBuffer *buffer;
+	};
+	
+	// Bounded queue with multiple producers and single consumer.
+	// Producers reserve slots with compare-exchange, slot sequence numbers tell consumer when slot is filled.
+	class NetTxQueue
+	{
+		struct Slot
+		{
+			volatile unsigned sequence;
+			NetTxFrame frame;
+		};
+		Slot _slots[NetTxQueueSize];
+		unsigned _head;
+		unsigned _tail;
+	public:
+		NetTxQueue();
+		bool Push(const NetTxFrame &frame);
+		// Returns 0 if queue is empty
+		NetTxFrame *Front();
+		void Pop();
+	};
+	
+	// Per interface transmit scheduler. Senders queue frames in priority classes and get
+	// back-pressure when class queue is full. Queued frames are passed to the interface
+	// in batches while it has free transmit descriptors.
+	class NetTxScheduler
+	{
+		NetTxQueue _queues[NetTxClasses];
+		uint16_t _quantum[NetTxClasses];
+		int32_t _deficit[NetTxClasses];
+		uint8_t _priorityClasses[8];
+		uint8_t _drrClass;
+		bool _drrCredited;
+		volatile uint8_t _busy;
+		volatile uint8_t _rerun;
+		
+		uint32_t _queued[NetTxClasses];
+		uint32_t _rejected[NetTxClasses];
+		uint32_t _transmitErrors;
+		
+		NetTxFrame *NextDrrFrame(unsigned &txClass);
+		unsigned ServiceQueues(NetInterface &interface);
+	public:
+		NetTxScheduler();
+		
+		// Maps 802.1Q priority code point to transmit class, untagged frames have priority 0.
+		// By default priorities 6-7 and untagged ARP go to class 0, 4-5 to class 1, 0-3 to class 2.
+		void SetPriorityClass(uint8_t priority, uint8_t txClass);
+		// Bytes sent by DRR class per round
+		void SetQuantum(uint8_t txClass, uint16_t bytes);
+		unsigned ClassOf(uint16_t protocolId, uint16_t vlanTag) const;
+		
+		// Queues frame, takes buffer ownership on success.
+		// Returns false and leaves 'buffer' intact if class queue is full.
+		bool Enqueue(const Net::MacAddr &destAddr, uint16_t protocolId, Net::NetBuffer &buffer);
+		// Passes queued frames to 'interface' until it has no room for the next one.
+		// May be called from different contexts, returns number of frames passed.
+		unsigned Service(NetInterface &interface);
+		bool Empty();
+		// Releases all queued frames
+		void Clear();
+		
+		uint32_t Queued(unsigned txClass) const { return _queued[txClass]; }
+		uint32_t Rejected(unsigned txClass) const { return _rejected[txClass]; }
+		// frames accepted by interface queue check, but failed in Transmit
+		uint32_t TransmitErrors() const { return _transmitErrors; }
+	};
+}
+}
@@ -0,0 +1,123 @@
+//*****************************************************************************
+//
+// Author		: Konstantin Chizhov
+// Date			: 2016
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer.
+
+// Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation and/or 
+// other materials provided with the distribution.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+// IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+// EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//*****************************************************************************
+
+#pragma once
+#include <net/ipv4.h>
+#include <net/net_stats.h>
+#include <static_assert.h>
+
+namespace Mcucpp
+{
+namespace Net
+{
+#if defined(MAX_UDP_PORTS) && MAX_UDP_PORTS > 0
+	const size_t MaxUdpPorts = MAX_UDP_PORTS;
+#else
+	const size_t MaxUdpPorts = 8;
+#endif
+	
+	const size_t UdpHeaderSize = 8;
+	
+	// Headroom to reserve in datagram buffers, so all headers are prepended without allocation:
+	//   buffer.InsertBack(payloadSize, UdpHeadroom);
+	const size_t UdpHeadroom = EthernetHeaderSize + VlanTagSize + Ipv4HeaderSize + UdpHeaderSize;
+	
+	struct UdpDatagram
+	{
+		Net::IpAddr remoteAddr;
+		Net::IpAddr localAddr;
+		uint16_t remotePort;
+		uint16_t localPort;
+		size_t payloadOffset;   // payload position in buffer
+		uint16_t payloadLength;
+	};
+	
+	class IUdpHandler
+	{
+	public:
+		// 'payload' iterates datagram payload in place over received buffer fragments.
+		// 'buffer' holds the whole frame, handler may take its ownership with MoveToBufferList.
+		virtual void ProcessDatagram(const UdpDatagram &datagram, Net::BufferSpans &payload, Net::NetBuffer &buffer)=0;
+	};
+	
+	// UDP protocol with port demultiplexing.
+	// Bound ports are kept in open-addressed hash table of twice MaxUdpPorts size with linear probing,
+	// so lookup takes constant time on average.
+	class Udp :public IIpProtocol
+	{
+		enum{TableSize = MaxUdpPorts * 2};
+		STATIC_ASSERT((TableSize & (TableSize - 1)) == 0);
+		
+		struct PortEntry
+		{
+			PortEntry() :handler(0), port(0) {}
+			IUdpHandler *handler;
+			uint16_t port;
+		};
+		
+		Ipv4 &_ipv4;
+		PortEntry _ports[TableSize];
+		size_t _count;
+		uint16_t _nextEphemeral;
+		NetStats *_stats;
+		
+		uint32_t _received;
+		uint32_t _sent;
+		uint32_t _noPort;
+		uint32_t _errors;
+		
+		static size_t Home(uint16_t port);
+		PortEntry *Find(uint16_t port);
+	public:
+		enum Statistic
+		{
+			UdpReceived,
+			UdpSent,
+			UdpNoPort,
+			UdpErrors
+		};
+		
+		Udp(Ipv4 &ipv4);
+		
+		bool Bind(uint16_t port, IUdpHandler *handler);
+		// Binds to free port from dynamic range, returns 0 on failure
+		uint16_t BindEphemeral(IUdpHandler *handler);
+		bool Unbind(uint16_t port);
+		
+		// Prepends UDP header to 'buffer' payload and sends datagram.
+		// Payload checksum is inserted by interface hardware or by NetDispatch.
+		bool Send(uint16_t localPort, const Net::IpAddr &destAddr, uint16_t destPort, Net::NetBuffer &buffer);
+		
+		uint32_t GetStatistic(Statistic statistic) const;
+		// Per local port payload traffic is counted in 'stats', may be null
+		void SetStats(NetStats *stats) { _stats = stats; }
+		
+	public: // IIpProtocol
+		virtual void ProcessMessage(const Ipv4Header &header, Net::NetBuffer &buffer);
+	};
+}
+}
@@ -157,6 +157,16 @@ SupportedDevices = {
 					'%(MCUCPP_HOME)s/mcucpp/ARM/Stm32F40x/src/adc.cpp',
 					'%(MCUCPP_HOME)s/mcucpp/ARM/Stm32F40x/src/ethernet.cpp',
 					'%(MCUCPP_HOME)s/mcucpp/net/src/net_buffer.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/NetDispatch.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/net_capture.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/net_stats.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/tx_scheduler.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/checksum.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/loopback_interface.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/arp.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/ipv4.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/ipv4_reassembly.cpp',
+					'%(MCUCPP_HOME)s/mcucpp/net/src/udp.cpp',
 					'%(MCUCPP_HOME)s/mcucpp/src/new.cpp'],
 		'linkerScript' : '%(MCUCPP_HOME)s/linker_scripts/stm32_40x.ld',
 		'clock' : 168000000,
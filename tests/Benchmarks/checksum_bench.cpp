@@ -0,0 +1,82 @@
+#include <net/checksum.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+static uint16_t ScalarChecksum(const DataBuffer *chain)
+{
+	uint32_t sum = 0;
+	bool odd = false;
+	for(; chain; chain = chain->Next())
+	{
+		for(size_t i = 0; i < chain->Size(); i++)
+		{
+			sum += odd ? chain->Data()[i] : chain->Data()[i] << 8;
+			odd = !odd;
+		}
+	}
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void FillRandom(NetBuffer &buffer, size_t size, size_t fragmentSize)
+{
+	while(size)
+	{
+		size_t chunk = size < fragmentSize ? size : fragmentSize;
+		DataBuffer *part = DataBuffer::GetNew(chunk);
+		if(!part)
+		{
+			printf("Out of net buffers\n");
+			exit(1);
+		}
+		for(size_t i = 0; i < chunk; i++)
+			(*part)[i] = (uint8_t)rand();
+		buffer.AttachBack(part);
+		size -= chunk;
+	}
+}
+
+template<class Func>
+static double Measure(Func func, const DataBuffer *chain, unsigned iterations, uint16_t &result)
+{
+	clock_t start = clock();
+	uint16_t acc = 0;
+	for(unsigned i = 0; i < iterations; i++)
+		acc ^= func(chain);
+	clock_t end = clock();
+	result = acc;
+	return double(end - start) / CLOCKS_PER_SEC;
+}
+
+static uint16_t FastChecksum(const DataBuffer *chain)
+{
+	return Checksum(chain, 0, 0xffff);
+}
+
+static void Run(const char *name, size_t size, size_t fragmentSize, unsigned iterations)
+{
+	NetBuffer buffer;
+	FillRandom(buffer, size, fragmentSize);
+	uint16_t fastResult, scalarResult;
+	double fast = Measure(FastChecksum, buffer.BufferList(), iterations, fastResult);
+	double scalar = Measure(ScalarChecksum, buffer.BufferList(), iterations, scalarResult);
+	double bytes = double(size) * iterations;
+	printf("%-24s %5u parts  fast %8.1f MB/s  scalar %8.1f MB/s  %s\n", 
+		name, buffer.Parts(), 
+		bytes / fast / 1e6, bytes / scalar / 1e6, 
+		fastResult == scalarResult ? "ok" : "MISMATCH");
+}
+
+int main()
+{
+	srand(1);
+	Run("64 bytes", 64, 64, 2000000);
+	Run("1500 bytes", 1500, 1380, 200000);
+	Run("1500 bytes, 127B frags", 1500, 127, 200000);
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include <filesystem/ram_disk.h>
+#include <filesystem/fat.h>
+#include <image_disk.h>
+#include <fat_image.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Fs;
+using namespace Mcucpp::Fat;
+
+// FAT file system over RAM disk with SD card like latencies.
+// Usage: fs_bench [image]. Image file is mapped privately, it is not modified.
+// Device time is modelled from latencies, host time shows file system CPU overhead.
+
+enum{ ImageSectors = 131072, FileSize = 4 * 1024 * 1024, Chunk = 16 * 1024, ListedFiles = 256 };
+
+typedef FatFs<RamDisk> Volume;
+
+static const BlockDeviceLatency cardLatency = {50, 25, 50, 2000};
+
+struct Measure
+{
+	RamDisk &disk;
+	clock_t start;
+	
+	Measure(RamDisk &diskArg)
+		:disk(diskArg)
+	{
+		disk.ResetCounters();
+		start = clock();
+	}
+	
+	void Print(const char *name, unsigned ops, double bytes, bool ok)
+	{
+		double seconds = double(clock() - start) / CLOCKS_PER_SEC;
+		double deviceSeconds = disk.BusyTime() * 1e-6;
+		printf("%-22s %9.1f us/op host  %8.1f us/op device  %7.2f commands/op", name,
+			seconds * 1e6 / ops, deviceSeconds * 1e6 / ops, double(disk.Commands()) / ops);
+		if(bytes > 0)
+			printf("  %7.2f MB/s", bytes / (deviceSeconds + seconds) / (1024 * 1024));
+		printf("%s\n", ok ? "" : "  FAILED");
+	}
+};
+
+class CountLister :public DirectoryLister
+{
+public:
+	unsigned count;
+	CountLister():count(0){}
+	virtual bool DirectoryEntry(const uint8_t *, DirectoryEntryType, Fs::FileAttributes, FsNode, uint32_t)
+	{
+		count++;
+		return true;
+	}
+};
+
+class FindLister :public DirectoryLister
+{
+	const char *_name;
+public:
+	FsNode node;
+	uint32_t size;
+	FindLister(const char *name):_name(name), node(EndOfFileNode), size(0){}
+	virtual bool DirectoryEntry(const uint8_t *name, DirectoryEntryType, Fs::FileAttributes, FsNode entryNode, uint32_t entrySize)
+	{
+		if(strcmp((const char *)name, _name) != 0)
+			return true;
+		node = entryNode;
+		size = entrySize;
+		return false;
+	}
+};
+
+static uint32_t Random(uint32_t &state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<uint8_t> memory;
+	ImageDisk image;
+	RamDisk disk;
+	RamDisk *device = &disk;
+	if(argc > 1)
+	{
+		if(!image.Open(argv[1]))
+		{
+			printf("can not open %s\n", argv[1]);
+			return 1;
+		}
+		device = &image;
+	}
+	else
+	{
+		memory.resize((size_t)ImageSectors * 512);
+		FatImageBuilder builder(&memory[0], ImageSectors);
+		builder.Format(Fat16, 8, 0);
+		uint32_t dir = builder.AddDirectory(0, "many");
+		char name[32];
+		uint8_t data[100] = {0};
+		for(unsigned i = 0; i < ListedFiles; i++)
+		{
+			sprintf(name, "file number %03u.txt", i);
+			builder.AddFile(dir, name, data, sizeof(data));
+		}
+		disk.Attach(&memory[0], ImageSectors);
+	}
+	device->SetLatency(cardLatency);
+	
+	SectorCacheStorage<32> storage;
+	SectorCache<RamDisk> cache(*device, storage, 4);
+	cache.SetReadAhead(8);
+	Volume fs(cache);
+	static uint8_t bitmap[32 * 1024];
+	fs.SetFreeBitmap(bitmap, sizeof(bitmap));
+	
+	{
+		Measure measure(*device);
+		bool ok = true;
+		for(int i = 0; i < 100; i++)
+			ok = fs.Mount() && ok;
+		measure.Print("mount", 100, 0, ok);
+	}
+	if(fs.Info().type == None)
+		return 1;
+	printf("FAT%d, %u clusters of %u bytes\n", fs.Info().type == Fat12 ? 12 : fs.Info().type == Fat16 ? 16 : 32,
+		(unsigned)fs.Info().countofClusters, (unsigned)fs.ClusterSize());
+	
+	{
+		FindLister find("many");
+		fs.ListDirectory(fs.RootDirectory(), find);
+		FsNode dir = find.node != EndOfFileNode ? find.node : fs.RootDirectory();
+		Measure measure(*device);
+		bool ok = true;
+		unsigned entries = 0;
+		for(int i = 0; i < 20; i++)
+		{
+			CountLister lister;
+			ok = fs.ListDirectory(dir, lister) && ok;
+			entries = lister.count;
+		}
+		measure.Print("list directory", 20, 0, ok);
+		printf("%u entries listed\n", entries);
+	}
+	
+	std::vector<uint8_t> buffer(FileSize);
+	for(size_t i = 0; i < buffer.size(); i++)
+		buffer[i] = uint8_t(i * 7);
+	const char *names[] = {"bench.bin", "prealloc.bin"};
+	for(int pass = 0; pass < 2; pass++)
+	{
+		FatFileWriter<RamDisk> writer(fs);
+		Measure measure(*device);
+		bool ok = writer.Create(fs.RootDirectory(), (const uint8_t *)names[pass], pass ? FileSize : 0);
+		for(uint32_t offset = 0; offset < FileSize && ok; offset += Chunk)
+			ok = writer.Write(&buffer[offset], Chunk) == Chunk;
+		ok = writer.Close() && ok;
+		measure.Print(pass ? "write preallocated" : "sequential write", FileSize / Chunk, FileSize, ok);
+	}
+	
+	FindLister find("bench.bin");
+	fs.ListDirectory(fs.RootDirectory(), find);
+	ClusterRun map[64];
+	FatFileReader<RamDisk> reader(fs, map, 64);
+	{
+		Measure measure(*device);
+		bool ok = reader.Open(find.node, find.size);
+		for(uint32_t offset = 0; offset < FileSize && ok; offset += Chunk)
+			ok = reader.Read(&buffer[offset], Chunk) == Chunk;
+		measure.Print("sequential read", FileSize / Chunk, FileSize, ok);
+	}
+	
+	{
+		const unsigned seeks = 2000, readSize = 4096;
+		uint32_t state = 12345;
+		Measure measure(*device);
+		bool ok = true;
+		for(unsigned i = 0; i < seeks && ok; i++)
+		{
+			uint32_t position = Random(state) % (FileSize - readSize);
+			ok = reader.Seek(position) && reader.Read(&buffer[0], readSize) == readSize;
+		}
+		measure.Print("random seek", seeks, double(seeks) * readSize, ok);
+	}
+	return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef F_CPU
+#define F_CPU 16000000ul
+#endif
+#include <sd_card_sim.h>
+#include <drivers/SdCard.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+using namespace Mcucpp;
+
+typedef SdCard<SdCardSimSpi, SdCardSimCs> Card;
+
+enum{ TotalBlocks = 4096, Passes = 8 };
+
+// Moves TotalBlocks in transfers of 'cluster' blocks, cluster of 1 uses single block commands.
+// SPI bytes per block shows protocol overhead over 512 payload bytes, that is independent from host speed.
+static void Run(const char *name, Card &card, SdCardSimulator &sim, uint32_t cluster, bool write)
+{
+	std::vector<uint8_t> buffer(cluster * 512, 0x5a);
+	sim.ResetCounters();
+	unsigned long failed = 0;
+	clock_t start = clock();
+	for(unsigned pass = 0; pass < Passes; pass++)
+	{
+		for(uint32_t block = 0; block < TotalBlocks; block += cluster)
+		{
+			bool result;
+			if(cluster == 1)
+				result = write ? card.WriteBlock(&buffer[0], block) : card.ReadBlock(&buffer[0], block);
+			else
+				result = write ? card.WriteBlocks(&buffer[0], block, cluster) : card.ReadBlocks(&buffer[0], block, cluster);
+			if(!result)
+				failed++;
+		}
+	}
+	clock_t end = clock();
+	
+	double seconds = double(end - start) / CLOCKS_PER_SEC;
+	double blocks = double(TotalBlocks) * Passes;
+	printf("%-16s %6.1f SPI bytes/block  %5.3f commands/block  %5.3f selects/block  %8.1f ns/block  failed %lu\n",
+		name, sim.Bytes() / blocks, sim.Commands() / blocks, sim.Selects() / blocks,
+		seconds * 1e9 / blocks, failed);
+}
+
+int main()
+{
+	SdCardSimulator sim(TotalBlocks);
+	Card card;
+	if(card.Detect() != SdhcCard)
+	{
+		printf("card detection failed\n");
+		return 1;
+	}
+	Run("read x1", card, sim, 1, false);
+	Run("read x8", card, sim, 8, false);
+	Run("read x64", card, sim, 64, false);
+	Run("write x1", card, sim, 1, true);
+	Run("write x8", card, sim, 8, true);
+	Run("write x64", card, sim, 64, true);
+	// same transfers without data CRC, Detect enables it
+	card.EnableCrc(false);
+	Run("read x64 nocrc", card, sim, 64, false);
+	Run("write x64 nocrc", card, sim, 64, true);
+	return 0;
+}
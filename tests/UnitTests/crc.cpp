@@ -38,6 +38,29 @@ TEST(Crc, XModem)
 	EXPECT_EQ(checkCrc, crc);
 }
 
+TEST(Crc, XModemTable)
+{
+	typedef Mcucpp::XModemCrcTable myCrc;
+	const char * testMesaage = myCrc::CheckMessage();
+	uint16_t crc = Mcucpp::ComputeCrc<myCrc>((uint8_t*)testMesaage, strlen(testMesaage));
+	const uint16_t checkCrc = myCrc::Check;
+	EXPECT_EQ(checkCrc, crc);
+	for(unsigned i = 0; i < 256; i++)
+		EXPECT_EQ(Mcucpp::XModemCrc::Table(i), myCrc::Table(i));
+}
+
+TEST(Crc, SdCrc7)
+{
+	typedef Mcucpp::SdCrc7 myCrc;
+	const char * testMesaage = myCrc::CheckMessage();
+	uint8_t crc = Mcucpp::ComputeCrc<myCrc>((uint8_t*)testMesaage, strlen(testMesaage));
+	const uint8_t checkCrc = myCrc::Check;
+	EXPECT_EQ(checkCrc, crc);
+	// GO_IDLE_STATE frame
+	const uint8_t command[] = {0x40, 0, 0, 0, 0};
+	EXPECT_EQ(0x94, Mcucpp::ComputeCrc<myCrc>(command, sizeof(command)));
+}
+
 TEST(Crc, Dallas)
 {
 	typedef Mcucpp::DallasCrc myCrc;
@@ -0,0 +1,425 @@
+#ifndef F_CPU
+#define F_CPU 16000000ul
+#endif
+#include <gtest.h>
+#include <string>
+#include <vector>
+#include <sd_card_sim.h>
+#include <fat_image.h>
+#include <drivers/SdCard.h>
+#include <filesystem/fat.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Fat;
+
+namespace
+{
+	typedef SdCard<SdCardSimSpi, SdCardSimCs> Card;
+	
+	struct ListedEntry
+	{
+		std::string name;
+		Fs::DirectoryEntryType type;
+		Fs::FsNode node;
+		uint32_t size;
+	};
+	
+	class CollectLister :public Fs::DirectoryLister
+	{
+	public:
+		std::vector<ListedEntry> entries;
+		virtual bool DirectoryEntry(const uint8_t *name, Fs::DirectoryEntryType type, Fs::FileAttributes, Fs::FsNode node, uint32_t size)
+		{
+			ListedEntry entry = {std::string((const char *)name), type, node, size};
+			entries.push_back(entry);
+			return true;
+		}
+		
+		const ListedEntry *Find(const char *name) const
+		{
+			for(size_t i = 0; i < entries.size(); i++)
+				if(entries[i].name == name)
+					return &entries[i];
+			return 0;
+		}
+	};
+	
+	struct Volume
+	{
+		SdCardSimulator sim;
+		Card card;
+		Fs::SectorCacheStorage<16> storage;
+		Fs::SectorCache<Card> cache;
+		FatFs<Card> fs;
+		FatImageBuilder image;
+		
+		Volume(uint32_t sectors)
+			:sim(sectors),
+			cache(card, storage, 4),
+			fs(cache),
+			image(sim.Block(0), sectors)
+		{}
+		
+		bool Mount()
+		{
+			return card.Detect() == SdhcCard && fs.Mount();
+		}
+	};
+	
+	std::vector<uint8_t> Pattern(uint32_t size, uint32_t seed)
+	{
+		std::vector<uint8_t> data(size);
+		for(uint32_t i = 0; i < size; i++)
+			data[i] = uint8_t((i * 7 + seed + (i >> 9)) & 0xff);
+		return data;
+	}
+	
+	void CheckVolume(FatType type, uint32_t sectors, uint8_t sectorsPerCluster, uint32_t partitionStart)
+	{
+		Volume vol(sectors);
+		ASSERT_TRUE(vol.image.Format(type, sectorsPerCluster, partitionStart));
+		std::vector<uint8_t> small = Pattern(100, 1);
+		ASSERT_TRUE(vol.image.AddFile(0, "README.TXT", &small[0], (uint32_t)small.size()));
+		uint32_t dir = vol.image.AddDirectory(0, "Log files");
+		ASSERT_NE(0u, dir);
+		std::vector<uint8_t> log = Pattern(20000, 2);
+		ASSERT_TRUE(vol.image.AddFile(dir, "measurements-2016.log", &log[0], (uint32_t)log.size(), 1));
+		
+		ASSERT_TRUE(vol.Mount());
+		EXPECT_EQ(type, vol.fs.Info().type);
+		EXPECT_EQ(partitionStart, vol.fs.Info().firstSector);
+		EXPECT_EQ(512u, vol.fs.GetParameter(Fs::BlockSize));
+		
+		CollectLister root;
+		ASSERT_TRUE(vol.fs.ListDirectory(vol.fs.RootDirectory(), root));
+		ASSERT_EQ(2u, root.entries.size());
+		const ListedEntry *readme = root.Find("README.TXT");
+		ASSERT_TRUE(readme != 0);
+		EXPECT_EQ(Fs::FileEntry, readme->type);
+		EXPECT_EQ(100u, readme->size);
+		const ListedEntry *logDir = root.Find("Log files");
+		ASSERT_TRUE(logDir != 0);
+		EXPECT_EQ(Fs::DirectoryEntry, logDir->type);
+		
+		CollectLister sub;
+		ASSERT_TRUE(vol.fs.ListDirectory(logDir->node, sub));
+		ASSERT_EQ(3u, sub.entries.size());
+		EXPECT_TRUE(sub.Find(".") != 0);
+		ASSERT_TRUE(sub.Find("..") != 0);
+		EXPECT_EQ(vol.fs.RootDirectory(), sub.Find("..")->node);
+		const ListedEntry *logFile = sub.Find("measurements-2016.log");
+		ASSERT_TRUE(logFile != 0);
+		EXPECT_EQ(20000u, logFile->size);
+		
+		ClusterRun map[8];
+		FatFileReader<Card> reader(vol.fs, map, 8);
+		ASSERT_TRUE(reader.Open(logFile->node, logFile->size));
+		std::vector<uint8_t> buffer(log.size() + 100);
+		EXPECT_EQ(log.size(), reader.Read(&buffer[0], (uint32_t)buffer.size()));
+		buffer.resize(log.size());
+		EXPECT_TRUE(buffer == log);
+		EXPECT_TRUE(reader.Eof());
+		
+		// following blocks by FsNode
+		Fs::FsNode node = readme->node;
+		uint8_t block[512];
+		ASSERT_TRUE(vol.fs.ReadBlock(node, block));
+		EXPECT_EQ(0, memcmp(block, &small[0], small.size()));
+		unsigned blocks = 0;
+		for(node = logFile->node; node != Fs::EndOfFileNode; node = vol.fs.NextBlock(node))
+		{
+			ASSERT_TRUE(vol.fs.ReadBlock(node, block));
+			uint32_t offset = blocks * 512;
+			uint32_t len = offset + 512 < log.size() ? 512 : (uint32_t)log.size() - offset;
+			ASSERT_EQ(0, memcmp(block, &log[offset], len));
+			blocks++;
+		}
+		uint32_t clusterBlocks = sectorsPerCluster;
+		EXPECT_EQ((40 + clusterBlocks - 1) / clusterBlocks * clusterBlocks, blocks);
+	}
+}
+
+TEST(Fat, Fat12)
+{
+	CheckVolume(Fat12, 4096, 1, 0);
+}
+
+TEST(Fat, Fat16)
+{
+	CheckVolume(Fat16, 16384, 2, 0);
+}
+
+TEST(Fat, Fat32)
+{
+	CheckVolume(Fat32, 70000, 1, 0);
+}
+
+TEST(Fat, Partitioned)
+{
+	CheckVolume(Fat16, 16384 + 63, 2, 63);
+}
+
+TEST(Fat, ContiguousRunsAndSeek)
+{
+	Volume vol(16384);
+	ASSERT_TRUE(vol.image.Format(Fat16, 2, 0));
+	std::vector<uint8_t> fragmented = Pattern(64 * 1024, 3);
+	std::vector<uint8_t> contiguous = Pattern(64 * 1024, 4);
+	ASSERT_TRUE(vol.image.AddFile(0, "FRAG.BIN", &fragmented[0], (uint32_t)fragmented.size(), 1));
+	ASSERT_TRUE(vol.image.AddFile(0, "CONT.BIN", &contiguous[0], (uint32_t)contiguous.size()));
+	ASSERT_TRUE(vol.Mount());
+	CollectLister root;
+	ASSERT_TRUE(vol.fs.ListDirectory(vol.fs.RootDirectory(), root));
+	ASSERT_EQ(2u, root.entries.size());
+	
+	ClusterRun map[16];
+	FatFileReader<Card> reader(vol.fs, map, 16);
+	std::vector<uint8_t> buffer(64 * 1024);
+	
+	// whole contiguous file is one multiple block read
+	ASSERT_TRUE(reader.Open(root.Find("CONT.BIN")->node, root.Find("CONT.BIN")->size));
+	vol.sim.ResetCounters();
+	EXPECT_EQ(buffer.size(), reader.Read(&buffer[0], (uint32_t)buffer.size()));
+	EXPECT_TRUE(buffer == contiguous);
+	EXPECT_EQ(128u, vol.sim.BlocksRead());
+	EXPECT_EQ(2u, vol.sim.Commands());
+	
+	ASSERT_TRUE(reader.Open(root.Find("FRAG.BIN")->node, root.Find("FRAG.BIN")->size));
+	EXPECT_EQ(buffer.size(), reader.Read(&buffer[0], (uint32_t)buffer.size()));
+	EXPECT_TRUE(buffer == fragmented);
+	
+	// seek uses link map, FAT is not walked again
+	vol.cache.ResetCounters();
+	uint8_t chunk[700];
+	const uint32_t positions[] = {1000, 60000, 3, 33333, 64 * 1024 - 700};
+	for(unsigned i = 0; i < sizeof(positions) / sizeof(positions[0]); i++)
+	{
+		ASSERT_TRUE(reader.Seek(positions[i]));
+		ASSERT_EQ(sizeof(chunk), reader.Read(chunk, sizeof(chunk)));
+		EXPECT_EQ(0, memcmp(chunk, &fragmented[positions[i]], sizeof(chunk))) << positions[i];
+		EXPECT_EQ(positions[i] + sizeof(chunk), reader.Tell());
+	}
+	EXPECT_EQ(0u, reader.Read(chunk, sizeof(chunk)));
+	EXPECT_FALSE(reader.Seek(64 * 1024 + 1));
+}
+
+TEST(Fat, FatCachedWhileStreaming)
+{
+	Volume vol(16384);
+	ASSERT_TRUE(vol.image.Format(Fat16, 1, 0));
+	std::vector<uint8_t> data = Pattern(200 * 1024, 5);
+	ASSERT_TRUE(vol.image.AddFile(0, "BIG.LOG", &data[0], (uint32_t)data.size(), 1));
+	ASSERT_TRUE(vol.Mount());
+	CollectLister root;
+	ASSERT_TRUE(vol.fs.ListDirectory(vol.fs.RootDirectory(), root));
+	ASSERT_EQ(1u, root.entries.size());
+	
+	ClusterRun map[4];
+	FatFileReader<Card> reader(vol.fs, map, 4);
+	ASSERT_TRUE(reader.Open(root.entries[0].node, root.entries[0].size));
+	vol.cache.ResetCounters();
+	vol.sim.ResetCounters();
+	std::vector<uint8_t> buffer(data.size());
+	for(uint32_t offset = 0; offset < data.size(); offset += 4096)
+		ASSERT_EQ(4096u, reader.Read(&buffer[offset], 4096));
+	EXPECT_TRUE(buffer == data);
+	// every other cluster up to 800 is used, its FAT spans 4 sectors and the first one
+	// is already cached by Open. Each FAT sector is read once.
+	EXPECT_EQ(3u, vol.cache.DeviceReads());
+	EXPECT_EQ(400u + 3, vol.sim.BlocksRead());
+}
+
+namespace
+{
+	bool FatCopiesEqual(Volume &vol)
+	{
+		const FatInfo &info = vol.fs.Info();
+		return memcmp(vol.sim.Block(info.firstFatSector), vol.sim.Block(info.firstFatSector + info.FATsize),
+			info.FATsize * 512) == 0;
+	}
+}
+
+TEST(Fat, WriteFiles)
+{
+	Volume vol(16384);
+	ASSERT_TRUE(vol.image.Format(Fat16, 2, 0));
+	ASSERT_TRUE(vol.Mount());
+	uint8_t bitmap[1024];
+	vol.fs.SetFreeBitmap(bitmap, sizeof(bitmap));
+	uint32_t freeClusters = vol.fs.FreeClusters();
+	
+	std::vector<uint8_t> data = Pattern(5000, 6);
+	FatFileWriter<Card> writer(vol.fs);
+	ASSERT_TRUE(writer.Create(vol.fs.RootDirectory(), (const uint8_t *)"sensor data.log"));
+	EXPECT_FALSE(FatFileWriter<Card>(vol.fs).Create(vol.fs.RootDirectory(), (const uint8_t *)"SENSOR DATA.LOG"));
+	// unaligned pieces
+	EXPECT_EQ(100u, writer.Write(&data[0], 100));
+	EXPECT_EQ(1500u, writer.Write(&data[100], 1500));
+	EXPECT_EQ(3400u, writer.Write(&data[1600], 3400));
+	EXPECT_EQ(5000u, writer.Size());
+	ASSERT_TRUE(writer.Close());
+	EXPECT_EQ(freeClusters - 5, vol.fs.FreeClusters());
+	EXPECT_TRUE(FatCopiesEqual(vol));
+	
+	std::vector<uint8_t> content;
+	ASSERT_TRUE(vol.image.ReadFile(0, "sensor data.log", content));
+	EXPECT_TRUE(content == data);
+	
+	// short name without long name entries
+	ASSERT_TRUE(writer.Create(vol.fs.RootDirectory(), (const uint8_t *)"EMPTY.TXT", 10000));
+	ASSERT_TRUE(writer.Close());
+	EXPECT_EQ(freeClusters - 5, vol.fs.FreeClusters());
+	
+	// mounted again, everything is on the card
+	ASSERT_TRUE(vol.fs.Mount());
+	CollectLister root;
+	ASSERT_TRUE(vol.fs.ListDirectory(vol.fs.RootDirectory(), root));
+	ASSERT_EQ(2u, root.entries.size());
+	ASSERT_TRUE(root.Find("EMPTY.TXT") != 0);
+	EXPECT_EQ(0u, root.Find("EMPTY.TXT")->size);
+	EXPECT_EQ(Fs::EndOfFileNode, root.Find("EMPTY.TXT")->node);
+	const ListedEntry *file = root.Find("sensor data.log");
+	ASSERT_TRUE(file != 0);
+	ClusterRun map[4];
+	FatFileReader<Card> reader(vol.fs, map, 4);
+	ASSERT_TRUE(reader.Open(file->node, file->size));
+	std::vector<uint8_t> buffer(5000);
+	EXPECT_EQ(5000u, reader.Read(&buffer[0], 5000));
+	EXPECT_TRUE(buffer == data);
+}
+
+TEST(Fat, PreallocatedStreaming)
+{
+	Volume vol(32768);
+	ASSERT_TRUE(vol.image.Format(Fat16, 4, 0));
+	// fragment free space
+	std::vector<uint8_t> filler = Pattern(40 * 2048, 7);
+	ASSERT_TRUE(vol.image.AddFile(0, "FILLER.BIN", &filler[0], (uint32_t)filler.size(), 1));
+	ASSERT_TRUE(vol.Mount());
+	uint8_t bitmap[1024];
+	vol.fs.SetFreeBitmap(bitmap, sizeof(bitmap));
+	
+	const uint32_t size = 256 * 1024;
+	std::vector<uint8_t> data = Pattern(size, 8);
+	FatFileWriter<Card> writer(vol.fs);
+	ASSERT_TRUE(writer.Create(vol.fs.RootDirectory(), (const uint8_t *)"stream.bin", size + 8192));
+	// contiguous space after the fragmented area
+	EXPECT_EQ(132u, vol.fs.ContiguousRun(writer.FirstCluster(), 1000));
+	ASSERT_TRUE(writer.Sync());
+	
+	vol.sim.ResetCounters();
+	for(uint32_t offset = 0; offset < size; offset += 16 * 1024)
+		ASSERT_EQ(16u * 1024, writer.Write(&data[offset], 16 * 1024));
+	// each piece is one multiple block write, metadata is untouched
+	EXPECT_EQ(size / 512, vol.sim.BlocksWritten());
+	EXPECT_EQ(16u * 3, vol.sim.Commands());
+	// blocks announced by the last ACMD23
+	EXPECT_EQ(32u, vol.sim.PreErase());
+	
+	vol.sim.ResetCounters();
+	ASSERT_TRUE(writer.Close());
+	// one FAT sector of each copy and directory sector
+	EXPECT_EQ(3u, vol.sim.BlocksWritten());
+	EXPECT_TRUE(FatCopiesEqual(vol));
+	EXPECT_EQ(128u, vol.fs.ContiguousRun(writer.FirstCluster(), 1000));
+	
+	std::vector<uint8_t> content;
+	ASSERT_TRUE(vol.image.ReadFile(0, "stream.bin", content));
+	EXPECT_TRUE(content == data);
+}
+
+TEST(Fat, CreateNodes)
+{
+	Volume vol(70000);
+	ASSERT_TRUE(vol.image.Format(Fat32, 1, 0));
+	ASSERT_TRUE(vol.Mount());
+	
+	Fs::FsNode dir = vol.fs.CreateNode(vol.fs.RootDirectory(), Fs::DirectoryEntry, (uint8_t *)"Logs");
+	ASSERT_NE(Fs::EndOfFileNode, dir);
+	EXPECT_EQ(Fs::EndOfFileNode, vol.fs.CreateNode(vol.fs.RootDirectory(), Fs::DirectoryEntry, (uint8_t *)"LOGS"));
+	
+	// directory grows over several clusters
+	char name[32];
+	for(unsigned i = 0; i < 20; i++)
+	{
+		sprintf(name, "record number %u.dat", i);
+		Fs::FsNode node = vol.fs.CreateNode(dir, Fs::FileEntry, (uint8_t *)name);
+		ASSERT_NE(Fs::EndOfFileNode, node) << name;
+		uint8_t block[512];
+		memset(block, i, sizeof(block));
+		ASSERT_TRUE(vol.fs.WriteBlock(node, block));
+		Fs::FsNode next = vol.fs.AllocBlock(node);
+		ASSERT_NE(Fs::EndOfFileNode, next);
+		EXPECT_EQ(next, vol.fs.NextBlock(node));
+		ASSERT_TRUE(vol.fs.WriteBlock(next, block));
+	}
+	ASSERT_TRUE(vol.fs.Sync());
+	EXPECT_TRUE(FatCopiesEqual(vol));
+	
+	ASSERT_TRUE(vol.fs.Mount());
+	CollectLister root;
+	ASSERT_TRUE(vol.fs.ListDirectory(vol.fs.RootDirectory(), root));
+	ASSERT_EQ(1u, root.entries.size());
+	EXPECT_EQ(dir, root.entries[0].node);
+	CollectLister logs;
+	ASSERT_TRUE(vol.fs.ListDirectory(dir, logs));
+	ASSERT_EQ(22u, logs.entries.size());
+	EXPECT_EQ(vol.fs.RootDirectory(), logs.Find("..")->node);
+	for(unsigned i = 0; i < 20; i++)
+	{
+		sprintf(name, "record number %u.dat", i);
+		const ListedEntry *entry = logs.Find(name);
+		ASSERT_TRUE(entry != 0) << name;
+		uint8_t block[512];
+		unsigned blocks = 0;
+		for(Fs::FsNode node = entry->node; node != Fs::EndOfFileNode; node = vol.fs.NextBlock(node), blocks++)
+		{
+			ASSERT_TRUE(vol.fs.ReadBlock(node, block));
+			EXPECT_EQ(i, block[511]);
+		}
+		EXPECT_EQ(2u, blocks);
+	}
+}
+
+TEST(Fat, Fat12EntriesAcrossSectors)
+{
+	Volume vol(4096);
+	ASSERT_TRUE(vol.image.Format(Fat12, 1, 0));
+	ASSERT_TRUE(vol.Mount());
+	// FAT12 entry of cluster 341 spans two FAT sectors
+	std::vector<uint8_t> data = Pattern(400 * 512, 9);
+	FatFileWriter<Card> writer(vol.fs);
+	ASSERT_TRUE(writer.Create(vol.fs.RootDirectory(), (const uint8_t *)"FAT12.BIN"));
+	for(uint32_t offset = 0; offset < data.size(); offset += 512)
+		ASSERT_EQ(512u, writer.Write(&data[offset], 512));
+	ASSERT_TRUE(writer.Close());
+	EXPECT_TRUE(FatCopiesEqual(vol));
+	std::vector<uint8_t> content;
+	ASSERT_TRUE(vol.image.ReadFile(0, "FAT12.BIN", content));
+	EXPECT_TRUE(content == data);
+}
+
+TEST(Fat, SyncMirrorsModifiedFatSectorsOnly)
+{
+	Volume vol(70000);
+	ASSERT_TRUE(vol.image.Format(Fat32, 1, 0));
+	ASSERT_TRUE(vol.Mount());
+	const FatInfo &info = vol.fs.Info();
+	ASSERT_EQ(Fat32, info.type);
+	ASSERT_LT(400u, info.FATsize);
+	
+	// entries far apart in the first FAT
+	ASSERT_TRUE(vol.fs.SetFatEntry(10, EndOfChain));
+	ASSERT_TRUE(vol.fs.SetFatEntry(60000, EndOfChain));
+	vol.sim.ResetCounters();
+	ASSERT_TRUE(vol.fs.Sync());
+	EXPECT_EQ(4u, vol.sim.BlocksWritten());
+	EXPECT_TRUE(FatCopiesEqual(vol));
+	
+	// more modified sectors than tracked, copies are refreshed ahead of Sync
+	for(uint32_t cluster = 100; cluster < 100 + 20 * 128; cluster += 128)
+		ASSERT_TRUE(vol.fs.SetFatEntry(cluster, EndOfChain));
+	ASSERT_TRUE(vol.fs.Sync());
+	EXPECT_TRUE(FatCopiesEqual(vol));
+	EXPECT_EQ(EndOfChain, vol.image.FatEntry(100 + 19 * 128));
+}
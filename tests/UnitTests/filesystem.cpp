@@ -0,0 +1,332 @@
+#ifndef F_CPU
+#define F_CPU 16000000ul
+#endif
+#include <gtest.h>
+#include <vector>
+#include <sd_card_sim.h>
+#include <fat_image.h>
+#include <drivers/SdCard.h>
+#include <filesystem/fat.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Fs;
+
+namespace
+{
+	typedef SdCard<SdCardSimSpi, SdCardSimCs> Card;
+	
+	class CountingFatFs :public Fat::FatFs<Card>
+	{
+	public:
+		unsigned listings;
+		// listed as if it had no entries at all, not even dot ones
+		FsNode emptyDir;
+		CountingFatFs(SectorCache<Card> &cache)
+			:Fat::FatFs<Card>(cache), listings(0), emptyDir(EndOfFileNode)
+		{}
+		
+		virtual bool ListDirectory(FsNode dir, DirectoryLister &directoryLister)
+		{
+			listings++;
+			if(dir == emptyDir)
+				return true;
+			return Fat::FatFs<Card>::ListDirectory(dir, directoryLister);
+		}
+	};
+	
+	class FileSystemTest :public ::testing::Test
+	{
+	protected:
+		SdCardSimulator sim;
+		Card card;
+		SectorCacheStorage<16> storage;
+		SectorCache<Card> cache;
+		CountingFatFs fat;
+		NodeLookupStorage<16> lookupStorage;
+		NodeLookupCache lookup;
+		FileSystem<CountingFatFs> fs;
+		uint32_t logs;
+		TaskItem tasks[8];
+		TimerData timers[1];
+		Dispatcher dispatcher;
+		
+		FileSystemTest()
+			:sim(16384),
+			cache(card, storage, 4),
+			fat(cache),
+			lookup(lookupStorage),
+			fs(fat, true),
+			dispatcher(tasks, 8, timers, 1)
+		{
+		}
+		
+		virtual void SetUp()
+		{
+			Fat::FatImageBuilder image(sim.Block(0), 16384);
+			ASSERT_TRUE(image.Format(Fat::Fat16, 2, 0));
+			uint8_t data[10] = {1, 2, 3};
+			uint32_t etc = image.AddDirectory(0, "etc");
+			ASSERT_TRUE(image.AddFile(etc, "config.ini", data, sizeof(data)));
+			logs = image.AddDirectory(0, "Logs");
+			std::vector<uint8_t> big(64 * 512);
+			for(size_t i = 0; i < big.size(); i++)
+				big[i] = uint8_t(i * 13 + (i >> 9));
+			ASSERT_TRUE(image.AddFile(0, "BIG.BIN", &big[0], (uint32_t)big.size()));
+			for(int i = 0; i < 30; i++)
+			{
+				char name[32];
+				sprintf(name, "log-%02d.txt", i);
+				ASSERT_TRUE(image.AddFile(logs, name, data, sizeof(data)));
+			}
+			ASSERT_EQ(SdhcCard, card.Detect());
+			ASSERT_TRUE(fat.Mount());
+		}
+	};
+}
+
+TEST_F(FileSystemTest, FindNodeWithoutCache)
+{
+	FsNode node = fs.FindNode((const uint8_t *)"/etc/config.ini");
+	ASSERT_NE(EndOfFileNode, node);
+	EXPECT_EQ(fat.ClusterToSector(3), node);
+	EXPECT_EQ(node, fs.FindNode((const uint8_t *)"ETC/Config.INI"));
+	EXPECT_EQ(fat.RootDirectory(), fs.FindNode((const uint8_t *)"/"));
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/etc/config"));
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/etc/config.ini.bak"));
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/e"));
+	EXPECT_EQ(fat.ClusterToSector(logs), fs.FindNode((const uint8_t *)"/etc/../Logs"));
+}
+
+TEST_F(FileSystemTest, RepeatedLookupsAreCached)
+{
+	fs.SetLookupCache(&lookup);
+	EXPECT_TRUE(lookup.IgnoreCase());
+	FsNode node = fs.FindNode((const uint8_t *)"/Logs/log-29.txt");
+	ASSERT_NE(EndOfFileNode, node);
+	EXPECT_EQ(2u, fat.listings);
+	EXPECT_EQ(2u, lookup.Misses());
+	
+	fat.listings = 0;
+	cache.ResetCounters();
+	for(int i = 0; i < 10; i++)
+	{
+		EXPECT_EQ(node, fs.FindNode((const uint8_t *)"/Logs/log-29.txt"));
+		// names are case folded on insert
+		EXPECT_EQ(node, fs.FindNode((const uint8_t *)"logs//LOG-29.TXT"));
+	}
+	EXPECT_EQ(0u, fat.listings);
+	EXPECT_EQ(0u, cache.Hits() + cache.Misses());
+	EXPECT_EQ(40u, lookup.Hits());
+	
+	// only the unknown element is listed
+	EXPECT_NE(EndOfFileNode, fs.FindNode((const uint8_t *)"/Logs/log-00.txt"));
+	EXPECT_EQ(1u, fat.listings);
+	// not found names are not cached
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/Logs/new.txt"));
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/Logs/new.txt"));
+	EXPECT_EQ(3u, fat.listings);
+}
+
+TEST_F(FileSystemTest, MissingNameInEmptyDirectory)
+{
+	fat.emptyDir = fs.FindNode((const uint8_t *)"/etc");
+	ASSERT_NE(EndOfFileNode, fat.emptyDir);
+	fs.SetLookupCache(&lookup);
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/etc/missing"));
+	// parent directory is not cached as the missing child
+	EXPECT_EQ(EndOfFileNode, fs.FindNode((const uint8_t *)"/etc/missing"));
+	EXPECT_EQ(1u, lookup.Hits());
+}
+
+TEST_F(FileSystemTest, CreateNodeInvalidates)
+{
+	fs.SetLookupCache(&lookup);
+	FsNode dir = fs.FindNode((const uint8_t *)"/Logs");
+	ASSERT_NE(EndOfFileNode, dir);
+	lookup.Insert(dir, (const uint8_t *)"new.txt", 7, 12345);
+	EXPECT_EQ(12345u, fs.FindNode((const uint8_t *)"/logs/NEW.TXT"));
+	
+	FsNode node = fs.CreateNode(dir, FileEntry, (uint8_t *)"new.txt");
+	ASSERT_NE(EndOfFileNode, node);
+	EXPECT_EQ(node, fs.FindNode((const uint8_t *)"/logs/NEW.TXT"));
+	EXPECT_EQ(node, fs.FindNode((const uint8_t *)"/logs/new.txt"));
+}
+
+TEST(NodeLookupCache, Replacement)
+{
+	NodeLookupStorage<4> storage;
+	NodeLookupCache lookup(storage);
+	char name[8];
+	for(int i = 0; i < 4; i++)
+	{
+		sprintf(name, "f%d", i);
+		lookup.Insert(1, (const uint8_t *)name, 2, 100 + i);
+	}
+	FsNode node = 0;
+	EXPECT_TRUE(lookup.Lookup(1, (const uint8_t *)"f0", 2, node));
+	EXPECT_EQ(100u, node);
+	EXPECT_FALSE(lookup.Lookup(1, (const uint8_t *)"F0", 2, node));
+	EXPECT_FALSE(lookup.Lookup(2, (const uint8_t *)"f0", 2, node));
+	
+	// least recently used f1 is replaced
+	lookup.Lookup(1, (const uint8_t *)"f2", 2, node);
+	lookup.Lookup(1, (const uint8_t *)"f3", 2, node);
+	lookup.Insert(1, (const uint8_t *)"f4", 2, 104);
+	EXPECT_FALSE(lookup.Lookup(1, (const uint8_t *)"f1", 2, node));
+	EXPECT_TRUE(lookup.Lookup(1, (const uint8_t *)"f4", 2, node));
+	EXPECT_EQ(104u, node);
+	
+	lookup.InvalidateNode(1);
+	EXPECT_FALSE(lookup.Lookup(1, (const uint8_t *)"f0", 2, node));
+	
+	// too long names are not cached
+	uint8_t longName[LookupNameSize + 1];
+	memset(longName, 'a', sizeof(longName));
+	lookup.Insert(1, longName, sizeof(longName), 5);
+	EXPECT_FALSE(lookup.Lookup(1, longName, sizeof(longName), node));
+}
+
+namespace
+{
+	struct Completion
+	{
+		unsigned calls;
+		unsigned failures;
+	};
+	
+	void OnComplete(void *tag, bool success)
+	{
+		Completion *completion = static_cast<Completion *>(tag);
+		completion->calls++;
+		if(!success)
+			completion->failures++;
+	}
+	
+	unsigned backgroundRuns;
+	Dispatcher *backgroundDispatcher;
+	void ControlLoop()
+	{
+		backgroundRuns++;
+		backgroundDispatcher->SetTask(ControlLoop);
+	}
+}
+
+TEST_F(FileSystemTest, AsyncReadMergesRequests)
+{
+	FsNode node = fs.FindNode((const uint8_t *)"/BIG.BIN");
+	ASSERT_NE(EndOfFileNode, node);
+	File<CountingFatFs> file(fat, dispatcher);
+	ASSERT_TRUE(file.Open(node));
+	
+	std::vector<uint8_t> buffer(20 * 512);
+	Completion completion = {};
+	for(int i = 0; i < 4; i++)
+		ASSERT_TRUE(file.ReadAsync(&buffer[i * 4 * 512], 4, OnComplete, &completion));
+	EXPECT_FALSE(file.ReadAsync(&buffer[16 * 512], 4, OnComplete, &completion));
+	EXPECT_EQ(4u, file.Pending());
+	EXPECT_EQ(0u, completion.calls);
+	
+	sim.ResetCounters();
+	while(!file.Idle())
+		dispatcher.Poll();
+	EXPECT_EQ(4u, completion.calls);
+	EXPECT_EQ(0u, completion.failures);
+	// FAT sector and one multiple block read for all requests
+	EXPECT_EQ(1u + 16, sim.BlocksRead());
+	EXPECT_EQ(1u + 2, sim.Commands());
+	for(size_t i = 0; i < 16 * 512; i++)
+		ASSERT_EQ(uint8_t(i * 13 + (i >> 9)), buffer[i]) << i;
+	
+	// seek back, read past the end fails, merged request before it succeeds
+	file.Seek(60);
+	ASSERT_TRUE(file.ReadAsync(&buffer[0], 4, OnComplete, &completion));
+	ASSERT_TRUE(file.ReadAsync(&buffer[4 * 512], 4, OnComplete, &completion));
+	while(!file.Idle())
+		dispatcher.Poll();
+	EXPECT_EQ(6u, completion.calls);
+	EXPECT_EQ(1u, completion.failures);
+	EXPECT_EQ(uint8_t(60 * 512 * 13 + 60), buffer[0]);
+}
+
+TEST_F(FileSystemTest, AsyncWriteKeepsControlLoopRunning)
+{
+	card.SetDispatcher(&dispatcher);
+	FsNode node = fs.CreateNode(fat.RootDirectory(), FileEntry, (uint8_t *)"async.bin");
+	ASSERT_NE(EndOfFileNode, node);
+	File<CountingFatFs> file(fat, dispatcher);
+	ASSERT_TRUE(file.Open(node));
+	
+	std::vector<uint8_t> data(40 * 512);
+	for(size_t i = 0; i < data.size(); i++)
+		data[i] = uint8_t(i ^ (i >> 9));
+	Completion completion = {};
+	ASSERT_TRUE(file.WriteAsync(&data[0], 8, OnComplete, &completion));
+	ASSERT_TRUE(file.WriteAsync(&data[8 * 512], 32, OnComplete, &completion));
+	
+	backgroundRuns = 0;
+	backgroundDispatcher = &dispatcher;
+	dispatcher.SetTask(ControlLoop);
+	unsigned polls = 0;
+	while(!file.Idle())
+	{
+		dispatcher.Poll();
+		polls++;
+	}
+	EXPECT_EQ(2u, completion.calls);
+	EXPECT_EQ(0u, completion.failures);
+	// control loop ran while the card was busy, not only between transfers
+	EXPECT_GT(backgroundRuns, polls);
+	EXPECT_EQ(40u, sim.BlocksWritten());
+	ASSERT_TRUE(file.Sync());
+	
+	// read back in another file object
+	std::vector<uint8_t> buffer(data.size());
+	File<CountingFatFs> reader(fat, dispatcher);
+	ASSERT_TRUE(reader.Open(node));
+	ASSERT_TRUE(reader.ReadAsync(&buffer[0], 40, OnComplete, &completion));
+	while(!reader.Idle())
+		dispatcher.Poll();
+	EXPECT_EQ(3u, completion.calls);
+	EXPECT_EQ(0u, completion.failures);
+	EXPECT_TRUE(buffer == data);
+}
+
+namespace
+{
+	struct Chain
+	{
+		File<Fat::FatFs<Card> > *file;
+		uint8_t *buffer;
+		unsigned remaining;
+		unsigned completed;
+	};
+	
+	void ReadNext(void *tag, bool success)
+	{
+		Chain *chain = static_cast<Chain *>(tag);
+		if(!success)
+			return;
+		chain->completed++;
+		if(chain->remaining)
+		{
+			chain->remaining--;
+			chain->file->ReadAsync(chain->buffer + chain->completed * 512, 1, ReadNext, chain);
+		}
+	}
+}
+
+TEST_F(FileSystemTest, CallbacksQueueRequests)
+{
+	FsNode node = fs.FindNode((const uint8_t *)"/big.bin");
+	ASSERT_NE(EndOfFileNode, node);
+	File<Fat::FatFs<Card> > file(fat, dispatcher);
+	ASSERT_TRUE(file.Open(node));
+	std::vector<uint8_t> buffer(10 * 512);
+	Chain chain = {&file, &buffer[0], 9, 0};
+	ASSERT_TRUE(file.ReadAsync(&buffer[0], 1, ReadNext, &chain));
+	for(int i = 0; i < 100 && !file.Idle(); i++)
+		dispatcher.Poll();
+	EXPECT_TRUE(file.Idle());
+	EXPECT_EQ(10u, chain.completed);
+	EXPECT_EQ(uint8_t(9 * 512 * 13 + 9), buffer[9 * 512]);
+}
@@ -0,0 +1,349 @@
+#include <gtest.h>
+#include <stdio.h>
+#include <flash.h>
+#include <flash_record_store.h>
+
+using namespace Mcucpp;
+
+namespace
+{
+	// three 16K pages
+	typedef FlashRecordStore<Flash> Store;
+	const unsigned FirstPage = 1;
+	const unsigned StorePages = 3;
+
+	void FillValue(uint8_t *buffer, size_t length, uint16_t key, uint32_t version)
+	{
+		for(size_t i = 0; i < length; i++)
+			buffer[i] = uint8_t(key * 31 + version * 7 + i);
+	}
+
+	bool CheckValue(const Store &store, uint16_t key, uint16_t expectedLength, uint32_t version)
+	{
+		uint16_t length;
+		const uint8_t *data = store.Find(key, length);
+		if(!data || length != expectedLength)
+			return false;
+		uint8_t expected[256];
+		FillValue(expected, length, key, version);
+		return memcmp(data, expected, length) == 0;
+	}
+}
+
+TEST(FlashSim, EraseAndWriteSemantics)
+{
+	Flash::Reset();
+	const uint8_t *page = (const uint8_t *)Flash::PageAddress(2);
+	EXPECT_EQ(0x4000u, Flash::PageSize(2));
+	EXPECT_EQ(0x10000u, Flash::PageSize(4));
+	EXPECT_EQ(0x20000u, Flash::PageSize(11));
+	EXPECT_EQ(0xff, page[0]);
+
+	uint8_t data[2] = {0x5a, 0x0f};
+	EXPECT_TRUE(Flash::WritePage(2, data, 2, 10));
+	EXPECT_EQ(0x5a, page[10]);
+	// only 1 -> 0 transitions are programmed
+	uint8_t other[2] = {0xf0, 0xff};
+	EXPECT_TRUE(Flash::WritePage(2, other, 2, 10));
+	EXPECT_EQ(0x50, page[10]);
+	EXPECT_EQ(0x0f, page[11]);
+	EXPECT_EQ(2u, Flash::Overwrites());
+	EXPECT_FALSE(Flash::WritePage(2, data, 2, 0x4000 - 1));
+	EXPECT_FALSE(Flash::WritePage(12, data, 1, 0));
+
+	EXPECT_TRUE(Flash::ErasePage(2));
+	EXPECT_EQ(0xff, page[10]);
+	EXPECT_EQ(1u, Flash::EraseCount(2));
+
+	Flash::FailAfter(1);
+	EXPECT_FALSE(Flash::WritePage(2, data, 2, 0));
+	EXPECT_TRUE(Flash::PowerLost());
+	EXPECT_EQ(0x5a, page[0]);
+	EXPECT_EQ(0xff, page[1]);
+	EXPECT_FALSE(Flash::ErasePage(2));
+	Flash::PowerUp();
+	EXPECT_TRUE(Flash::ErasePage(2));
+}
+
+TEST(FlashRecordStore, WriteReadRemove)
+{
+	Flash::Reset();
+	FlashRecordIndexStorage<16> index;
+	Store store(FirstPage, StorePages, index);
+	EXPECT_TRUE(store.Mount());
+	EXPECT_EQ(0u, store.Count());
+
+	uint8_t value[100];
+	for(uint16_t key = 1; key <= 5; key++)
+	{
+		FillValue(value, key * 10, key, 0);
+		EXPECT_TRUE(store.Write(key, value, key * 10));
+	}
+	FillValue(value, 33, 3, 1);
+	EXPECT_TRUE(store.Write(3, value, 33));
+	EXPECT_TRUE(store.Write(7, 0, 0));
+	EXPECT_TRUE(store.Remove(2));
+	EXPECT_FALSE(store.Remove(100));
+	EXPECT_FALSE(store.Write(0xffff, value, 1));
+
+	EXPECT_EQ(5u, store.Count());
+	EXPECT_TRUE(CheckValue(store, 1, 10, 0));
+	EXPECT_TRUE(CheckValue(store, 3, 33, 1));
+	EXPECT_TRUE(CheckValue(store, 5, 50, 0));
+	EXPECT_TRUE(CheckValue(store, 7, 0, 0));
+	uint16_t length;
+	EXPECT_EQ(0, store.Find(2, length));
+
+	uint8_t buffer[8];
+	EXPECT_TRUE(store.Read(4, buffer, sizeof(buffer)));
+	FillValue(value, 40, 4, 0);
+	EXPECT_EQ(0, memcmp(buffer, value, sizeof(buffer)));
+	EXPECT_FALSE(store.Read(2, buffer, sizeof(buffer)));
+
+	// index is rebuilt from flash
+	FlashRecordIndexStorage<16> index2;
+	Store store2(FirstPage, StorePages, index2);
+	EXPECT_TRUE(store2.Mount());
+	EXPECT_EQ(5u, store2.Count());
+	EXPECT_TRUE(CheckValue(store2, 3, 33, 1));
+	EXPECT_TRUE(CheckValue(store2, 4, 40, 0));
+	EXPECT_EQ(0, store2.Find(2, length));
+	EXPECT_EQ(store.FreeSpace(), store2.FreeSpace());
+	EXPECT_EQ(0u, Flash::Overwrites());
+	// other pages are not touched
+	EXPECT_EQ(0xff, *(const uint8_t *)Flash::PageAddress(0));
+	EXPECT_EQ(0xff, *(const uint8_t *)Flash::PageAddress(4));
+}
+
+TEST(FlashRecordStore, IndexFull)
+{
+	Flash::Reset();
+	FlashRecordIndexStorage<2> index;
+	Store store(FirstPage, StorePages, index);
+	EXPECT_TRUE(store.Mount());
+	uint8_t value = 1;
+	EXPECT_TRUE(store.Write(10, &value, 1));
+	EXPECT_TRUE(store.Write(20, &value, 1));
+	EXPECT_FALSE(store.Write(30, &value, 1));
+	EXPECT_TRUE(store.Write(10, &value, 1));
+	EXPECT_TRUE(store.Remove(20));
+	EXPECT_TRUE(store.Write(30, &value, 1));
+}
+
+TEST(FlashRecordStore, RotationWearsPagesEvenly)
+{
+	Flash::Reset();
+	FlashRecordIndexStorage<16> index;
+	Store store(FirstPage, StorePages, index);
+	EXPECT_TRUE(store.Mount());
+
+	const uint16_t Keys = 8;
+	const uint16_t Length = 120;
+	uint32_t versions[Keys + 1] = {0};
+	uint8_t value[Length];
+	for(uint32_t i = 0; i < 3000; i++)
+	{
+		uint16_t key = uint16_t(i * 5 % Keys + 1);
+		versions[key] = i;
+		FillValue(value, Length, key, i);
+		ASSERT_TRUE(store.Write(key, value, Length)) << i;
+	}
+	for(uint16_t key = 1; key <= Keys; key++)
+		EXPECT_TRUE(CheckValue(store, key, Length, versions[key])) << key;
+
+	// every page is erased in turn
+	uint32_t minErase = 0xffffffff, maxErase = 0;
+	for(unsigned page = FirstPage; page < FirstPage + StorePages; page++)
+	{
+		minErase = std::min(minErase, Flash::EraseCount(page));
+		maxErase = std::max(maxErase, Flash::EraseCount(page));
+	}
+	EXPECT_LT(5u, minErase);
+	EXPECT_GE(1u, maxErase - minErase);
+	EXPECT_EQ(0u, Flash::EraseCount(0));
+	EXPECT_EQ(0u, Flash::Overwrites());
+
+	FlashRecordIndexStorage<16> index2;
+	Store store2(FirstPage, StorePages, index2);
+	EXPECT_TRUE(store2.Mount());
+	EXPECT_EQ(store.Sequence(), store2.Sequence());
+	EXPECT_EQ(unsigned(Keys), store2.Count());
+	for(uint16_t key = 1; key <= Keys; key++)
+		EXPECT_TRUE(CheckValue(store2, key, Length, versions[key])) << key;
+}
+
+TEST(FlashRecordStore, LogRecords)
+{
+	Flash::Reset();
+	FlashRecordIndexStorage<4> index;
+	Store store(FirstPage, StorePages, index);
+	EXPECT_TRUE(store.Mount());
+
+	uint8_t calibration[16];
+	FillValue(calibration, sizeof(calibration), 1, 0);
+	EXPECT_TRUE(store.Write(1, calibration, sizeof(calibration)));
+	uint32_t event;
+	for(event = 0; event < 100; event++)
+		EXPECT_TRUE(store.Log(2, &event, sizeof(event)));
+	EXPECT_EQ(1u, store.Count());
+
+	Store::Record record;
+	uint32_t expected = 0;
+	bool ok = store.First(record);
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(Store::ValueRecord, record.type);
+	for(ok = store.Next(record); ok; ok = store.Next(record))
+	{
+		EXPECT_EQ(Store::LogRecord, record.type);
+		EXPECT_EQ(2u, record.key);
+		EXPECT_EQ(0, memcmp(record.data, &expected, sizeof(expected)));
+		expected++;
+	}
+	EXPECT_EQ(100u, expected);
+
+	// ring keeps the newest events, values survive recycling
+	for(; event < 10000; event++)
+		ASSERT_TRUE(store.Log(2, &event, sizeof(event)));
+	EXPECT_TRUE(CheckValue(store, 1, sizeof(calibration), 0));
+	uint32_t first = 0, last = 0, count = 0;
+	for(ok = store.First(record); ok; ok = store.Next(record))
+	{
+		if(record.type != Store::LogRecord)
+			continue;
+		memcpy(&last, record.data, sizeof(last));
+		if(count == 0)
+			first = last;
+		else
+			EXPECT_EQ(first + count, last);
+		count++;
+	}
+	EXPECT_EQ(9999u, last);
+	EXPECT_LT(1000u, count);
+	EXPECT_GT(10000u, count);
+}
+
+TEST(FlashRecordStore, TornRecord)
+{
+	Flash::Reset();
+	FlashRecordIndexStorage<8> index;
+	Store store(FirstPage, StorePages, index);
+	EXPECT_TRUE(store.Mount());
+	uint8_t value[64];
+	FillValue(value, sizeof(value), 1, 0);
+	EXPECT_TRUE(store.Write(1, value, sizeof(value)));
+
+	Flash::FailAfter(20);
+	FillValue(value, sizeof(value), 1, 1);
+	EXPECT_FALSE(store.Write(1, value, sizeof(value)));
+	Flash::PowerUp();
+
+	FlashRecordIndexStorage<8> index2;
+	Store store2(FirstPage, StorePages, index2);
+	EXPECT_TRUE(store2.Mount());
+	EXPECT_TRUE(CheckValue(store2, 1, sizeof(value), 0));
+	// rest of damaged page is not used, next write goes to the next page
+	EXPECT_EQ(0u, store2.FreeSpace());
+	FillValue(value, sizeof(value), 2, 0);
+	EXPECT_TRUE(store2.Write(2, value, sizeof(value)));
+	EXPECT_TRUE(CheckValue(store2, 1, sizeof(value), 0));
+	EXPECT_TRUE(CheckValue(store2, 2, sizeof(value), 0));
+	EXPECT_EQ(0u, Flash::Overwrites());
+}
+
+TEST(FlashRecordStore, PowerLossDuringRotation)
+{
+	const uint16_t Keys = 6;
+	const uint16_t Length = 200;
+	uint8_t value[Length];
+	// keys 2..6 are written once and stay in the oldest page, key 1 is updated
+	// up to the end of the second page, next update starts recycling of the first one.
+	// Power is cut at every step of it.
+	for(uint32_t failAfter = 0; failAfter < 2000; failAfter += 7)
+	{
+		Flash::Reset();
+		FlashRecordIndexStorage<8> index;
+		Store store(FirstPage, StorePages, index);
+		ASSERT_TRUE(store.Mount());
+		uint32_t versions[Keys + 1] = {0};
+		uint32_t i = 0;
+		for(; store.FreeSpace() >= Length + 8u || store.Sequence() < 2; i++)
+		{
+			uint16_t key = uint16_t(i < Keys ? i + 1 : 1);
+			versions[key] = i;
+			FillValue(value, Length, key, i);
+			ASSERT_TRUE(store.Write(key, value, Length));
+		}
+		uint16_t key = 1;
+		FillValue(value, Length, key, i);
+		Flash::FailAfter(failAfter);
+		bool written = store.Write(key, value, Length);
+		Flash::PowerUp();
+
+		FlashRecordIndexStorage<8> index2;
+		Store store2(FirstPage, StorePages, index2);
+		ASSERT_TRUE(store2.Mount()) << failAfter;
+		EXPECT_EQ(unsigned(Keys), store2.Count()) << failAfter;
+		for(uint16_t k = 1; k <= Keys; k++)
+		{
+			if(k == key)
+				EXPECT_TRUE(CheckValue(store2, k, Length, i) || (!written && CheckValue(store2, k, Length, versions[k]))) << failAfter;
+			else
+				EXPECT_TRUE(CheckValue(store2, k, Length, versions[k])) << failAfter;
+		}
+		FillValue(value, Length, key, i + 1);
+		EXPECT_TRUE(store2.Write(key, value, Length)) << failAfter;
+		EXPECT_EQ(0u, Flash::Overwrites()) << failAfter;
+	}
+}
+
+TEST(FlashRecordStore, FailedRotationUnmounts)
+{
+	const uint16_t Length = 200;
+	uint8_t value[Length];
+	Flash::Reset();
+	FlashRecordIndexStorage<8> index;
+	Store store(FirstPage, StorePages, index);
+	ASSERT_TRUE(store.Mount());
+	uint32_t i = 0;
+	for(; store.FreeSpace() >= Length + 8u || store.Sequence() < 2; i++)
+	{
+		FillValue(value, Length, 2, i);
+		ASSERT_TRUE(store.Write(2, value, Length));
+	}
+	FillValue(value, Length, 2, i);
+	Flash::FailAfter(0);
+	EXPECT_FALSE(store.Write(2, value, Length));
+	Flash::PowerUp();
+	// nothing is appended until the store is mounted again
+	EXPECT_FALSE(store.Mounted());
+	EXPECT_FALSE(store.Write(2, value, Length));
+	ASSERT_TRUE(store.Mount());
+	EXPECT_TRUE(CheckValue(store, 2, Length, i - 1));
+	EXPECT_TRUE(store.Write(2, value, Length));
+	EXPECT_TRUE(CheckValue(store, 2, Length, i));
+}
+
+TEST(FlashRecordStore, FullStore)
+{
+	Flash::Reset();
+	FlashRecordIndexStorage<64> index;
+	Store store(FirstPage, StorePages, index);
+	EXPECT_TRUE(store.Mount());
+	uint8_t value[1000];
+	memset(value, 0x5a, sizeof(value));
+	uint16_t key = 0;
+	while(store.Write(key, value, sizeof(value)))
+		key++;
+	// live data may not exceed two pages out of three
+	EXPECT_LT(10u, key);
+	EXPECT_GT(33u, key);
+	// existing values are kept and still readable after remount
+	FlashRecordIndexStorage<64> index2;
+	Store store2(FirstPage, StorePages, index2);
+	EXPECT_TRUE(store2.Mount());
+	EXPECT_EQ(unsigned(key), store2.Count());
+	// removing values makes room again
+	for(uint16_t k = 0; k < key; k += 2)
+		EXPECT_TRUE(store2.Remove(k));
+	EXPECT_TRUE(store2.Write(key, value, sizeof(value)));
+}
@@ -0,0 +1,216 @@
+#include <gtest.h>
+#include <net/arp.h>
+#include <net/loopback_interface.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <stdlib.h>
+#include <set>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	class CountingProtocol :public INetProtocol
+	{
+	public:
+		CountingProtocol() :frames(0), firstByte(0) {}
+		virtual void ProcessMessage(const Net::MacAddr &, const Net::MacAddr &, Net::NetBuffer &buffer)
+		{
+			frames++;
+			firstByte = buffer.Read();
+		}
+		unsigned frames;
+		uint8_t firstByte;
+	};
+	
+	struct Host
+	{
+		TaskItem tasks[8];
+		TimerData timers[4];
+		Dispatcher dispatcher;
+		NetDispatch netDispatch;
+		LoopbackInterface loopback;
+		ArpEntry entries[16];
+		Arp arp;
+		CountingProtocol protocol;
+		
+		Host(uint8_t id)
+			:dispatcher(tasks, 8, timers, 4),
+			netDispatch(dispatcher),
+			loopback(dispatcher, Net::MacAddr(2, 0, 0, 0, 0, id)),
+			arp(dispatcher, netDispatch, entries, 16)
+		{
+			dispatcher.SetTimerFunc(GetTicks);
+			arp.SetAddress(Net::IpAddr(10, 0, 0, id), loopback.GetMacAddress(0));
+			arp.SetAging(10, 3, 2);
+			netDispatch.AddInterface(&loopback);
+			netDispatch.AddProtocol(ARP, &arp);
+			netDispatch.AddProtocol(IEEE802_1_Public1, &protocol);
+		}
+		
+		void Poll()
+		{
+			dispatcher.Poll();
+			netDispatch.Poll();
+		}
+	};
+	
+	// feeds ARP reply from 'ip' to the host
+	void ReceiveReply(Host &host, const Net::IpAddr &ip, const Net::MacAddr &mac)
+	{
+		NetBuffer buffer;
+		ASSERT_TRUE(buffer.InsertBack(28));
+		buffer.Seek(0);
+		buffer.WriteU16Be(1);
+		buffer.WriteU16Be(IPv4);
+		buffer.Write(6);
+		buffer.Write(4);
+		buffer.WriteU16Be(Arp::ArpReply);
+		buffer.WriteMac(mac);
+		buffer.WriteIp(ip);
+		buffer.WriteMac(host.loopback.GetMacAddress(0));
+		buffer.WriteIp(Net::IpAddr(10, 0, 0, 1));
+		buffer.Seek(0);
+		host.arp.ProcessMessage(mac, host.loopback.GetMacAddress(0), buffer);
+	}
+	
+	Net::IpAddr MakeIp(unsigned i)
+	{
+		return Net::IpAddr(192, 168, (uint8_t)(i >> 8), (uint8_t)i);
+	}
+}
+
+TEST(NetArp, ResolveAndFlushPending)
+{
+	ticks = 0;
+	Host a(1), b(2);
+	a.loopback.Connect(&b.loopback);
+	b.loopback.Connect(&a.loopback);
+	
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46));
+	buffer.Seek(0);
+	buffer.Write(0x42);
+	EXPECT_TRUE(a.arp.Send(Net::IpAddr(10, 0, 0, 2), IEEE802_1_Public1, buffer));
+	EXPECT_EQ(1u, a.arp.GetStatistic(Arp::ArpMisses));
+	
+	for(int i = 0; i < 4; i++)
+	{
+		a.Poll();
+		b.Poll();
+	}
+	EXPECT_EQ(1u, b.protocol.frames);
+	EXPECT_EQ(0x42, b.protocol.firstByte);
+	
+	Net::MacAddr mac;
+	EXPECT_TRUE(a.arp.Resolve(Net::IpAddr(10, 0, 0, 2), mac));
+	EXPECT_TRUE(mac == b.loopback.GetMacAddress(0));
+	// request addressed to b creates entry for a
+	EXPECT_TRUE(b.arp.Resolve(Net::IpAddr(10, 0, 0, 1), mac));
+	EXPECT_TRUE(mac == a.loopback.GetMacAddress(0));
+}
+
+TEST(NetArp, ClockEviction)
+{
+	ticks = 0;
+	Host host(1);
+	for(unsigned i = 0; i < 20; i++)
+		ReceiveReply(host, MakeIp(i), Net::MacAddr(2, 1, 0, 0, 0, (uint8_t)i));
+	
+	// 16 slots are filled up to 3/4
+	EXPECT_EQ(12u, host.arp.GetStatistic(Arp::ArpEntries));
+	EXPECT_EQ(8u, host.arp.GetStatistic(Arp::ArpEvictions));
+	
+	unsigned found = 0;
+	Net::MacAddr mac;
+	for(unsigned i = 0; i < 20; i++)
+	{
+		if(host.arp.Lookup(MakeIp(i), mac))
+		{
+			EXPECT_EQ(i, mac[5]);
+			found++;
+		}
+	}
+	EXPECT_EQ(12u, found);
+	// the last inserted entry is never the eviction victim
+	EXPECT_TRUE(host.arp.Lookup(MakeIp(19), mac));
+}
+
+TEST(NetArp, Aging)
+{
+	ticks = 0;
+	Host host(1);
+	ReceiveReply(host, MakeIp(5), Net::MacAddr(2, 1, 0, 0, 0, 5));
+	EXPECT_TRUE(host.arp.AddStatic(MakeIp(6), Net::MacAddr(2, 1, 0, 0, 0, 6)));
+	Net::MacAddr mac;
+	EXPECT_FALSE(host.arp.Resolve(MakeIp(7), mac)); // incomplete
+	EXPECT_EQ(3u, host.arp.GetStatistic(Arp::ArpEntries));
+	
+	for(ticks = 0; ticks <= 40; ticks++)
+	{
+		host.Poll();
+		host.Poll();
+	}
+	// dynamic and unresolved entries are gone, static one stays
+	EXPECT_EQ(1u, host.arp.GetStatistic(Arp::ArpEntries));
+	EXPECT_TRUE(host.arp.Resolve(MakeIp(6), mac));
+}
+
+TEST(NetArp, AgingStartsAfterTimerFuncIsSet)
+{
+	ticks = 0;
+	TaskItem tasks[4];
+	TimerData timers[2];
+	Dispatcher dispatcher(tasks, 4, timers, 2);
+	NetDispatch netDispatch(dispatcher);
+	ArpEntry entries[4];
+	Arp arp(dispatcher, netDispatch, entries, 4);
+	// no tick source yet, timer can not be armed here
+	arp.SetAddress(Net::IpAddr(10, 0, 0, 1), Net::MacAddr(2, 0, 0, 0, 0, 1));
+	dispatcher.SetTimerFunc(GetTicks);
+	
+	EXPECT_TRUE(arp.AddStatic(MakeIp(5), Net::MacAddr(2, 1, 0, 0, 0, 5)));
+	Net::MacAddr mac;
+	EXPECT_FALSE(arp.Resolve(MakeIp(6), mac)); // incomplete
+	EXPECT_EQ(2u, arp.GetStatistic(Arp::ArpEntries));
+	
+	for(ticks = 0; ticks <= 5000; ticks += 100)
+		dispatcher.Poll();
+	EXPECT_EQ(1u, arp.GetStatistic(Arp::ArpEntries));
+}
+
+TEST(NetArp, RandomInsertRemove)
+{
+	ticks = 0;
+	Host host(1);
+	std::set<unsigned> reference;
+	srand(42);
+	for(unsigned step = 0; step < 2000; step++)
+	{
+		unsigned i = rand() % 24;
+		if(rand() % 2)
+		{
+			// static entries are not evicted, keep them under the load limit
+			if(reference.size() < 12 || reference.count(i))
+			{
+				EXPECT_TRUE(host.arp.AddStatic(MakeIp(i), Net::MacAddr(2, 1, 0, 0, 0, (uint8_t)i)));
+				reference.insert(i);
+			}
+		}
+		else
+		{
+			EXPECT_EQ(reference.count(i) != 0, host.arp.Remove(MakeIp(i)));
+			reference.erase(i);
+		}
+		ASSERT_EQ(reference.size(), host.arp.GetStatistic(Arp::ArpEntries));
+	}
+	Net::MacAddr mac;
+	for(unsigned i = 0; i < 24; i++)
+	{
+		EXPECT_EQ(reference.count(i) != 0, host.arp.Lookup(MakeIp(i), mac));
+	}
+}
@@ -0,0 +1,133 @@
+#include <gtest.h>
+#include <net/net_capture.h>
+#include <net/loopback_interface.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	struct MemorySink
+	{
+		MemorySink() :readPos(0) {}
+		void Write(uint8_t value) { data.push_back(value); }
+		uint8_t Read() { return readPos < data.size() ? data[readPos++] : 0; }
+		std::vector<uint8_t> data;
+		size_t readPos;
+	};
+	
+	void RecordFrame(NetCapture &capture, uint32_t timestamp, uint8_t tag, size_t size)
+	{
+		NetBuffer buffer;
+		ASSERT_TRUE(buffer.InsertBack(size));
+		buffer.Seek(0);
+		for(size_t i = 0; i < size; i++)
+			buffer.Write((uint8_t)(tag + i));
+		capture.Record(timestamp, CaptureRx, 0, 0, buffer.BufferList());
+	}
+}
+
+TEST(NetCapture, OverwritesOldest)
+{
+	NetCapture capture;
+	RecordFrame(capture, 0, 0, 10);
+	CaptureRecord record;
+	EXPECT_FALSE(capture.Read(record)); // disabled
+	
+	capture.Enable(true);
+	for(unsigned i = 0; i < NetCaptureRecords + 4; i++)
+		RecordFrame(capture, i, (uint8_t)i, 10);
+	
+	for(unsigned i = 4; i < NetCaptureRecords + 4; i++)
+	{
+		ASSERT_TRUE(capture.Read(record));
+		EXPECT_EQ(i, record.timestamp);
+		EXPECT_EQ((uint8_t)i, record.data[0]);
+	}
+	EXPECT_FALSE(capture.Read(record));
+	EXPECT_EQ(4u, capture.Overwritten());
+	
+	RecordFrame(capture, 100, 1, 10);
+	ASSERT_TRUE(capture.Read(record));
+	EXPECT_EQ(100u, record.timestamp);
+}
+
+TEST(NetCapture, SnapLength)
+{
+	NetCapture capture;
+	capture.Enable(true);
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(30));
+	ASSERT_TRUE(buffer.InsertBack(170));
+	buffer.Seek(0);
+	for(size_t i = 0; i < 200; i++)
+		buffer.Write((uint8_t)i);
+	uint8_t header[4] = {0xaa, 0xbb, 0xcc, 0xdd};
+	capture.Record(5, CaptureTx, header, sizeof(header), buffer.BufferList());
+	
+	CaptureRecord record;
+	ASSERT_TRUE(capture.Read(record));
+	EXPECT_EQ(CaptureTx, record.direction);
+	EXPECT_EQ(204u, record.originalLength);
+	EXPECT_EQ(NetCaptureSnapLength, record.capturedLength);
+	EXPECT_EQ(0xaa, record.data[0]);
+	EXPECT_EQ(0xdd, record.data[3]);
+	for(size_t i = 4; i < NetCaptureSnapLength; i++)
+		ASSERT_EQ((uint8_t)(i - 4), record.data[i]);
+}
+
+TEST(NetCapture, DispatchTapAndPcapExport)
+{
+	ticks = 0;
+	TaskItem tasks[4];
+	TimerData timers[4];
+	Dispatcher dispatcher(tasks, 4, timers, 4);
+	dispatcher.SetTimerFunc(GetTicks);
+	NetDispatch netDispatch(dispatcher);
+	LoopbackInterface loopback(dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 1));
+	netDispatch.AddInterface(&loopback);
+	NetCapture capture;
+	capture.Enable(true);
+	netDispatch.SetCapture(&capture);
+	
+	ticks = 2500;
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46));
+	buffer.Seek(0);
+	buffer.Write(0x5a);
+	netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer);
+	ticks = 2501;
+	netDispatch.Poll();
+	
+	MemorySink sink;
+	PcapWriter<MemorySink> writer(sink, NetCaptureSnapLength);
+	writer.WriteFileHeader();
+	EXPECT_EQ(2u, capture.ExportPcap(writer, 10));
+	EXPECT_EQ(0u, capture.ExportPcap(writer, 10));
+	
+	PcapReader<MemorySink> reader(sink);
+	ASSERT_TRUE(reader.ReadFileHeader());
+	EXPECT_EQ(NetCaptureSnapLength, reader.SnapLength());
+	std::vector<uint8_t> frames[2];
+	for(unsigned i = 0; i < 2; i++)
+	{
+		PcapRecordHeader record;
+		ASSERT_TRUE(reader.ReadRecordHeader(record));
+		EXPECT_EQ(2u, record.seconds);
+		EXPECT_EQ(i == 0 ? 500000u : 501000u, record.microseconds);
+		EXPECT_EQ(EthernetHeaderSize + 46, record.originalLength);
+		for(unsigned j = 0; j < record.capturedLength; j++)
+			frames[i].push_back(sink.Read());
+	}
+	// transmitted frame header is rebuilt the same way interface writes it
+	EXPECT_TRUE(frames[0] == frames[1]);
+	EXPECT_EQ(0xff, frames[0][0]);
+	EXPECT_EQ(0x01, frames[0][11]);
+	EXPECT_EQ(0x5a, frames[0][EthernetHeaderSize]);
+}
@@ -0,0 +1,132 @@
+#include <gtest.h>
+#include <net/checksum.h>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+// IPv4 + UDP packet: 192.168.0.1:1024 -> 192.168.0.2:80, payload "Hello!!"
+static const uint8_t udpPacket[] = 
+{
+	0x45, 0x00, 0x00, 0x23, 0x12, 0x34, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00,
+	0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0x02,
+	0x04, 0x00, 0x00, 0x50, 0x00, 0x0f, 0x00, 0x00,
+	'H', 'e', 'l', 'l', 'o', '!', '!'
+};
+
+static uint16_t ReferenceChecksum(const uint8_t *data, size_t size, uint32_t sum = 0)
+{
+	for(size_t i = 0; i < size; i += 2)
+	{
+		sum += data[i] << 8;
+		if(i + 1 < size)
+			sum += data[i + 1];
+	}
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void FillBuffer(NetBuffer &buffer, const uint8_t *data, size_t size, const size_t *splits, size_t splitsCount)
+{
+	size_t pos = 0;
+	for(size_t i = 0; i <= splitsCount; i++)
+	{
+		size_t end = i < splitsCount ? splits[i] : size;
+		buffer.AttachBack(DataBuffer::GetNew(data + pos, end - pos));
+		pos = end;
+	}
+}
+
+TEST(NetChecksum, OddFragments)
+{
+	const size_t splits[] = {1, 4, 7, 8, 19, 30};
+	NetBuffer buffer;
+	FillBuffer(buffer, udpPacket, sizeof(udpPacket), splits, 6);
+	EXPECT_EQ(7u, buffer.Parts());
+	for(size_t offset = 0; offset < 10; offset++)
+	{
+		EXPECT_EQ(ReferenceChecksum(udpPacket + offset, sizeof(udpPacket) - offset), 
+			Checksum(buffer.BufferList(), offset, sizeof(udpPacket) - offset));
+	}
+}
+
+TEST(NetChecksum, Ipv4SoftwareInsertion)
+{
+	const size_t splits[] = {3, 21};
+	NetBuffer buffer;
+	FillBuffer(buffer, udpPacket, sizeof(udpPacket), splits, 2);
+	ASSERT_TRUE(ComputeIpv4Checksums(buffer, ChecksumIpHeader | ChecksumPayload));
+	
+	uint8_t result[sizeof(udpPacket)];
+	buffer.Seek(0);
+	for(size_t i = 0; i < sizeof(result); i++)
+		result[i] = buffer.Read();
+	
+	// whole header and payload with pseudo header must sum up to zero
+	EXPECT_EQ(0, ReferenceChecksum(result, 20));
+	EXPECT_EQ(0xa742, (result[10] << 8) | result[11]);
+	uint32_t pseudo = 0xc0a8 + 0x0001 + 0xc0a8 + 0x0002 + 17 + 15;
+	EXPECT_EQ(0, ReferenceChecksum(result + 20, 15, pseudo));
+	EXPECT_EQ(0, memcmp(result + 12, udpPacket + 12, 14));
+}
+
+TEST(NetChecksum, RandomChains)
+{
+	srand(12345);
+	// sizes are limited to fit into net buffer pools
+	uint8_t data[1300];
+	for(int iteration = 0; iteration < 200; iteration++)
+	{
+		size_t size = 1 + rand() % sizeof(data);
+		for(size_t i = 0; i < size; i++)
+			data[i] = (uint8_t)rand();
+		
+		size_t splits[10];
+		size_t splitsCount = 0;
+		size_t pos = 0;
+		while(splitsCount < 10)
+		{
+			pos += 1 + rand() % 120;
+			if(pos >= size)
+				break;
+			splits[splitsCount++] = pos;
+		}
+		
+		NetBuffer buffer;
+		FillBuffer(buffer, data, size, splits, splitsCount);
+		ASSERT_EQ(splitsCount + 1, buffer.Parts());
+		ASSERT_EQ(size, buffer.Size());
+		
+		size_t offset = rand() % size;
+		size_t length = rand() % (size - offset + 1);
+		ASSERT_EQ(ReferenceChecksum(data + offset, length), 
+			Checksum(buffer.BufferList(), offset, length)) << "size " << size << " offset " << offset << " length " << length;
+		ASSERT_EQ(ReferenceChecksum(data + offset, length), 
+			(uint16_t)~ChecksumFold(ChecksumAdd(data + offset, length)));
+	}
+}
+
+TEST(NetChecksum, IncrementalUpdate)
+{
+	uint8_t header[20];
+	memcpy(header, udpPacket, sizeof(header));
+	uint16_t checksum = ReferenceChecksum(header, sizeof(header));
+	header[10] = (uint8_t)(checksum >> 8);
+	header[11] = (uint8_t)checksum;
+	
+	// decrement TTL
+	uint16_t oldWord = (header[8] << 8) | header[9];
+	header[8]--;
+	uint16_t newWord = (header[8] << 8) | header[9];
+	checksum = ChecksumUpdate(checksum, oldWord, newWord);
+	header[10] = header[11] = 0;
+	EXPECT_EQ(ReferenceChecksum(header, sizeof(header)), checksum);
+	
+	// rewrite destination address
+	uint32_t oldAddr = 0xc0a80002, newAddr = 0x0a000001;
+	header[16] = 0x0a; header[17] = 0x00; header[18] = 0x00; header[19] = 0x01;
+	checksum = ChecksumUpdate32(checksum, oldAddr, newAddr);
+	EXPECT_EQ(ReferenceChecksum(header, sizeof(header)), checksum);
+}
@@ -0,0 +1,297 @@
+#include <gtest.h>
+#include <net/loopback_interface.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <pcap_interface.h>
+#include <stdio.h>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	class CountingProtocol :public INetProtocol
+	{
+	public:
+		CountingProtocol() :frames(0), bytes(0), firstByte(0) {}
+		virtual void ProcessMessage(const Net::MacAddr &srcAddr, const Net::MacAddr &, Net::NetBuffer &buffer)
+		{
+			frames++;
+			lastSrc = srcAddr;
+			firstByte = buffer.Read();
+			bytes += buffer.Size() - EthernetHeaderSize;
+		}
+		unsigned frames;
+		size_t bytes;
+		uint8_t firstByte;
+		Net::MacAddr lastSrc;
+	};
+	
+	bool SendFrame(INetDispatch &dispatch, uint8_t tag, size_t size = 46)
+	{
+		NetBuffer buffer;
+		if(!buffer.InsertBack(size))
+			return false;
+		buffer.Seek(0);
+		buffer.Write(tag);
+		return dispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer);
+	}
+	
+	struct LoopbackFixture
+	{
+		TaskItem tasks[4];
+		TimerData timers[4];
+		Dispatcher dispatcher;
+		NetDispatch netDispatch;
+		LoopbackInterface loopback;
+		CountingProtocol protocol;
+		
+		LoopbackFixture()
+			:dispatcher(tasks, 4, timers, 4),
+			netDispatch(dispatcher),
+			loopback(dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 1))
+		{
+			ticks = 0;
+			dispatcher.SetTimerFunc(GetTicks);
+			netDispatch.AddInterface(&loopback);
+			netDispatch.AddProtocol(IEEE802_1_Public1, &protocol);
+		}
+	};
+}
+
+TEST(NetLoopback, DeliversOnPoll)
+{
+	LoopbackFixture f;
+	EXPECT_TRUE(SendFrame(f.netDispatch, 0x55));
+	EXPECT_EQ(0u, f.protocol.frames);
+	f.netDispatch.Poll();
+	EXPECT_EQ(1u, f.protocol.frames);
+	EXPECT_EQ(0x55, f.protocol.firstByte);
+	EXPECT_EQ(46u, f.protocol.bytes);
+	EXPECT_TRUE(f.protocol.lastSrc == f.loopback.GetMacAddress(0));
+	EXPECT_EQ(1u, f.loopback.GetParameter(NetIfFramesSend));
+	EXPECT_EQ(1u, f.loopback.GetParameter(NetIfFramesRecived));
+}
+
+TEST(NetLoopback, LatencyAndBandwidth)
+{
+	LoopbackFixture f;
+	f.loopback.SetLatency(10);
+	f.loopback.SetBandwidth(60); // one 60 byte frame per tick
+	
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46));
+	TransferId id1 = f.loopback.Transmit(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer);
+	ASSERT_TRUE(buffer.InsertBack(46));
+	TransferId id2 = f.loopback.Transmit(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer);
+	EXPECT_NE(0u, id1);
+	EXPECT_NE(0u, id2);
+	
+	ticks = 10;
+	f.netDispatch.Poll();
+	EXPECT_EQ(0u, f.protocol.frames);
+	EXPECT_FALSE(f.loopback.TxCompleteFor(id1));
+	
+	ticks = 11;
+	f.netDispatch.Poll();
+	EXPECT_EQ(1u, f.protocol.frames);
+	EXPECT_TRUE(f.loopback.TxCompleteFor(id1));
+	EXPECT_FALSE(f.loopback.TxCompleteFor(id2));
+	
+	ticks = 12;
+	f.netDispatch.Poll();
+	EXPECT_EQ(2u, f.protocol.frames);
+	EXPECT_TRUE(f.loopback.TxCompleteFor(id2));
+}
+
+TEST(NetLoopback, AddressFilter)
+{
+	LoopbackFixture f;
+	Net::MacAddr group(0x01, 0x00, 0x5e, 0x00, 0x00, 0x01);
+	Net::MacAddr other(0x02, 0x00, 0x00, 0x00, 0x00, 0x77);
+	
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46));
+	f.loopback.Transmit(group, IEEE802_1_Public1, buffer);
+	ASSERT_TRUE(buffer.InsertBack(46));
+	f.loopback.Transmit(other, IEEE802_1_Public1, buffer);
+	f.netDispatch.Poll();
+	EXPECT_EQ(0u, f.protocol.frames);
+	
+	EXPECT_TRUE(f.loopback.AddAddressFilter(group));
+	ASSERT_TRUE(buffer.InsertBack(46));
+	f.loopback.Transmit(group, IEEE802_1_Public1, buffer);
+	ASSERT_TRUE(buffer.InsertBack(46));
+	f.loopback.Transmit(other, IEEE802_1_Public1, buffer);
+	f.netDispatch.Poll();
+	EXPECT_EQ(1u, f.protocol.frames);
+	
+	f.loopback.SetPromiscuous(true);
+	ASSERT_TRUE(buffer.InsertBack(46));
+	f.loopback.Transmit(other, IEEE802_1_Public1, buffer);
+	f.netDispatch.Poll();
+	EXPECT_EQ(2u, f.protocol.frames);
+}
+
+TEST(NetLoopback, LossAndQueueLimit)
+{
+	LoopbackFixture f;
+	f.loopback.SetLossRate(32768);
+	unsigned sent = 0;
+	for(unsigned i = 0; i < MaxLoopbackFrames + 2; i++)
+	{
+		NetBuffer buffer;
+		ASSERT_TRUE(buffer.InsertBack(46));
+		if(f.loopback.Transmit(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer))
+			sent++;
+	}
+	EXPECT_EQ(MaxLoopbackFrames, sent);
+	EXPECT_EQ(2u, f.loopback.GetParameter(NetIfSendErrors));
+	
+	f.netDispatch.Poll();
+	uint32_t lost = f.loopback.GetParameter(NetIfFramesMacMissed);
+	EXPECT_EQ(sent, f.protocol.frames + lost);
+	EXPECT_LT(0u, lost);
+	EXPECT_LT(0u, f.protocol.frames);
+}
+
+TEST(NetLoopback, PcapRecordAndReplay)
+{
+	const char *fileName = "net_loopback_test.pcap";
+	LoopbackFixture f;
+	{
+		PcapInterface recorder(f.dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 2));
+		ASSERT_TRUE(recorder.OpenRecord(fileName));
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			NetBuffer buffer;
+			ASSERT_TRUE(buffer.InsertBack(100));
+			buffer.Seek(0);
+			buffer.Write(i);
+			EXPECT_NE(0u, recorder.Transmit(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+		}
+		recorder.Close();
+	}
+	
+	PcapInterface player(f.dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 3));
+	ASSERT_TRUE(player.OpenReplay(fileName));
+	f.netDispatch.AddInterface(&player);
+	f.netDispatch.Poll();
+	EXPECT_EQ(3u, f.protocol.frames);
+	EXPECT_EQ(2, f.protocol.firstByte);
+	EXPECT_EQ(300u, f.protocol.bytes);
+	EXPECT_TRUE(f.protocol.lastSrc == Net::MacAddr(2, 0, 0, 0, 0, 2));
+	player.Close();
+	remove(fileName);
+}
+
+TEST(NetLoopback, PcapReplayWithoutMemory)
+{
+	const char *fileName = "net_loopback_nomem.pcap";
+	LoopbackFixture f;
+	{
+		PcapInterface recorder(f.dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 2));
+		ASSERT_TRUE(recorder.OpenRecord(fileName));
+		for(uint8_t i = 0; i < 6; i++)
+		{
+			// first frame does not fit small buffers, others fill one of them
+			NetBuffer buffer;
+			ASSERT_TRUE(buffer.InsertBack(i == 0 ? 100 : SmallPoolBufferSize - EthernetHeaderSize));
+			buffer.Seek(0);
+			buffer.Write(i);
+			EXPECT_NE(0u, recorder.Transmit(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+		}
+		recorder.Close();
+	}
+	
+	PcapInterface player(f.dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 3));
+	ASSERT_TRUE(player.OpenReplay(fileName));
+	f.netDispatch.AddInterface(&player);
+	
+	// leave two small buffers, the first frame fails to load after two fragments,
+	// next two frames are loaded and the rest is dropped
+	std::vector<DataBuffer *> held;
+	for(DataBuffer *buffer; (buffer = DataBuffer::GetNew(1)) != 0; )
+		held.push_back(buffer);
+	ASSERT_LT(2u, held.size());
+	// first ones are taken from small pool
+	DataBuffer::Release(held[0]);
+	DataBuffer::Release(held[1]);
+	
+	f.netDispatch.Poll();
+	EXPECT_EQ(2u, f.protocol.frames);
+	EXPECT_EQ(2, f.protocol.firstByte);
+	EXPECT_EQ(4u, player.GetParameter(NetIfReciveErrors));
+	EXPECT_TRUE(player.IsLinked());
+	
+	for(size_t i = 2; i < held.size(); i++)
+		DataBuffer::Release(held[i]);
+	player.Close();
+	remove(fileName);
+}
+
+TEST(NetLoopback, VlanDemux)
+{
+	LoopbackFixture f;
+	CountingProtocol vlanProtocol;
+	f.netDispatch.AddProtocol(IEEE802_1_Public1, &vlanProtocol, 10);
+	
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46, EthernetHeaderSize + VlanTagSize));
+	buffer.Seek(0);
+	buffer.Write(0x10);
+	buffer.SetVlanTag(MakeVlanTag(10, 3));
+	EXPECT_TRUE(f.netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	// unknown VLAN is dropped
+	ASSERT_TRUE(buffer.InsertBack(46, EthernetHeaderSize + VlanTagSize));
+	buffer.SetVlanTag(MakeVlanTag(20, 0));
+	EXPECT_TRUE(f.netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	EXPECT_TRUE(SendFrame(f.netDispatch, 0x55));
+	f.netDispatch.Poll();
+	
+	EXPECT_EQ(1u, vlanProtocol.frames);
+	EXPECT_EQ(0x10, vlanProtocol.firstByte);
+	// tag stays in front of payload
+	EXPECT_EQ(46u + VlanTagSize, vlanProtocol.bytes);
+	EXPECT_EQ(1u, f.protocol.frames);
+	EXPECT_EQ(0x55, f.protocol.firstByte);
+}
+
+TEST(NetLoopback, VlanPriorityLanes)
+{
+	LoopbackFixture f;
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46));
+	buffer.Seek(0);
+	buffer.Write(0x01);
+	buffer.SetVlanTag(MakeVlanTag(0, 0));
+	EXPECT_TRUE(f.netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	ASSERT_TRUE(buffer.InsertBack(46));
+	buffer.Seek(0);
+	buffer.Write(0x06);
+	buffer.SetVlanTag(MakeVlanTag(0, 6));
+	EXPECT_TRUE(f.netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	f.netDispatch.Poll();
+	
+	// high priority frame is delivered first, though it was sent last
+	EXPECT_EQ(2u, f.protocol.frames);
+	EXPECT_EQ(0x01, f.protocol.firstByte);
+	
+	f.netDispatch.SetPriorityLane(6, 0);
+	ASSERT_TRUE(buffer.InsertBack(46));
+	buffer.Seek(0);
+	buffer.Write(0x01);
+	EXPECT_TRUE(f.netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	ASSERT_TRUE(buffer.InsertBack(46));
+	buffer.Seek(0);
+	buffer.Write(0x06);
+	buffer.SetVlanTag(MakeVlanTag(0, 6));
+	EXPECT_TRUE(f.netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	f.netDispatch.Poll();
+	EXPECT_EQ(4u, f.protocol.frames);
+	EXPECT_EQ(0x06, f.protocol.firstByte);
+}
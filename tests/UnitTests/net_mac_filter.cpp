@@ -0,0 +1,105 @@
+#include <gtest.h>
+#include <net/mac_filter.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	// reference: bitwise MSB first CRC-32 of the address bits in transmission order, inverted
+	unsigned ReferenceHash(const Net::MacAddr &addr)
+	{
+		uint32_t crc = 0xffffffff;
+		for(unsigned i = 0; i < 6; i++)
+		{
+			uint8_t byte = addr[i];
+			for(unsigned bit = 0; bit < 8; bit++)
+			{
+				bool carry = ((crc >> 31) ^ (byte >> bit)) & 1;
+				crc <<= 1;
+				if(carry)
+					crc ^= 0x04C11DB7;
+			}
+		}
+		return ~crc >> 26;
+	}
+	
+	Net::MacAddr Multicast(uint8_t i)
+	{
+		return Net::MacAddr(0x01, 0x00, 0x5e, 0x00, 0x00, i);
+	}
+}
+
+TEST(NetMacFilter, HashIndex)
+{
+	for(unsigned i = 0; i < 256; i++)
+	{
+		Net::MacAddr addr = Multicast((uint8_t)i);
+		ASSERT_EQ(ReferenceHash(addr), MacHashIndex(addr));
+		addr = Net::MacAddr(0x02, (uint8_t)(i * 7), 0x11, (uint8_t)i, 0x33, 0x44);
+		ASSERT_EQ(ReferenceHash(addr), MacHashIndex(addr));
+	}
+	// known value for all hosts group 01:00:5e:00:00:01
+	EXPECT_EQ(0x20u, MacHashIndex(Multicast(1)));
+}
+
+TEST(NetMacFilter, PerfectThenHash)
+{
+	MacAddressFilter<2> filter;
+	EXPECT_TRUE(filter.Add(Multicast(1)));
+	EXPECT_TRUE(filter.Add(Multicast(2)));
+	EXPECT_TRUE(filter.Add(Multicast(3)));
+	EXPECT_TRUE(filter.Add(Net::MacAddr(2, 0, 0, 0, 0, 9)));
+	
+	Net::MacAddr addr;
+	EXPECT_TRUE(filter.PerfectSlot(0, addr));
+	EXPECT_TRUE(addr == Multicast(1));
+	EXPECT_TRUE(filter.PerfectSlot(1, addr));
+	EXPECT_TRUE(addr == Multicast(2));
+	EXPECT_FALSE(filter.PerfectSlot(2, addr));
+	
+	EXPECT_EQ(MacFilterPerfect, filter.Match(Multicast(1)));
+	EXPECT_EQ(MacFilterHash, filter.Match(Multicast(3)));
+	EXPECT_EQ(MacFilterHash, filter.Match(Net::MacAddr(2, 0, 0, 0, 0, 9)));
+	EXPECT_TRUE(filter.HashMulticast());
+	EXPECT_TRUE(filter.HashUnicast());
+	
+	unsigned index = MacHashIndex(Multicast(3));
+	uint32_t bits = index < 32 ? filter.HashLow() : filter.HashHigh();
+	EXPECT_NE(0u, bits & (1ul << (index & 31)));
+	
+	// perfect slot is freed, hashed entries stay in the table
+	EXPECT_TRUE(filter.Remove(Multicast(1)));
+	EXPECT_FALSE(filter.PerfectSlot(0, addr));
+	EXPECT_NE(MacFilterPerfect, filter.Match(Multicast(1)));
+	EXPECT_TRUE(filter.Add(Multicast(4)));
+	EXPECT_EQ(MacFilterPerfect, filter.Match(Multicast(4)));
+	
+	EXPECT_TRUE(filter.Remove(Multicast(3)));
+	EXPECT_TRUE(filter.Remove(Net::MacAddr(2, 0, 0, 0, 0, 9)));
+	EXPECT_FALSE(filter.HashMulticast());
+	EXPECT_FALSE(filter.HashUnicast());
+	EXPECT_EQ(0u, filter.HashLow());
+	EXPECT_EQ(0u, filter.HashHigh());
+	EXPECT_FALSE(filter.Remove(Multicast(3)));
+}
+
+TEST(NetMacFilter, SharedHashBucket)
+{
+	MacAddressFilter<0> filter;
+	// find two addresses with the same hash
+	Net::MacAddr first = Multicast(0), second;
+	for(unsigned i = 1; i < 256; i++)
+	{
+		second = Multicast((uint8_t)i);
+		if(MacHashIndex(second) == MacHashIndex(first))
+			break;
+	}
+	ASSERT_EQ(MacHashIndex(first), MacHashIndex(second));
+	EXPECT_TRUE(filter.Add(first));
+	EXPECT_TRUE(filter.Add(second));
+	EXPECT_TRUE(filter.Remove(first));
+	EXPECT_EQ(MacFilterHash, filter.Match(second));
+	EXPECT_TRUE(filter.Remove(second));
+	EXPECT_EQ(MacFilterNone, filter.Match(second));
+}
@@ -0,0 +1,270 @@
+#include <gtest.h>
+#include <net/ipv4_reassembly.h>
+#include <net/udp.h>
+#include <net/checksum.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	struct Env
+	{
+		TaskItem tasks[8];
+		TimerData timers[4];
+		Dispatcher dispatcher;
+		Ipv4Reassembly reassembly;
+		
+		Env()
+			:dispatcher(tasks, 8, timers, 4),
+			reassembly(dispatcher)
+		{
+			dispatcher.SetTimerFunc(GetTicks);
+		}
+	};
+	
+	// Builds frame with ethernet and IP headers carrying 'length' bytes of datagram 'id' payload starting at 'offset'.
+	// Payload byte value is its offset in the datagram.
+	void MakeFragment(NetBuffer &buffer, Ipv4Header &header, uint16_t id, uint16_t offset, uint16_t length, bool more)
+	{
+		const size_t padding = 2;
+		ASSERT_TRUE(buffer.InsertBack(EthernetHeaderSize + Ipv4HeaderSize + length + padding));
+		buffer.Seek(EthernetHeaderSize);
+		buffer.Write(0x45);
+		buffer.Write(0);
+		buffer.WriteU16Be(Ipv4HeaderSize + length);
+		buffer.WriteU16Be(id);
+		buffer.WriteU16Be((more ? 0x2000 : 0) | (offset / 8));
+		buffer.Write(64);
+		buffer.Write(IpProtocolUdp);
+		buffer.WriteU16Be(0);
+		buffer.WriteIp(Net::IpAddr(10, 0, 0, 1));
+		buffer.WriteIp(Net::IpAddr(10, 0, 0, 2));
+		for(uint16_t i = 0; i < length; i++)
+			buffer.Write((uint8_t)(offset + i));
+		
+		header.srcAddr = Net::IpAddr(10, 0, 0, 1);
+		header.destAddr = Net::IpAddr(10, 0, 0, 2);
+		header.offset = EthernetHeaderSize;
+		header.payloadOffset = EthernetHeaderSize + Ipv4HeaderSize;
+		header.payloadLength = length;
+		header.id = id;
+		header.fragment = (more ? 0x2000 : 0) | (offset / 8);
+		header.headerLength = Ipv4HeaderSize;
+		header.tos = 0;
+		header.ttl = 64;
+		header.protocol = IpProtocolUdp;
+		header.checksumFlags = ChecksumNone;
+	}
+	
+	bool Feed(Env &env, NetBuffer &buffer, Ipv4Header &header, uint16_t id, uint16_t offset, uint16_t length, bool more)
+	{
+		MakeFragment(buffer, header, id, offset, length, more);
+		return env.reassembly.Process(header, buffer);
+	}
+	
+	class Receiver :public IUdpHandler
+	{
+	public:
+		Receiver() :datagrams(0) {}
+		virtual void ProcessDatagram(const UdpDatagram &, Net::BufferSpans &payload, Net::NetBuffer &)
+		{
+			datagrams++;
+			data.clear();
+			const uint8_t *span;
+			size_t size;
+			while(payload.Next(span, size))
+				data.insert(data.end(), span, span + size);
+		}
+		unsigned datagrams;
+		std::vector<uint8_t> data;
+	};
+}
+
+TEST(NetReassembly, OutOfOrderInPlace)
+{
+	ticks = 0;
+	Env env;
+	size_t freeBuffers = DataBuffer::FreeBuffers(MedPoolBufferSize);
+	{
+		NetBuffer buffer;
+		Ipv4Header header;
+		EXPECT_FALSE(Feed(env, buffer, header, 1, 128, 40, false));
+		EXPECT_FALSE(Feed(env, buffer, header, 1, 0, 64, true));
+		EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyActive));
+		ASSERT_TRUE(Feed(env, buffer, header, 1, 64, 64, true));
+		
+		EXPECT_EQ(0u, header.offset);
+		EXPECT_EQ(Ipv4HeaderSize, header.payloadOffset);
+		EXPECT_EQ(168u, header.payloadLength);
+		EXPECT_EQ(0, header.fragment);
+		// fragments are chained, not copied, padding is cut off
+		EXPECT_EQ(3u, buffer.Parts());
+		EXPECT_EQ(Ipv4HeaderSize + 168u, buffer.Size());
+		EXPECT_EQ(Ipv4HeaderSize, buffer.Position());
+		for(unsigned i = 0; i < 168; i++)
+			ASSERT_EQ((uint8_t)i, buffer.Read());
+		buffer.Seek(0);
+		EXPECT_EQ(0x45, buffer.Read());
+		EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyCompleted));
+		EXPECT_EQ(0u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyActive));
+	}
+	EXPECT_EQ(freeBuffers, DataBuffer::FreeBuffers(MedPoolBufferSize));
+}
+
+TEST(NetReassembly, OverlapsAreDiscarded)
+{
+	ticks = 0;
+	Env env;
+	NetBuffer buffer;
+	Ipv4Header header;
+	EXPECT_FALSE(Feed(env, buffer, header, 2, 0, 64, true));
+	EXPECT_FALSE(Feed(env, buffer, header, 2, 0, 64, true));    // duplicate
+	EXPECT_FALSE(Feed(env, buffer, header, 2, 56, 16, true));   // overlap
+	EXPECT_FALSE(Feed(env, buffer, header, 2, 60, 10, true));   // not multiple of 8
+	EXPECT_EQ(3u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyDropped));
+	ASSERT_TRUE(Feed(env, buffer, header, 2, 64, 8, false));
+	EXPECT_EQ(72u, header.payloadLength);
+	EXPECT_EQ(Ipv4HeaderSize + 72u, buffer.Size());
+}
+
+TEST(NetReassembly, Timeout)
+{
+	ticks = 0;
+	Env env;
+	size_t freeBuffers = DataBuffer::FreeBuffers(MedPoolBufferSize);
+	env.reassembly.SetTimeout(100);
+	NetBuffer buffer;
+	Ipv4Header header;
+	EXPECT_FALSE(Feed(env, buffer, header, 3, 0, 64, true));
+	EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyActive));
+	for(ticks = 0; ticks < 160; ticks++)
+		env.dispatcher.Poll();
+	EXPECT_EQ(0u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyActive));
+	EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyTimedOut));
+	EXPECT_EQ(freeBuffers, DataBuffer::FreeBuffers(MedPoolBufferSize));
+	// late fragment starts new reassembly
+	EXPECT_FALSE(Feed(env, buffer, header, 3, 64, 8, false));
+	EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyActive));
+}
+
+TEST(NetReassembly, LeastRecentlyUpdatedEviction)
+{
+	ticks = 0;
+	Env env;
+	NetBuffer buffer;
+	Ipv4Header header;
+	for(uint16_t id = 10; id < 10 + MaxIpReassemblySlots; id++)
+	{
+		ticks++;
+		EXPECT_FALSE(Feed(env, buffer, header, id, 0, 64, true));
+	}
+	// update the oldest one, the next oldest is the victim
+	ticks++;
+	EXPECT_FALSE(Feed(env, buffer, header, 10, 64, 64, true));
+	ticks++;
+	EXPECT_FALSE(Feed(env, buffer, header, 100, 0, 64, true));
+	EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyEvicted));
+	EXPECT_TRUE(Feed(env, buffer, header, 10, 128, 8, false));
+	
+	// pool pressure: no full size buffers left
+	buffer.Clear();
+	env.reassembly.SetMinFreeBuffers(1);
+	std::vector<DataBuffer *> held;
+	while(DataBuffer::FreeBuffers(LargePoolBufferSize))
+		held.push_back(DataBuffer::GetNew(LargePoolBufferSize));
+	ticks++;
+	EXPECT_FALSE(Feed(env, buffer, header, 200, 0, 64, true));
+	EXPECT_EQ(1u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyActive));
+	EXPECT_LE(2u, env.reassembly.GetStatistic(Ipv4Reassembly::ReassemblyEvicted));
+	for(size_t i = 0; i < held.size(); i++)
+		DataBuffer::Release(held[i]);
+}
+
+TEST(NetReassembly, FragmentedUdpDatagram)
+{
+	ticks = 0;
+	TaskItem tasks[8];
+	TimerData timers[4];
+	Dispatcher dispatcher(tasks, 8, timers, 4);
+	dispatcher.SetTimerFunc(GetTicks);
+	NetDispatch netDispatch(dispatcher);
+	ArpEntry entries[4];
+	Arp arp(dispatcher, netDispatch, entries, 4);
+	Ipv4 ipv4(netDispatch, arp);
+	Ipv4Reassembly reassembly(dispatcher);
+	Udp udp(ipv4);
+	Receiver receiver;
+	ipv4.SetAddress(Net::IpAddr(10, 0, 0, 2), Net::IpAddr(255, 255, 255, 0), Net::IpAddr());
+	ASSERT_TRUE(udp.Bind(7, &receiver));
+	
+	// whole datagram with software checksums
+	const uint16_t payloadLength = 180;
+	const uint16_t udpLength = UdpHeaderSize + payloadLength;
+	std::vector<uint8_t> packet;
+	{
+		NetBuffer datagram;
+		ASSERT_TRUE(datagram.InsertBack(Ipv4HeaderSize));
+		ASSERT_TRUE(datagram.InsertBack(udpLength));
+		datagram.Seek(0);
+		datagram.Write(0x45);
+		datagram.Write(0);
+		datagram.WriteU16Be(Ipv4HeaderSize + udpLength);
+		datagram.WriteU16Be(77);
+		datagram.WriteU16Be(0);
+		datagram.Write(64);
+		datagram.Write(IpProtocolUdp);
+		datagram.WriteU16Be(0);
+		datagram.WriteIp(Net::IpAddr(10, 0, 0, 1));
+		datagram.WriteIp(Net::IpAddr(10, 0, 0, 2));
+		datagram.WriteU16Be(5000);
+		datagram.WriteU16Be(7);
+		datagram.WriteU16Be(udpLength);
+		datagram.WriteU16Be(0);
+		for(unsigned i = 0; i < payloadLength; i++)
+			datagram.Write((uint8_t)(i * 3));
+		ASSERT_TRUE(ComputeIpv4Checksums(datagram, ChecksumIpHeader | ChecksumPayload));
+		datagram.Seek(0);
+		for(unsigned i = 0; i < Ipv4HeaderSize + udpLength; i++)
+			packet.push_back(datagram.Read());
+	}
+	
+	// split into 64 byte fragments, fed in reverse order
+	ipv4.SetReassembly(&reassembly);
+	for(int offset = (udpLength - 1) / 64 * 64; offset >= 0; offset -= 64)
+	{
+		uint16_t length = udpLength - offset < 64 ? udpLength - offset : 64;
+		bool more = offset + length < udpLength;
+		NetBuffer frame;
+		ASSERT_TRUE(frame.InsertBack(EthernetHeaderSize + Ipv4HeaderSize + length));
+		frame.Seek(EthernetHeaderSize);
+		for(unsigned i = 0; i < Ipv4HeaderSize; i++)
+			frame.Write(packet[i]);
+		frame.Seek(EthernetHeaderSize + 2);
+		frame.WriteU16Be(Ipv4HeaderSize + length);
+		frame.Seek(EthernetHeaderSize + 6);
+		frame.WriteU16Be((more ? 0x2000 : 0) | (offset / 8));
+		frame.WriteU16Be(0x4011);
+		frame.WriteU16Be(0);
+		uint16_t checksum = Checksum(frame.BufferList(), EthernetHeaderSize, Ipv4HeaderSize);
+		frame.Seek(EthernetHeaderSize + 10);
+		frame.WriteU16Be(checksum);
+		frame.Seek(EthernetHeaderSize + Ipv4HeaderSize);
+		for(unsigned i = 0; i < length; i++)
+			frame.Write(packet[Ipv4HeaderSize + offset + i]);
+		frame.Seek(EthernetHeaderSize);
+		ipv4.ProcessMessage(Net::MacAddr(), Net::MacAddr(), frame);
+	}
+	EXPECT_EQ(0u, ipv4.GetStatistic(Ipv4::IpChecksumErrors));
+	EXPECT_EQ(0u, udp.GetStatistic(Udp::UdpErrors));
+	ASSERT_EQ(1u, receiver.datagrams);
+	ASSERT_EQ(payloadLength, receiver.data.size());
+	for(unsigned i = 0; i < payloadLength; i++)
+		EXPECT_EQ((uint8_t)(i * 3), receiver.data[i]);
+}
@@ -0,0 +1,146 @@
+#include <gtest.h>
+#include <net/net_stats.h>
+#include <net/loopback_interface.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <tiny_ostream.h>
+#include <string>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	class StringWriter
+	{
+	public:
+		void put(char c) { text += c; }
+		std::string text;
+	};
+	
+	class VectorSink
+	{
+	public:
+		void Write(uint8_t value) { data.push_back(value); }
+		std::vector<uint8_t> data;
+	};
+	
+	class NullProtocol :public INetProtocol
+	{
+	public:
+		NullProtocol() :frames(0) {}
+		virtual void ProcessMessage(const Net::MacAddr &, const Net::MacAddr &, Net::NetBuffer &) { frames++; }
+		unsigned frames;
+	};
+	
+	uint32_t ReadU32(const std::vector<uint8_t> &data, size_t offset)
+	{
+		return data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24);
+	}
+}
+
+TEST(NetStats, Counters)
+{
+	NetStats stats;
+	stats.RxFrame(0, IPv4, 60);
+	stats.RxFrame(0, IPv4, 1514);
+	stats.RxFrame(1, ARP, 100);
+	stats.TxFrame(0, IPv4, 300, true);
+	stats.TxFrame(0, IPv4, 300, false);
+	// interface out of range, still not counted for protocol
+	stats.TxFrame(MaxStatsInterfaces, IPv4, 300, false);
+	stats.UdpRx(7, 10);
+	stats.UdpTx(7, 20);
+	
+	const NetInterfaceStats &if0 = stats.Interface(0);
+	EXPECT_EQ(2u, if0.rx.frames);
+	EXPECT_EQ(1574u, if0.rx.bytes);
+	EXPECT_EQ(1u, if0.rxSizes[0]);
+	EXPECT_EQ(1u, if0.rxSizes[5]);
+	EXPECT_EQ(1u, if0.tx.frames);
+	EXPECT_EQ(1u, if0.txSizes[3]);
+	EXPECT_EQ(1u, if0.txRejected);
+	EXPECT_EQ(1u, stats.Interface(1).rxSizes[1]);
+	
+	ASSERT_TRUE(stats.Protocol(IPv4) != 0);
+	EXPECT_EQ(2u, stats.Protocol(IPv4)->rx.frames);
+	EXPECT_EQ(1u, stats.Protocol(IPv4)->tx.frames);
+	EXPECT_EQ(100u, stats.Protocol(ARP)->rx.bytes);
+	EXPECT_TRUE(stats.Protocol(IPv6) == 0);
+	ASSERT_TRUE(stats.UdpPort(7) != 0);
+	EXPECT_EQ(10u, stats.UdpPort(7)->rx.bytes);
+	EXPECT_EQ(20u, stats.UdpPort(7)->tx.bytes);
+	
+	// tables are bounded, extra ports are counted as untracked
+	for(uint16_t port = 100; port < 100 + MaxStatsUdpPorts; port++)
+		stats.UdpRx(port, 1);
+	EXPECT_EQ(1u, stats.Untracked());
+	EXPECT_TRUE(stats.UdpPort(100 + MaxStatsUdpPorts - 1) == 0);
+	
+	VectorSink sink;
+	stats.WriteBinary(sink);
+	ASSERT_LE(17u, sink.data.size());
+	EXPECT_EQ(NetStats::BinaryVersion, sink.data[0]);
+	EXPECT_EQ(MaxStatsInterfaces, sink.data[1]);
+	EXPECT_EQ(2u, sink.data[3]);
+	EXPECT_EQ(MaxStatsUdpPorts, sink.data[4]);
+	EXPECT_EQ(1u, ReadU32(sink.data, 9));
+	size_t interfaceSize = 4 * (5 + 2 * NetStatsSizeBuckets);
+	size_t flowSize = 2 + 4 * 4;
+	EXPECT_EQ(17 + MaxStatsInterfaces * interfaceSize + (2 + MaxStatsUdpPorts) * flowSize, sink.data.size());
+	EXPECT_EQ(2u, ReadU32(sink.data, 17));
+	
+	stats.Reset();
+	EXPECT_EQ(0u, stats.Interface(0).rx.frames);
+	EXPECT_TRUE(stats.Protocol(IPv4) == 0);
+}
+
+TEST(NetStats, Print)
+{
+	NetStats stats;
+	stats.RxFrame(0, ARP, 60);
+	stats.UdpTx(53, 20);
+	basic_ostream<StringWriter> out;
+	stats.Print(out);
+	std::string text = out.text;
+	EXPECT_NE(std::string::npos, text.find("if0 rx 1/60 tx 0/0 rejected 0"));
+	EXPECT_NE(std::string::npos, text.find("eth 0x806 rx 1/60"));
+	EXPECT_NE(std::string::npos, text.find("udp 53 rx 0/0 tx 1/20"));
+}
+
+TEST(NetStats, DispatchHooks)
+{
+	TaskItem tasks[4];
+	TimerData timers[4];
+	Dispatcher dispatcher(tasks, 4, timers, 4);
+	dispatcher.SetTimerFunc(GetTicks);
+	NetDispatch netDispatch(dispatcher);
+	LoopbackInterface loopback(dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 1));
+	NullProtocol protocol;
+	NetStats stats;
+	netDispatch.AddInterface(&loopback);
+	netDispatch.AddProtocol(IEEE802_1_Public1, &protocol);
+	netDispatch.SetStats(&stats);
+	
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(46));
+	EXPECT_TRUE(netDispatch.SendMesage(Net::MacAddr::Broadcast(), IEEE802_1_Public1, buffer));
+	ASSERT_TRUE(buffer.InsertBack(100));
+	EXPECT_TRUE(netDispatch.SendMesage(Net::MacAddr::Broadcast(), ARP, buffer));
+	netDispatch.Poll();
+	
+	EXPECT_EQ(1u, protocol.frames);
+	const NetInterfaceStats &if0 = stats.Interface(0);
+	EXPECT_EQ(2u, if0.tx.frames);
+	EXPECT_EQ(60u + 114u, if0.tx.bytes);
+	EXPECT_EQ(2u, if0.rx.frames);
+	EXPECT_EQ(60u + 114u, if0.rx.bytes);
+	EXPECT_EQ(1u, stats.NoProtocolFrames());
+	ASSERT_TRUE(stats.Protocol(ARP) != 0);
+	EXPECT_EQ(1u, stats.Protocol(ARP)->rx.frames);
+	EXPECT_EQ(0u, stats.PoolExhausted());
+}
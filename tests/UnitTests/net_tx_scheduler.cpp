@@ -0,0 +1,137 @@
+#include <gtest.h>
+#include <net/tx_scheduler.h>
+#include <net/loopback_interface.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	class RecordingProtocol :public INetProtocol
+	{
+	public:
+		virtual void ProcessMessage(const Net::MacAddr &, const Net::MacAddr &, Net::NetBuffer &buffer)
+		{
+			tags.push_back(buffer.Read());
+		}
+		std::vector<uint8_t> tags;
+	};
+	
+	struct SchedulerFixture
+	{
+		TaskItem tasks[4];
+		TimerData timers[4];
+		Dispatcher dispatcher;
+		NetDispatch netDispatch;
+		LoopbackInterface loopback;
+		NetTxScheduler scheduler;
+		RecordingProtocol protocol;
+		
+		SchedulerFixture()
+			:dispatcher(tasks, 4, timers, 4),
+			netDispatch(dispatcher),
+			loopback(dispatcher, Net::MacAddr(2, 0, 0, 0, 0, 1))
+		{
+			ticks = 0;
+			dispatcher.SetTimerFunc(GetTicks);
+			netDispatch.AddInterface(&loopback, &scheduler);
+			netDispatch.AddProtocol(IEEE802_1_Public1, &protocol);
+			netDispatch.AddProtocol(ARP, &protocol);
+			// keep arrival order on receive side
+			for(uint8_t i = 0; i < 8; i++)
+				netDispatch.SetPriorityLane(i, 0);
+		}
+		
+		bool Send(uint8_t tag, uint8_t priority, uint16_t protocolId = IEEE802_1_Public1)
+		{
+			NetBuffer buffer;
+			if(!buffer.InsertBack(46))
+				return false;
+			buffer.Seek(0);
+			buffer.Write(tag);
+			buffer.SetVlanTag(MakeVlanTag(0, priority));
+			bool result = netDispatch.SendMesage(Net::MacAddr::Broadcast(), protocolId, buffer);
+			// rejected frame is left to sender
+			EXPECT_EQ(result ? 0u : 46u, buffer.Size());
+			return result;
+		}
+	};
+}
+
+TEST(NetTxScheduler, QueueWrapAround)
+{
+	NetTxQueue queue;
+	NetTxFrame frame = NetTxFrame();
+	for(unsigned round = 0; round < 3; round++)
+	{
+		for(unsigned i = 0; i < NetTxQueueSize; i++)
+		{
+			frame.size = (uint16_t)(round * 100 + i);
+			EXPECT_TRUE(queue.Push(frame));
+		}
+		EXPECT_FALSE(queue.Push(frame));
+		for(unsigned i = 0; i < NetTxQueueSize; i++)
+		{
+			ASSERT_TRUE(queue.Front() != 0);
+			EXPECT_EQ(round * 100 + i, queue.Front()->size);
+			queue.Pop();
+		}
+		EXPECT_TRUE(queue.Front() == 0);
+	}
+}
+
+TEST(NetTxScheduler, BackPressureWithoutLoss)
+{
+	SchedulerFixture f;
+	f.loopback.SetLinked(false);
+	for(unsigned i = 0; i < NetTxQueueSize; i++)
+		EXPECT_TRUE(f.Send((uint8_t)i, 0));
+	EXPECT_FALSE(f.Send(0xff, 0));
+	EXPECT_EQ(1u, f.scheduler.Rejected(2));
+	// other classes have their own queues
+	EXPECT_TRUE(f.Send(0x40, 4));
+	
+	f.netDispatch.Poll();
+	EXPECT_TRUE(f.protocol.tags.empty());
+	
+	f.loopback.SetLinked(true);
+	for(int i = 0; i < 4; i++)
+		f.netDispatch.Poll();
+	EXPECT_EQ(NetTxQueueSize + 1, f.protocol.tags.size());
+	EXPECT_TRUE(f.scheduler.Empty());
+	EXPECT_EQ(0u, f.scheduler.TransmitErrors());
+	EXPECT_EQ(0u, f.loopback.GetParameter(NetIfSendErrors));
+}
+
+TEST(NetTxScheduler, StrictPriorityAndRoundRobin)
+{
+	SchedulerFixture f;
+	// one frame per round, tagged frames are 4 bytes longer
+	f.scheduler.SetQuantum(1, 50);
+	f.scheduler.SetQuantum(2, 50);
+	f.loopback.SetLinked(false);
+	EXPECT_TRUE(f.Send(0x21, 0));
+	EXPECT_TRUE(f.Send(0x22, 0));
+	EXPECT_TRUE(f.Send(0x23, 0));
+	EXPECT_TRUE(f.Send(0x11, 4));
+	EXPECT_TRUE(f.Send(0x12, 5));
+	EXPECT_TRUE(f.Send(0x13, 4));
+	EXPECT_TRUE(f.Send(0x71, 7));
+	EXPECT_TRUE(f.Send(0xa1, 0, ARP));
+	
+	f.loopback.SetLinked(true);
+	for(int i = 0; i < 4; i++)
+		f.netDispatch.Poll();
+	
+	// round robin started at class 2, when its first frame was blocked by link down
+	const uint8_t expected[] = {0x71, 0xa1, 0x21, 0x11, 0x22, 0x12, 0x23, 0x13};
+	ASSERT_EQ(sizeof(expected), f.protocol.tags.size());
+	for(unsigned i = 0; i < sizeof(expected); i++)
+		EXPECT_EQ(expected[i], f.protocol.tags[i]);
+}
@@ -0,0 +1,262 @@
+#include <gtest.h>
+#include <net/udp.h>
+#include <net/loopback_interface.h>
+#include <net/NetDispatch.h>
+#include <net/ether_type.h>
+#include <stdlib.h>
+#include <set>
+#include <vector>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Net;
+
+namespace
+{
+	uint32_t ticks = 0;
+	uint32_t GetTicks(){ return ticks; }
+	
+	class EchoHandler :public IUdpHandler
+	{
+	public:
+		EchoHandler(Udp &udp) :udp(udp), datagrams(0), spans(0), echo(true) {}
+		virtual void ProcessDatagram(const UdpDatagram &datagram, Net::BufferSpans &payload, Net::NetBuffer &)
+		{
+			datagrams++;
+			last = datagram;
+			data.clear();
+			const uint8_t *span;
+			size_t size;
+			while(payload.Next(span, size))
+			{
+				data.insert(data.end(), span, span + size);
+				spans++;
+			}
+			if(!echo)
+				return;
+			NetBuffer reply;
+			ASSERT_TRUE(reply.InsertBack(data.size(), UdpHeadroom));
+			reply.Seek(0);
+			for(size_t i = 0; i < data.size(); i++)
+				reply.Write(data[i]);
+			udp.Send(datagram.localPort, datagram.remoteAddr, datagram.remotePort, reply);
+		}
+		Udp &udp;
+		unsigned datagrams;
+		unsigned spans;
+		bool echo;
+		UdpDatagram last;
+		std::vector<uint8_t> data;
+	};
+	
+	struct Host
+	{
+		TaskItem tasks[8];
+		TimerData timers[4];
+		Dispatcher dispatcher;
+		NetDispatch netDispatch;
+		LoopbackInterface loopback;
+		ArpEntry entries[8];
+		Arp arp;
+		Ipv4 ipv4;
+		Udp udp;
+		EchoHandler handler;
+		
+		Host(uint8_t id)
+			:dispatcher(tasks, 8, timers, 4),
+			netDispatch(dispatcher),
+			loopback(dispatcher, Net::MacAddr(2, 0, 0, 0, 0, id)),
+			arp(dispatcher, netDispatch, entries, 8),
+			ipv4(netDispatch, arp),
+			udp(ipv4),
+			handler(udp)
+		{
+			dispatcher.SetTimerFunc(GetTicks);
+			Net::IpAddr ip(10, 0, 0, id);
+			arp.SetAddress(ip, loopback.GetMacAddress(0));
+			ipv4.SetAddress(ip, Net::IpAddr(255, 255, 255, 0), Net::IpAddr());
+			netDispatch.AddInterface(&loopback);
+			netDispatch.AddProtocol(ARP, &arp);
+			netDispatch.AddProtocol(IPv4, &ipv4);
+		}
+		
+		void Poll()
+		{
+			dispatcher.Poll();
+			netDispatch.Poll();
+		}
+	};
+	
+	void SendPayload(Host &host, uint16_t localPort, const Net::IpAddr &dest, uint16_t destPort, size_t size, size_t splitAt)
+	{
+		NetBuffer buffer;
+		ASSERT_TRUE(buffer.InsertBack(splitAt, UdpHeadroom));
+		if(size > splitAt)
+		{
+			DataBuffer *tail = DataBuffer::GetNew(size - splitAt);
+			ASSERT_TRUE(tail != 0);
+			buffer.AttachBack(tail);
+		}
+		buffer.Seek(0);
+		for(size_t i = 0; i < size; i++)
+			buffer.Write((uint8_t)(i * 7));
+		EXPECT_TRUE(host.udp.Send(localPort, dest, destPort, buffer));
+	}
+	
+	void PollHosts(Host &a, Host &b)
+	{
+		for(int i = 0; i < 8; i++)
+		{
+			a.Poll();
+			b.Poll();
+		}
+	}
+}
+
+TEST(NetUdp, HeadersUseHeadroom)
+{
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(100, UdpHeadroom));
+	ASSERT_TRUE(buffer.InsertFront(UdpHeaderSize));
+	ASSERT_TRUE(buffer.InsertFront(Ipv4HeaderSize));
+	ASSERT_TRUE(buffer.InsertFront(VlanTagSize));
+	ASSERT_TRUE(buffer.InsertFront(EthernetHeaderSize));
+	EXPECT_EQ(1u, buffer.Parts());
+	EXPECT_EQ(100u + UdpHeadroom, buffer.Size());
+	EXPECT_EQ(0u, buffer.BufferList()->Headroom());
+	// no headroom left, new fragment is allocated
+	ASSERT_TRUE(buffer.InsertFront(4));
+	EXPECT_EQ(2u, buffer.Parts());
+}
+
+TEST(NetUdp, FailedSendRestoresBuffer)
+{
+	TaskItem tasks[4];
+	TimerData timers[2];
+	Dispatcher dispatcher(tasks, 4, timers, 2);
+	NetDispatch netDispatch(dispatcher); // no interfaces, every send fails
+	ArpEntry entries[4];
+	Arp arp(dispatcher, netDispatch, entries, 4);
+	Ipv4 ipv4(netDispatch, arp);
+	Udp udp(ipv4);
+	ipv4.SetAddress(Net::IpAddr(10, 0, 0, 1), Net::IpAddr(255, 255, 255, 0), Net::IpAddr());
+	
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(20, UdpHeadroom));
+	buffer.SetVlanTag(5);
+	buffer.Seek(0);
+	buffer.Write(0x42);
+	for(int i = 0; i < 2; i++)
+	{
+		EXPECT_FALSE(udp.Send(1000, Net::IpAddr(255, 255, 255, 255), 2000, buffer));
+		EXPECT_EQ(20u, buffer.Size());
+		EXPECT_EQ((unsigned)ChecksumNone, buffer.ChecksumOffload());
+		buffer.Seek(0);
+		EXPECT_EQ(0x42, buffer.Read());
+	}
+}
+
+TEST(NetUdp, EchoRoundTrip)
+{
+	ticks = 0;
+	Host a(1), b(2);
+	a.loopback.Connect(&b.loopback);
+	b.loopback.Connect(&a.loopback);
+	a.handler.echo = false;
+	ASSERT_TRUE(a.udp.Bind(5000, &a.handler));
+	ASSERT_TRUE(b.udp.Bind(7, &b.handler));
+	
+	// payload spans two fragments
+	SendPayload(a, 5000, Net::IpAddr(10, 0, 0, 2), 7, 200, 50);
+	PollHosts(a, b);
+	
+	ASSERT_EQ(1u, b.handler.datagrams);
+	EXPECT_TRUE(b.handler.last.remoteAddr == Net::IpAddr(10, 0, 0, 1));
+	EXPECT_EQ(5000, b.handler.last.remotePort);
+	EXPECT_EQ(7, b.handler.last.localPort);
+	EXPECT_EQ(200u, b.handler.last.payloadLength);
+	EXPECT_LE(2u, b.handler.spans);
+	ASSERT_EQ(200u, b.handler.data.size());
+	for(size_t i = 0; i < 200; i++)
+		EXPECT_EQ((uint8_t)(i * 7), b.handler.data[i]);
+	
+	ASSERT_EQ(1u, a.handler.datagrams);
+	EXPECT_EQ(7, a.handler.last.remotePort);
+	EXPECT_TRUE(a.handler.data == b.handler.data);
+	EXPECT_EQ(0u, a.udp.GetStatistic(Udp::UdpErrors));
+	EXPECT_EQ(0u, b.udp.GetStatistic(Udp::UdpErrors));
+	EXPECT_EQ(0u, b.ipv4.GetStatistic(Ipv4::IpChecksumErrors));
+}
+
+TEST(NetUdp, DropsBadDatagrams)
+{
+	ticks = 0;
+	Host a(1), b(2);
+	a.loopback.Connect(&b.loopback);
+	b.loopback.Connect(&a.loopback);
+	b.handler.echo = false;
+	ASSERT_TRUE(b.udp.Bind(7, &b.handler));
+	
+	// no listener
+	SendPayload(a, 5000, Net::IpAddr(10, 0, 0, 2), 8, 20, 20);
+	PollHosts(a, b);
+	EXPECT_EQ(1u, b.udp.GetStatistic(Udp::UdpNoPort));
+	
+	// bad UDP checksum, header is built manually so it is not recomputed on send
+	NetBuffer buffer;
+	ASSERT_TRUE(buffer.InsertBack(UdpHeaderSize + 4, UdpHeadroom));
+	buffer.Seek(0);
+	buffer.WriteU16Be(5000);
+	buffer.WriteU16Be(7);
+	buffer.WriteU16Be(UdpHeaderSize + 4);
+	buffer.WriteU16Be(0x1234);
+	buffer.WriteU32Be(0xdeadbeef);
+	EXPECT_TRUE(a.ipv4.Send(Net::IpAddr(10, 0, 0, 2), IpProtocolUdp, buffer));
+	PollHosts(a, b);
+	EXPECT_EQ(1u, b.udp.GetStatistic(Udp::UdpErrors));
+	
+	// not addressed to b
+	SendPayload(a, 5000, Net::IpAddr(10, 0, 0, 3), 7, 20, 20);
+	EXPECT_TRUE(a.arp.AddStatic(Net::IpAddr(10, 0, 0, 3), b.loopback.GetMacAddress(0)));
+	PollHosts(a, b);
+	EXPECT_EQ(1u, b.ipv4.GetStatistic(Ipv4::IpNotForUs));
+	
+	// subnet broadcast is accepted
+	SendPayload(a, 5000, Net::IpAddr(10, 0, 0, 255), 7, 20, 20);
+	PollHosts(a, b);
+	EXPECT_EQ(1u, b.handler.datagrams);
+}
+
+TEST(NetUdp, RandomBindUnbind)
+{
+	Host host(1);
+	std::set<uint16_t> reference;
+	srand(7);
+	for(unsigned step = 0; step < 2000; step++)
+	{
+		uint16_t port = (uint16_t)(1 + rand() % 32);
+		if(rand() % 2)
+		{
+			bool expected = reference.size() < MaxUdpPorts && !reference.count(port);
+			EXPECT_EQ(expected, host.udp.Bind(port, &host.handler));
+			if(expected)
+				reference.insert(port);
+		}
+		else
+		{
+			EXPECT_EQ(reference.count(port) != 0, host.udp.Unbind(port));
+			reference.erase(port);
+		}
+	}
+	// bound port can not be bound twice
+	for(std::set<uint16_t>::iterator it = reference.begin(); it != reference.end(); ++it)
+		EXPECT_FALSE(host.udp.Bind(*it, &host.handler));
+	
+	uint16_t ephemeral = 0;
+	while(reference.size() < MaxUdpPorts)
+	{
+		ephemeral = host.udp.BindEphemeral(&host.handler);
+		ASSERT_LE(49152, ephemeral);
+		reference.insert(ephemeral);
+	}
+	EXPECT_EQ(0, host.udp.BindEphemeral(&host.handler));
+}
@@ -0,0 +1,104 @@
+#include <gtest.h>
+#include <stdio.h>
+#include <vector>
+#include <filesystem/ram_disk.h>
+#include <filesystem/fat.h>
+#include <fat_image.h>
+#if !defined(_WIN32)
+#include <image_disk.h>
+#endif
+
+using namespace Mcucpp;
+using namespace Mcucpp::Fs;
+
+TEST(RamDisk, BlockContract)
+{
+	std::vector<uint8_t> memory(64 * 512);
+	RamDisk disk(&memory[0], 64);
+	EXPECT_EQ(64u, disk.BlocksCount());
+	EXPECT_EQ(512u, disk.BlockSize());
+	
+	uint8_t data[3 * 512];
+	for(size_t i = 0; i < sizeof(data); i++)
+		data[i] = uint8_t(i ^ (i >> 9));
+	EXPECT_TRUE(disk.WriteBlocks((const uint8_t *)data, 10, 3));
+	EXPECT_EQ(0, memcmp(&memory[10 * 512], data, sizeof(data)));
+	
+	std::vector<uint8_t> readBack(3 * 512);
+	EXPECT_TRUE(disk.ReadBlocks(readBack.begin(), 10, 3));
+	EXPECT_EQ(0, memcmp(&readBack[0], data, sizeof(data)));
+	
+	uint8_t block[512];
+	EXPECT_TRUE(disk.BeginRead(11));
+	EXPECT_TRUE(disk.ReadNext(block));
+	EXPECT_EQ(0, memcmp(block, data + 512, 512));
+	// no other command during transfer
+	EXPECT_FALSE(disk.ReadBlock(block, 0));
+	EXPECT_TRUE(disk.EndRead());
+	EXPECT_FALSE(disk.EndRead());
+	EXPECT_FALSE(disk.ReadBlock(block, 64));
+	EXPECT_FALSE(disk.ReadBlocks(block, 63, 2));
+}
+
+TEST(RamDisk, Latency)
+{
+	std::vector<uint8_t> memory(64 * 512);
+	RamDisk disk(&memory[0], 64);
+	BlockDeviceLatency latency = {100, 10, 20, 1000};
+	disk.SetLatency(latency);
+	uint8_t data[4 * 512] = {0};
+	
+	EXPECT_TRUE(disk.ReadBlock(data, 0));
+	EXPECT_EQ(110u, disk.BusyTime());
+	disk.ResetCounters();
+	EXPECT_TRUE(disk.ReadBlocks(data, 0, 4));
+	EXPECT_EQ(2 * 100u + 4 * 10, disk.BusyTime());
+	disk.ResetCounters();
+	EXPECT_TRUE(disk.WriteBlock((const uint8_t *)data, 0));
+	EXPECT_TRUE(disk.WriteBlocks((const uint8_t *)data, 0, 4));
+	EXPECT_EQ(3u, disk.Commands());
+	EXPECT_EQ(5u, disk.BlocksWritten());
+	EXPECT_EQ(3 * 100u + 5 * 20 + 2 * 1000, disk.BusyTime());
+}
+
+#if !defined(_WIN32)
+TEST(ImageDisk, FatVolumeInFile)
+{
+	const uint32_t sectors = 4096;
+	std::vector<uint8_t> memory(sectors * 512);
+	Fat::FatImageBuilder builder(&memory[0], sectors);
+	ASSERT_TRUE(builder.Format(Fat::Fat12, 1, 0));
+	const char text[] = "image file";
+	ASSERT_TRUE(builder.AddFile(0, "README.TXT", (const uint8_t *)text, sizeof(text)));
+	
+	char path[] = "/tmp/mcucpp_image_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ((ssize_t)memory.size(), write(fd, &memory[0], memory.size()));
+	close(fd);
+	
+	{
+		ImageDisk disk;
+		ASSERT_TRUE(disk.Open(path, true));
+		EXPECT_EQ(sectors, disk.BlocksCount());
+		SectorCacheStorage<8> storage;
+		SectorCache<RamDisk> cache(disk, storage, 2);
+		Fat::FatFs<RamDisk> fs(cache);
+		ASSERT_TRUE(fs.Mount());
+		Fat::FatFileWriter<RamDisk> writer(fs);
+		ASSERT_TRUE(writer.Create(fs.RootDirectory(), (const uint8_t *)"new file.txt"));
+		EXPECT_EQ(sizeof(text), writer.Write((const uint8_t *)text, sizeof(text)));
+		ASSERT_TRUE(writer.Close());
+	}
+	
+	// changes reached the file
+	FILE *file = fopen(path, "rb");
+	ASSERT_TRUE(file != 0);
+	ASSERT_EQ(memory.size(), fread(&memory[0], 1, memory.size(), file));
+	fclose(file);
+	unlink(path);
+	std::vector<uint8_t> content;
+	ASSERT_TRUE(builder.ReadFile(0, "new file.txt", content));
+	EXPECT_EQ(0, memcmp(&content[0], text, sizeof(text)));
+}
+#endif
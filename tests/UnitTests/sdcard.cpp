@@ -0,0 +1,207 @@
+#ifndef F_CPU
+#define F_CPU 16000000ul
+#endif
+#include <gtest.h>
+#include <sd_card_sim.h>
+#include <drivers/SdCard.h>
+#include <vector>
+
+using namespace Mcucpp;
+
+namespace
+{
+	typedef SdCard<SdCardSimSpi, SdCardSimCs> Card;
+	
+	void Fill(std::vector<uint8_t> &data, uint8_t seed)
+	{
+		for(size_t i = 0; i < data.size(); i++)
+			data[i] = uint8_t(i * 7 + seed);
+	}
+}
+
+TEST(SdCard, Detect)
+{
+	SdCardSimulator sim(2048);
+	Card card;
+	EXPECT_EQ(SdhcCard, card.Detect());
+	EXPECT_EQ(2047u, card.BlocksCount());
+	
+	SdCardSimulator simV2(2048, false);
+	EXPECT_EQ(SdCardV2, card.Detect());
+}
+
+TEST(SdCard, SingleBlock)
+{
+	SdCardSimulator sim(2048, false);
+	Card card;
+	ASSERT_EQ(SdCardV2, card.Detect());
+	
+	std::vector<uint8_t> data(512), readBack(512);
+	Fill(data, 1);
+	EXPECT_TRUE(card.WriteBlock(data.begin(), 5));
+	EXPECT_TRUE(card.ReadBlock(readBack.begin(), 5));
+	EXPECT_TRUE(data == readBack);
+	EXPECT_EQ(0, memcmp(sim.Block(5), &data[0], 512));
+	EXPECT_EQ(0u, sim.ProtocolErrors());
+	
+	EXPECT_FALSE(card.ReadBlock(readBack.begin(), 4096));
+	EXPECT_TRUE(card.CheckStatus());
+}
+
+TEST(SdCard, MultipleBlocks)
+{
+	SdCardSimulator sim(2048);
+	Card card;
+	ASSERT_EQ(SdhcCard, card.Detect());
+	sim.ResetCounters();
+	
+	std::vector<uint8_t> data(512 * 8), readBack(512 * 8);
+	Fill(data, 3);
+	EXPECT_TRUE(card.WriteBlocks(data.begin(), 100, 8));
+	EXPECT_EQ(8u, sim.BlocksWritten());
+	EXPECT_EQ(8u, sim.PreErase());
+	EXPECT_EQ(0, memcmp(sim.Block(100), &data[0], data.size()));
+	
+	EXPECT_TRUE(card.ReadBlocks(&readBack[0], 100, 8));
+	EXPECT_EQ(8u, sim.BlocksRead());
+	EXPECT_TRUE(data == readBack);
+	// ACMD23 + CMD25 and CMD18 + CMD12
+	EXPECT_EQ(5u, sim.Commands());
+	EXPECT_EQ(0u, sim.ProtocolErrors());
+	// card is usable after stop commands
+	EXPECT_TRUE(card.CheckStatus());
+}
+
+TEST(SdCard, MultipleBlocksAfterSingleWrite)
+{
+	SdCardSimulator sim(2048);
+	Card card;
+	ASSERT_EQ(SdhcCard, card.Detect());
+	sim.ResetCounters();
+	
+	std::vector<uint8_t> data(512 * 4);
+	Fill(data, 5);
+	// card is still programming the single block when ACMD23 is sent
+	EXPECT_TRUE(card.WriteBlock(data.begin(), 5));
+	EXPECT_TRUE(card.WriteBlocks(data.begin(), 10, 4));
+	EXPECT_EQ(4u, sim.PreErase());
+	EXPECT_EQ(0, memcmp(sim.Block(10), &data[0], data.size()));
+	EXPECT_EQ(0u, sim.ProtocolErrors());
+	
+	// empty transfers do not reach the card
+	uint32_t commands = sim.Commands();
+	EXPECT_TRUE(card.WriteBlocks(data.begin(), 20, 0));
+	EXPECT_TRUE(card.ReadBlocks(data.begin(), 20, 0));
+	EXPECT_EQ(commands, sim.Commands());
+}
+
+TEST(SdCard, Streaming)
+{
+	SdCardSimulator sim(2048);
+	Card card;
+	ASSERT_EQ(SdhcCard, card.Detect());
+	
+	uint8_t block[512];
+	ASSERT_TRUE(card.BeginWrite(10));
+	for(unsigned i = 0; i < 3; i++)
+	{
+		memset(block, i + 1, sizeof(block));
+		EXPECT_TRUE(card.WriteNext(block));
+	}
+	EXPECT_TRUE(card.EndWrite());
+	EXPECT_EQ(0u, sim.PreErase());
+	EXPECT_EQ(3u, sim.Block(12)[511]);
+	
+	ASSERT_TRUE(card.BeginRead(11));
+	EXPECT_TRUE(card.ReadNext(block));
+	EXPECT_EQ(2u, block[0]);
+	EXPECT_TRUE(card.ReadNext(block));
+	EXPECT_EQ(3u, block[0]);
+	EXPECT_TRUE(card.EndRead());
+	EXPECT_EQ(0u, sim.ProtocolErrors());
+	
+	// reading past the card end fails but leaves card in command state
+	EXPECT_FALSE(card.ReadBlocks(block, 2047, 2));
+	EXPECT_TRUE(card.CheckStatus());
+}
+
+namespace
+{
+	Dispatcher *testDispatcher;
+	unsigned backgroundRuns;
+	void BackgroundTask()
+	{
+		backgroundRuns++;
+		testDispatcher->SetTask(BackgroundTask);
+	}
+}
+
+TEST(SdCard, BlockTransferPolicy)
+{
+	typedef SdCardSimDma<128> Dma;
+	SdCardSimulator sim(2048);
+	SdCard<SdCardSimSpi, SdCardSimCs, Dma> card;
+	ASSERT_EQ(SdhcCard, card.Detect());
+	
+	TaskItem tasks[2];
+	TimerData timers[1];
+	Dispatcher dispatcher(tasks, 2, timers, 1);
+	testDispatcher = &dispatcher;
+	backgroundRuns = 0;
+	dispatcher.SetTask(BackgroundTask);
+	card.SetDispatcher(&dispatcher);
+	
+	uint8_t data[512 * 4], readBack[512 * 4];
+	for(size_t i = 0; i < sizeof(data); i++)
+		data[i] = uint8_t(i ^ (i >> 8));
+	uint32_t transfers = Dma::Transfers();
+	EXPECT_TRUE(card.WriteBlocks((const uint8_t *)data, 20, 4));
+	EXPECT_TRUE(card.ReadBlocks(readBack, 20, 4));
+	EXPECT_EQ(0, memcmp(data, readBack, sizeof(data)));
+	EXPECT_EQ(8u, Dma::Transfers() - transfers);
+	// 4 chunks per block, dispatcher runs between them while writing and
+	// while the card is busy, reads compute CRC of received chunks instead
+	EXPECT_LT(4u * 3, backgroundRuns);
+	card.EnableCrc(false);
+	backgroundRuns = 0;
+	EXPECT_TRUE(card.ReadBlocks(readBack, 20, 4));
+	EXPECT_EQ(4u * 3, backgroundRuns);
+	
+	// other iterators do not use the policy
+	std::vector<uint8_t> buffer(512);
+	EXPECT_TRUE(card.ReadBlock(buffer.begin(), 20));
+	EXPECT_EQ(12u, Dma::Transfers() - transfers);
+	EXPECT_EQ(0u, sim.ProtocolErrors());
+}
+
+TEST(SdCard, Crc)
+{
+	SdCardSimulator sim(2048);
+	Card card;
+	ASSERT_EQ(SdhcCard, card.Detect());
+	EXPECT_TRUE(card.CrcEnabled());
+	EXPECT_TRUE(sim.CrcEnabled());
+	
+	std::vector<uint8_t> data(512 * 2), readBack(512 * 2);
+	Fill(data, 9);
+	// card checks command and data CRC
+	EXPECT_TRUE(card.WriteBlocks(data.begin(), 7, 2));
+	EXPECT_TRUE(card.WriteBlock(&data[0], 9));
+	EXPECT_EQ(0u, sim.CrcErrors());
+	
+	sim.CorruptNextRead();
+	EXPECT_FALSE(card.ReadBlock(readBack.begin(), 7));
+	sim.CorruptNextRead();
+	EXPECT_FALSE(card.ReadBlock(&readBack[0], 7));
+	sim.CorruptNextRead();
+	EXPECT_FALSE(card.ReadBlocks(&readBack[0], 7, 2));
+	EXPECT_TRUE(card.ReadBlocks(&readBack[0], 7, 2));
+	EXPECT_TRUE(data == readBack);
+	
+	EXPECT_TRUE(card.EnableCrc(false));
+	EXPECT_FALSE(sim.CrcEnabled());
+	sim.CorruptNextRead();
+	EXPECT_TRUE(card.ReadBlock(readBack.begin(), 7));
+	EXPECT_FALSE(data == readBack);
+	EXPECT_EQ(0u, sim.CrcErrors());
+}
@@ -0,0 +1,138 @@
+#ifndef F_CPU
+#define F_CPU 16000000ul
+#endif
+#include <gtest.h>
+#include <sd_card_sim.h>
+#include <drivers/SdCard.h>
+#include <filesystem/sector_cache.h>
+
+using namespace Mcucpp;
+using namespace Mcucpp::Fs;
+
+namespace
+{
+	typedef SdCard<SdCardSimSpi, SdCardSimCs> Card;
+	
+	class SectorCacheTest :public ::testing::Test
+	{
+	protected:
+		SdCardSimulator sim;
+		Card card;
+		SectorCacheStorage<8> storage;
+		SectorCache<Card> cache;
+		
+		SectorCacheTest()
+			:sim(2048),
+			cache(card, storage, 2)
+		{
+		}
+		
+		virtual void SetUp()
+		{
+			ASSERT_EQ(SdhcCard, card.Detect());
+			for(uint32_t i = 0; i < 256; i++)
+				memset(sim.Block(i), (uint8_t)i, SectorSize);
+			sim.ResetCounters();
+		}
+	};
+}
+
+TEST_F(SectorCacheTest, HitsAndLru)
+{
+	const uint8_t *data = cache.Read(5);
+	ASSERT_TRUE(data != 0);
+	EXPECT_EQ(5, data[0]);
+	EXPECT_EQ(5, cache.Read(5)[511]);
+	EXPECT_EQ(1u, cache.Hits());
+	EXPECT_EQ(1u, cache.DeviceReads());
+	
+	// 4 sets of 2 ways, sectors 0, 4 and 8 share a set
+	cache.Read(0);
+	cache.Read(4);
+	cache.Read(0);
+	cache.Read(8);
+	EXPECT_TRUE(cache.IsCached(0));
+	EXPECT_FALSE(cache.IsCached(4));
+	EXPECT_TRUE(cache.IsCached(8));
+	EXPECT_TRUE(cache.IsCached(5));
+	EXPECT_EQ(cache.DeviceReads(), sim.BlocksRead());
+	
+	EXPECT_TRUE(cache.Read(4096) == 0);
+	EXPECT_EQ(1u, cache.Errors());
+}
+
+TEST_F(SectorCacheTest, WriteBack)
+{
+	for(uint32_t sector = 10; sector < 13; sector++)
+		cache.Modify(sector)[0] = 0xa0;
+	memset(cache.Overwrite(20), 0xbb, SectorSize);
+	EXPECT_EQ(4u, cache.DirtyCount());
+	EXPECT_EQ(3u, cache.DeviceReads());
+	EXPECT_EQ(0u, sim.BlocksWritten());
+	
+	EXPECT_TRUE(cache.Flush());
+	EXPECT_EQ(0u, cache.DirtyCount());
+	EXPECT_EQ(4u, sim.BlocksWritten());
+	// 10..12 in one command
+	EXPECT_EQ(2u, cache.DeviceWrites());
+	EXPECT_EQ(3u, sim.PreErase());
+	EXPECT_EQ(0xa0, sim.Block(11)[0]);
+	EXPECT_EQ(11, sim.Block(11)[1]);
+	EXPECT_EQ(0xbb, sim.Block(20)[100]);
+	
+	// dirty line is written back when evicted
+	cache.Modify(1)[0] = 0xcc;
+	cache.Read(5);
+	cache.Read(9);
+	EXPECT_FALSE(cache.IsCached(1));
+	EXPECT_EQ(0xcc, sim.Block(1)[0]);
+	
+	// invalidated dirty sectors are not written
+	cache.Modify(2)[0] = 0xdd;
+	cache.Invalidate(0, 4);
+	EXPECT_EQ(0u, cache.DirtyCount());
+	EXPECT_TRUE(cache.Flush());
+	EXPECT_EQ(2, sim.Block(2)[0]);
+}
+
+TEST_F(SectorCacheTest, ReadAhead)
+{
+	cache.SetReadAhead(4);
+	for(uint32_t sector = 100; sector < 116; sector++)
+		ASSERT_EQ((uint8_t)sector, cache.Read(sector)[17]);
+	// first miss is not sequential, then 4 sectors per command
+	EXPECT_EQ(5u, cache.DeviceReads());
+	EXPECT_EQ(11u, cache.Hits());
+	
+	// random access reads one sector
+	cache.ResetCounters();
+	cache.Read(200);
+	cache.Read(50);
+	EXPECT_EQ(2u, cache.DeviceReads());
+	EXPECT_EQ(2u, sim.BlocksRead() - 17);
+}
+
+TEST_F(SectorCacheTest, Pinning)
+{
+	cache.SetPinnedRange(0, 2);
+	cache.Read(0);
+	for(uint32_t sector = 4; sector < 40; sector += 4)
+		cache.Read(sector);
+	EXPECT_TRUE(cache.IsCached(0));
+	EXPECT_TRUE(cache.IsCached(36));
+	EXPECT_FALSE(cache.IsCached(32));
+	
+	// unpinned lines are replaced first, pinned ones when whole set is pinned
+	cache.SetPinnedRange(0, 8);
+	cache.Read(4);
+	EXPECT_TRUE(cache.IsCached(0));
+	EXPECT_FALSE(cache.IsCached(36));
+	cache.Read(0);
+	cache.Read(12);
+	EXPECT_TRUE(cache.IsCached(0));
+	EXPECT_FALSE(cache.IsCached(4));
+	cache.Read(8);
+	EXPECT_TRUE(cache.IsCached(0));
+	EXPECT_TRUE(cache.IsCached(8));
+	EXPECT_FALSE(cache.IsCached(12));
+}